@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <string>
+#include <string_view>
+
+namespace ou::bench {
+
+// Prevents the optimizer from discarding a computed value
+template <typename T> void doNotOptimize(const T &value) { asm volatile("" : : "g"(&value) : "memory"); }
+
+// Calls fn repeatedly for roughly the given duration on the current thread and returns calls per second
+template <typename Fn> double measureRate(Fn &&fn, std::chrono::milliseconds duration = std::chrono::milliseconds(1000)) {
+	using Clock = std::chrono::steady_clock;
+	constexpr size_t kBatch = 256;
+
+	size_t iterations = 0;
+	auto start = Clock::now();
+	auto deadline = start + duration;
+	Clock::time_point now;
+	do {
+		for (size_t i = 0; i < kBatch; ++i)
+			fn();
+		iterations += kBatch;
+		now = Clock::now();
+	} while (now < deadline);
+
+	return static_cast<double>(iterations) / std::chrono::duration<double>(now - start).count();
+}
+
+// Text for a JSON string, without the quotes
+inline std::string jsonEscape(std::string_view text) {
+	std::string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		if (static_cast<unsigned char>(c) < 0x20)
+			escaped += std::format("\\u{:04x}", static_cast<unsigned>(static_cast<unsigned char>(c)));
+		else
+			escaped += c;
+	}
+	return escaped;
+}
+
+// Prints the result and, when OU_BENCH_JSON names a file, appends it there as a JSON object on a line of its own,
+// labelled with the program and the time of the run, so results from every benchmark can be collected and compared
+inline void report(std::string_view name, double rate, std::string_view unit = "ops/s") {
+	std::printf("%-48.*s %14.0f %.*s\n", static_cast<int>(name.size()), name.data(), rate, static_cast<int>(unit.size()), unit.data());
+
+	static const char *jsonPath = std::getenv("OU_BENCH_JSON");
+	static const auto started = std::chrono::system_clock::now();
+	if (jsonPath == nullptr || *jsonPath == '\0')
+		return;
+	if (std::FILE *file = std::fopen(jsonPath, "a")) {
+		std::string line = std::format(R"({{"benchmark":"{}","name":"{}","value":{},"unit":"{}","time":{}}})", jsonEscape(program_invocation_short_name),
+																	 jsonEscape(name), rate, jsonEscape(unit),
+																	 std::chrono::duration_cast<std::chrono::seconds>(started.time_since_epoch()).count());
+		line += '\n';
+		std::fwrite(line.data(), 1, line.size(), file);
+		std::fclose(file);
+	}
+}
+
+} // namespace ou::bench
@@ -0,0 +1,182 @@
+#include "Benchmark.h"
+#include "HttpTypes.h"
+#include "RequestParser.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <format>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace ou::http;
+
+namespace {
+
+// Chrome's headers for a page navigation: 18 fields
+const std::string kChromeRequest = "GET /dashboard HTTP/1.1\r\n"
+																	 "Host: www.example.com\r\n"
+																	 "Connection: keep-alive\r\n"
+																	 "Cache-Control: max-age=0\r\n"
+																	 "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+																	 "sec-ch-ua-mobile: ?0\r\n"
+																	 "sec-ch-ua-platform: \"Linux\"\r\n"
+																	 "Upgrade-Insecure-Requests: 1\r\n"
+																	 "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+																	 "Chrome/124.0.0.0 Safari/537.36\r\n"
+																	 "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+																	 "Sec-Fetch-Site: same-origin\r\n"
+																	 "Sec-Fetch-Mode: navigate\r\n"
+																	 "Sec-Fetch-User: ?1\r\n"
+																	 "Sec-Fetch-Dest: document\r\n"
+																	 "Referer: https://www.example.com/login\r\n"
+																	 "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+																	 "Accept-Language: en-GB,en-US;q=0.9,en;q=0.8\r\n"
+																	 "Cookie: session=6f1e2d3c4b5a69788796a5b4c3d2e1f0; theme=dark; _ga=GA1.1.123456789.1700000000\r\n"
+																	 "If-None-Match: \"5d41402abc4b2a76b9719d911017c592\"\r\n"
+																	 "\r\n";
+
+// Firefox's headers for a script, as they arrive through a proxy and a CDN: 24 fields, lower-case as HTTP/2 sends them
+const std::string kProxiedRequest = "GET /assets/app.js HTTP/1.1\r\n"
+																		"host: www.example.com\r\n"
+																		"user-agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+																		"accept: */*\r\n"
+																		"accept-language: en-GB,en;q=0.5\r\n"
+																		"accept-encoding: gzip, deflate, br, zstd\r\n"
+																		"referer: https://www.example.com/dashboard\r\n"
+																		"dnt: 1\r\n"
+																		"connection: keep-alive\r\n"
+																		"cookie: session=6f1e2d3c4b5a69788796a5b4c3d2e1f0; theme=dark\r\n"
+																		"sec-fetch-dest: script\r\n"
+																		"sec-fetch-mode: no-cors\r\n"
+																		"sec-fetch-site: same-origin\r\n"
+																		"if-modified-since: Tue, 15 Nov 1994 08:12:31 GMT\r\n"
+																		"if-none-match: \"5f2b-1a-17c9e2\"\r\n"
+																		"priority: u=2\r\n"
+																		"pragma: no-cache\r\n"
+																		"cache-control: no-cache\r\n"
+																		"te: trailers\r\n"
+																		"x-forwarded-for: 203.0.113.7, 198.51.100.23\r\n"
+																		"x-forwarded-proto: https\r\n"
+																		"x-real-ip: 203.0.113.7\r\n"
+																		"via: 1.1 cdn-edge-42\r\n"
+																		"x-request-id: 0d4c9f3e-8a51-4d3b-9a8e-2f4d1c6b7a90\r\n"
+																		"cdn-loop: example; loops=1\r\n"
+																		"\r\n";
+
+// What the server looks up in a request to a cached static file; Range is usually absent
+constexpr std::array<std::string_view, 6> kLookups{ "Host", "Connection", "Accept-Encoding", "If-None-Match", "If-Modified-Since", "Range" };
+constexpr std::array<HeaderName, 6> kInternedLookups{ HeaderName::Host,				 HeaderName::Connection,			HeaderName::AcceptEncoding,
+																											HeaderName::IfNoneMatch, HeaderName::IfModifiedSince, HeaderName::Range };
+
+// The flat vector of views RequestHeaders was before names were interned, compared with the C library's tolower()
+class LinearHeaders {
+public:
+	void add(std::string_view name, std::string_view value) { fields_.emplace_back(name, value); }
+	void clear() { fields_.clear(); }
+	std::optional<std::string_view> find(std::string_view name) const {
+		for (const auto &[fieldName, value] : fields_) {
+			if (std::ranges::equal(fieldName, name, [](char x, char y) {
+						return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+					}))
+				return value;
+		}
+		return std::nullopt;
+	}
+
+private:
+	std::vector<std::pair<std::string_view, std::string_view>> fields_;
+};
+
+void benchmarkRequestHeaders(std::string_view name, const std::string &raw) {
+	RequestParser parser;
+	parser.parse(raw);
+	const RequestHeaders &parsed = parser.request().headers;
+	std::string label = std::format("/{}-{}-headers", name, parsed.size());
+
+	// The std::map<std::string, std::string> requests once had: a node and two strings per field, and exact-case keys,
+	// so lookups only find fields whose case happens to match
+	auto map = [&parsed] {
+		std::map<std::string, std::string> headers;
+		for (const auto &[fieldName, value] : parsed)
+			headers[std::string(fieldName)] = std::string(value);
+		for (std::string_view lookup : kLookups)
+			ou::bench::doNotOptimize(headers.find(std::string(lookup)));
+	};
+	ou::bench::report("map" + label, ou::bench::measureRate(map), "requests/s");
+
+	LinearHeaders linearHeaders;
+	auto linear = [&parsed, &linearHeaders] {
+		linearHeaders.clear();
+		for (const auto &[fieldName, value] : parsed)
+			linearHeaders.add(fieldName, value);
+		for (std::string_view lookup : kLookups)
+			ou::bench::doNotOptimize(linearHeaders.find(lookup));
+	};
+	ou::bench::report("linear" + label, ou::bench::measureRate(linear), "requests/s");
+
+	// Interning happens as fields are added, which the parser does once per request
+	RequestHeaders internedHeaders;
+	auto byString = [&parsed, &internedHeaders] {
+		internedHeaders.clear();
+		for (const auto &[fieldName, value] : parsed)
+			internedHeaders.add(fieldName, value);
+		for (std::string_view lookup : kLookups)
+			ou::bench::doNotOptimize(internedHeaders.find(lookup));
+	};
+	ou::bench::report("interned-by-string" + label, ou::bench::measureRate(byString), "requests/s");
+	auto byName = [&parsed, &internedHeaders] {
+		internedHeaders.clear();
+		for (const auto &[fieldName, value] : parsed)
+			internedHeaders.add(fieldName, value);
+		for (HeaderName lookup : kInternedLookups)
+			ou::bench::doNotOptimize(internedHeaders.find(lookup));
+	};
+	ou::bench::report("interned-by-name" + label, ou::bench::measureRate(byName), "requests/s");
+}
+
+// The headers a static file response is given, set and then written out
+void benchmarkResponseHeaders() {
+	auto fill = [](auto &headers) {
+		headers["Content-Type"] = "text/css";
+		headers["ETag"] = "\"5f2b-1a-17c9e2\"";
+		headers["Last-Modified"] = "Tue, 15 Nov 1994 08:12:31 GMT";
+		headers["Accept-Ranges"] = "bytes";
+		headers["Cache-Control"] = "public, max-age=3600";
+		headers["Vary"] = "Accept-Encoding";
+		headers["Content-Encoding"] = "gzip";
+		headers["Connection"] = "keep-alive";
+	};
+	auto write = [](const auto &headers) {
+		size_t length = 0;
+		for (const auto &[fieldName, value] : headers)
+			length += fieldName.size() + value.size() + 4;
+		return length;
+	};
+
+	auto map = [&fill, &write] {
+		std::map<std::string, std::string> headers;
+		fill(headers);
+		ou::bench::doNotOptimize(write(headers));
+	};
+	ou::bench::report("response-map/8-headers", ou::bench::measureRate(map), "responses/s");
+	auto flat = [&fill, &write] {
+		ResponseHeaders headers;
+		fill(headers);
+		ou::bench::doNotOptimize(write(headers));
+	};
+	ou::bench::report("response-flat/8-headers", ou::bench::measureRate(flat), "responses/s");
+}
+
+} // namespace
+
+int main() {
+	benchmarkRequestHeaders("chrome", kChromeRequest);
+	benchmarkRequestHeaders("proxied", kProxiedRequest);
+	benchmarkResponseHeaders();
+	return 0;
+}
@@ -0,0 +1,232 @@
+#include "Benchmark.h"
+#include "Hpack.h"
+#include "Http2Session.h"
+#include "Server.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr uint16_t kPort = 18195;
+constexpr auto kDuration = std::chrono::seconds(2);
+constexpr std::string_view kBody = R"({"id":42,"name":"widget","tags":["a","b","c"],"stock":17})";
+
+int sConnect() {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool sSendAll(int fd, std::string_view data) {
+	while (!data.empty()) {
+		ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		data.remove_prefix(static_cast<size_t>(n));
+	}
+	return true;
+}
+
+// Buffered reads from a blocking socket
+class Reader {
+public:
+	explicit Reader(int fd) : fd_(fd) {}
+
+	// Makes at least size bytes available at data()
+	bool fill(size_t size) {
+		while (buffer_.size() - offset_ < size) {
+			if (offset_ > 0) {
+				buffer_.erase(0, offset_);
+				offset_ = 0;
+			}
+			char chunk[65536];
+			ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+			if (n <= 0)
+				return false;
+			buffer_.append(chunk, static_cast<size_t>(n));
+		}
+		return true;
+	}
+	std::string_view data() const { return std::string_view(buffer_).substr(offset_); }
+	void consume(size_t size) { offset_ += size; }
+
+private:
+	int fd_;
+	std::string buffer_;
+	size_t offset_ = 0;
+};
+
+struct Totals {
+	uint64_t requests = 0;
+	uint64_t requestHeaderBytes = 0;
+	uint64_t responseHeaderBytes = 0;
+};
+
+void reportTotals(std::string_view name, const Totals &totals, double seconds) {
+	ou::bench::report(name, static_cast<double>(totals.requests) / seconds, "requests/s");
+	double requests = static_cast<double>(std::max<uint64_t>(totals.requests, 1));
+	ou::bench::report(std::string(name) + "/request-header-bytes", static_cast<double>(totals.requestHeaderBytes) / requests, "B/request");
+	ou::bench::report(std::string(name) + "/response-header-bytes", static_cast<double>(totals.responseHeaderBytes) / requests, "B/request");
+}
+
+// One request at a time over a keep-alive HTTP/1.1 connection
+void benchmarkHttp1(std::string_view name) {
+	int fd = sConnect();
+	if (fd < 0)
+		return;
+	Reader reader(fd);
+	const std::string request = "GET /item HTTP/1.1\r\nHost: localhost\r\nUser-Agent: ou-bench/1.0\r\nAccept: application/json\r\n\r\n";
+	// Returns the size of the response head, or 0 on failure
+	auto readResponse = [&reader]() -> size_t {
+		size_t headerEnd = std::string_view::npos;
+		while ((headerEnd = reader.data().find("\r\n\r\n")) == std::string_view::npos)
+			if (!reader.fill(reader.data().size() + 1))
+				return 0;
+		if (!reader.fill(headerEnd + 4 + kBody.size()))
+			return 0;
+		reader.consume(headerEnd + 4 + kBody.size());
+		return headerEnd + 4;
+	};
+	Totals totals;
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - start < kDuration) {
+		size_t headSize = sSendAll(fd, request) ? readResponse() : 0;
+		if (headSize == 0)
+			break;
+		++totals.requests;
+		totals.requestHeaderBytes += request.size();
+		totals.responseHeaderBytes += headSize;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	close(fd);
+	reportTotals(name, totals, seconds);
+}
+
+std::string sFrame(uint8_t type, uint8_t flags, uint32_t streamId, std::string_view payload) {
+	std::string frame{ static_cast<char>(payload.size() >> 16), static_cast<char>(payload.size() >> 8), static_cast<char>(payload.size()),
+										 static_cast<char>(type), static_cast<char>(flags), static_cast<char>(streamId >> 24), static_cast<char>(streamId >> 16),
+										 static_cast<char>(streamId >> 8), static_cast<char>(streamId) };
+	return frame.append(payload);
+}
+
+// Keeps `concurrency` streams in flight over one prior-knowledge h2c connection, opening a new one as each finishes
+void benchmarkHttp2(std::string_view name, size_t concurrency) {
+	int fd = sConnect();
+	if (fd < 0)
+		return;
+	Reader reader(fd);
+	HpackEncoder encoder;
+	HpackDecoder decoder;
+	// Open the connection window once; each response is far smaller than a stream's default window
+	std::string out(Http2Session::kPreface);
+	out += sFrame(0x4, 0, 0, "");
+	out += sFrame(0x8, 0, 0, std::string{ 0x7f, 0, 0, 0 });
+	uint32_t nextStreamId = 1;
+	Totals totals;
+	auto queueRequest = [&]() {
+		std::string block;
+		encoder.encode(":method", "GET", block);
+		encoder.encode(":scheme", "http", block);
+		encoder.encode(":path", "/item", block);
+		encoder.encode(":authority", "localhost", block);
+		encoder.encode("user-agent", "ou-bench/1.0", block);
+		encoder.encode("accept", "application/json", block);
+		totals.requestHeaderBytes += 9 + block.size();
+		out += sFrame(0x1, 0x5, nextStreamId, block);
+		nextStreamId += 2;
+	};
+	for (size_t i = 0; i < concurrency; ++i)
+		queueRequest();
+
+	std::vector<HeaderField> fields;
+	auto start = std::chrono::steady_clock::now();
+	bool running = true;
+	size_t inFlight = concurrency;
+	while (inFlight > 0) {
+		if (!out.empty() && !sSendAll(fd, out))
+			break;
+		out.clear();
+		if (!reader.fill(9))
+			break;
+		auto header = reader.data();
+		auto byte = [header](size_t i) { return static_cast<uint32_t>(static_cast<uint8_t>(header[i])); };
+		size_t length = byte(0) << 16 | byte(1) << 8 | byte(2);
+		uint8_t type = static_cast<uint8_t>(byte(3));
+		uint8_t flags = static_cast<uint8_t>(byte(4));
+		if (!reader.fill(9 + length))
+			break;
+		std::string_view payload = reader.data().substr(9, length);
+		if (type == 0x1) {
+			totals.responseHeaderBytes += 9 + length;
+			fields.clear();
+			decoder.decode(payload, fields);
+		} else if (type == 0x4 && (flags & 0x1) == 0) {
+			out += sFrame(0x4, 0x1, 0, "");
+		} else if (type == 0x7) {
+			std::fprintf(stderr, "Connection closed by server\n");
+			break;
+		}
+		reader.consume(9 + length);
+		if ((type == 0x0 || type == 0x1) && (flags & 0x1) != 0) {
+			++totals.requests;
+			--inFlight;
+			running = running && std::chrono::steady_clock::now() - start < kDuration && nextStreamId < (1u << 31) - 2;
+			if (running) {
+				queueRequest();
+				++inFlight;
+			}
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	close(fd);
+	reportTotals(name, totals, seconds);
+}
+
+} // namespace
+
+int main() {
+	// Small JSON responses, so the rates are dominated by per-request work and the header bytes show what HPACK saves
+	// once its tables are warm. Client and server share the machine.
+	Server::Config config;
+	config.port = kPort;
+	config.threadCount = 1;
+	config.maxRequestsPerConnection = std::numeric_limits<size_t>::max();
+	Server server(config);
+	server.registerPathHandler(Method::GET, "/item", [](const Request &) {
+		return Response{ 200, "OK", { { "Content-Type", "application/json" }, { "Cache-Control", "no-store" } }, std::string(kBody) };
+	});
+	if (!server.init()) {
+		std::fprintf(stderr, "Failed to start server on port %u\n", kPort);
+		return 1;
+	}
+	server.start();
+
+	benchmarkHttp1("http1.1/keep-alive");
+	benchmarkHttp2("h2c/1-stream", 1);
+	benchmarkHttp2("h2c/32-streams", 32);
+
+	server.stop();
+	return 0;
+}
@@ -0,0 +1,125 @@
+#include "Benchmark.h"
+#include "KVStore.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr size_t kKeys = 100000;
+constexpr size_t kValueSize = 1024;
+constexpr auto kDuration = std::chrono::milliseconds(500);
+
+// The store as it was before sharding: one mutex, values copied out under it
+class SingleMutexStore {
+public:
+	void set(const std::string &key, const std::string &value) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		store_[key] = value;
+	}
+
+	std::optional<std::string> get(const std::string &key) const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto it = store_.find(key);
+		if (it != store_.end())
+			return it->second;
+		return std::nullopt;
+	}
+
+	bool remove(const std::string &key) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return store_.erase(key) > 0;
+	}
+
+private:
+	mutable std::mutex mutex_;
+	std::unordered_map<std::string, std::string> store_;
+};
+
+// Used as a cache holding about a third of the key set, so writes keep evicting
+class BoundedStore : public KVStore {
+public:
+	BoundedStore() : KVStore({ .maxBytes = 32 * 1024 * 1024 }) {}
+};
+
+struct Mix {
+	std::string_view name;
+	int getPercent;
+	int putPercent; // The rest are deletes
+};
+
+std::vector<std::string> sKeys() {
+	std::vector<std::string> keys;
+	keys.reserve(kKeys);
+	for (size_t i = 0; i < kKeys; ++i)
+		keys.push_back("user:" + std::to_string(i));
+	return keys;
+}
+
+template <typename Store> double runMix(Store &store, const std::vector<std::string> &keys, const Mix &mix, int threadCount) {
+	const std::string value(kValueSize, 'v');
+	std::atomic<bool> running{ true };
+	std::atomic<uint64_t> operations{ 0 };
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			std::mt19937_64 random(static_cast<uint64_t>(t) + 1);
+			std::uniform_int_distribution<size_t> keyIndex(0, keys.size() - 1);
+			std::uniform_int_distribution<int> percent(0, 99);
+			uint64_t done = 0;
+			while (running.load(std::memory_order_relaxed)) {
+				for (int i = 0; i < 64; ++i) {
+					const std::string &key = keys[keyIndex(random)];
+					int roll = percent(random);
+					if (roll < mix.getPercent)
+						ou::bench::doNotOptimize(store.get(key));
+					else if (roll < mix.getPercent + mix.putPercent)
+						store.set(key, value);
+					else
+						ou::bench::doNotOptimize(store.remove(key));
+				}
+				done += 64;
+			}
+			operations.fetch_add(done, std::memory_order_relaxed);
+		});
+	}
+	std::this_thread::sleep_for(kDuration);
+	running = false;
+	for (auto &thread : threads)
+		thread.join();
+	return static_cast<double>(operations) / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Store> void benchmarkStore(std::string_view name, const std::vector<std::string> &keys) {
+	for (const Mix &mix : { Mix{ "read-heavy-95-4-1", 95, 4 }, Mix{ "balanced-50-40-10", 50, 40 }, Mix{ "write-heavy-10-70-20", 10, 70 } }) {
+		for (int threads : { 1, 2, 4, 8, 16, 32 }) {
+			Store store;
+			const std::string value(kValueSize, 'v');
+			for (const auto &key : keys)
+				store.set(key, value);
+			double rate = runMix(store, keys, mix, threads);
+			ou::bench::report(std::string(name) + "/" + std::string(mix.name) + "/" + std::to_string(threads) + "-threads", rate, "ops/s");
+		}
+	}
+}
+
+} // namespace
+
+int main() {
+	auto keys = sKeys();
+	std::printf("%zu keys, %zu-byte values, %u hardware threads\n", kKeys, kValueSize, std::thread::hardware_concurrency());
+	benchmarkStore<KVStore>("sharded", keys);
+	benchmarkStore<BoundedStore>("sharded-32MiB-budget", keys);
+	benchmarkStore<SingleMutexStore>("single-mutex", keys);
+	return 0;
+}
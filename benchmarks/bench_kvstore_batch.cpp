@@ -0,0 +1,133 @@
+#include "Benchmark.h"
+#include "KVStore.h"
+#include "Server.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <charconv>
+#include <chrono>
+#include <format>
+#include <memory>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <netinet/in.h>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr uint16_t kPort = 18191;
+constexpr size_t kKeys = 100000;
+constexpr size_t kValueSize = 64;
+constexpr auto kDuration = std::chrono::seconds(2);
+
+int sConnect() {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Sends one request on a persistent connection and reads the whole response; returns false on failure
+bool sRoundTrip(int fd, const std::string &request, std::string &response) {
+	if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+		return false;
+	response.clear();
+	std::array<char, 64 * 1024> buffer{};
+	size_t headEnd = std::string::npos;
+	uint64_t length = 0;
+	while (headEnd == std::string::npos || response.size() < headEnd + 4 + length) {
+		ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+		if (n <= 0)
+			return false;
+		response.append(buffer.data(), static_cast<size_t>(n));
+		if (headEnd == std::string::npos && (headEnd = response.find("\r\n\r\n")) != std::string::npos) {
+			size_t lengthPos = response.find("Content-Length: ");
+			std::from_chars(response.data() + lengthPos + 16, response.data() + headEnd, length);
+		}
+	}
+	return response.starts_with("HTTP/1.1 200");
+}
+
+// Builds the request for one round trip covering keysPerRequest keys, starting at key index first
+using RequestBuilder = std::string (*)(size_t first, size_t keysPerRequest);
+
+std::string sKey(size_t index) { return std::format("user:{:06}", index % kKeys); }
+
+std::string sSingleGet(size_t first, size_t) { return "GET /kv?key=" + sKey(first) + " HTTP/1.1\r\nHost: localhost\r\n\r\n"; }
+
+std::string sBatchGet(size_t first, size_t keysPerRequest) {
+	std::string body;
+	for (size_t i = 0; i < keysPerRequest; ++i) {
+		std::string key = sKey(first + i);
+		body += std::format("G {}\n{}", key.size(), key);
+	}
+	return std::format("POST /kv/batch HTTP/1.1\r\nHost: localhost\r\nContent-Length: {}\r\n\r\n{}", body.size(), body);
+}
+
+std::string sScan(size_t first, size_t keysPerRequest) {
+	return std::format("GET /kv/scan?from={}&limit={} HTTP/1.1\r\nHost: localhost\r\n\r\n", sKey(first), keysPerRequest);
+}
+
+void benchmarkReads(std::string_view name, RequestBuilder build, size_t keysPerRequest) {
+	int fd = sConnect();
+	if (fd < 0)
+		return;
+	std::mt19937_64 random(1);
+	std::uniform_int_distribution<size_t> firstKey(0, kKeys - keysPerRequest);
+	std::string response;
+	uint64_t requests = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - start < kDuration) {
+		if (!sRoundTrip(fd, build(firstKey(random), keysPerRequest), response))
+			break;
+		++requests;
+	}
+	close(fd);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::string label = std::string(name) + "/" + std::to_string(keysPerRequest) + "-keys";
+	ou::bench::report(label, static_cast<double>(requests * keysPerRequest) / seconds, "keys/s");
+}
+
+} // namespace
+
+int main() {
+	auto store = std::make_shared<KVStore>(KVStore::Config{ .orderedIndex = true });
+	const std::string value(kValueSize, 'v');
+	for (size_t i = 0; i < kKeys; ++i)
+		store->set(sKey(i), value);
+
+	Server::Config config;
+	config.port = kPort;
+	config.threadCount = 1;
+	Server server(config);
+	server.registerPathHandler(Method::GET, "/kv", store);
+	server.registerPathHandler(Method::POST, "/kv/batch", store);
+	server.registerPathHandler(Method::GET, "/kv/scan", store);
+	if (!server.init()) {
+		std::fprintf(stderr, "Failed to start server on port %u\n", kPort);
+		return 1;
+	}
+	server.start();
+
+	// Each key costs a round trip on its own; a batch or a scan page shares one between many keys
+	benchmarkReads("single-get", sSingleGet, 1);
+	for (size_t keys : { 10, 100, 1000 })
+		benchmarkReads("batch-get", sBatchGet, keys);
+	for (size_t keys : { 10, 100, 1000 })
+		benchmarkReads("scan", sScan, keys);
+
+	server.stop();
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include "Benchmark.h"
+#include "KVStore.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr size_t kRecoveryKeys = 2'000'000;
+constexpr size_t kValueSize = 64;
+constexpr auto kDuration = std::chrono::seconds(2);
+
+KVStore::Config sConfig(const std::filesystem::path &directory, KVLog::FsyncPolicy policy) {
+	return { .persistence = KVLog::Config{ .directory = directory, .fsync = policy, .compactionLogBytes = 0 } };
+}
+
+void benchmarkWrites(const std::filesystem::path &directory, std::string_view name, KVLog::FsyncPolicy policy, int threadCount) {
+	std::filesystem::remove_all(directory);
+	KVStore store(sConfig(directory, policy));
+	const std::string value(kValueSize, 'v');
+	std::atomic<bool> running{ true };
+	std::atomic<uint64_t> writes{ 0 };
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			uint64_t done = 0;
+			while (running.load(std::memory_order_relaxed)) {
+				store.set("user:" + std::to_string(t) + ":" + std::to_string(done % 100000), value);
+				++done;
+			}
+			writes.fetch_add(done, std::memory_order_relaxed);
+		});
+	}
+	std::this_thread::sleep_for(kDuration);
+	running = false;
+	for (auto &thread : threads)
+		thread.join();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	auto stats = *store.persistenceStats();
+	std::string label = "write/" + std::string(name) + "/" + std::to_string(threadCount) + "-threads";
+	ou::bench::report(label, static_cast<double>(writes) / seconds, "writes/s");
+	if (stats.syncs > 0)
+		std::printf("  %.1f records per fdatasync\n", static_cast<double>(stats.records) / static_cast<double>(stats.syncs));
+}
+
+void reportRecovery(std::string_view name, const KVStore &store) {
+	auto stats = *store.persistenceStats();
+	std::printf("%-48.*s %14lld ms (%llu records, %zu keys)\n", static_cast<int>(name.size()), name.data(),
+							static_cast<long long>(stats.recoveryTime.count()), static_cast<unsigned long long>(stats.recoveredRecords), store.size());
+}
+
+} // namespace
+
+int main() {
+	auto directory = std::filesystem::temp_directory_path() / "ou_http_bench_kvstore";
+
+	for (int threads : { 1, 8, 32 })
+		benchmarkWrites(directory, "fsync-always", KVLog::FsyncPolicy::Always, threads);
+	for (int threads : { 1, 8 })
+		benchmarkWrites(directory, "fsync-interval", KVLog::FsyncPolicy::Interval, threads);
+	benchmarkWrites(directory, "fsync-never", KVLog::FsyncPolicy::Never, 1);
+
+	// Recovery of a few million keys, first by replaying the whole log and then from a snapshot
+	std::filesystem::remove_all(directory);
+	{
+		KVStore store(sConfig(directory, KVLog::FsyncPolicy::Never));
+		const std::string value(kValueSize, 'v');
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < kRecoveryKeys; ++i)
+			store.set("user:" + std::to_string(i), value);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		ou::bench::report("load/fsync-never/1-thread", static_cast<double>(kRecoveryKeys) / seconds, "writes/s");
+	}
+	{
+		KVStore store(sConfig(directory, KVLog::FsyncPolicy::Never));
+		reportRecovery("recover/log-replay", store);
+		store.compact();
+	}
+	{
+		KVStore store(sConfig(directory, KVLog::FsyncPolicy::Never));
+		reportRecovery("recover/snapshot", store);
+	}
+
+	std::filesystem::remove_all(directory);
+	return 0;
+}
@@ -0,0 +1,102 @@
+#include "Benchmark.h"
+#include "KVStore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr size_t kKeys = 1000000;
+constexpr size_t kValueSize = 100;
+
+std::vector<std::string> sKeys() {
+	std::vector<std::string> keys;
+	keys.reserve(kKeys);
+	for (size_t i = 0; i < kKeys; ++i)
+		keys.push_back("user:" + std::to_string(i));
+	return keys;
+}
+
+double sSeconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Waits until the follower has applied everything the leader published; returns false after a minute
+bool sWaitForFollower(const KVStore &leader, const KVStore &follower) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::minutes(1);
+	while (std::chrono::steady_clock::now() < deadline) {
+		auto followerStats = follower.followerStats();
+		if (followerStats->connected && followerStats->snapshots > 0 && followerStats->appliedSequence == leader.leaderStats()->sequence)
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+void benchmarkTransport(std::string_view transport, const std::string &address, const std::vector<std::string> &keys) {
+	const std::string value(kValueSize, 'v');
+	KVStore leader({ .leader = ReplicationLeader::Config{ .address = address } });
+	std::string name(transport);
+
+	// Writes while no follower is connected cost one atomic increment more than without replication
+	auto start = std::chrono::steady_clock::now();
+	for (const auto &key : keys)
+		leader.set(key, value);
+	ou::bench::report(name + "/writes-no-follower", static_cast<double>(keys.size()) / sSeconds(start), "ops/s");
+
+	// A new follower catches up from a snapshot of every key
+	start = std::chrono::steady_clock::now();
+	KVStore follower({ .follower = ReplicationFollower::Config{ .leader = address, .reconnectInterval = std::chrono::milliseconds(10) } });
+	if (!sWaitForFollower(leader, follower)) {
+		std::fprintf(stderr, "%s: follower did not catch up\n", name.c_str());
+		return;
+	}
+	ou::bench::report(name + "/snapshot-catch-up", static_cast<double>(keys.size()) / sSeconds(start), "keys/s");
+
+	// Writes with a follower connected, and the time until it has applied the last of them
+	start = std::chrono::steady_clock::now();
+	for (const auto &key : keys)
+		leader.set(key, value);
+	double writeSeconds = sSeconds(start);
+	sWaitForFollower(leader, follower);
+	double applySeconds = sSeconds(start);
+	ou::bench::report(name + "/writes-one-follower", static_cast<double>(keys.size()) / writeSeconds, "ops/s");
+	ou::bench::report(name + "/applied-by-follower", static_cast<double>(keys.size()) / applySeconds, "ops/s");
+	std::printf("%s: follower finished applying %.0f ms after the last write\n", name.c_str(), (applySeconds - writeSeconds) * 1000);
+
+	// Steady trickle: lag as the follower reports it
+	for (int i = 0; i < 200; ++i) {
+		leader.set(keys[static_cast<size_t>(i)], value);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	auto stats = follower.followerStats();
+	std::printf("%s: idle follower reports lag of %llu changes, %lld ms\n", name.c_str(), static_cast<unsigned long long>(stats->lag),
+							static_cast<long long>(stats->lagTime.count()));
+}
+
+} // namespace
+
+int main() {
+	auto keys = sKeys();
+	std::printf("%zu keys, %zu-byte values, %u hardware threads\n", kKeys, kValueSize, std::thread::hardware_concurrency());
+	{
+		KVStore standalone;
+		const std::string value(kValueSize, 'v');
+		auto start = std::chrono::steady_clock::now();
+		for (const auto &key : keys)
+			standalone.set(key, value);
+		ou::bench::report("no-replication/writes", static_cast<double>(keys.size()) / sSeconds(start), "ops/s");
+	}
+	benchmarkTransport("unix", "unix:" + (std::filesystem::temp_directory_path() / "ou_bench_replication.sock").string(), keys);
+	benchmarkTransport("tcp", "127.0.0.1:18192", keys);
+	return 0;
+}
@@ -0,0 +1,72 @@
+#include "Benchmark.h"
+#include "Logging.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <format>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+using namespace ou::http;
+
+namespace {
+
+constexpr std::string_view kPath = "/static/css/site.css";
+
+// The per-request line the server used to write synchronously, formatted and written the same way
+void sLogSynchronously(int fd) {
+	std::string line = std::vformat("[INFO] Received request: {} {}", std::make_format_args("GET", kPath));
+	line += '\n';
+	ou::bench::doNotOptimize(write(fd, line.data(), line.size()));
+}
+
+void benchmarkThreads(std::string_view name, int threadCount) {
+	Logger::Stats before = Logger::stats();
+	std::atomic<uint64_t> total{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&total] {
+			double rate = ou::bench::measureRate([] { LOG_INFO("Received request: {} {}", "GET", kPath); });
+			total.fetch_add(static_cast<uint64_t>(rate), std::memory_order_relaxed);
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	Logger::flush();
+	ou::bench::report(std::string(name) + "/" + std::to_string(threadCount) + "-threads", static_cast<double>(total), "msgs/s");
+
+	// A full thread buffer drops rather than blocks, so the rate only means something next to the drop ratio
+	Logger::Stats after = Logger::stats();
+	uint64_t logged = after.logged - before.logged;
+	uint64_t dropped = after.dropped - before.dropped;
+	std::printf("  %.1f%% dropped\n", 100.0 * static_cast<double>(dropped) / static_cast<double>(std::max<uint64_t>(logged + dropped, 1)));
+}
+
+} // namespace
+
+int main() {
+	int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+	Logger::configure({ .level = LogLevel::Info, .fd = devNull });
+	ou::bench::report("sync-vformat-write", ou::bench::measureRate([devNull] { sLogSynchronously(devNull); }), "msgs/s");
+
+	// A disabled level costs a relaxed load and a branch; the arguments are never evaluated
+	ou::bench::report("disabled-debug", ou::bench::measureRate([] {
+											LOG_DEBUG("Received request: {} {}", "GET", std::string(kPath));
+										}),
+										"msgs/s");
+
+	for (int threads : { 1, 4 })
+		benchmarkThreads("async-text", threads);
+
+	Logger::configure({ .level = LogLevel::Info, .json = true, .fd = devNull });
+	benchmarkThreads("async-json", 1);
+
+	Logger::configure({});
+	close(devNull);
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include "Benchmark.h"
+#include "Metrics.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr std::array<std::string_view, 8> kRoutes{ "/kv", "/kv/batch", "/kv/scan", "/users/:id", "/users/:id/posts/:post", "/files/*path",
+																									 "static", "/metrics" };
+
+// What recording would cost with one map shared by every worker
+class LockedMetrics {
+public:
+	void recordRequest(std::string_view route, Method method, int statusCode, std::chrono::nanoseconds duration) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto &[count, total] = series_[{ std::string(route), method, statusCode }];
+		++count;
+		total += static_cast<uint64_t>(duration.count());
+	}
+
+private:
+	std::mutex mutex_;
+	std::map<std::tuple<std::string, Method, int>, std::pair<uint64_t, uint64_t>> series_;
+};
+
+template <typename Recorder> void benchmarkThreads(std::string_view name, Recorder &recorder, int threadCount) {
+	std::atomic<uint64_t> total{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&recorder, &total] {
+			size_t i = 0;
+			double rate = ou::bench::measureRate([&recorder, &i] {
+				++i;
+				recorder.recordRequest(kRoutes[i % kRoutes.size()], Method::GET, i % 16 == 0 ? 404 : 200, std::chrono::nanoseconds(i % 5000000));
+			});
+			total.fetch_add(static_cast<uint64_t>(rate), std::memory_order_relaxed);
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	ou::bench::report(std::string(name) + "/" + std::to_string(threadCount) + "-threads", static_cast<double>(total), "records/s");
+}
+
+} // namespace
+
+int main() {
+	// Recording cycles through 8 routes and 2 statuses. With one core, several threads only interleave, so the threaded
+	// rates show the cost of contention rather than of parallelism.
+	for (int threads : { 1, 4 }) {
+		Metrics metrics;
+		benchmarkThreads("per-thread-shards", metrics, threads);
+		LockedMetrics locked;
+		benchmarkThreads("shared-locked-map", locked, threads);
+	}
+
+	// The server reads the clock before and after each request, which costs more than recording it
+	ou::bench::report("steady_clock::now", ou::bench::measureRate([] { ou::bench::doNotOptimize(std::chrono::steady_clock::now()); }), "calls/s");
+
+	// A scrape sums every thread's series and formats 18 lines per series
+	Metrics metrics;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&metrics] {
+			for (size_t i = 0; i < 100000; ++i)
+				metrics.recordRequest(kRoutes[i % kRoutes.size()], Method::GET, i % 16 == 0 ? 404 : 200, std::chrono::nanoseconds(i * 37));
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	ou::bench::report("render/4-threads-16-series", ou::bench::measureRate([&metrics] { ou::bench::doNotOptimize(metrics.render()); },
+																																			 std::chrono::milliseconds(300)),
+										"scrapes/s");
+	return 0;
+}
@@ -0,0 +1,186 @@
+#include "Benchmark.h"
+#include "ByteScan.h"
+#include "HttpTypes.h"
+#include "RequestParser.h"
+
+#include <algorithm>
+#include <cctype>
+#include <format>
+#include <map>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+using namespace ou::http;
+
+namespace {
+
+// The stream-based parser that RequestParser replaced, kept verbatim as the comparison baseline
+struct LegacyRequest {
+	Method method;
+	std::string path;
+	std::map<std::string, std::string> headers;
+	std::string body;
+};
+
+std::pair<std::string_view, std::string_view> legacySplitAt(std::string_view str, char delimiter) {
+	size_t pos = str.find(delimiter);
+	if (pos == std::string_view::npos)
+		return { str, {} };
+	return { str.substr(0, pos), str.substr(pos + 1) };
+}
+
+std::string_view legacyTrim(std::string_view str) {
+	auto isSpace = [](unsigned char ch) {
+		return std::isspace(ch);
+	};
+	str.remove_prefix(std::ranges::distance(str | std::views::take_while(isSpace)));
+	str.remove_suffix(std::ranges::distance(str | std::views::reverse | std::views::take_while(isSpace)));
+	return str;
+}
+
+LegacyRequest legacyParse(std::string_view raw) {
+	LegacyRequest req;
+	size_t pos = raw.find("\r\n\r\n");
+	std::string_view headerSection = raw.substr(0, pos);
+	std::string_view bodySection = (pos != std::string_view::npos) ? raw.substr(pos + 4) : "";
+
+	std::string headerStr(headerSection);
+	std::istringstream headerStream(headerStr);
+	std::string line;
+	std::getline(headerStream, line);
+	std::istringstream requestLine(line);
+	requestLine >> req.method >> req.path;
+
+	while (std::getline(headerStream, line) && !line.empty()) {
+		auto [key, value] = legacySplitAt(line, ':');
+		req.headers[std::string(legacyTrim(key))] = std::string(legacyTrim(value));
+	}
+
+	req.body = std::string(bodySection);
+	return req;
+}
+
+const std::string kSmallRequest = "GET /kv?key=user:1234 HTTP/1.1\r\n"
+																	"Host: localhost:8080\r\n"
+																	"User-Agent: curl/8.5.0\r\n"
+																	"Accept: */*\r\n"
+																	"\r\n";
+
+const std::string kBrowserRequest = "GET /assets/app.js HTTP/1.1\r\n"
+																		"Host: www.example.com\r\n"
+																		"Connection: keep-alive\r\n"
+																		"sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+																		"sec-ch-ua-mobile: ?0\r\n"
+																		"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+																		"Chrome/124.0.0.0 Safari/537.36\r\n"
+																		"sec-ch-ua-platform: \"Linux\"\r\n"
+																		"Accept: */*\r\n"
+																		"Sec-Fetch-Site: same-origin\r\n"
+																		"Sec-Fetch-Mode: no-cors\r\n"
+																		"Sec-Fetch-Dest: script\r\n"
+																		"Referer: https://www.example.com/dashboard\r\n"
+																		"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+																		"Accept-Language: en-GB,en-US;q=0.9,en;q=0.8\r\n"
+																		"Cookie: session=6f1e2d3c4b5a69788796a5b4c3d2e1f0; theme=dark; _ga=GA1.1.123456789.1700000000; "
+																		"_gid=GA1.1.987654321.1700000000; consent=analytics%3Dtrue%26ads%3Dfalse\r\n"
+																		"If-None-Match: \"5d41402abc4b2a76b9719d911017c592\"\r\n"
+																		"\r\n";
+
+const std::string kPutRequest = "PUT /kv?key=user:1234 HTTP/1.1\r\n"
+																"Host: localhost:8080\r\n"
+																"Content-Type: application/json\r\n"
+																"Content-Length: 64\r\n"
+																"\r\n"
+																+ std::string(64, 'v');
+
+// An API request behind a login: a 4 KB cookie jar and a 1.5 KB bearer token dominate the header section
+const std::string kCookieAuthRequest = [] {
+	std::string cookie;
+	for (int i = 0; cookie.size() < 4096; ++i)
+		cookie += std::format("{}pref_{}=a8f3c2e1d4b5968778695a4b3c2d1e0f{}", i == 0 ? "" : "; ", i, i * 7919);
+	std::string token = "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.";
+	while (token.size() < 1536)
+		token += "eyJzdWIiOiIxMjM0NTY3ODkwIiwic2NvcGUiOiJyZWFkIHdyaXRlIiwiaWF0IjoxNzAwMDAwMDAwfQ";
+	return "GET /api/v2/orders?page=3&per_page=50 HTTP/1.1\r\n"
+				 "Host: api.example.com\r\n"
+				 "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+				 "Accept: application/json\r\n"
+				 "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+				 "Authorization: Bearer "
+				 + token + "\r\nCookie: " + cookie + "\r\nX-Request-Id: 0d4c9f3e-8a51-4d3b-9a8e-2f4d1c6b7a90\r\n\r\n";
+}();
+
+void benchmarkRequest(std::string_view name, const std::string &raw) {
+	double legacy = ou::bench::measureRate([&raw] {
+		LegacyRequest req = legacyParse(raw);
+		ou::bench::doNotOptimize(req);
+	});
+	ou::bench::report(std::string("legacy/") + std::string(name), legacy, "req/s");
+
+	// One parser per connection, reset between requests, as in Server::processRequests
+	RequestParser parser;
+	double incremental = ou::bench::measureRate([&parser, &raw] {
+		parser.reset();
+		auto status = parser.parse(raw);
+		ou::bench::doNotOptimize(status);
+		ou::bench::doNotOptimize(parser.request());
+	});
+	ou::bench::report(std::string("incremental/") + std::string(name), incremental, "req/s");
+
+	// The same request arriving in two reads, split in the middle of the header section
+	std::string_view firstHalf = std::string_view(raw).substr(0, raw.size() / 2);
+	double split = ou::bench::measureRate([&parser, &raw, firstHalf] {
+		parser.reset();
+		auto first = parser.parse(firstHalf);
+		auto second = parser.parse(raw);
+		ou::bench::doNotOptimize(first);
+		ou::bench::doNotOptimize(second);
+	});
+	ou::bench::report(std::string("incremental-split/") + std::string(name), split, "req/s");
+}
+
+// The parser and its scans at each level of vector instructions this CPU supports
+void benchmarkScanLevels() {
+	std::string_view cookieValue = kCookieAuthRequest;
+	cookieValue = cookieValue.substr(cookieValue.find("Cookie: ") + 8);
+
+	for (ScanLevel level : { ScanLevel::Scalar, ScanLevel::Sse42, ScanLevel::Avx2 }) {
+		if (level > supportedScanLevel())
+			continue;
+		setScanLevel(level);
+		std::string_view levelName = scanLevelName(level);
+
+		RequestParser parser;
+		for (auto [name, raw] : { std::pair<std::string_view, const std::string &>{ "small", kSmallRequest },
+															{ "browser", kBrowserRequest },
+															{ "cookie-auth", kCookieAuthRequest } }) {
+			double rate = ou::bench::measureRate([&parser, &raw] {
+				parser.reset();
+				auto status = parser.parse(raw);
+				ou::bench::doNotOptimize(status);
+			});
+			ou::bench::report(std::format("scan-{}/{}", levelName, name), rate, "req/s");
+		}
+
+		for (const std::string *raw : { &kBrowserRequest, &kCookieAuthRequest }) {
+			double headerEnd = ou::bench::measureRate([raw] { ou::bench::doNotOptimize(findHeaderEnd(*raw)); });
+			ou::bench::report(std::format("scan-{}/find-header-end-{}-bytes", levelName, raw->size()), headerEnd, "scans/s");
+		}
+		double value = ou::bench::measureRate([cookieValue] { ou::bench::doNotOptimize(fieldValueLength(cookieValue)); });
+		ou::bench::report(std::format("scan-{}/cookie-value-{}-bytes", levelName, cookieValue.find('\r')), value, "scans/s");
+	}
+	setScanLevel(supportedScanLevel());
+}
+
+} // namespace
+
+int main() {
+	benchmarkRequest("small", kSmallRequest);
+	benchmarkRequest("browser", kBrowserRequest);
+	benchmarkRequest("put", kPutRequest);
+	benchmarkRequest("cookie-auth", kCookieAuthRequest);
+	benchmarkScanLevels();
+	return 0;
+}
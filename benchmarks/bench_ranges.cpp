@@ -0,0 +1,161 @@
+#include "Benchmark.h"
+#include "Server.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr uint16_t kPort = 18190;
+constexpr uint64_t kFileSize = 4ull * 1024 * 1024 * 1024; // Sparse, so it costs no disk space
+constexpr auto kDuration = std::chrono::seconds(3);
+
+struct Totals {
+	std::atomic<uint64_t> requests{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+};
+
+int sConnect() {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Reads one response from a persistent connection and returns its body length, or -1 on failure
+int64_t sReadResponse(int fd, std::vector<char> &buffer) {
+	std::string head;
+	size_t headEnd = std::string::npos;
+	while (headEnd == std::string::npos) {
+		ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+		if (n <= 0)
+			return -1;
+		head.append(buffer.data(), static_cast<size_t>(n));
+		headEnd = head.find("\r\n\r\n");
+	}
+	if (!head.starts_with("HTTP/1.1 206"))
+		return -1;
+
+	size_t lengthPos = head.find("Content-Length: ");
+	uint64_t length = 0;
+	std::from_chars(head.data() + lengthPos + 16, head.data() + headEnd, length);
+	uint64_t received = head.size() - headEnd - 4;
+	while (received < length) {
+		ssize_t n = recv(fd, buffer.data(), std::min<uint64_t>(buffer.size(), length - received), 0);
+		if (n <= 0)
+			return -1;
+		received += static_cast<uint64_t>(n);
+	}
+	return static_cast<int64_t>(length);
+}
+
+void sClient(Totals &totals, std::atomic<bool> &running, uint64_t rangeSize, int rangeCount, unsigned seed) {
+	int fd = sConnect();
+	if (fd < 0)
+		return;
+	std::mt19937_64 random(seed);
+	std::uniform_int_distribution<uint64_t> offsets(0, kFileSize - rangeSize * static_cast<uint64_t>(rangeCount) - 1);
+	std::vector<char> buffer(256 * 1024);
+
+	while (running.load(std::memory_order_relaxed)) {
+		std::string request = "GET /large.bin HTTP/1.1\r\nHost: localhost\r\nRange: bytes=";
+		for (int i = 0; i < rangeCount; ++i) {
+			uint64_t first = offsets(random);
+			if (i > 0)
+				request += ',';
+			request += std::to_string(first) + "-" + std::to_string(first + rangeSize - 1);
+		}
+		request += "\r\n\r\n";
+		if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+			break;
+		int64_t length = sReadResponse(fd, buffer);
+		if (length < 0)
+			break;
+		totals.requests.fetch_add(1, std::memory_order_relaxed);
+		totals.bytes.fetch_add(static_cast<uint64_t>(length), std::memory_order_relaxed);
+	}
+	close(fd);
+}
+
+long sMaxResidentKiB() {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+void benchmarkRanges(std::string_view name, int clients, uint64_t rangeSize, int rangeCount) {
+	Totals totals;
+	std::atomic<bool> running{ true };
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < clients; ++i)
+		threads.emplace_back(sClient, std::ref(totals), std::ref(running), rangeSize, rangeCount, static_cast<unsigned>(i + 1));
+	std::this_thread::sleep_for(kDuration);
+	running = false;
+	for (auto &thread : threads)
+		thread.join();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::string label = std::string(name) + "/" + std::to_string(clients) + "-clients";
+	ou::bench::report(label, static_cast<double>(totals.requests) / seconds, "req/s");
+	ou::bench::report(label, static_cast<double>(totals.bytes) / seconds / (1024 * 1024), "MiB/s");
+}
+
+} // namespace
+
+int main() {
+	auto servingDirectory = std::filesystem::temp_directory_path() / "ou_http_bench_ranges";
+	std::filesystem::create_directories(servingDirectory);
+	int fd = open((servingDirectory / "large.bin").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, static_cast<off_t>(kFileSize)) < 0) {
+		std::fprintf(stderr, "Failed to create %s\n", (servingDirectory / "large.bin").c_str());
+		return 1;
+	}
+	close(fd);
+
+	Server::Config config;
+	config.servingDirectory = servingDirectory;
+	config.port = kPort;
+	config.threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency() / 2));
+	Server server(config);
+	if (!server.init()) {
+		std::fprintf(stderr, "Failed to start server on port %u\n", kPort);
+		return 1;
+	}
+	server.start();
+
+	long residentBefore = sMaxResidentKiB();
+	for (int clients : { 1, 8, 32 })
+		benchmarkRanges("range-1MiB", clients, 1024 * 1024, 1);
+	benchmarkRanges("multirange-4x64KiB", 8, 64 * 1024, 4);
+	benchmarkRanges("range-4KiB", 8, 4096, 1);
+
+	// Serving ranges of a 4 GiB file should not grow the process beyond per-connection buffers
+	std::printf("max resident set: %ld KiB before, %ld KiB after\n", residentBefore, sMaxResidentKiB());
+
+	server.stop();
+	std::filesystem::remove_all(servingDirectory);
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include "Benchmark.h"
+#include "HttpTypes.h"
+#include "Server.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace ou::http;
+
+namespace {
+
+// handleRequest() is what a worker calls for each parsed request; it needs no sockets, so no init()
+class BenchServer : public Server {
+public:
+	using Server::handleRequest;
+	using Server::Server;
+};
+
+Response sJsonResponse() {
+	return Response{ 200, "OK", { { "Content-Type", "application/json" } }, R"({"id":42,"name":"widget","tags":["a","b","c"],"stock":17})" };
+}
+
+Response sManyHeadersResponse() {
+	Response response = sJsonResponse();
+	response.headers["Cache-Control"] = "no-store";
+	response.headers["Vary"] = "Accept-Encoding";
+	response.headers["ETag"] = "\"5f2b-1a-17c9e2\"";
+	response.headers["Last-Modified"] = "Tue, 15 Nov 1994 08:12:31 GMT";
+	response.headers["X-Request-Id"] = "0d4c9f3e-8a51-4d3b-9a8e-2f4d1c6b7a90";
+	response.headers["Strict-Transport-Security"] = "max-age=63072000";
+	response.headers["Connection"] = "keep-alive";
+	return response;
+}
+
+void benchmarkSerialize() {
+	Response small = sJsonResponse();
+	ou::bench::report("serialize/small-json", ou::bench::measureRate([&small] { ou::bench::doNotOptimize(small.serialize()); }), "responses/s");
+	Response many = sManyHeadersResponse();
+	ou::bench::report("serialize-head/8-headers", ou::bench::measureRate([&many] { ou::bench::doNotOptimize(many.serializeHead()); }),
+										"responses/s");
+	// What a worker does per response: the head goes into a reused buffer, and the body is sent from where it is
+	std::string buffer;
+	auto appendHead = [&many, &buffer] {
+		buffer.clear();
+		many.appendHead(buffer);
+		ou::bench::doNotOptimize(buffer);
+	};
+	ou::bench::report("append-head/8-headers-reused-buffer", ou::bench::measureRate(appendHead), "responses/s");
+	Response large{ 200, "OK", { { "Content-Type", "application/octet-stream" } }, std::string(64 * 1024, 'x') };
+	ou::bench::report("serialize/64KiB-body", ou::bench::measureRate([&large] { ou::bench::doNotOptimize(large.serialize()); }), "responses/s");
+}
+
+void benchmarkHandleRequest(const std::filesystem::path &directory) {
+	BenchServer::Config config;
+	config.servingDirectory = directory;
+	config.compression.enabled = false;
+	BenchServer server(config);
+	server.registerPathHandler(Method::GET, "/items/:id", [](const Request &) { return sJsonResponse(); });
+	// The same handler as a coroutine that has nothing to wait for: the cost of its frame and of the task around it
+	server.registerPathHandler(Method::GET, "/async-items/:id", [](const Request &) -> Task<Response> { co_return sJsonResponse(); });
+
+	// Parsing and serializing are included: this is the work a worker does per request, minus the socket calls
+	auto pipeline = [&server](std::string_view raw) {
+		return [&server, raw] {
+			Request request = Request::parse(raw);
+			std::optional<Response> response = server.handleRequest(request);
+			ou::bench::doNotOptimize(response->serializeHead());
+		};
+	};
+	ou::bench::report("handle/route-param", ou::bench::measureRate(pipeline("GET /items/42 HTTP/1.1\r\nHost: localhost\r\n\r\n")), "requests/s");
+	ou::bench::report("handle/async-route-param", ou::bench::measureRate(pipeline("GET /async-items/42 HTTP/1.1\r\nHost: localhost\r\n\r\n")),
+										"requests/s");
+	ou::bench::report("handle/static-cached-file", ou::bench::measureRate(pipeline("GET /site.css HTTP/1.1\r\nHost: localhost\r\n\r\n")),
+										"requests/s");
+	ou::bench::report("handle/static-not-found", ou::bench::measureRate(pipeline("GET /missing.css HTTP/1.1\r\nHost: localhost\r\n\r\n")),
+										"requests/s");
+}
+
+} // namespace
+
+int main() {
+	auto directory = std::filesystem::temp_directory_path() / "ou_bench_response";
+	std::filesystem::create_directories(directory);
+	std::ofstream(directory / "site.css") << std::string(4096, 'c');
+
+	benchmarkSerialize();
+	benchmarkHandleRequest(directory);
+
+	std::filesystem::remove_all(directory);
+	return 0;
+}
@@ -0,0 +1,89 @@
+#include "Benchmark.h"
+#include "Router.h"
+
+#include <functional>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr int kResources = 200;
+
+// Six routes per resource, in the shapes a REST API typically has
+std::vector<std::string> sRoutePatterns() {
+	std::vector<std::string> patterns;
+	for (int i = 0; i < kResources; ++i) {
+		std::string base = "/api/v1/resource" + std::to_string(i);
+		patterns.push_back(base);
+		patterns.push_back(base + "/search");
+		patterns.push_back(base + "/:id");
+		patterns.push_back(base + "/:id/history");
+		patterns.push_back(base + "/:id/children/:child");
+		patterns.push_back(base + "/files/*path");
+	}
+	return patterns;
+}
+
+// The same pattern as a regular expression, the way routes had to be registered before the router existed
+std::string sToRegex(const std::string &pattern) {
+	std::string regex;
+	for (size_t pos = 0; pos < pattern.size(); ++pos) {
+		if ((pattern[pos] == ':' || pattern[pos] == '*') && pattern[pos - 1] == '/') {
+			regex += pattern[pos] == ':' ? "[^/]+" : ".*";
+			while (pos + 1 < pattern.size() && pattern[pos + 1] != '/')
+				++pos;
+		} else {
+			regex += pattern[pos];
+		}
+	}
+	return regex;
+}
+
+void benchmarkPath(std::string_view name, const std::string &path, const Router &router,
+									 const std::vector<std::pair<std::regex, Router::Handler>> &regexRoutes) {
+	RouteParams params;
+	double radix = ou::bench::measureRate([&] {
+		const auto *handler = router.find(Method::GET, path, params);
+		ou::bench::doNotOptimize(handler);
+	});
+	ou::bench::report(std::string("radix/") + std::string(name), radix, "lookups/s");
+
+	double regex = ou::bench::measureRate([&] {
+		const Router::Handler *handler = nullptr;
+		for (const auto &[pattern, candidate] : regexRoutes) {
+			if (std::regex_match(path, pattern)) {
+				handler = &candidate;
+				break;
+			}
+		}
+		ou::bench::doNotOptimize(handler);
+	});
+	ou::bench::report(std::string("regex-scan/") + std::string(name), regex, "lookups/s");
+}
+
+} // namespace
+
+int main() {
+	auto patterns = sRoutePatterns();
+	Router router;
+	std::vector<std::pair<std::regex, Router::Handler>> regexRoutes;
+	for (const auto &pattern : patterns) {
+		Router::Handler handler = [](const Request &) {
+			return Response{};
+		};
+		router.add(Method::GET, pattern, handler);
+		regexRoutes.emplace_back(std::regex(sToRegex(pattern)), handler);
+	}
+	std::printf("%zu routes\n", patterns.size());
+
+	benchmarkPath("static-first", "/api/v1/resource0/search", router, regexRoutes);
+	benchmarkPath("static-last", "/api/v1/resource199/search", router, regexRoutes);
+	benchmarkPath("params", "/api/v1/resource120/8f14e45f/children/c9f0f895", router, regexRoutes);
+	benchmarkPath("wildcard", "/api/v1/resource150/files/reports/2024/q3.pdf", router, regexRoutes);
+	benchmarkPath("miss", "/api/v2/unknown", router, regexRoutes);
+	return 0;
+}
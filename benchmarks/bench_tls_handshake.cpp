@@ -0,0 +1,121 @@
+#include "Benchmark.h"
+#include "Server.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr uint16_t kPort = 18193;
+constexpr auto kDuration = std::chrono::seconds(2);
+
+int sConnect() {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	// Otherwise the request would wait behind the client's last handshake message for a delayed ACK
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// One connection carrying one request; returns the session to offer next time, or nullptr on failure. The request
+// matters for TLS 1.3, whose tickets arrive after the handshake.
+SSL_SESSION *sRequest(SSL_CTX *clientCtx, SSL_SESSION *session, bool &resumed) {
+	int fd = sConnect();
+	if (fd < 0)
+		return nullptr;
+	SSL *ssl = SSL_new(clientCtx);
+	SSL_set_fd(ssl, fd);
+	if (session != nullptr)
+		SSL_set_session(ssl, session);
+	static constexpr std::string_view kRequest = "GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+	SSL_SESSION *next = nullptr;
+	char buffer[1024];
+	if (SSL_connect(ssl) == 1 && SSL_write(ssl, kRequest.data(), static_cast<int>(kRequest.size())) > 0) {
+		while (SSL_read(ssl, buffer, sizeof(buffer)) > 0) {
+		}
+		resumed = SSL_session_reused(ssl) != 0;
+		next = SSL_get1_session(ssl);
+	}
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	close(fd);
+	return next;
+}
+
+void benchmarkHandshakes(std::string_view name, const SSLSocketHandler::Config &https, int tlsVersion, bool resume) {
+	Server::Config config;
+	config.port = kPort;
+	config.threadCount = 1;
+	config.https = https;
+	Server server(config);
+	server.registerPathHandler(Method::GET, "/hello",
+														 [](const Request &) { return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "hello" }; });
+	if (!server.init()) {
+		std::fprintf(stderr, "Failed to start server on port %u\n", kPort);
+		return;
+	}
+	server.start();
+
+	SSL_CTX *clientCtx = SSL_CTX_new(TLS_client_method());
+	SSL_CTX_set_min_proto_version(clientCtx, tlsVersion);
+	SSL_CTX_set_max_proto_version(clientCtx, tlsVersion);
+	SSL_CTX_set_session_cache_mode(clientCtx, SSL_SESS_CACHE_CLIENT);
+
+	SSL_SESSION *session = nullptr;
+	uint64_t connections = 0;
+	uint64_t resumedCount = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - start < kDuration) {
+		bool resumed = false;
+		SSL_SESSION *next = sRequest(clientCtx, resume ? session : nullptr, resumed);
+		if (next == nullptr)
+			break;
+		SSL_SESSION_free(session);
+		session = next;
+		++connections;
+		resumedCount += resumed ? 1 : 0;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	SSL_SESSION_free(session);
+	SSL_CTX_free(clientCtx);
+	server.stop();
+
+	ou::bench::report(name, static_cast<double>(connections) / seconds, "conn/s");
+	if (resume && connections > 0)
+		ou::bench::report(name, 100.0 * static_cast<double>(resumedCount) / static_cast<double>(connections), "% resumed");
+}
+
+} // namespace
+
+int main() {
+	// Each connection makes one request; the client and server share the machine, so rates include both sides' work
+	SSLSocketHandler::Config tickets{ .enabled = true, .certPath = OU_CERTS_DIR "/cert.pem", .keyPath = OU_CERTS_DIR "/key.pem" };
+	SSLSocketHandler::Config cacheOnly = tickets;
+	cacheOnly.sessionTickets = false;
+
+	benchmarkHandshakes("tls1.3/full", tickets, TLS1_3_VERSION, false);
+	benchmarkHandshakes("tls1.3/resumed-ticket", tickets, TLS1_3_VERSION, true);
+	benchmarkHandshakes("tls1.3/resumed-session-cache", cacheOnly, TLS1_3_VERSION, true);
+	benchmarkHandshakes("tls1.2/full", tickets, TLS1_2_VERSION, false);
+	benchmarkHandshakes("tls1.2/resumed-ticket", tickets, TLS1_2_VERSION, true);
+	benchmarkHandshakes("tls1.2/resumed-session-id", cacheOnly, TLS1_2_VERSION, true);
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include "Benchmark.h"
+#include "Server.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+
+using namespace ou::http;
+
+namespace {
+
+constexpr uint16_t kPort = 18194;
+constexpr auto kDuration = std::chrono::seconds(2);
+
+int sConnect() {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Reads one response to a GET for a file of fileSize bytes; returns false on failure
+bool sReadResponse(SSL *ssl, size_t fileSize) {
+	std::string head;
+	char buffer[16384];
+	size_t headerEnd = std::string::npos;
+	size_t body = 0;
+	while (headerEnd == std::string::npos) {
+		int n = SSL_read(ssl, buffer, sizeof(buffer));
+		if (n <= 0)
+			return false;
+		head.append(buffer, static_cast<size_t>(n));
+		headerEnd = head.find("\r\n\r\n");
+		if (headerEnd != std::string::npos)
+			body = head.size() - headerEnd - 4;
+	}
+	while (body < fileSize) {
+		int n = SSL_read(ssl, buffer, sizeof(buffer));
+		if (n <= 0)
+			return false;
+		body += static_cast<size_t>(n);
+	}
+	return true;
+}
+
+// Repeatedly fetches the file over one keep-alive connection
+void benchmarkFile(std::string_view name, const std::filesystem::path &directory, size_t fileSize, bool kernelTls) {
+	Server::Config config;
+	config.servingDirectory = directory;
+	config.port = kPort;
+	config.threadCount = 1;
+	config.maxRequestsPerConnection = std::numeric_limits<size_t>::max();
+	config.https = { .enabled = true, .certPath = OU_CERTS_DIR "/cert.pem", .keyPath = OU_CERTS_DIR "/key.pem", .kernelTls = kernelTls };
+	Server server(config);
+	if (!server.init()) {
+		std::fprintf(stderr, "Failed to start server on port %u\n", kPort);
+		return;
+	}
+	server.start();
+
+	SSL_CTX *clientCtx = SSL_CTX_new(TLS_client_method());
+	SSL *ssl = SSL_new(clientCtx);
+	int fd = sConnect();
+	std::string request = "GET /" + std::to_string(fileSize) + ".bin HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	uint64_t bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	if (fd >= 0 && SSL_set_fd(ssl, fd) == 1 && SSL_connect(ssl) == 1) {
+		while (std::chrono::steady_clock::now() - start < kDuration) {
+			if (SSL_write(ssl, request.data(), static_cast<int>(request.size())) <= 0 || !sReadResponse(ssl, fileSize))
+				break;
+			bytes += fileSize;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	if (fd >= 0)
+		close(fd);
+	SSL_CTX_free(clientCtx);
+	bool offloaded = server.tlsStats()->kernelTls > 0;
+	server.stop();
+
+	ou::bench::report(name, static_cast<double>(bytes) / seconds / (1024 * 1024), offloaded ? "MiB/s (kernel TLS)" : "MiB/s (userspace TLS)");
+}
+
+} // namespace
+
+int main() {
+	// The client decrypts in userspace on the same machine, so the rates include its work. Files above the static file
+	// cache's entry limit are streamed from disk: sendfile() under kernel TLS, pread() and SSL_write() otherwise. Kernel
+	// TLS requests fall back to userspace TLS where the kernel's tls module is missing, as the unit label shows.
+	auto directory = std::filesystem::temp_directory_path() / "ou_bench_tls_static_file";
+	std::filesystem::create_directories(directory);
+	for (size_t size : { size_t{ 64 } * 1024, size_t{ 8 } * 1024 * 1024 })
+		std::ofstream(directory / (std::to_string(size) + ".bin"), std::ios::binary) << std::string(size, 'x');
+
+	benchmarkFile("https/64KiB-cached", directory, 64 * 1024, false);
+	benchmarkFile("https/64KiB-cached/ktls", directory, 64 * 1024, true);
+	benchmarkFile("https/8MiB-streamed", directory, 8 * 1024 * 1024, false);
+	benchmarkFile("https/8MiB-streamed/ktls", directory, 8 * 1024 * 1024, true);
+
+	std::filesystem::remove_all(directory);
+	return 0;
+}
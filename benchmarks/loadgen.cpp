@@ -0,0 +1,460 @@
+#include "Benchmark.h"
+#include "EventLoop.h"
+#include "KVStore.h"
+#include "Metrics.h"
+#include "Server.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// HTTP/1.1 load generator. Keeps a set of keep-alive connections to a server over loopback and reports the request rate
+// and latency quantiles. In a closed loop each connection sends its next request as soon as the previous response
+// arrives, which measures peak throughput. In an open loop requests are due at a fixed rate whether or not the server
+// keeps up, and latency counts from when a request was due rather than when a free connection sent it, so a stalled
+// server shows up in the tail instead of slowing the load down (coordinated omission).
+//
+// Without --port it starts a Server in the same process with a few routes to aim at: /hello (a short text), /kv?key=k1
+// (a KVStore read), /wait-blocking?ms=N and /wait-async?ms=N (a handler that waits N milliseconds for a backend, by
+// blocking the worker or by suspending) and any file under --serve.
+
+using namespace ou::http;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint16_t kDefaultPort = 18196;
+constexpr uint64_t kTimerEvent = std::numeric_limits<uint64_t>::max(); // epoll data of the timer; connections use their index
+
+struct Options {
+	uint16_t port = 0; // 0 starts an in-process server
+	std::string path = "/hello";
+	bool openLoop = false;
+	size_t connections = 16;
+	double rate = 10000; // Requests per second, open loop only
+	std::chrono::milliseconds duration{ 5000 };
+	std::chrono::milliseconds warmup{ 1000 }; // Excluded from the results
+	int serverThreads = 1;
+	std::string serve; // Serving directory of the in-process server
+};
+
+// The ms query parameter of the /wait routes
+std::chrono::milliseconds sWaitTime(const Request &request) {
+	int milliseconds = 1;
+	if (auto value = findQueryParameter(request.query, "ms"))
+		std::from_chars(value->data(), value->data() + value->size(), milliseconds);
+	return std::chrono::milliseconds(milliseconds);
+}
+
+void sUsage() {
+	std::fprintf(stderr, "Usage: loadgen [--port N] [--path /hello] [--open --rate R] [--connections N] [--duration SECONDS]\n"
+											 "               [--warmup SECONDS] [--server-threads N] [--serve DIRECTORY]\n"
+											 "Set OU_BENCH_JSON=results.jsonl to append the results as JSON.\n");
+}
+
+std::optional<Options> sParseOptions(int argc, char *argv[]) {
+	Options options;
+	auto number = [](std::string_view text, auto &value) {
+		auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+		return error == std::errc() && end == text.data() + text.size();
+	};
+	auto seconds = [&number](std::string_view text, std::chrono::milliseconds &value) {
+		double parsed = 0;
+		if (!number(text, parsed) || parsed < 0)
+			return false;
+		value = std::chrono::milliseconds(static_cast<int64_t>(parsed * 1000));
+		return true;
+	};
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		if (arg == "--open") {
+			options.openLoop = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return std::nullopt;
+		std::string_view value = argv[++i];
+		bool valid = true;
+		if (arg == "--port")
+			valid = number(value, options.port);
+		else if (arg == "--path")
+			options.path = value;
+		else if (arg == "--rate")
+			valid = number(value, options.rate) && options.rate > 0;
+		else if (arg == "--connections")
+			valid = number(value, options.connections) && options.connections > 0;
+		else if (arg == "--duration")
+			valid = seconds(value, options.duration);
+		else if (arg == "--warmup")
+			valid = seconds(value, options.warmup);
+		else if (arg == "--server-threads")
+			valid = number(value, options.serverThreads) && options.serverThreads > 0;
+		else if (arg == "--serve")
+			options.serve = value;
+		else
+			valid = false;
+		if (!valid)
+			return std::nullopt;
+	}
+	return options;
+}
+
+int sConnect(uint16_t port) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Length of the response at the front of data, or 0 if it is not complete yet. Bodies must have a Content-Length.
+size_t sResponseLength(std::string_view data, int &statusCode) {
+	size_t headerEnd = data.find("\r\n\r\n");
+	if (headerEnd == std::string_view::npos)
+		return 0;
+	std::string_view head = data.substr(0, headerEnd + 2);
+	statusCode = head.size() > 12 ? (head[9] - '0') * 100 + (head[10] - '0') * 10 + (head[11] - '0') : 0;
+	size_t bodyLength = 0;
+	for (size_t lineStart = head.find("\r\n") + 2; lineStart < head.size();) {
+		size_t lineEnd = head.find("\r\n", lineStart);
+		std::string_view line = head.substr(lineStart, lineEnd - lineStart);
+		constexpr std::string_view kName = "content-length:";
+		if (line.size() > kName.size()
+				&& std::equal(kName.begin(), kName.end(), line.begin(), [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); })) {
+			std::string_view value = line.substr(kName.size());
+			value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+			std::from_chars(value.data(), value.data() + value.size(), bodyLength);
+		}
+		lineStart = lineEnd + 2;
+	}
+	return data.size() >= headerEnd + 4 + bodyLength ? headerEnd + 4 + bodyLength : 0;
+}
+
+class LoadGenerator {
+public:
+	explicit LoadGenerator(const Options &options)
+			: options_(options), request_(std::format("GET {} HTTP/1.1\r\nHost: localhost\r\nUser-Agent: ou-loadgen\r\n\r\n", options.path)) {
+		latencies_.buckets.resize(LatencyBuckets::kCount);
+	}
+
+	bool run() {
+		epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+		// Requests fall due between milliseconds, which an epoll_wait() timeout cannot express; the wait would add up to a
+		// millisecond to every open-loop latency
+		timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		epoll_event timerEvent{};
+		timerEvent.events = EPOLLIN;
+		timerEvent.data.u64 = kTimerEvent;
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd_, &timerEvent);
+		connections_.resize(options_.connections);
+		for (size_t i = 0; i < connections_.size(); ++i) {
+			if (!reconnect(i))
+				return false;
+		}
+
+		start_ = Clock::now();
+		measureFrom_ = start_ + options_.warmup;
+		end_ = measureFrom_ + options_.duration;
+		if (!options_.openLoop) {
+			for (size_t i = 0; i < connections_.size(); ++i)
+				send(i, Clock::now());
+		}
+
+		std::vector<epoll_event> events(connections_.size() + 1);
+		while (true) {
+			Clock::time_point now = Clock::now();
+			if (options_.openLoop)
+				schedule(now);
+			if (now >= end_ && busy_ == 0)
+				break;
+			// Waiting past the end for responses still in flight, for at most a second
+			if (now >= end_ + std::chrono::seconds(1))
+				break;
+
+			if (options_.openLoop && now < end_)
+				armTimer(nextDue());
+			int count = epoll_wait(epollFd_, events.data(), static_cast<int>(events.size()), 100);
+			if (count < 0 && errno != EINTR)
+				return false;
+			for (int e = 0; e < count; ++e) {
+				if (events[e].data.u64 == kTimerEvent) {
+					uint64_t expirations = 0;
+					ou::bench::doNotOptimize(read(timerFd_, &expirations, sizeof(expirations)));
+				} else {
+					onEvent(static_cast<size_t>(events[e].data.u64), events[e].events);
+				}
+			}
+		}
+		finished_ = Clock::now();
+		for (auto &connection : connections_)
+			close(connection.fd);
+		close(timerFd_);
+		close(epollFd_);
+		return true;
+	}
+
+	void report(std::string_view name) const {
+		double seconds = std::chrono::duration<double>(std::min(finished_, end_) - measureFrom_).count();
+		ou::bench::report(std::string(name) + "/throughput", static_cast<double>(latencies_.count) / seconds, "requests/s");
+		for (auto [label, q] : { std::pair{ "p50", 0.5 }, std::pair{ "p99", 0.99 }, std::pair{ "p99.9", 0.999 } }) {
+			auto latency = std::chrono::duration<double, std::micro>(latencies_.quantile(q)).count();
+			ou::bench::report(std::string(name) + "/" + label, latency, "us");
+		}
+		if (errors_ > 0 || failedStatuses_ > 0)
+			std::printf("  %llu connection errors, %llu responses with status >= 400\n", static_cast<unsigned long long>(errors_),
+									static_cast<unsigned long long>(failedStatuses_));
+		if (options_.openLoop && backlog_.size() + busy_ > 0)
+			std::printf("  %zu requests still queued or in flight at the end: the server did not keep up\n", backlog_.size() + busy_);
+	}
+
+private:
+	struct Connection {
+		int fd = -1;
+		bool busy = false;
+		size_t sent = 0;
+		Clock::time_point due; // When the request in flight was due, which latency counts from
+		std::string input;
+	};
+
+	bool reconnect(size_t index) {
+		Connection &connection = connections_[index];
+		if (connection.fd >= 0)
+			close(connection.fd);
+		connection = Connection{};
+		connection.fd = sConnect(options_.port);
+		if (connection.fd < 0) {
+			std::fprintf(stderr, "Failed to connect to port %u: %s\n", options_.port, std::strerror(errno));
+			return false;
+		}
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.u64 = index;
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, connection.fd, &event);
+		// A closed loop sends on every connection all the time, so only an open loop keeps track of idle ones
+		if (options_.openLoop)
+			idle_.push_back(index);
+		return true;
+	}
+
+	void armTimer(Clock::time_point when) const {
+		auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+		itimerspec spec{};
+		spec.it_value.tv_sec = static_cast<time_t>(sinceEpoch / 1000000000);
+		spec.it_value.tv_nsec = static_cast<long>(sinceEpoch % 1000000000);
+		timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+	}
+
+	Clock::time_point nextDue() const {
+		auto interval = std::chrono::duration<double>(1.0 / options_.rate);
+		return start_ + std::chrono::duration_cast<Clock::duration>(interval * static_cast<double>(scheduled_));
+	}
+
+	// Queues every request due by now and hands the queue to idle connections
+	void schedule(Clock::time_point now) {
+		for (Clock::time_point due = nextDue(); due <= now && due < end_; due = nextDue()) {
+			backlog_.push_back(due);
+			++scheduled_;
+		}
+		while (!backlog_.empty() && !idle_.empty()) {
+			size_t index = idle_.front();
+			idle_.pop_front();
+			send(index, backlog_.front());
+			backlog_.pop_front();
+		}
+	}
+
+	void send(size_t index, Clock::time_point due) {
+		Connection &connection = connections_[index];
+		connection.busy = true;
+		connection.due = due;
+		connection.sent = 0;
+		++busy_;
+		flush(index);
+	}
+
+	void flush(size_t index) {
+		Connection &connection = connections_[index];
+		while (connection.sent < request_.size()) {
+			ssize_t n = ::send(connection.fd, request_.data() + connection.sent, request_.size() - connection.sent, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EAGAIN) {
+					epoll_event event{};
+					event.events = EPOLLIN | EPOLLOUT;
+					event.data.u64 = index;
+					epoll_ctl(epollFd_, EPOLL_CTL_MOD, connection.fd, &event);
+					return;
+				}
+				fail(index);
+				return;
+			}
+			connection.sent += static_cast<size_t>(n);
+		}
+	}
+
+	void onEvent(size_t index, uint32_t events) {
+		Connection &connection = connections_[index];
+		if ((events & EPOLLOUT) != 0) {
+			epoll_event event{};
+			event.events = EPOLLIN;
+			event.data.u64 = index;
+			epoll_ctl(epollFd_, EPOLL_CTL_MOD, connection.fd, &event);
+			flush(index);
+		}
+		if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0)
+			return;
+
+		char buffer[65536];
+		ssize_t n = recv(connection.fd, buffer, sizeof(buffer), 0);
+		if (n < 0 && errno == EAGAIN)
+			return;
+		if (n <= 0) {
+			// The server may close a keep-alive connection between requests
+			if (connection.busy)
+				fail(index);
+			else
+				replace(index);
+			return;
+		}
+		connection.input.append(buffer, static_cast<size_t>(n));
+
+		int statusCode = 0;
+		size_t length = sResponseLength(connection.input, statusCode);
+		if (length == 0 || !connection.busy)
+			return;
+		connection.input.erase(0, length);
+		connection.busy = false;
+		--busy_;
+		Clock::time_point now = Clock::now();
+		// An open loop counts the requests that were due in time, however late they finish; a closed loop counts what
+		// finished in time
+		if (connection.due >= measureFrom_ && (options_.openLoop || now <= end_)) {
+			auto nanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - connection.due).count());
+			++latencies_.count;
+			++latencies_.buckets[LatencyBuckets::index(nanoseconds)];
+			if (statusCode >= 400)
+				++failedStatuses_;
+		}
+
+		if (options_.openLoop)
+			idle_.push_back(index);
+		else if (now < end_)
+			send(index, now);
+	}
+
+	void fail(size_t index) {
+		++errors_;
+		if (connections_[index].busy)
+			--busy_;
+		replace(index);
+	}
+
+	void replace(size_t index) {
+		std::erase(idle_, index);
+		if (!reconnect(index))
+			return;
+		if (!options_.openLoop && Clock::now() < end_)
+			send(index, Clock::now());
+	}
+
+	const Options &options_;
+	const std::string request_;
+	int epollFd_ = -1;
+	int timerFd_ = -1; // Fires when the next open-loop request is due; steady_clock is CLOCK_MONOTONIC
+	std::vector<Connection> connections_;
+	std::deque<size_t> idle_;
+	std::deque<Clock::time_point> backlog_; // Open loop: requests due that no connection was free to send
+	size_t busy_ = 0;
+	uint64_t scheduled_ = 0;
+
+	Clock::time_point start_;
+	Clock::time_point measureFrom_;
+	Clock::time_point end_;
+	Clock::time_point finished_;
+
+	Metrics::RequestStats latencies_;
+	uint64_t errors_ = 0;
+	uint64_t failedStatuses_ = 0;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	std::optional<Options> options = sParseOptions(argc, argv);
+	if (!options) {
+		sUsage();
+		return 2;
+	}
+
+	std::unique_ptr<Server> server;
+	std::shared_ptr<KVStore> kvStore;
+	if (options->port == 0) {
+		options->port = kDefaultPort;
+		Server::Config config;
+		config.port = kDefaultPort;
+		config.threadCount = options->serverThreads;
+		config.servingDirectory = options->serve.empty() ? std::filesystem::path(".") : std::filesystem::path(options->serve);
+		config.maxRequestsPerConnection = std::numeric_limits<size_t>::max();
+		server = std::make_unique<Server>(config);
+		server->registerPathHandler(Method::GET, "/hello",
+																[](const Request &) { return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "Hello, world!\n" }; });
+		kvStore = std::make_shared<KVStore>();
+		for (int i = 0; i < 1000; ++i)
+			kvStore->set(std::format("k{}", i), std::string(100, 'v'));
+		server->registerPathHandler(Method::GET, "/kv", kvStore);
+		server->registerPathHandler(Method::GET, "/wait-blocking", [](const Request &request) {
+			std::this_thread::sleep_for(sWaitTime(request));
+			return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "waited\n" };
+		});
+		server->registerPathHandler(Method::GET, "/wait-async", [](const Request &request) -> Task<Response> {
+			co_await sleepFor(sWaitTime(request));
+			co_return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "waited\n" };
+		});
+		if (!server->init()) {
+			std::fprintf(stderr, "Failed to start server on port %u\n", kDefaultPort);
+			return 1;
+		}
+		server->start();
+	}
+
+	LoadGenerator generator(*options);
+	bool completed = generator.run();
+	if (server)
+		server->stop();
+	if (!completed)
+		return 1;
+
+	// e.g. closed/16-conn/hello or open/10000-rps/16-conn/hello
+	std::string name = options->openLoop ? std::format("open/{:.0f}-rps", options->rate) : std::string("closed");
+	name += std::format("/{}-conn{}", options->connections, options->path.substr(0, options->path.find('?')));
+	generator.report(name);
+	return 0;
+}
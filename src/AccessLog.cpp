@@ -0,0 +1,145 @@
+#include "AccessLog.h"
+#include "Logging.h"
+
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ou::http {
+
+namespace {
+	// Formatting the calendar time is comparatively expensive, so each thread does it once per second
+	std::string_view sTimestamp() {
+		thread_local time_t cachedSecond = -1;
+		thread_local std::array<char, 32> cached{};
+		thread_local size_t length = 0;
+
+		time_t now = std::time(nullptr);
+		if (now != cachedSecond) {
+			std::tm tmStruct{};
+			localtime_r(&now, &tmStruct);
+			length = std::strftime(cached.data(), cached.size(), "%Y-%m-%d %H:%M:%S", &tmStruct);
+			cachedSecond = now;
+		}
+		return { cached.data(), length };
+	}
+
+	void sAppendNumber(std::string &out, uint64_t value) {
+		std::array<char, 24> digits{};
+		auto [end, ec] = std::to_chars(digits.data(), digits.data() + digits.size(), value);
+		out.append(digits.data(), end);
+	}
+} // namespace
+
+AccessLog::AccessLog(Config config) : config_(std::move(config)) {
+	openFile();
+	writer_ = std::make_unique<AsyncWriter>(AsyncWriter::Config{ config_.threadBufferBytes, config_.flushInterval },
+																					[this](std::vector<iovec> &iovecs, size_t bytes) { return writeBatch(iovecs, bytes); });
+}
+
+AccessLog::~AccessLog() {
+	// Joins the writer thread, which drains the rings one last time, before the file is closed
+	writer_.reset();
+	if (fd_ >= 0)
+		close(fd_);
+}
+
+void AccessLog::log(const Request &request, const Response &response, const sockaddr_in &clientAddr) {
+	thread_local std::string line;
+	line.clear();
+
+	std::array<char, INET_ADDRSTRLEN> address{};
+	inet_ntop(AF_INET, &clientAddr.sin_addr, address.data(), address.size());
+
+	line += '[';
+	line += sTimestamp();
+	line += "] ";
+	line += address.data();
+	line += " - \"";
+	line += methodToString(request.method);
+	line += ' ';
+	line += request.path;
+	if (!request.query.empty()) {
+		line += '?';
+		line += request.query;
+	}
+	line += "\" ";
+	sAppendNumber(line, static_cast<uint64_t>(response.statusCode));
+	line += ' ';
+	sAppendNumber(line, response.contentLength());
+	line += '\n';
+
+	writer_->append(line);
+}
+
+bool AccessLog::process(Request &, Response &) { return false; }
+
+void AccessLog::onResponse(const Request &request, const Response &response) {
+	if (request.clientAddr.has_value())
+		log(request, response, request.clientAddr.value());
+}
+
+void AccessLog::flush() { writer_->flush(); }
+
+AccessLog::Stats AccessLog::stats() const {
+	AsyncWriter::Stats writerStats = writer_->stats();
+	Stats stats;
+	stats.logged = writerStats.records;
+	stats.dropped = writerStats.dropped;
+	stats.bytesWritten = writerStats.bytesWritten;
+	stats.rotations = rotations_.load(std::memory_order_relaxed);
+	return stats;
+}
+
+size_t AccessLog::writeBatch(std::vector<iovec> &iovecs, size_t bytes) {
+	bool expired = config_.rotateInterval.count() > 0 && std::chrono::steady_clock::now() - openedAt_ >= config_.rotateInterval;
+	bool full = config_.maxSizeBytes > 0 && fileSize_ + bytes > config_.maxSizeBytes;
+	if (fileSize_ > 0 && (expired || full))
+		rotate();
+	if (fd_ < 0)
+		return 0;
+
+	size_t written = AsyncWriter::writeAll(fd_, iovecs);
+	if (written < bytes)
+		LOG_WARN("Failed to write access log {}: {}", config_.path.string(), std::strerror(errno));
+	fileSize_ += written;
+	return written;
+}
+
+void AccessLog::openFile() {
+	fd_ = open(config_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd_ < 0) {
+		LOG_WARN("Failed to open access log {}: {}", config_.path.string(), std::strerror(errno));
+		return;
+	}
+	struct stat fileStat {};
+	fileSize_ = fstat(fd_, &fileStat) == 0 ? static_cast<size_t>(fileStat.st_size) : 0;
+	openedAt_ = std::chrono::steady_clock::now();
+}
+
+void AccessLog::rotate() {
+	if (fd_ >= 0)
+		close(fd_);
+
+	// path.N-1 -> path.N, ..., path -> path.1; renames never copy the log contents
+	std::string base = config_.path.string();
+	if (config_.maxFiles == 0) {
+		unlink(base.c_str());
+	} else {
+		for (size_t i = config_.maxFiles - 1; i > 0; --i)
+			std::rename((base + "." + std::to_string(i)).c_str(), (base + "." + std::to_string(i + 1)).c_str());
+		std::rename(base.c_str(), (base + ".1").c_str());
+	}
+	rotations_.fetch_add(1, std::memory_order_relaxed);
+	openFile();
+}
+
+} // namespace ou::http
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "AsyncWriter.h"
+#include "Server.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace ou::http {
+
+// Access log written off the request path. Workers format entries into per-thread rings of an AsyncWriter, whose
+// background thread appends them with writev() and rotates the file by renaming it. A full ring drops entries (they
+// are counted) rather than blocking the worker.
+class AccessLog : public Middleware {
+public:
+	struct Config {
+		std::filesystem::path path;
+		size_t maxSizeBytes;														// Rotate when a batch would take the file past this; 0 disables
+		std::chrono::seconds rotateInterval{ 0 };				// Also rotate once the file is this old; 0 disables
+		size_t maxFiles = 5;														// Rotated files are kept as path.1 (newest) to path.N
+		size_t threadBufferBytes = 256 * 1024;					// Ring size per logging thread
+		std::chrono::milliseconds flushInterval{ 100 }; // How often the writer drains the rings
+	};
+
+	struct Stats {
+		uint64_t logged = 0;	// Entries accepted into a ring
+		uint64_t dropped = 0; // Entries discarded because their thread's ring was full
+		uint64_t bytesWritten = 0;
+		uint64_t rotations = 0;
+	};
+
+	explicit AccessLog(Config config);
+	~AccessLog() override;
+
+	AccessLog(const AccessLog &) = delete;
+	AccessLog &operator=(const AccessLog &) = delete;
+
+	void log(const Request &request, const Response &response, const sockaddr_in &clientAddr);
+
+	bool process(Request &request, Response &response) override;
+	void onResponse(const Request &request, const Response &response) override;
+
+	// Writes everything logged so far before returning
+	void flush();
+
+	Stats stats() const;
+
+private:
+	size_t writeBatch(std::vector<iovec> &iovecs, size_t bytes);
+	void openFile();
+	void rotate();
+
+	Config config_;
+
+	// File state, only touched by the writer's batch callback
+	int fd_ = -1;
+	size_t fileSize_ = 0;
+	std::chrono::steady_clock::time_point openedAt_;
+	std::atomic<uint64_t> rotations_{ 0 };
+
+	std::unique_ptr<AsyncWriter> writer_;
+};
+
+} // namespace ou::http
@@ -0,0 +1,61 @@
+#include "AsyncFile.h"
+#include "FileHandle.h"
+
+#include <cerrno>
+#include <sys/stat.h>
+
+namespace ou::http {
+
+namespace {
+
+	std::optional<std::string> sReadWholeFile(const std::filesystem::path &path) {
+		auto file = FileHandle::open(path);
+		struct stat fileStat {};
+		if (!file || fstat(file->fd(), &fileStat) < 0)
+			return std::nullopt;
+		std::string contents;
+		contents.resize(static_cast<size_t>(fileStat.st_size));
+		size_t size = 0;
+		while (true) {
+			if (size == contents.size())
+				contents.resize(size + 4096);
+			ssize_t bytesRead = ::read(file->fd(), contents.data() + size, contents.size() - size);
+			if (bytesRead < 0 && errno == EINTR)
+				continue;
+			if (bytesRead < 0)
+				return std::nullopt;
+			if (bytesRead == 0)
+				break;
+			size += static_cast<size_t>(bytesRead);
+		}
+		contents.resize(size);
+		return contents;
+	}
+
+	bool sWriteWholeFile(const std::filesystem::path &path, std::string_view data) {
+		int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return false;
+		FileHandle file(fd);
+		while (!data.empty()) {
+			ssize_t bytesWritten = ::write(fd, data.data(), data.size());
+			if (bytesWritten < 0 && errno == EINTR)
+				continue;
+			if (bytesWritten < 0)
+				return false;
+			data.remove_prefix(static_cast<size_t>(bytesWritten));
+		}
+		return true;
+	}
+
+} // namespace
+
+BlockingCall<std::optional<std::string>> readFile(std::filesystem::path path) {
+	return BlockingCall<std::optional<std::string>>([path = std::move(path)] { return sReadWholeFile(path); });
+}
+
+BlockingCall<bool> writeFile(std::filesystem::path path, std::string data) {
+	return BlockingCall<bool>([path = std::move(path), data = std::move(data)] { return sWriteWholeFile(path, data); });
+}
+
+} // namespace ou::http
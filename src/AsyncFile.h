@@ -0,0 +1,20 @@
+#pragma once
+
+#include "EventLoop.h"
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace ou::http {
+
+// File I/O for asynchronous handlers. epoll cannot wait on regular files, so the calls run on the blocking pool and
+// the handler is resumed when they return.
+
+// The whole file; nullopt with errno set if it cannot be read
+BlockingCall<std::optional<std::string>> readFile(std::filesystem::path path);
+// Replaces the file's contents; false with errno set if it cannot be written
+BlockingCall<bool> writeFile(std::filesystem::path path, std::string data);
+
+} // namespace ou::http
@@ -0,0 +1,66 @@
+#include "AsyncSocket.h"
+#include "EventLoop.h"
+
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ou::http {
+
+AsyncSocket::~AsyncSocket() {
+	// A failed operation may be dropping the socket; its errno is the one that matters
+	int error = errno;
+	if (EventLoop *loop = EventLoop::current())
+		loop->forget(fd_);
+	::close(fd_);
+	errno = error;
+}
+
+Task<std::unique_ptr<AsyncSocket>> AsyncSocket::connect(sockaddr_in address) {
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		co_return nullptr;
+	auto socket = std::make_unique<AsyncSocket>(fd);
+
+	if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0) {
+		if (errno != EINPROGRESS)
+			co_return nullptr;
+		co_await waitWritable(fd);
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+			if (error != 0)
+				errno = error;
+			co_return nullptr;
+		}
+	}
+	co_return socket;
+}
+
+Task<ssize_t> AsyncSocket::read(char *buffer, size_t size) {
+	while (true) {
+		ssize_t bytesRead = ::recv(fd_, buffer, size, 0);
+		if (bytesRead >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			co_return bytesRead;
+		if (errno != EINTR)
+			co_await waitReadable(fd_);
+	}
+}
+
+Task<ssize_t> AsyncSocket::write(std::string_view data) {
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t bytesWritten = ::send(fd_, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+		if (bytesWritten >= 0) {
+			written += static_cast<size_t>(bytesWritten);
+			continue;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			co_await waitWritable(fd_);
+		else if (errno != EINTR)
+			co_return -1;
+	}
+	co_return static_cast<ssize_t>(written);
+}
+
+} // namespace ou::http
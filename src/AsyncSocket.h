@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Task.h"
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <sys/types.h>
+
+#include <netinet/in.h>
+
+namespace ou::http {
+
+// Client socket for asynchronous handlers, e.g. to call another service. Its operations suspend the handler until the
+// socket is ready instead of blocking the worker. Failures are reported like the system calls they wrap: -1 (or
+// nullptr) with errno set.
+class AsyncSocket {
+public:
+	// Takes ownership of a non-blocking socket
+	explicit AsyncSocket(int fd) : fd_(fd) {}
+	~AsyncSocket();
+	AsyncSocket(const AsyncSocket &) = delete;
+	AsyncSocket &operator=(const AsyncSocket &) = delete;
+
+	static Task<std::unique_ptr<AsyncSocket>> connect(sockaddr_in address);
+
+	int fd() const { return fd_; }
+
+	// Reads what has arrived, waiting until something has; 0 at the end of the stream
+	Task<ssize_t> read(char *buffer, size_t size);
+	// Writes all of data, waiting for room in the socket buffer as often as needed
+	Task<ssize_t> write(std::string_view data);
+
+private:
+	const int fd_;
+};
+
+} // namespace ou::http
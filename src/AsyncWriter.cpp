@@ -0,0 +1,140 @@
+#include "AsyncWriter.h"
+
+#include <algorithm>
+#include <cerrno>
+
+namespace ou::http {
+
+namespace {
+	std::atomic<uint64_t> sNextId{ 1 };
+
+	// Rings are gathered in groups so that a batch never exceeds IOV_MAX (at least 1024 on Linux)
+	constexpr size_t kBuffersPerBatch = 256;
+} // namespace
+
+AsyncWriter::AsyncWriter(Config config, BatchWriter writeBatch) : config_(config), writeBatch_(std::move(writeBatch)), id_(sNextId++) {
+	writer_ = std::thread([this]() { writerThread(); });
+}
+
+AsyncWriter::~AsyncWriter() {
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex_);
+		stopping_ = true;
+	}
+	wake_.notify_one();
+	writer_.join();
+}
+
+bool AsyncWriter::append(std::string_view record) {
+	ThreadBuffer &buffer = threadBuffer();
+	bool pushed = buffer.ring.tryPush(record);
+	auto &counter = pushed ? buffer.records : buffer.dropped;
+	counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	size_t threshold = buffer.ring.capacity() / 2;
+	if (buffer.ring.sizeUpperBound() > threshold && buffer.ring.size() > threshold && !wakePending_.exchange(true, std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(wakeMutex_);
+		wake_.notify_one();
+	}
+	return pushed;
+}
+
+void AsyncWriter::flush() {
+	std::lock_guard<std::mutex> drainLock(drainMutex_);
+
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex_);
+		buffers = buffers_;
+	}
+
+	for (size_t group = 0; group < buffers.size(); group += kBuffersPerBatch) {
+		size_t groupEnd = std::min(group + kBuffersPerBatch, buffers.size());
+		std::vector<iovec> iovecs;
+		std::vector<size_t> pending(groupEnd - group, 0);
+		size_t total = 0;
+		for (size_t i = group; i < groupEnd; ++i) {
+			for (std::string_view region : buffers[i]->ring.readable()) {
+				if (region.empty())
+					continue;
+				iovecs.push_back({ const_cast<char *>(region.data()), region.size() });
+				pending[i - group] += region.size();
+				total += region.size();
+			}
+		}
+		if (total == 0)
+			continue;
+
+		// Whatever could not be written is discarded rather than retried forever; the next batch may succeed
+		bytesWritten_.fetch_add(writeBatch_(iovecs, total), std::memory_order_relaxed);
+		for (size_t i = group; i < groupEnd; ++i)
+			buffers[i]->ring.consume(pending[i - group]);
+	}
+}
+
+AsyncWriter::Stats AsyncWriter::stats() const {
+	Stats stats;
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex_);
+		for (const auto &buffer : buffers_) {
+			stats.records += buffer->records.load(std::memory_order_relaxed);
+			stats.dropped += buffer->dropped.load(std::memory_order_relaxed);
+		}
+	}
+	stats.bytesWritten = bytesWritten_.load(std::memory_order_relaxed);
+	return stats;
+}
+
+size_t AsyncWriter::writeAll(int fd, std::vector<iovec> &iovecs) {
+	size_t total = 0;
+	size_t index = 0;
+	while (index < iovecs.size()) {
+		ssize_t written = writev(fd, iovecs.data() + index, static_cast<int>(iovecs.size() - index));
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		total += static_cast<size_t>(written);
+		for (auto remaining = static_cast<size_t>(written); remaining > 0 && index < iovecs.size();) {
+			size_t step = std::min(remaining, iovecs[index].iov_len);
+			iovecs[index].iov_base = static_cast<char *>(iovecs[index].iov_base) + step;
+			iovecs[index].iov_len -= step;
+			remaining -= step;
+			if (iovecs[index].iov_len == 0)
+				++index;
+		}
+	}
+	return total;
+}
+
+AsyncWriter::ThreadBuffer &AsyncWriter::threadBuffer() {
+	// A thread rarely writes to more than a couple of writers, so a short list beats a map. The list keeps its buffers
+	// alive, so instance ids (never reused) rather than addresses identify the owner.
+	thread_local std::vector<std::pair<uint64_t, std::shared_ptr<ThreadBuffer>>> threadBuffers;
+	for (const auto &[id, buffer] : threadBuffers) {
+		if (id == id_)
+			return *buffer;
+	}
+
+	auto buffer = std::make_shared<ThreadBuffer>(config_.threadBufferBytes);
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex_);
+		buffers_.push_back(buffer);
+	}
+	threadBuffers.emplace_back(id_, buffer);
+	return *buffer;
+}
+
+void AsyncWriter::writerThread() {
+	std::unique_lock<std::mutex> lock(wakeMutex_);
+	while (!stopping_) {
+		wake_.wait_for(lock, config_.flushInterval, [this]() { return stopping_ || wakePending_.load(std::memory_order_relaxed); });
+		wakePending_.store(false, std::memory_order_relaxed);
+		lock.unlock();
+		flush();
+		lock.lock();
+	}
+}
+
+} // namespace ou::http
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace ou::http {
+
+// Moves formatted records off the calling threads. Each thread appends to its own lock-free ring; one background
+// thread periodically gathers everything buffered and hands it to the batch writer as iovecs pointing into the rings.
+// A ring filling up wakes the writer early; a full ring drops the record (it is counted) rather than blocking the caller.
+class AsyncWriter {
+public:
+	struct Config {
+		size_t threadBufferBytes = 256 * 1024;
+		std::chrono::milliseconds flushInterval{ 100 };
+	};
+
+	struct Stats {
+		uint64_t records = 0; // Accepted into a ring
+		uint64_t dropped = 0; // Discarded because the ring was full
+		uint64_t bytesWritten = 0;
+	};
+
+	// Writes as much of the batch as it can and returns the number of bytes written. Called by one thread at a time.
+	using BatchWriter = std::function<size_t(std::vector<iovec> &iovecs, size_t bytes)>;
+
+	AsyncWriter(Config config, BatchWriter writeBatch);
+	~AsyncWriter();
+
+	AsyncWriter(const AsyncWriter &) = delete;
+	AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+	// Safe to call from any thread
+	bool append(std::string_view record);
+
+	// Writes everything appended so far before returning
+	void flush();
+
+	Stats stats() const;
+
+	// writev() until everything is written or an error occurs; advances the iovecs past what was written
+	static size_t writeAll(int fd, std::vector<iovec> &iovecs);
+
+private:
+	struct ThreadBuffer {
+		explicit ThreadBuffer(size_t capacity) : ring(capacity) {}
+
+		ByteRingBuffer ring;
+		// Written only by the owning thread
+		std::atomic<uint64_t> records{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };
+	};
+
+	ThreadBuffer &threadBuffer();
+	void writerThread();
+
+	Config config_;
+	BatchWriter writeBatch_;
+	const uint64_t id_; // Distinguishes instances in the per-thread buffer lookup
+
+	mutable std::mutex buffersMutex_;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+
+	std::mutex drainMutex_; // Makes the writer thread and flush() take turns as the rings' single consumer
+	std::atomic<uint64_t> bytesWritten_{ 0 };
+
+	std::mutex wakeMutex_;
+	std::condition_variable wake_;
+	bool stopping_ = false;
+	std::atomic<bool> wakePending_{ false }; // Set when a ring is half full, so only the first producer notifies
+	std::thread writer_;
+};
+
+} // namespace ou::http
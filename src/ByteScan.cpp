@@ -0,0 +1,284 @@
+#include "ByteScan.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace ou::http {
+
+namespace {
+
+	// RFC 9110 tchar: characters allowed in methods and field names
+	constexpr std::array<bool, 256> kTokenChars = [] {
+		std::array<bool, 256> table{};
+		for (unsigned char c = '0'; c <= '9'; ++c)
+			table[c] = true;
+		for (unsigned char c = 'a'; c <= 'z'; ++c)
+			table[c] = true;
+		for (unsigned char c = 'A'; c <= 'Z'; ++c)
+			table[c] = true;
+		for (unsigned char c : std::string_view("!#$%&'*+-.^_`|~"))
+			table[c] = true;
+		return table;
+	}();
+
+	constexpr bool sIsTargetChar(unsigned char c) { return c > 0x20 && c != 0x7f; }
+	constexpr bool sIsFieldValueChar(unsigned char c) { return (c >= 0x20 || c == '\t') && c != 0x7f; }
+
+	size_t sScalarHeaderEnd(std::string_view data, size_t from) { return data.find("\r\n\r\n", from); }
+
+	template <typename Accept> size_t sScalarLength(std::string_view data, size_t from, Accept accept) {
+		for (size_t i = from; i < data.size(); ++i) {
+			if (!accept(static_cast<unsigned char>(data[i])))
+				return i;
+		}
+		return data.size();
+	}
+
+	size_t sScalarTokenLength(std::string_view data, size_t from) {
+		return sScalarLength(data, from, [](unsigned char c) { return kTokenChars[c]; });
+	}
+	size_t sScalarTargetLength(std::string_view data, size_t from) { return sScalarLength(data, from, sIsTargetChar); }
+	size_t sScalarFieldValueLength(std::string_view data, size_t from) { return sScalarLength(data, from, sIsFieldValueChar); }
+
+	struct Scanner {
+		size_t (*headerEnd)(std::string_view data, size_t from);
+		size_t (*tokenLength)(std::string_view data, size_t from);
+		size_t (*targetLength)(std::string_view data, size_t from);
+		size_t (*fieldValueLength)(std::string_view data, size_t from);
+	};
+
+	constexpr Scanner kScalarScanner{ sScalarHeaderEnd, sScalarTokenLength, sScalarTargetLength, sScalarFieldValueLength };
+
+#ifdef __x86_64__
+	// tchar membership by nibble lookup: a byte is a tchar when the bits its low nibble selects and the bit its high
+	// nibble selects meet. Each high nibble holding tchars (2 to 7) gets its own bit; the others select nothing.
+	struct NibbleTables {
+		std::array<uint8_t, 16> low{};
+		std::array<uint8_t, 16> high{};
+	};
+
+	constexpr NibbleTables kTokenNibbles = [] {
+		NibbleTables tables;
+		for (size_t c = 0; c < 128; ++c) {
+			if (!kTokenChars[c])
+				continue;
+			auto bit = static_cast<uint8_t>(1U << ((c >> 4) - 2));
+			tables.low[c & 0x0f] |= bit;
+			tables.high[c >> 4] = bit;
+		}
+		return tables;
+	}();
+
+	// Masks of the bytes in the vector at p that a scan stops at, one bit per byte. Each is compiled for its own
+	// instruction set, so no vector crosses a function boundary outside code built for it.
+	[[gnu::target("sse4.2")]] inline __m128i sSse42Table(const std::array<uint8_t, 16> &table) {
+		return _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.data()));
+	}
+
+	[[gnu::target("sse4.2")]] inline __m128i sSse42Equals(const char *p, char c) {
+		return _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), _mm_set1_epi8(c));
+	}
+
+	// Candidates for "\r\n\r\n" have CR and LF three bytes apart, which in a header section is almost only its end; the
+	// caller confirms them
+	[[gnu::target("sse4.2")]] inline __m128i sSse42Candidates(const char *p) { return _mm_and_si128(sSse42Equals(p, '\r'), sSse42Equals(p + 3, '\n')); }
+	[[gnu::target("sse4.2")]] inline uint32_t sSse42Terminators(const char *p) { return static_cast<uint32_t>(_mm_movemask_epi8(sSse42Candidates(p))); }
+
+	// Whether the four vectors from p hold any candidate
+	[[gnu::target("sse4.2")]] inline bool sSse42AnyTerminator(const char *p) {
+		__m128i any = _mm_or_si128(_mm_or_si128(sSse42Candidates(p), sSse42Candidates(p + 16)), _mm_or_si128(sSse42Candidates(p + 32), sSse42Candidates(p + 48)));
+		return _mm_movemask_epi8(any) != 0;
+	}
+
+	[[gnu::target("sse4.2")]] inline uint32_t sSse42TokenRejects(const char *p) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i nibble = _mm_set1_epi8(0x0f);
+		__m128i low = _mm_shuffle_epi8(sSse42Table(kTokenNibbles.low), _mm_and_si128(v, nibble));
+		__m128i high = _mm_shuffle_epi8(sSse42Table(kTokenNibbles.high), _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128())));
+	}
+
+	[[gnu::target("sse4.2")]] inline uint32_t sSse42TargetRejects(const char *p) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		// min(v, 0x20) == v exactly when v <= 0x20, unsigned
+		__m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x20)), v);
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(low, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)))));
+	}
+
+	[[gnu::target("sse4.2")]] inline uint32_t sSse42FieldValueRejects(const char *p) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i control = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v));
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(control, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)))));
+	}
+
+	[[gnu::target("avx2")]] inline __m256i sAvx2Table(const std::array<uint8_t, 16> &table) {
+		return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(table.data())));
+	}
+
+	[[gnu::target("avx2")]] inline __m256i sAvx2Equals(const char *p, char c) {
+		return _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), _mm256_set1_epi8(c));
+	}
+
+	[[gnu::target("avx2")]] inline __m256i sAvx2Candidates(const char *p) { return _mm256_and_si256(sAvx2Equals(p, '\r'), sAvx2Equals(p + 3, '\n')); }
+	[[gnu::target("avx2")]] inline uint32_t sAvx2Terminators(const char *p) { return static_cast<uint32_t>(_mm256_movemask_epi8(sAvx2Candidates(p))); }
+
+	[[gnu::target("avx2")]] inline bool sAvx2AnyTerminator(const char *p) {
+		__m256i any = _mm256_or_si256(_mm256_or_si256(sAvx2Candidates(p), sAvx2Candidates(p + 32)), _mm256_or_si256(sAvx2Candidates(p + 64), sAvx2Candidates(p + 96)));
+		return !_mm256_testz_si256(any, any);
+	}
+
+	[[gnu::target("avx2")]] inline uint32_t sAvx2TokenRejects(const char *p) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+		__m256i nibble = _mm256_set1_epi8(0x0f);
+		__m256i low = _mm256_shuffle_epi8(sAvx2Table(kTokenNibbles.low), _mm256_and_si256(v, nibble));
+		__m256i high = _mm256_shuffle_epi8(sAvx2Table(kTokenNibbles.high), _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+		return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256())));
+	}
+
+	[[gnu::target("avx2")]] inline uint32_t sAvx2TargetRejects(const char *p) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+		__m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x20)), v);
+		return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(low, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)))));
+	}
+
+	[[gnu::target("avx2")]] inline uint32_t sAvx2FieldValueRejects(const char *p) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+		__m256i control =
+				_mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v));
+		return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(control, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)))));
+	}
+
+	// Each scan tests whole vectors while they fit in data and finishes with the scalar scan. The scans run over the rest
+	// of a header section and stop within a line, so the tail is rarely reached.
+	template <size_t kWidth, uint32_t (*rejects)(const char *), size_t (*finish)(std::string_view, size_t)>
+	size_t sVectorLength(std::string_view data, size_t from) {
+		size_t i = from;
+		for (; i + kWidth <= data.size(); i += kWidth) {
+			if (uint32_t rejected = rejects(data.data() + i))
+				return i + static_cast<size_t>(std::countr_zero(rejected));
+		}
+		return finish(data, i);
+	}
+
+	template <size_t kWidth, uint32_t (*terminators)(const char *), bool (*anyTerminator)(const char *)>
+	size_t sVectorHeaderEnd(std::string_view data, size_t from) {
+		auto confirm = [data](size_t block) {
+			for (uint32_t candidates = terminators(data.data() + block); candidates != 0; candidates &= candidates - 1) {
+				size_t position = block + static_cast<size_t>(std::countr_zero(candidates));
+				if (data.substr(position, 4) == "\r\n\r\n")
+					return position;
+			}
+			return std::string_view::npos;
+		};
+
+		// Candidates are rare, so four vectors are tested per branch
+		size_t i = from;
+		for (; i + 4 * kWidth + 3 <= data.size(); i += 4 * kWidth) {
+			if (!anyTerminator(data.data() + i))
+				continue;
+			for (size_t block = i; block < i + 4 * kWidth; block += kWidth) {
+				if (size_t position = confirm(block); position != std::string_view::npos)
+					return position;
+			}
+		}
+		for (; i + kWidth + 3 <= data.size(); i += kWidth) {
+			if (size_t position = confirm(i); position != std::string_view::npos)
+				return position;
+		}
+		return sScalarHeaderEnd(data, i);
+	}
+
+	// flatten inlines the masks, which only code built for their instruction set may do
+	[[gnu::target("sse4.2"), gnu::flatten]] size_t sSse42HeaderEnd(std::string_view data, size_t from) {
+		return sVectorHeaderEnd<16, sSse42Terminators, sSse42AnyTerminator>(data, from);
+	}
+	[[gnu::target("sse4.2"), gnu::flatten]] size_t sSse42TokenLength(std::string_view data, size_t from) {
+		return sVectorLength<16, sSse42TokenRejects, sScalarTokenLength>(data, from);
+	}
+	[[gnu::target("sse4.2"), gnu::flatten]] size_t sSse42TargetLength(std::string_view data, size_t from) {
+		return sVectorLength<16, sSse42TargetRejects, sScalarTargetLength>(data, from);
+	}
+	[[gnu::target("sse4.2"), gnu::flatten]] size_t sSse42FieldValueLength(std::string_view data, size_t from) {
+		return sVectorLength<16, sSse42FieldValueRejects, sScalarFieldValueLength>(data, from);
+	}
+
+	[[gnu::target("avx2"), gnu::flatten]] size_t sAvx2HeaderEnd(std::string_view data, size_t from) {
+		return sVectorHeaderEnd<32, sAvx2Terminators, sAvx2AnyTerminator>(data, from);
+	}
+	[[gnu::target("avx2"), gnu::flatten]] size_t sAvx2TokenLength(std::string_view data, size_t from) {
+		return sVectorLength<32, sAvx2TokenRejects, sScalarTokenLength>(data, from);
+	}
+	[[gnu::target("avx2"), gnu::flatten]] size_t sAvx2TargetLength(std::string_view data, size_t from) {
+		return sVectorLength<32, sAvx2TargetRejects, sScalarTargetLength>(data, from);
+	}
+	[[gnu::target("avx2"), gnu::flatten]] size_t sAvx2FieldValueLength(std::string_view data, size_t from) {
+		return sVectorLength<32, sAvx2FieldValueRejects, sScalarFieldValueLength>(data, from);
+	}
+
+	constexpr Scanner kSse42Scanner{ sSse42HeaderEnd, sSse42TokenLength, sSse42TargetLength, sSse42FieldValueLength };
+	constexpr Scanner kAvx2Scanner{ sAvx2HeaderEnd, sAvx2TokenLength, sAvx2TargetLength, sAvx2FieldValueLength };
+#endif
+
+	const Scanner *sScannerFor(ScanLevel level) {
+#ifdef __x86_64__
+		if (level == ScanLevel::Avx2)
+			return &kAvx2Scanner;
+		if (level == ScanLevel::Sse42)
+			return &kSse42Scanner;
+#endif
+		return &kScalarScanner;
+	}
+
+	// Scalar until the CPU has been asked, in case a scan runs during static initialization
+	std::atomic<const Scanner *> sScanner{ &kScalarScanner };
+	std::atomic<ScanLevel> sLevel{ ScanLevel::Scalar };
+	[[maybe_unused]] const bool sScannerChosen = (setScanLevel(ScanLevel::Avx2), true);
+
+	const Scanner &sActive() { return *sScanner.load(std::memory_order_relaxed); }
+
+} // namespace
+
+ScanLevel supportedScanLevel() {
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return ScanLevel::Avx2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return ScanLevel::Sse42;
+#endif
+	return ScanLevel::Scalar;
+}
+
+ScanLevel scanLevel() { return sLevel.load(std::memory_order_relaxed); }
+
+std::string_view scanLevelName(ScanLevel level) {
+	switch (level) {
+	case ScanLevel::Avx2:
+		return "avx2";
+	case ScanLevel::Sse42:
+		return "sse4.2";
+	case ScanLevel::Scalar:
+		break;
+	}
+	return "scalar";
+}
+
+void setScanLevel(ScanLevel level) {
+	level = std::min(level, supportedScanLevel());
+	sLevel.store(level, std::memory_order_relaxed);
+	sScanner.store(sScannerFor(level), std::memory_order_relaxed);
+}
+
+size_t findHeaderEnd(std::string_view data, size_t from) { return from > data.size() ? std::string_view::npos : sActive().headerEnd(data, from); }
+size_t tokenLength(std::string_view data) { return sActive().tokenLength(data, 0); }
+size_t targetLength(std::string_view data) { return sActive().targetLength(data, 0); }
+size_t fieldValueLength(std::string_view data) { return sActive().fieldValueLength(data, 0); }
+
+} // namespace ou::http
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace ou::http {
+
+// Byte scans the request parser spends its time in, using the widest vector instructions the CPU has. The level is
+// chosen at startup from what the CPU reports; all levels give the same results.
+enum class ScanLevel { Scalar, Sse42, Avx2 };
+
+// The highest level this CPU supports
+ScanLevel supportedScanLevel();
+ScanLevel scanLevel();
+std::string_view scanLevelName(ScanLevel level);
+// Makes every later scan use level, or the supported level if that is lower. For tests and benchmarks; not meant to be
+// called while requests are being parsed.
+void setScanLevel(ScanLevel level);
+
+// Position of the first "\r\n\r\n" at or after from, or npos
+size_t findHeaderEnd(std::string_view data, size_t from = 0);
+
+// Length of the longest prefix of data made of the following, so a scan over the rest of a header section stops at
+// the first byte that ends or breaks the element:
+// - RFC 9110 tchar, for methods and field names
+size_t tokenLength(std::string_view data);
+// - bytes above 0x20 other than DEL, for request targets
+size_t targetLength(std::string_view data);
+// - bytes other than DEL and control characters besides HTAB, for field values
+size_t fieldValueLength(std::string_view data);
+
+} // namespace ou::http
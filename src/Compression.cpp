@@ -0,0 +1,147 @@
+#include "Compression.h"
+
+#include <algorithm>
+#include <charconv>
+
+#include <zlib.h>
+
+namespace ou::http {
+
+namespace {
+	// Rough per-entry bookkeeping overhead counted against the byte budget
+	constexpr size_t kEntryOverhead = 256;
+
+	std::string_view sTrim(std::string_view str) {
+		while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+			str.remove_prefix(1);
+		while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+			str.remove_suffix(1);
+		return str;
+	}
+
+	// Parses the weight of one Accept-Encoding element ("gzip;q=0.5"); a missing or malformed q counts as 1
+	double sQuality(std::string_view parameters) {
+		while (!parameters.empty()) {
+			size_t semicolon = parameters.find(';');
+			std::string_view parameter = sTrim(parameters.substr(0, semicolon));
+			parameters = semicolon == std::string_view::npos ? std::string_view() : parameters.substr(semicolon + 1);
+			if (parameter.size() > 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+				double quality = 1;
+				std::from_chars(parameter.data() + 2, parameter.data() + parameter.size(), quality);
+				return quality;
+			}
+		}
+		return 1;
+	}
+
+	std::string sCacheKey(const std::string &path, std::string_view encoding) {
+		std::string key(encoding);
+		key += ':';
+		key += path;
+		return key;
+	}
+} // namespace
+
+bool acceptsEncoding(const Request &request, std::string_view coding) {
+	auto acceptEncoding = request.headers.find(HeaderName::AcceptEncoding);
+	if (!acceptEncoding)
+		return false;
+
+	std::optional<double> exact;
+	std::optional<double> wildcard;
+	std::string_view list = *acceptEncoding;
+	while (!list.empty()) {
+		size_t comma = list.find(',');
+		std::string_view element = list.substr(0, comma);
+		list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+		size_t semicolon = element.find(';');
+		std::string_view name = sTrim(element.substr(0, semicolon));
+		double quality = semicolon == std::string_view::npos ? 1 : sQuality(element.substr(semicolon + 1));
+		if (equalsIgnoreCase(name, coding))
+			exact = quality;
+		else if (name == "*")
+			wildcard = quality;
+	}
+	return exact.value_or(wildcard.value_or(0)) > 0;
+}
+
+bool isCompressible(std::string_view contentType) {
+	std::string_view type = contentType.substr(0, contentType.find(';'));
+	if (type.starts_with("text/"))
+		return true;
+	return type == "application/json" || type == "application/javascript" || type == "application/xml" || type == "application/yaml"
+				 || type == "application/wasm" || type == "image/svg+xml" || type.ends_with("+json") || type.ends_with("+xml");
+}
+
+std::optional<std::string> gzipCompress(std::string_view data, int level) {
+	z_stream stream{};
+	// windowBits 15 + 16 selects the gzip wrapper instead of raw zlib
+	if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return std::nullopt;
+
+	std::string output(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+	stream.avail_in = static_cast<uInt>(data.size());
+	stream.next_out = reinterpret_cast<Bytef *>(output.data());
+	stream.avail_out = static_cast<uInt>(output.size());
+	int result = deflate(&stream, Z_FINISH);
+	output.resize(stream.total_out);
+	deflateEnd(&stream);
+
+	if (result != Z_STREAM_END)
+		return std::nullopt;
+	return output;
+}
+
+std::shared_ptr<const std::string> CompressionCache::find(const std::string &path, std::string_view version, std::string_view encoding) {
+	std::string key = sCacheKey(path, encoding);
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = entries_.find(key);
+	if (it == entries_.end() || it->second.version != version) {
+		++stats_.misses;
+		return nullptr;
+	}
+	++stats_.hits;
+	lru_.splice(lru_.begin(), lru_, it->second.lruIt);
+	return it->second.body;
+}
+
+void CompressionCache::insert(const std::string &path, std::string_view version, std::string_view encoding,
+															std::shared_ptr<const std::string> body) {
+	std::string key = sCacheKey(path, encoding);
+	size_t cost = body->size() + key.size() + version.size() + kEntryOverhead;
+	if (cost > maxBytes_)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (entries_.contains(key))
+		evictLocked(key);
+	while (bytes_ + cost > maxBytes_ && !lru_.empty()) {
+		evictLocked(lru_.back());
+		++stats_.evictions;
+	}
+
+	lru_.push_front(key);
+	entries_[key] = Slot{ std::string(version), std::move(body), lru_.begin(), cost };
+	bytes_ += cost;
+}
+
+CompressionCache::Stats CompressionCache::stats() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	Stats stats = stats_;
+	stats.entries = entries_.size();
+	stats.bytes = bytes_;
+	return stats;
+}
+
+void CompressionCache::evictLocked(const std::string &key) {
+	// key may refer into lru_, so it must stay alive until the map entry is gone
+	auto it = entries_.find(key);
+	auto lruIt = it->second.lruIt;
+	bytes_ -= it->second.cost;
+	entries_.erase(it);
+	lru_.erase(lruIt);
+}
+
+} // namespace ou::http
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "HttpTypes.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace ou::http {
+
+struct CompressionConfig {
+	bool enabled = true;
+	int gzipLevel = 6;
+	size_t minSize = 256;								// Smaller bodies gain too little to be worth the extra header
+	size_t maxSize = 8 * 1024 * 1024;		// Larger files are only sent compressed from a precompressed sibling
+	size_t cacheBytes = 32 * 1024 * 1024; // 0 disables caching of compressed bodies
+};
+
+// Whether the request's Accept-Encoding allows the given content coding (q=0 and missing entries refuse it)
+bool acceptsEncoding(const Request &request, std::string_view coding);
+
+// Text-like media types that typically shrink several times under gzip
+bool isCompressible(std::string_view contentType);
+
+std::optional<std::string> gzipCompress(std::string_view data, int level);
+
+// Byte-budgeted LRU of compressed bodies. Each path and encoding holds one version, identified by e.g. the entity tag
+// of the uncompressed content; looking up a different version misses and replaces it on the next insert.
+class CompressionCache {
+public:
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+	};
+
+	explicit CompressionCache(size_t maxBytes) : maxBytes_(maxBytes) {}
+
+	std::shared_ptr<const std::string> find(const std::string &path, std::string_view version, std::string_view encoding);
+	void insert(const std::string &path, std::string_view version, std::string_view encoding, std::shared_ptr<const std::string> body);
+
+	Stats stats() const;
+
+private:
+	struct Slot {
+		std::string version;
+		std::shared_ptr<const std::string> body;
+		std::list<std::string>::iterator lruIt;
+		size_t cost = 0;
+	};
+
+	void evictLocked(const std::string &key);
+
+	size_t maxBytes_;
+	mutable std::mutex mutex_;
+	std::unordered_map<std::string, Slot> entries_;
+	std::list<std::string> lru_; // Most recently used first
+	size_t bytes_ = 0;
+	Stats stats_;
+};
+
+} // namespace ou::http
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Http2Session.h"
+#include "RequestParser.h"
+#include "SocketHandler.h"
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <netinet/in.h>
+
+namespace ou::http {
+
+// State of a single client connection driven by a worker's event loop.
+struct Connection {
+	enum class State { Handshaking, Reading, Writing, Closing };
+
+	explicit Connection(RequestParser::Limits limits) : parser(limits) {}
+
+	int socket = -1;
+	std::unique_ptr<Socket> transport; // Plain or TLS; closes the socket when the connection is destroyed
+	sockaddr_in clientAddr{};
+	State state = State::Handshaking;
+	Socket::Readiness waitingFor = Socket::Readiness::Readable; // What the current state can only continue after
+	// What the worker's epoll registration waits for; nothing while a handler runs and no output is left to send
+	std::optional<Socket::Readiness> polledFor = Socket::Readiness::Readable;
+
+	std::string inBuffer; // Bytes received but not yet consumed by a request
+	RequestParser parser; // Progress through the request at the front of inBuffer
+	// Set while an asynchronous handler answers that request. The request's views into inBuffer must stay valid until it
+	// finishes, so nothing more is read meanwhile.
+	std::optional<PendingResponse> pendingResponse;
+
+	// Serialized responses waiting to be sent, in order. Bodies are queued as chunks of their own: moved, shared with a
+	// cache, or sent from their file with sendfile(), so none is copied into the connection.
+	using OutputChunk = BodyPart;
+	std::deque<OutputChunk> output;
+	size_t outputOffset = 0;	// Bytes of the front chunk already sent
+	size_t bufferedOutput = 0; // Bytes held in string chunks, to bound memory used by pipelined responses
+	std::string spareBuffer;	 // A sent string chunk's buffer, kept for the next response head
+
+	std::unique_ptr<Http2Session> http2; // Set once the connection has switched to HTTP/2
+
+	size_t requestCount = 0;
+	bool closeAfterWrite = false; // Set once a response has announced "Connection: close"
+	std::chrono::steady_clock::time_point lastActivity; // Or, while handshaking, when the connection was accepted
+	std::list<Connection *>::iterator activityIt;				 // Position in the worker's handshake or idle timeout list
+};
+
+} // namespace ou::http
@@ -0,0 +1,291 @@
+#include "EventLoop.h"
+#include "Logging.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace ou::http {
+
+namespace {
+
+	// Threads for blocking calls, shared by every worker. Enough for a few slow disks' worth of file I/O; calls beyond that
+	// queue up rather than adding threads.
+	constexpr size_t kBlockingThreads = 8;
+
+	thread_local EventLoop *sCurrentLoop = nullptr;
+
+	class BlockingPool {
+	public:
+		BlockingPool() {
+			for (size_t i = 0; i < kBlockingThreads; ++i)
+				threads_.emplace_back([this] { run(); });
+		}
+		~BlockingPool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+			wake_.notify_all();
+			for (auto &thread : threads_)
+				thread.join();
+		}
+		BlockingPool(const BlockingPool &) = delete;
+		BlockingPool &operator=(const BlockingPool &) = delete;
+
+		void submit(std::function<void()> job) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				jobs_.push_back(std::move(job));
+			}
+			wake_.notify_one();
+		}
+
+	private:
+		void run() {
+			while (true) {
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+					if (jobs_.empty())
+						return;
+					job = std::move(jobs_.front());
+					jobs_.pop_front();
+				}
+				job();
+			}
+		}
+
+		std::mutex mutex_;
+		std::condition_variable wake_;
+		std::deque<std::function<void()>> jobs_;
+		bool stopping_ = false;
+		std::vector<std::thread> threads_;
+	};
+
+	// Started on first use, so servers whose handlers never block pay nothing for it
+	BlockingPool &sBlockingPool() {
+		static BlockingPool pool;
+		return pool;
+	}
+
+	void sEpollControl(int epollFd, int op, int fd, uint32_t events) {
+		epoll_event event{};
+		event.events = events;
+		event.data.fd = fd;
+		if (epoll_ctl(epollFd, op, fd, &event) < 0)
+			throw std::runtime_error(std::format("Failed to watch descriptor {}: {}", fd, std::strerror(errno)));
+	}
+
+} // namespace
+
+// Functions pool threads post back to the loop, with an eventfd to wake its worker
+struct EventLoop::Inbox {
+	std::mutex mutex;
+	std::vector<std::function<void()>> posted;
+	bool closed = false;
+	int eventFd = -1;
+
+	~Inbox() {
+		if (eventFd >= 0)
+			close(eventFd);
+	}
+
+	void post(std::function<void()> fn) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (closed)
+			return;
+		posted.push_back(std::move(fn));
+		if (posted.size() == 1) {
+			uint64_t one = 1;
+			(void)::write(eventFd, &one, sizeof(one));
+		}
+	}
+};
+
+EventLoop::EventLoop(int epollFd) : epollFd_(epollFd), inbox_(std::make_shared<Inbox>()) {
+	inbox_->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (inbox_->eventFd < 0)
+		throw std::runtime_error(std::format("Failed to create eventfd: {}", std::strerror(errno)));
+	sEpollControl(epollFd_, EPOLL_CTL_ADD, inbox_->eventFd, EPOLLIN);
+	sCurrentLoop = this;
+}
+
+EventLoop::~EventLoop() {
+	if (sCurrentLoop == this)
+		sCurrentLoop = nullptr;
+	std::lock_guard<std::mutex> lock(inbox_->mutex);
+	inbox_->closed = true;
+	inbox_->posted.clear();
+}
+
+EventLoop *EventLoop::current() { return sCurrentLoop; }
+
+EventLoop &currentEventLoop() {
+	EventLoop *loop = EventLoop::current();
+	if (loop == nullptr)
+		throw std::logic_error("Only coroutines run by a server worker can wait for events");
+	return *loop;
+}
+
+bool EventLoop::dispatch(int fd, uint32_t events) {
+	if (fd == inbox_->eventFd) {
+		uint64_t count = 0;
+		(void)::read(fd, &count, sizeof(count));
+		runPosted();
+		return true;
+	}
+
+	auto it = watched_.find(fd);
+	if (it == watched_.end())
+		return false;
+	ReadinessAwaiter *awaiter = std::exchange(it->second, nullptr);
+	// A one-shot registration stays disarmed until the next wait, so a stale event finds nobody waiting
+	if (awaiter == nullptr)
+		return true;
+	if ((events & (awaiter->events_ | EPOLLERR | EPOLLHUP)) == 0)
+		LOG_DEBUG("Unexpected events {:#x} on descriptor {}", events, fd);
+	awaiter->loop_ = nullptr;
+	resume(std::exchange(awaiter->waiter_, nullptr));
+	return true;
+}
+
+std::optional<std::chrono::milliseconds> EventLoop::timeUntilNextTimer() const {
+	if (timers_.empty())
+		return std::nullopt;
+	// Rounded up, so the worker does not wake just before the timer is due and spin until it is
+	auto remaining = std::chrono::ceil<std::chrono::milliseconds>(timers_.begin()->first - Clock::now());
+	return std::max(remaining, std::chrono::milliseconds(0));
+}
+
+void EventLoop::runTimers() {
+	auto now = Clock::now();
+	while (!timers_.empty() && timers_.begin()->first <= now) {
+		SleepAwaiter *awaiter = timers_.begin()->second;
+		timers_.erase(timers_.begin());
+		awaiter->loop_ = nullptr;
+		resume(std::exchange(awaiter->waiter_, nullptr));
+	}
+}
+
+void EventLoop::defer(std::function<void()> fn) { deferred_.push_back(std::move(fn)); }
+
+void EventLoop::runBlocking(std::function<void()> work, std::function<void()> done) {
+	sBlockingPool().submit([inbox = inbox_, work = std::move(work), done = std::move(done)]() mutable {
+		work();
+		inbox->post(std::move(done));
+	});
+}
+
+void EventLoop::forget(int fd) {
+	auto it = watched_.find(fd);
+	if (it == watched_.end())
+		return;
+	if (it->second != nullptr)
+		throw std::logic_error(std::format("Descriptor {} forgotten while a coroutine waits on it", fd));
+	epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+	watched_.erase(it);
+}
+
+EventLoop::Timers::iterator EventLoop::addTimer(Clock::time_point deadline, SleepAwaiter *awaiter) {
+	return timers_.emplace(deadline, awaiter);
+}
+
+void EventLoop::watch(int fd, uint32_t events, ReadinessAwaiter *awaiter) {
+	auto [it, added] = watched_.try_emplace(fd, nullptr);
+	if (it->second != nullptr)
+		throw std::logic_error(std::format("Descriptor {} already has a coroutine waiting on it", fd));
+	try {
+		if (added) {
+			sEpollControl(epollFd_, EPOLL_CTL_ADD, fd, events | EPOLLONESHOT);
+		} else {
+			epoll_event event{};
+			event.events = events | EPOLLONESHOT;
+			event.data.fd = fd;
+			// A descriptor closed without being forgotten left epoll; a new one may have taken its number
+			if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event) < 0)
+				sEpollControl(epollFd_, EPOLL_CTL_ADD, fd, events | EPOLLONESHOT);
+		}
+	} catch (...) {
+		watched_.erase(it);
+		throw;
+	}
+	it->second = awaiter;
+}
+
+void EventLoop::unwatch(int fd) {
+	auto it = watched_.find(fd);
+	if (it == watched_.end())
+		return;
+	it->second = nullptr;
+	// Disarmed, so a later event is not taken for the next wait
+	epoll_event event{};
+	event.data.fd = fd;
+	epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event);
+}
+
+void EventLoop::resume(std::coroutine_handle<> handle) {
+	handle.resume();
+	runDeferred();
+}
+
+void EventLoop::runDeferred() {
+	while (!deferred_.empty()) {
+		std::vector<std::function<void()>> deferred;
+		deferred.swap(deferred_);
+		for (auto &fn : deferred)
+			fn();
+	}
+}
+
+void EventLoop::runPosted() {
+	std::vector<std::function<void()>> posted;
+	{
+		std::lock_guard<std::mutex> lock(inbox_->mutex);
+		posted.swap(inbox_->posted);
+	}
+	for (auto &fn : posted) {
+		fn();
+		runDeferred();
+	}
+}
+
+SleepAwaiter::~SleepAwaiter() {
+	if (loop_ != nullptr)
+		loop_->removeTimer(timer_);
+}
+
+void SleepAwaiter::await_suspend(std::coroutine_handle<> waiter) {
+	EventLoop &loop = currentEventLoop();
+	waiter_ = waiter;
+	timer_ = loop.addTimer(deadline_, this);
+	loop_ = &loop;
+}
+
+ReadinessAwaiter::~ReadinessAwaiter() {
+	if (loop_ != nullptr)
+		loop_->unwatch(fd_);
+}
+
+void ReadinessAwaiter::await_suspend(std::coroutine_handle<> waiter) {
+	EventLoop &loop = currentEventLoop();
+	loop.watch(fd_, events_, this);
+	waiter_ = waiter;
+	loop_ = &loop;
+}
+
+ReadinessAwaiter waitReadable(int fd) { return ReadinessAwaiter(fd, EPOLLIN | EPOLLRDHUP); }
+ReadinessAwaiter waitWritable(int fd) { return ReadinessAwaiter(fd, EPOLLOUT); }
+
+} // namespace ou::http
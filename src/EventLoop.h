@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ou::http {
+
+class SleepAwaiter;
+class ReadinessAwaiter;
+
+// Resumes the coroutines of asynchronous handlers from a worker's epoll loop: when a descriptor they wait on becomes
+// ready, when a timer they sleep on expires, or when a blocking call they handed to a pool thread returns. A loop
+// belongs to the thread that made it, and everything it resumes runs there.
+class EventLoop {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Registers its own descriptors with epollFd, which the worker keeps waiting on
+	explicit EventLoop(int epollFd);
+	~EventLoop();
+	EventLoop(const EventLoop &) = delete;
+	EventLoop &operator=(const EventLoop &) = delete;
+
+	// The loop of the worker running on this thread, or nullptr
+	static EventLoop *current();
+
+	// Called by the worker for an epoll event on a descriptor it does not own; returns false if the loop does not own it
+	// either
+	bool dispatch(int fd, uint32_t events);
+	// How long the worker may wait for events before the next timer is due; nullopt without timers
+	std::optional<std::chrono::milliseconds> timeUntilNextTimer() const;
+	// Resumes the coroutines whose timers have expired
+	void runTimers();
+
+	// Runs fn once the coroutine being resumed has suspended or finished, so fn may destroy it
+	void defer(std::function<void()> fn);
+	// Runs work on a pool thread shared by every loop, then done on this loop's thread
+	void runBlocking(std::function<void()> work, std::function<void()> done);
+	// Stops waiting on fd, before it is closed
+	void forget(int fd);
+
+private:
+	friend class SleepAwaiter;
+	friend class ReadinessAwaiter;
+	struct Inbox;
+
+	using Timers = std::multimap<Clock::time_point, SleepAwaiter *>;
+
+	Timers::iterator addTimer(Clock::time_point deadline, SleepAwaiter *awaiter);
+	void removeTimer(Timers::iterator it) { timers_.erase(it); }
+	void watch(int fd, uint32_t events, ReadinessAwaiter *awaiter);
+	void unwatch(int fd);
+	// Resumes a suspended coroutine, then what it deferred
+	void resume(std::coroutine_handle<> handle);
+	void runDeferred();
+	void runPosted();
+
+	const int epollFd_;
+	Timers timers_;
+	// Descriptors registered with epoll, and who waits on each; nullptr while nobody does
+	std::unordered_map<int, ReadinessAwaiter *> watched_;
+	std::vector<std::function<void()>> deferred_;
+	// Shared with pool threads, which may finish a call after the loop is gone
+	std::shared_ptr<Inbox> inbox_;
+};
+
+// Suspends until a deadline; destroying the waiting coroutine first cancels the timer
+class SleepAwaiter {
+public:
+	explicit SleepAwaiter(EventLoop::Clock::time_point deadline) : deadline_(deadline) {}
+	SleepAwaiter(const SleepAwaiter &) = delete;
+	SleepAwaiter &operator=(const SleepAwaiter &) = delete;
+	~SleepAwaiter();
+
+	bool await_ready() const { return EventLoop::Clock::now() >= deadline_; }
+	// Throws std::logic_error outside a worker
+	void await_suspend(std::coroutine_handle<> waiter);
+	void await_resume() const {}
+
+private:
+	friend class EventLoop;
+
+	EventLoop::Clock::time_point deadline_;
+	EventLoop *loop_ = nullptr; // Set while the timer is pending
+	EventLoop::Timers::iterator timer_;
+	std::coroutine_handle<> waiter_;
+};
+
+inline SleepAwaiter sleepUntil(EventLoop::Clock::time_point deadline) { return SleepAwaiter(deadline); }
+inline SleepAwaiter sleepFor(EventLoop::Clock::duration duration) { return SleepAwaiter(EventLoop::Clock::now() + duration); }
+
+// Suspends until a non-blocking descriptor is ready for reading or writing, or has failed. One coroutine at a time may
+// wait on a descriptor; destroying it first cancels the wait.
+class ReadinessAwaiter {
+public:
+	ReadinessAwaiter(int fd, uint32_t events) : fd_(fd), events_(events) {}
+	ReadinessAwaiter(const ReadinessAwaiter &) = delete;
+	ReadinessAwaiter &operator=(const ReadinessAwaiter &) = delete;
+	~ReadinessAwaiter();
+
+	bool await_ready() const { return false; }
+	// Throws std::logic_error outside a worker, or if another coroutine waits on the descriptor
+	void await_suspend(std::coroutine_handle<> waiter);
+	void await_resume() const {}
+
+private:
+	friend class EventLoop;
+
+	int fd_;
+	uint32_t events_;
+	EventLoop *loop_ = nullptr; // Set while waiting
+	std::coroutine_handle<> waiter_;
+};
+
+ReadinessAwaiter waitReadable(int fd);
+ReadinessAwaiter waitWritable(int fd);
+
+// Runs a function that blocks, such as file I/O, on the blocking pool, resuming the waiting coroutine with its result
+// or exception, and the errno it left. Destroying the waiting coroutine first does not stop the call, but its result is dropped.
+template <typename T> class BlockingCall {
+public:
+	explicit BlockingCall(std::function<T()> work) : work_(std::move(work)) {}
+	BlockingCall(const BlockingCall &) = delete;
+	BlockingCall &operator=(const BlockingCall &) = delete;
+	~BlockingCall() {
+		if (state_)
+			state_->waiter = nullptr;
+	}
+
+	bool await_ready() const { return false; }
+	// Throws std::logic_error outside a worker
+	void await_suspend(std::coroutine_handle<> waiter);
+	T await_resume() {
+		errno = state_->errorNumber;
+		if (state_->error)
+			std::rethrow_exception(state_->error);
+		if constexpr (!std::is_void_v<T>)
+			return std::move(std::get<1>(state_->result));
+	}
+
+private:
+	using Result = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+	struct State {
+		std::coroutine_handle<> waiter; // Only touched on the loop's thread
+		std::variant<std::monostate, Result> result;
+		std::exception_ptr error;
+		int errorNumber = 0;
+	};
+
+	std::function<T()> work_;
+	std::shared_ptr<State> state_;
+};
+
+template <typename T> BlockingCall<std::invoke_result_t<T>> runBlocking(T work) {
+	return BlockingCall<std::invoke_result_t<T>>(std::move(work));
+}
+
+// Throws std::logic_error if the calling thread runs no worker
+EventLoop &currentEventLoop();
+
+template <typename T> void BlockingCall<T>::await_suspend(std::coroutine_handle<> waiter) {
+	EventLoop &loop = currentEventLoop();
+	state_ = std::make_shared<State>();
+	state_->waiter = waiter;
+	auto call = [state = state_, work = std::move(work_)] {
+		try {
+			if constexpr (std::is_void_v<T>) {
+				work();
+				state->result.template emplace<1>();
+			} else {
+				state->result.template emplace<1>(work());
+			}
+		} catch (...) {
+			state->error = std::current_exception();
+		}
+		state->errorNumber = errno;
+	};
+	auto done = [state = state_] {
+		if (auto waiter = std::exchange(state->waiter, nullptr))
+			waiter.resume();
+	};
+	loop.runBlocking(std::move(call), std::move(done));
+}
+
+} // namespace ou::http
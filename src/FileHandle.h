@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ou::http {
+
+// Owns an open file descriptor; shared between responses that stream from the same file.
+class FileHandle {
+public:
+	explicit FileHandle(int fd) : fd_(fd) {}
+	~FileHandle() {
+		if (fd_ >= 0)
+			::close(fd_);
+	}
+
+	FileHandle(const FileHandle &) = delete;
+	FileHandle &operator=(const FileHandle &) = delete;
+
+	// Returns nullptr and leaves errno set if the file cannot be opened
+	static std::shared_ptr<FileHandle> open(const std::filesystem::path &path) {
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		return fd < 0 ? nullptr : std::make_shared<FileHandle>(fd);
+	}
+
+	int fd() const { return fd_; }
+
+private:
+	int fd_;
+};
+
+} // namespace ou::http
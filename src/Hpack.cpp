@@ -0,0 +1,421 @@
+#include "Hpack.h"
+
+#include <algorithm>
+#include <array>
+
+namespace ou::http {
+
+namespace {
+
+	struct HuffmanCode {
+		uint32_t code;
+		uint8_t bits;
+	};
+
+	// RFC 7541 appendix B, indexed by symbol; 256 is end-of-string
+	constexpr std::array<HuffmanCode, 257> kHuffmanCodes{ {
+		{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 },
+		{ 0xfffffe7, 28 }, { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 }, { 0xfffffea, 28 }, { 0x3ffffffd, 30 },
+		{ 0xfffffeb, 28 }, { 0xfffffec, 28 }, { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 },
+		{ 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 }, { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+		{ 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 }, { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+		{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 },
+		{ 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 }, { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 },
+		{ 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+		{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 }, { 0x63, 7 }, { 0x64, 7 },
+		{ 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+		{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 },
+		{ 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 }, { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 },
+		{ 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 },
+		{ 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 }, { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 },
+		{ 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 },
+		{ 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+		{ 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 }, { 0xffffec, 24 },
+		{ 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+		{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 },
+		{ 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 },
+		{ 0x7fffe9, 23 }, { 0x1fffde, 21 }, { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 },
+		{ 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+		{ 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 },
+		{ 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 }, { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 },
+		{ 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 },
+		{ 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+		{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 },
+		{ 0xfffff2, 24 }, { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+		{ 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 },
+		{ 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+		{ 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 }, { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 },
+		{ 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 },
+		{ 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 }, { 0x3fffffff, 30 },
+	} };
+
+	// RFC 7541 appendix A
+	const std::array<HeaderField, 61> kStaticTable{ {
+		{ ":authority", "" },
+		{ ":method", "GET" },
+		{ ":method", "POST" },
+		{ ":path", "/" },
+		{ ":path", "/index.html" },
+		{ ":scheme", "http" },
+		{ ":scheme", "https" },
+		{ ":status", "200" },
+		{ ":status", "204" },
+		{ ":status", "206" },
+		{ ":status", "304" },
+		{ ":status", "400" },
+		{ ":status", "404" },
+		{ ":status", "500" },
+		{ "accept-charset", "" },
+		{ "accept-encoding", "gzip, deflate" },
+		{ "accept-language", "" },
+		{ "accept-ranges", "" },
+		{ "accept", "" },
+		{ "access-control-allow-origin", "" },
+		{ "age", "" },
+		{ "allow", "" },
+		{ "authorization", "" },
+		{ "cache-control", "" },
+		{ "content-disposition", "" },
+		{ "content-encoding", "" },
+		{ "content-language", "" },
+		{ "content-length", "" },
+		{ "content-location", "" },
+		{ "content-range", "" },
+		{ "content-type", "" },
+		{ "cookie", "" },
+		{ "date", "" },
+		{ "etag", "" },
+		{ "expect", "" },
+		{ "expires", "" },
+		{ "from", "" },
+		{ "host", "" },
+		{ "if-match", "" },
+		{ "if-modified-since", "" },
+		{ "if-none-match", "" },
+		{ "if-range", "" },
+		{ "if-unmodified-since", "" },
+		{ "last-modified", "" },
+		{ "link", "" },
+		{ "location", "" },
+		{ "max-forwards", "" },
+		{ "proxy-authenticate", "" },
+		{ "proxy-authorization", "" },
+		{ "range", "" },
+		{ "referer", "" },
+		{ "refresh", "" },
+		{ "retry-after", "" },
+		{ "server", "" },
+		{ "set-cookie", "" },
+		{ "strict-transport-security", "" },
+		{ "transfer-encoding", "" },
+		{ "user-agent", "" },
+		{ "vary", "" },
+		{ "via", "" },
+		{ "www-authenticate", "" },
+	} };
+
+	constexpr size_t kEntryOverhead = 32;
+	// Integers past this are malformed in any block this server accepts, and stopping here keeps shifts in range
+	constexpr uint64_t kMaxInteger = uint64_t{ 1 } << 32;
+	constexpr uint16_t kEndOfString = 256;
+
+	// Binary tree of the Huffman code, walked one bit at a time while decoding
+	struct HuffmanTree {
+		struct Node {
+			std::array<int16_t, 2> children{ -1, -1 };
+			int16_t symbol = -1;
+		};
+		std::vector<Node> nodes{ Node{} };
+
+		HuffmanTree() {
+			for (size_t symbol = 0; symbol < kHuffmanCodes.size(); ++symbol) {
+				size_t node = 0;
+				for (int bit = kHuffmanCodes[symbol].bits - 1; bit >= 0; --bit) {
+					int branch = (kHuffmanCodes[symbol].code >> bit) & 1;
+					if (nodes[node].children[branch] < 0) {
+						nodes[node].children[branch] = static_cast<int16_t>(nodes.size());
+						nodes.emplace_back();
+					}
+					node = static_cast<size_t>(nodes[node].children[branch]);
+				}
+				nodes[node].symbol = static_cast<int16_t>(symbol);
+			}
+		}
+	};
+
+	// Fields that differ between responses; indexing them would only push out fields that repeat
+	bool sWorthIndexing(std::string_view name) {
+		return name != "content-length" && name != "etag" && name != "last-modified" && name != "content-range" && name != "set-cookie";
+	}
+
+	// Set-Cookie can carry credentials, which intermediaries must not index either (RFC 7541 section 7.1.3)
+	bool sSensitive(std::string_view name) { return name == "set-cookie"; }
+
+	void sEncodeInteger(uint64_t value, int prefixBits, uint8_t flags, std::string &out) {
+		uint64_t limit = (uint64_t{ 1 } << prefixBits) - 1;
+		if (value < limit) {
+			out.push_back(static_cast<char>(flags | value));
+			return;
+		}
+		out.push_back(static_cast<char>(flags | limit));
+		value -= limit;
+		while (value >= 0x80) {
+			out.push_back(static_cast<char>(0x80 | (value & 0x7f)));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	void sEncodeString(std::string_view data, std::string &out) {
+		size_t huffmanSize = huffmanEncodedSize(data);
+		if (huffmanSize < data.size()) {
+			sEncodeInteger(huffmanSize, 7, 0x80, out);
+			huffmanEncode(data, out);
+		} else {
+			sEncodeInteger(data.size(), 7, 0, out);
+			out.append(data);
+		}
+	}
+
+	// Reads integers and strings from a header block, failing for good once anything is malformed
+	class BlockReader {
+	public:
+		explicit BlockReader(std::string_view block) : block_(block) {}
+
+		bool done() const { return pos_ >= block_.size(); }
+		uint8_t peek() const { return static_cast<uint8_t>(block_[pos_]); }
+
+		bool readInteger(int prefixBits, uint64_t &value) {
+			if (done())
+				return false;
+			uint64_t limit = (uint64_t{ 1 } << prefixBits) - 1;
+			value = static_cast<uint8_t>(block_[pos_++]) & limit;
+			if (value < limit)
+				return true;
+			for (int shift = 0; !done(); shift += 7) {
+				auto byte = static_cast<uint8_t>(block_[pos_++]);
+				value += static_cast<uint64_t>(byte & 0x7f) << shift;
+				if (value > kMaxInteger)
+					return false;
+				if ((byte & 0x80) == 0)
+					return true;
+			}
+			return false;
+		}
+
+		bool readString(std::string &out) {
+			if (done())
+				return false;
+			bool huffman = (peek() & 0x80) != 0;
+			uint64_t length = 0;
+			if (!readInteger(7, length) || length > block_.size() - pos_)
+				return false;
+			std::string_view data = block_.substr(pos_, length);
+			pos_ += length;
+			out.clear();
+			if (huffman)
+				return huffmanDecode(data, out);
+			out.assign(data);
+			return true;
+		}
+
+	private:
+		std::string_view block_;
+		size_t pos_ = 0;
+	};
+
+} // namespace
+
+size_t huffmanEncodedSize(std::string_view data) {
+	size_t bits = 0;
+	for (char c : data)
+		bits += kHuffmanCodes[static_cast<uint8_t>(c)].bits;
+	return (bits + 7) / 8;
+}
+
+void huffmanEncode(std::string_view data, std::string &out) {
+	uint64_t pending = 0;
+	int pendingBits = 0;
+	for (char c : data) {
+		const HuffmanCode &code = kHuffmanCodes[static_cast<uint8_t>(c)];
+		pending = (pending << code.bits) | code.code;
+		pendingBits += code.bits;
+		while (pendingBits >= 8) {
+			pendingBits -= 8;
+			out.push_back(static_cast<char>(pending >> pendingBits));
+		}
+	}
+	// Padded with the most significant bits of end-of-string, which are all ones
+	if (pendingBits > 0)
+		out.push_back(static_cast<char>((pending << (8 - pendingBits)) | (0xff >> pendingBits)));
+}
+
+bool huffmanDecode(std::string_view data, std::string &out) {
+	static const HuffmanTree kTree;
+	size_t node = 0;
+	int bitsSinceSymbol = 0;
+	bool allOnes = true;
+	for (char c : data) {
+		for (int bit = 7; bit >= 0; --bit) {
+			int branch = (static_cast<uint8_t>(c) >> bit) & 1;
+			int16_t next = kTree.nodes[node].children[branch];
+			if (next < 0)
+				return false;
+			node = static_cast<size_t>(next);
+			++bitsSinceSymbol;
+			allOnes = allOnes && branch == 1;
+			int16_t symbol = kTree.nodes[node].symbol;
+			if (symbol >= 0) {
+				if (symbol == kEndOfString)
+					return false;
+				out.push_back(static_cast<char>(symbol));
+				node = 0;
+				bitsSinceSymbol = 0;
+				allOnes = true;
+			}
+		}
+	}
+	// Only a prefix of end-of-string, shorter than a byte, may follow the last symbol
+	return bitsSinceSymbol < 8 && allOnes;
+}
+
+const HeaderField *HpackTable::at(size_t index) const {
+	if (index == 0)
+		return nullptr;
+	if (index <= kStaticTable.size())
+		return &kStaticTable[index - 1];
+	index -= kStaticTable.size() + 1;
+	return index < entries_.size() ? &entries_[index] : nullptr;
+}
+
+void HpackTable::add(std::string_view name, std::string_view value) {
+	size_t entrySize = name.size() + value.size() + kEntryOverhead;
+	// An entry larger than the table empties it and is not added
+	evict(std::min(entrySize, maxSize_ + 1));
+	if (entrySize > maxSize_)
+		return;
+	entries_.emplace_front(std::string(name), std::string(value));
+	size_ += entrySize;
+}
+
+void HpackTable::setMaxSize(size_t maxSize) {
+	maxSize_ = maxSize;
+	evict(0);
+}
+
+void HpackTable::evict(size_t needed) {
+	while (!entries_.empty() && size_ + needed > maxSize_) {
+		size_ -= entries_.back().first.size() + entries_.back().second.size() + kEntryOverhead;
+		entries_.pop_back();
+	}
+}
+
+std::pair<size_t, bool> HpackTable::find(std::string_view name, std::string_view value) const {
+	size_t nameIndex = 0;
+	for (size_t i = 0; i < kStaticTable.size(); ++i) {
+		if (kStaticTable[i].first != name)
+			continue;
+		if (kStaticTable[i].second == value)
+			return { i + 1, true };
+		if (nameIndex == 0)
+			nameIndex = i + 1;
+	}
+	for (size_t i = 0; i < entries_.size(); ++i) {
+		if (entries_[i].first != name)
+			continue;
+		if (entries_[i].second == value)
+			return { kStaticTable.size() + 1 + i, true };
+		if (nameIndex == 0)
+			nameIndex = kStaticTable.size() + 1 + i;
+	}
+	return { nameIndex, false };
+}
+
+bool HpackDecoder::decode(std::string_view block, std::vector<HeaderField> &fields, size_t maxListSize) {
+	BlockReader reader(block);
+	size_t listSize = 0;
+	// Checked before each field is copied: a one-byte reference can expand to a table entry of several kilobytes
+	auto fits = [&listSize, maxListSize](size_t nameSize, size_t valueSize) {
+		listSize += nameSize + valueSize + 32;
+		return listSize <= maxListSize;
+	};
+	while (!reader.done()) {
+		uint8_t first = reader.peek();
+		uint64_t index = 0;
+
+		if ((first & 0x80) != 0) {
+			// Indexed field
+			const HeaderField *field = reader.readInteger(7, index) ? table_.at(index) : nullptr;
+			if (field == nullptr || !fits(field->first.size(), field->second.size()))
+				return false;
+			fields.push_back(*field);
+			continue;
+		}
+
+		if ((first & 0xe0) == 0x20) {
+			// Dynamic table size update, bounded by what this end advertised
+			if (!reader.readInteger(5, index) || index > maxTableSize_)
+				return false;
+			table_.setMaxSize(index);
+			continue;
+		}
+
+		// Literal field, added to the table (01), or not (0000 and the never-indexed 0001)
+		bool addToTable = (first & 0xc0) == 0x40;
+		if (!reader.readInteger(addToTable ? 6 : 4, index))
+			return false;
+		HeaderField field;
+		if (index != 0) {
+			const HeaderField *named = table_.at(index);
+			if (named == nullptr)
+				return false;
+			field.first = named->first;
+		} else if (!reader.readString(field.first)) {
+			return false;
+		}
+		if (!reader.readString(field.second) || !fits(field.first.size(), field.second.size()))
+			return false;
+		if (addToTable)
+			table_.add(field.first, field.second);
+		fields.push_back(std::move(field));
+	}
+	return true;
+}
+
+void HpackEncoder::setMaxTableSize(size_t maxSize) {
+	// This encoder never needs more than the default, whatever the peer allows
+	maxSize = std::min<size_t>(maxSize, 4096);
+	if (maxSize == table_.maxSize())
+		return;
+	announceMinSize_ = sizeUpdatePending_ ? std::min(announceMinSize_, maxSize) : std::min(table_.maxSize(), maxSize);
+	sizeUpdatePending_ = true;
+	table_.setMaxSize(maxSize);
+}
+
+void HpackEncoder::encode(std::string_view name, std::string_view value, std::string &out) {
+	if (sizeUpdatePending_) {
+		if (announceMinSize_ < table_.maxSize())
+			sEncodeInteger(announceMinSize_, 5, 0x20, out);
+		sEncodeInteger(table_.maxSize(), 5, 0x20, out);
+		sizeUpdatePending_ = false;
+	}
+
+	auto [index, exact] = table_.find(name, value);
+	if (exact) {
+		sEncodeInteger(index, 7, 0x80, out);
+		return;
+	}
+
+	bool addToTable = sWorthIndexing(name);
+	if (addToTable)
+		sEncodeInteger(index, 6, 0x40, out);
+	else
+		sEncodeInteger(index, 4, sSensitive(name) ? 0x10 : 0, out);
+	if (index == 0)
+		sEncodeString(name, out);
+	sEncodeString(value, out);
+	if (addToTable)
+		table_.add(name, value);
+}
+
+} // namespace ou::http
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ou::http {
+
+// HPACK header compression (RFC 7541) for HTTP/2. Each direction of a connection has its own dynamic table, kept in
+// step between the encoder on one end and the decoder on the other, so an encoder and a decoder belong to exactly one
+// connection and must see every header block of that direction in order.
+
+using HeaderField = std::pair<std::string, std::string>;
+
+// Entries most recently added first. Sizes count 32 bytes of overhead per entry, as the RFC defines them.
+class HpackTable {
+public:
+	explicit HpackTable(size_t maxSize) : maxSize_(maxSize) {}
+
+	// Index 1 is the first static table entry; dynamic entries follow the 61 static ones. Null if out of range.
+	const HeaderField *at(size_t index) const;
+	void add(std::string_view name, std::string_view value);
+	void setMaxSize(size_t maxSize);
+
+	size_t maxSize() const { return maxSize_; }
+	size_t size() const { return size_; }
+	// Index of an entry with the name, preferring one whose value matches too, and whether it does; index 0 if none
+	std::pair<size_t, bool> find(std::string_view name, std::string_view value) const;
+
+private:
+	void evict(size_t needed);
+
+	std::deque<HeaderField> entries_;
+	size_t size_ = 0;
+	size_t maxSize_;
+};
+
+class HpackDecoder {
+public:
+	// maxTableSize is the SETTINGS_HEADER_TABLE_SIZE this end advertised; the peer may shrink the table below it
+	explicit HpackDecoder(size_t maxTableSize = 4096) : table_(maxTableSize), maxTableSize_(maxTableSize) {}
+
+	// Decodes one complete header block, appending its fields in order. False means the block was malformed, or that
+	// its fields, counted as name + value + 32 bytes each, passed maxListSize; decoding stops there, which leaves the
+	// table out of step with the peer's, so the connection has to be closed.
+	bool decode(std::string_view block, std::vector<HeaderField> &fields, size_t maxListSize = SIZE_MAX);
+
+private:
+	HpackTable table_;
+	size_t maxTableSize_;
+};
+
+class HpackEncoder {
+public:
+	// Applies the peer's SETTINGS_HEADER_TABLE_SIZE; the change is announced at the start of the next header block
+	void setMaxTableSize(size_t maxSize);
+
+	// Appends one field to the header block being built in out. Names must be lowercase. Fields whose values rarely
+	// repeat, such as content-length, are not added to the table so they do not push out ones that do.
+	void encode(std::string_view name, std::string_view value, std::string &out);
+
+private:
+	HpackTable table_{ 4096 };
+	// Smallest size since the last update was announced, which the peer has to hear first if the table shrank and grew
+	size_t announceMinSize_ = 0;
+	bool sizeUpdatePending_ = false;
+};
+
+// Exposed for tests. Huffman-encodes data onto out; decoding returns false for invalid codes or padding.
+void huffmanEncode(std::string_view data, std::string &out);
+size_t huffmanEncodedSize(std::string_view data);
+bool huffmanDecode(std::string_view data, std::string &out);
+
+} // namespace ou::http
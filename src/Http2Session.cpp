@@ -0,0 +1,666 @@
+#include "Http2Session.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <format>
+#include <utility>
+
+namespace ou::http {
+
+namespace {
+
+	constexpr size_t kFrameHeaderSize = 9;
+	constexpr size_t kMaxReceiveFrameSize = 16384; // The protocol default, never raised
+	// Larger frames would only make streams take longer turns
+	constexpr size_t kMaxSendFrameSize = 64 * 1024;
+	constexpr size_t kMaxConcurrentStreams = 100;
+	// Advertised for the connection and for each stream, so uploads are not limited to 64 KiB per round trip
+	constexpr int64_t kReceiveWindow = 1024 * 1024;
+	constexpr int64_t kDefaultWindow = 65535;
+	constexpr int64_t kMaxWindow = 0x7fffffff;
+
+	enum FrameType : uint8_t {
+		kData = 0x0,
+		kHeaders = 0x1,
+		kPriority = 0x2,
+		kRstStream = 0x3,
+		kSettings = 0x4,
+		kPushPromise = 0x5,
+		kPing = 0x6,
+		kGoaway = 0x7,
+		kWindowUpdate = 0x8,
+		kContinuation = 0x9,
+	};
+
+	enum Flag : uint8_t {
+		kEndStream = 0x1,
+		kAck = 0x1,
+		kEndHeaders = 0x4,
+		kPadded = 0x8,
+		kPriorityFlag = 0x20,
+	};
+
+	enum Setting : uint16_t {
+		kSettingHeaderTableSize = 0x1,
+		kSettingEnablePush = 0x2,
+		kSettingMaxConcurrentStreams = 0x3,
+		kSettingInitialWindowSize = 0x4,
+		kSettingMaxFrameSize = 0x5,
+		kSettingMaxHeaderListSize = 0x6,
+	};
+
+	uint32_t sRead32(std::string_view data) {
+		return (static_cast<uint32_t>(static_cast<uint8_t>(data[0])) << 24) | (static_cast<uint32_t>(static_cast<uint8_t>(data[1])) << 16)
+				| (static_cast<uint32_t>(static_cast<uint8_t>(data[2])) << 8) | static_cast<uint32_t>(static_cast<uint8_t>(data[3]));
+	}
+
+	void sAppend32(std::string &out, uint32_t value) {
+		for (int shift = 24; shift >= 0; shift -= 8)
+			out.push_back(static_cast<char>(value >> shift));
+	}
+
+	void sAppendSetting(std::string &out, uint16_t id, uint32_t value) {
+		out.push_back(static_cast<char>(id >> 8));
+		out.push_back(static_cast<char>(id));
+		sAppend32(out, value);
+	}
+
+	std::array<char, kFrameHeaderSize> sFrameHeader(size_t length, uint8_t type, uint8_t flags, uint32_t streamId) {
+		return { static_cast<char>(length >> 16), static_cast<char>(length >> 8), static_cast<char>(length), static_cast<char>(type),
+						 static_cast<char>(flags), static_cast<char>(streamId >> 24), static_cast<char>(streamId >> 16),
+						 static_cast<char>(streamId >> 8), static_cast<char>(streamId) };
+	}
+
+	// Removes the padding of a PADDED frame; false if the padding does not fit
+	bool sRemovePadding(uint8_t flags, std::string_view &payload) {
+		if ((flags & kPadded) == 0)
+			return true;
+		if (payload.empty())
+			return false;
+		size_t padding = static_cast<uint8_t>(payload[0]);
+		payload.remove_prefix(1);
+		if (padding > payload.size())
+			return false;
+		payload.remove_suffix(padding);
+		return true;
+	}
+
+	// HTTP/1 connection management has no place in HTTP/2 (RFC 9113 section 8.2.2)
+	bool sConnectionSpecific(std::string_view name) {
+		return name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" || name == "upgrade";
+	}
+
+	std::string sLowercase(std::string_view name) {
+		std::string result(name);
+		std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return result;
+	}
+
+	std::string_view sErrorReason(int statusCode) {
+		switch (statusCode) {
+		case 413:
+			return "Payload Too Large";
+		case 431:
+			return "Request Header Fields Too Large";
+		default:
+			return "Not Implemented";
+		}
+	}
+
+} // namespace
+
+Http2Session::Http2Session(RequestParser::Limits limits, Dispatch dispatch)
+		: limits_(limits), dispatch_(std::move(dispatch)), connectionReceiveWindow_(kReceiveWindow) {
+	std::string settings;
+	sAppendSetting(settings, kSettingEnablePush, 0);
+	sAppendSetting(settings, kSettingMaxConcurrentStreams, kMaxConcurrentStreams);
+	sAppendSetting(settings, kSettingInitialWindowSize, kReceiveWindow);
+	sAppendSetting(settings, kSettingMaxHeaderListSize, static_cast<uint32_t>(limits_.maxHeaderSize));
+	queueFrame(kSettings, 0, 0, settings);
+	// The connection window can only be raised with WINDOW_UPDATE
+	std::string increment;
+	sAppend32(increment, kReceiveWindow - kDefaultWindow);
+	queueFrame(kWindowUpdate, 0, 0, increment);
+}
+
+bool Http2Session::receive(std::string &input) {
+	size_t pos = 0;
+	if (!prefaceReceived_ && !failed_) {
+		if (input.size() < kPreface.size()) {
+			if (!kPreface.starts_with(input))
+				fail(ErrorCode::ProtocolError);
+			return !failed_;
+		}
+		if (!input.starts_with(kPreface)) {
+			fail(ErrorCode::ProtocolError);
+			return false;
+		}
+		prefaceReceived_ = true;
+		pos = kPreface.size();
+	}
+
+	while (!failed_ && input.size() - pos >= kFrameHeaderSize) {
+		std::string_view header(input.data() + pos, kFrameHeaderSize);
+		size_t length = sRead32(header) >> 8;
+		auto type = static_cast<uint8_t>(header[3]);
+		auto flags = static_cast<uint8_t>(header[4]);
+		uint32_t streamId = sRead32(header.substr(5)) & 0x7fffffff;
+		if (length > kMaxReceiveFrameSize) {
+			fail(ErrorCode::FrameSizeError);
+			break;
+		}
+		if (input.size() - pos - kFrameHeaderSize < length)
+			break;
+		onFrame(type, flags, streamId, std::string_view(input).substr(pos + kFrameHeaderSize, length));
+		pos += kFrameHeaderSize + length;
+	}
+
+	if (failed_)
+		input.clear();
+	else
+		input.erase(0, pos);
+	return !failed_;
+}
+
+void Http2Session::onFrame(uint8_t type, uint8_t flags, uint32_t streamId, std::string_view payload) {
+	if (headerBlockStream_ != 0 && (type != kContinuation || streamId != headerBlockStream_))
+		return fail(ErrorCode::ProtocolError);
+	// The client's preface ends with its SETTINGS
+	if (!settingsReceived_ && type != kSettings)
+		return fail(ErrorCode::ProtocolError);
+
+	switch (type) {
+	case kData:
+		return onData(flags, streamId, payload);
+	case kHeaders:
+		return onHeaders(flags, streamId, payload);
+	case kPriority:
+		// Priorities are advisory and streams take turns regardless
+		if (streamId == 0)
+			return fail(ErrorCode::ProtocolError);
+		if (payload.size() != 5)
+			return fail(ErrorCode::FrameSizeError);
+		return;
+	case kRstStream:
+		if (streamId == 0 || streamId > lastStreamId_)
+			return fail(ErrorCode::ProtocolError);
+		if (payload.size() != 4)
+			return fail(ErrorCode::FrameSizeError);
+		streams_.erase(streamId);
+		return;
+	case kSettings:
+		return onSettings(flags, streamId, payload);
+	case kPushPromise:
+		// Only servers push
+		return fail(ErrorCode::ProtocolError);
+	case kPing:
+		if (streamId != 0)
+			return fail(ErrorCode::ProtocolError);
+		if (payload.size() != 8)
+			return fail(ErrorCode::FrameSizeError);
+		if ((flags & kAck) == 0)
+			queueFrame(kPing, kAck, 0, payload);
+		return;
+	case kGoaway:
+		if (streamId != 0)
+			return fail(ErrorCode::ProtocolError);
+		// Streams already opened still get their responses
+		goawayReceived_ = true;
+		return;
+	case kWindowUpdate:
+		return onWindowUpdate(streamId, payload);
+	case kContinuation:
+		if (headerBlockStream_ == 0)
+			return fail(ErrorCode::ProtocolError);
+		if (headerBlock_.size() + payload.size() > limits_.maxHeaderSize)
+			return fail(ErrorCode::EnhanceYourCalm);
+		headerBlock_.append(payload);
+		if ((flags & kEndHeaders) != 0)
+			onHeaderBlockEnd();
+		return;
+	default:
+		// Unknown frame types are ignored (RFC 9113 section 4.1)
+		return;
+	}
+}
+
+void Http2Session::onHeaders(uint8_t flags, uint32_t streamId, std::string_view payload) {
+	if (streamId == 0 || streamId % 2 == 0)
+		return fail(ErrorCode::ProtocolError);
+	if (!sRemovePadding(flags, payload))
+		return fail(ErrorCode::ProtocolError);
+	if ((flags & kPriorityFlag) != 0) {
+		if (payload.size() < 5)
+			return fail(ErrorCode::FrameSizeError);
+		payload.remove_prefix(5);
+	}
+	if (payload.size() > limits_.maxHeaderSize)
+		return fail(ErrorCode::EnhanceYourCalm);
+
+	if (!streams_.contains(streamId)) {
+		// A stream that is neither open nor new has been closed
+		if (streamId <= lastStreamId_)
+			return fail(ErrorCode::StreamClosed);
+		lastStreamId_ = streamId;
+		// Refused streams are not created, but their header block is still decoded to keep HPACK in step
+		if (streams_.size() < kMaxConcurrentStreams && !goawayReceived_) {
+			Stream &stream = streams_[streamId];
+			stream.receiveWindow = kReceiveWindow;
+			stream.sendWindow = initialSendWindow_;
+		}
+	}
+
+	headerBlockStream_ = streamId;
+	headerBlockEndsStream_ = (flags & kEndStream) != 0;
+	headerBlock_.assign(payload);
+	if ((flags & kEndHeaders) != 0)
+		onHeaderBlockEnd();
+}
+
+void Http2Session::onHeaderBlockEnd() {
+	uint32_t streamId = std::exchange(headerBlockStream_, 0);
+	std::vector<HeaderField> fields;
+	// Decoding stops once the fields pass the advertised list size, so a small block cannot expand without bound
+	if (!decoder_.decode(headerBlock_, fields, limits_.maxHeaderSize))
+		return fail(ErrorCode::CompressionError);
+
+	auto it = streams_.find(streamId);
+	if (it == streams_.end())
+		return resetStream(streamId, ErrorCode::RefusedStream);
+	Stream &stream = it->second;
+	if (stream.requestComplete) {
+		resetStream(streamId, ErrorCode::StreamClosed);
+		streams_.erase(it);
+		return;
+	}
+
+	if (stream.headersReceived) {
+		// Trailers, which end the request and are not passed on
+		if (!headerBlockEndsStream_) {
+			resetStream(streamId, ErrorCode::ProtocolError);
+			streams_.erase(it);
+			return;
+		}
+		stream.requestComplete = true;
+		if (stream.responded)
+			return;
+		return dispatch(it);
+	}
+
+	stream.headersReceived = true;
+	stream.requestComplete = headerBlockEndsStream_;
+	stream.fields = std::move(fields);
+	if (stream.requestComplete)
+		dispatch(it);
+}
+
+void Http2Session::onData(uint8_t flags, uint32_t streamId, std::string_view payload) {
+	if (streamId == 0)
+		return fail(ErrorCode::ProtocolError);
+	// Flow control counts the whole payload, padding included
+	connectionReceiveWindow_ -= static_cast<int64_t>(payload.size());
+	if (connectionReceiveWindow_ < 0)
+		return fail(ErrorCode::FlowControlError);
+	connectionUnacknowledged_ += static_cast<uint32_t>(payload.size());
+	if (connectionUnacknowledged_ >= kReceiveWindow / 2) {
+		std::string increment;
+		sAppend32(increment, std::exchange(connectionUnacknowledged_, 0));
+		connectionReceiveWindow_ += sRead32(increment);
+		queueFrame(kWindowUpdate, 0, 0, increment);
+	}
+	size_t frameSize = payload.size();
+	if (!sRemovePadding(flags, payload))
+		return fail(ErrorCode::ProtocolError);
+
+	auto it = streams_.find(streamId);
+	if (it == streams_.end() || it->second.requestComplete || !it->second.headersReceived) {
+		if (streamId > lastStreamId_)
+			return fail(ErrorCode::ProtocolError);
+		resetStream(streamId, ErrorCode::StreamClosed);
+		if (it != streams_.end())
+			streams_.erase(it);
+		return;
+	}
+	Stream &stream = it->second;
+	stream.receiveWindow -= static_cast<int64_t>(frameSize);
+	if (stream.receiveWindow < 0) {
+		resetStream(streamId, ErrorCode::FlowControlError);
+		streams_.erase(it);
+		return;
+	}
+
+	// A stream answered early, because its request was too large, discards the rest of its body
+	if (!stream.responded) {
+		if (stream.body.size() + payload.size() > limits_.maxBodySize)
+			return respondWithError(it, 413);
+		stream.body.append(payload);
+	}
+
+	if ((flags & kEndStream) != 0) {
+		stream.requestComplete = true;
+		if (!stream.responded)
+			dispatch(it);
+		return;
+	}
+	stream.unacknowledged += static_cast<uint32_t>(frameSize);
+	if (!stream.responded && stream.unacknowledged >= kReceiveWindow / 2) {
+		std::string increment;
+		sAppend32(increment, std::exchange(stream.unacknowledged, 0));
+		stream.receiveWindow += sRead32(increment);
+		queueFrame(kWindowUpdate, 0, streamId, increment);
+	}
+}
+
+void Http2Session::onSettings(uint8_t flags, uint32_t streamId, std::string_view payload) {
+	if (streamId != 0)
+		return fail(ErrorCode::ProtocolError);
+	if ((flags & kAck) != 0) {
+		if (!payload.empty())
+			fail(ErrorCode::FrameSizeError);
+		return;
+	}
+	if (payload.size() % 6 != 0)
+		return fail(ErrorCode::FrameSizeError);
+
+	for (size_t pos = 0; pos < payload.size(); pos += 6) {
+		auto id = static_cast<uint16_t>((static_cast<uint8_t>(payload[pos]) << 8) | static_cast<uint8_t>(payload[pos + 1]));
+		uint32_t value = sRead32(payload.substr(pos + 2));
+		switch (id) {
+		case kSettingHeaderTableSize:
+			encoder_.setMaxTableSize(value);
+			break;
+		case kSettingEnablePush:
+			if (value > 1)
+				return fail(ErrorCode::ProtocolError);
+			break;
+		case kSettingInitialWindowSize: {
+			if (value > kMaxWindow)
+				return fail(ErrorCode::FlowControlError);
+			// Applies retroactively to every open stream
+			int64_t delta = static_cast<int64_t>(value) - initialSendWindow_;
+			for (auto &[id, stream] : streams_) {
+				stream.sendWindow += delta;
+				if (stream.sendWindow > kMaxWindow)
+					return fail(ErrorCode::FlowControlError);
+			}
+			initialSendWindow_ = value;
+			break;
+		}
+		case kSettingMaxFrameSize:
+			if (value < 16384 || value > 16777215)
+				return fail(ErrorCode::ProtocolError);
+			maxSendFrameSize_ = std::min<size_t>(value, kMaxSendFrameSize);
+			break;
+		default:
+			// Unknown settings are ignored, and this server never pushes or opens streams
+			break;
+		}
+	}
+	settingsReceived_ = true;
+	queueFrame(kSettings, kAck, 0, {});
+}
+
+void Http2Session::onWindowUpdate(uint32_t streamId, std::string_view payload) {
+	if (payload.size() != 4)
+		return fail(ErrorCode::FrameSizeError);
+	int64_t increment = sRead32(payload) & 0x7fffffff;
+	if (streamId == 0) {
+		connectionSendWindow_ += increment;
+		if (increment == 0)
+			return fail(ErrorCode::ProtocolError);
+		if (connectionSendWindow_ > kMaxWindow)
+			return fail(ErrorCode::FlowControlError);
+		return;
+	}
+
+	auto it = streams_.find(streamId);
+	if (it == streams_.end()) {
+		// Updates for streams that just closed are expected; ones for streams never opened are not
+		if (streamId > lastStreamId_)
+			fail(ErrorCode::ProtocolError);
+		return;
+	}
+	it->second.sendWindow += increment;
+	if (increment == 0 || it->second.sendWindow > kMaxWindow) {
+		resetStream(streamId, increment == 0 ? ErrorCode::ProtocolError : ErrorCode::FlowControlError);
+		streams_.erase(it);
+	}
+}
+
+void Http2Session::dispatch(StreamIterator it) {
+	Stream &stream = it->second;
+	Request request;
+	std::string_view method;
+	std::string_view target;
+	std::string_view authority;
+	bool valid = true;
+	bool regularSeen = false;
+	std::vector<std::string_view> cookies;
+	for (const auto &[name, value] : stream.fields) {
+		if (name.starts_with(':')) {
+			// Pseudo-header fields come first, once each
+			if (regularSeen)
+				valid = false;
+			else if (name == ":method" && method.empty())
+				method = value;
+			else if (name == ":path" && target.empty())
+				target = value;
+			else if (name == ":authority" && authority.empty())
+				authority = value;
+			else if (name != ":scheme")
+				valid = false;
+			continue;
+		}
+		regularSeen = true;
+		if (sConnectionSpecific(name) || std::any_of(name.begin(), name.end(), [](unsigned char c) { return std::isupper(c) != 0; }))
+			valid = false;
+		else if (name == "cookie")
+			cookies.push_back(value);
+		else
+			request.headers.add(name, value);
+	}
+	if (!valid || method.empty() || target.empty()) {
+		resetStream(it->first, ErrorCode::ProtocolError);
+		streams_.erase(it);
+		return;
+	}
+
+	std::optional<Method> parsedMethod = parseMethod(method);
+	if (!parsedMethod)
+		return respondWithError(it, 501);
+	request.method = *parsedMethod;
+	size_t queryStart = target.find('?');
+	request.path = target.substr(0, queryStart);
+	if (queryStart != std::string_view::npos)
+		request.query = target.substr(queryStart + 1);
+	request.version = "HTTP/2";
+	// Handlers read the host and cookies the way HTTP/1.1 sends them
+	if (!authority.empty() && !request.headers.contains("host"))
+		request.headers.add("host", authority);
+	for (std::string_view crumb : cookies)
+		stream.cookie.append(stream.cookie.empty() ? "" : "; ").append(crumb);
+	if (!cookies.empty())
+		request.headers.add("cookie", stream.cookie);
+	request.body = stream.body;
+	stream.headOnly = request.method == Method::HEAD;
+
+	DispatchResult result = dispatch_(request, it->first);
+	if (auto *pending = std::get_if<PendingResponse>(&result)) {
+		stream.pendingResponse = std::move(*pending);
+		return;
+	}
+	respond(it, std::move(std::get<std::optional<Response>>(result)));
+}
+
+void Http2Session::answer(uint32_t streamId) {
+	auto it = streams_.find(streamId);
+	if (it == streams_.end() || !it->second.pendingResponse || !it->second.pendingResponse->done())
+		return;
+	std::optional<Response> response = it->second.pendingResponse->result();
+	it->second.pendingResponse.reset();
+	respond(it, std::move(response));
+}
+
+bool Http2Session::awaitingHandlers() const {
+	return std::any_of(streams_.begin(), streams_.end(), [](const auto &entry) { return entry.second.pendingResponse.has_value(); });
+}
+
+void Http2Session::respond(StreamIterator it, std::optional<Response> response) {
+	if (!response) {
+		resetStream(it->first, ErrorCode::InternalError);
+		streams_.erase(it);
+		return;
+	}
+	respond(it, std::move(*response), it->second.headOnly);
+}
+
+void Http2Session::respond(StreamIterator it, Response response, bool headOnly) {
+	Stream &stream = it->second;
+	stream.responded = true;
+	stream.fields = {};
+	stream.body = {};
+	stream.cookie = {};
+
+	// The same header fields Response::serializeHead() writes for HTTP/1.1, minus the reason phrase
+	bool bodyless = response.statusCode == 304 || response.statusCode == 204;
+	std::string block;
+	encoder_.encode(":status", std::to_string(response.statusCode), block);
+	if (!bodyless) {
+		encoder_.encode("content-length", std::to_string(response.contentLength()), block);
+		if (!response.headers.contains(HeaderName::ContentType))
+			encoder_.encode("content-type", "text/html", block);
+	}
+	for (const auto &[name, value] : response.headers) {
+		std::string lowercaseName = sLowercase(name);
+		if (!sConnectionSpecific(lowercaseName) && lowercaseName != "content-length")
+			encoder_.encode(lowercaseName, value, block);
+	}
+
+	if (!headOnly && !bodyless) {
+		if (!response.body.empty())
+			stream.output.emplace_back(std::move(response.body));
+		for (auto &part : response.bodyParts) {
+			if (bodyPartSize(part) > 0)
+				stream.output.push_back(std::move(part));
+		}
+	}
+
+	// Header blocks larger than a frame continue in CONTINUATION frames, which must follow immediately
+	bool endStream = stream.output.empty();
+	std::string_view remaining = block;
+	uint8_t type = kHeaders;
+	do {
+		std::string_view fragment = remaining.substr(0, maxSendFrameSize_);
+		remaining.remove_prefix(fragment.size());
+		uint8_t flags = (remaining.empty() ? kEndHeaders : 0) | (type == kHeaders && endStream ? kEndStream : 0);
+		queueFrame(type, flags, it->first, fragment);
+		type = kContinuation;
+	} while (!remaining.empty());
+
+	if (endStream)
+		finishStream(it);
+}
+
+void Http2Session::respondWithError(StreamIterator it, int statusCode) {
+	Response response{ statusCode, std::string(sErrorReason(statusCode)), { { "Content-Type", "text/plain" } },
+										 std::format("{} {}", statusCode, sErrorReason(statusCode)) };
+	respond(it, std::move(response), false);
+}
+
+Http2Session::StreamIterator Http2Session::finishStream(StreamIterator it) {
+	// The response may have been sent before the whole request arrived; the rest is not wanted (RFC 9113 section 8.1)
+	if (!it->second.requestComplete)
+		resetStream(it->first, ErrorCode::NoError);
+	return streams_.erase(it);
+}
+
+bool Http2Session::pollOutput(std::deque<BodyPart> &output, size_t &bufferedBytes, size_t maxBytes) {
+	size_t appended = 0;
+	auto append = [&](std::string_view data) {
+		if (data.empty())
+			return;
+		bufferedBytes += data.size();
+		appended += data.size();
+		auto *last = output.empty() ? nullptr : std::get_if<std::string>(&output.back());
+		if (last != nullptr)
+			last->append(data);
+		else
+			output.emplace_back(std::string(data));
+	};
+
+	// Header blocks must reach the client in the order they were compressed in, so they go out first, in order
+	append(control_);
+	control_.clear();
+
+	// Streams take turns sending one DATA frame each
+	bool progress = true;
+	while (progress && appended < maxBytes && connectionSendWindow_ > 0) {
+		progress = false;
+		for (auto it = streams_.begin(); it != streams_.end() && connectionSendWindow_ > 0;) {
+			Stream &stream = it->second;
+			if (stream.output.empty() || stream.sendWindow <= 0) {
+				++it;
+				continue;
+			}
+			BodyPart &part = stream.output.front();
+			size_t partSize = bodyPartSize(part);
+			size_t length = std::min({ partSize - stream.outputOffset, maxSendFrameSize_, static_cast<size_t>(stream.sendWindow),
+																 static_cast<size_t>(connectionSendWindow_) });
+			bool last = stream.output.size() == 1 && stream.outputOffset + length == partSize;
+
+			auto header = sFrameHeader(length, kData, last ? kEndStream : 0, it->first);
+			append(std::string_view(header.data(), header.size()));
+			if (const auto *data = std::get_if<std::string>(&part)) {
+				append(std::string_view(*data).substr(stream.outputOffset, length));
+			} else if (const auto *shared = std::get_if<std::shared_ptr<const std::string>>(&part)) {
+				append(std::string_view(**shared).substr(stream.outputOffset, length));
+			} else {
+				const FileRange &range = std::get<FileRange>(part);
+				output.emplace_back(FileRange{ range.file, range.offset + static_cast<off_t>(stream.outputOffset), length });
+				appended += length;
+			}
+
+			stream.sendWindow -= static_cast<int64_t>(length);
+			connectionSendWindow_ -= static_cast<int64_t>(length);
+			stream.outputOffset += length;
+			if (stream.outputOffset == partSize) {
+				stream.output.pop_front();
+				stream.outputOffset = 0;
+			}
+			progress = true;
+			it = last ? finishStream(it) : std::next(it);
+		}
+	}
+
+	// Resets of streams that finished above
+	append(control_);
+	control_.clear();
+	return appended > 0;
+}
+
+void Http2Session::queueFrame(uint8_t type, uint8_t flags, uint32_t streamId, std::string_view payload) {
+	auto header = sFrameHeader(payload.size(), type, flags, streamId);
+	control_.append(header.data(), header.size());
+	control_.append(payload);
+}
+
+void Http2Session::resetStream(uint32_t streamId, ErrorCode error) {
+	std::string payload;
+	sAppend32(payload, static_cast<uint32_t>(error));
+	queueFrame(kRstStream, 0, streamId, payload);
+}
+
+void Http2Session::fail(ErrorCode error) {
+	if (failed_)
+		return;
+	failed_ = true;
+	// Nothing more is sent for any stream, only the reason for closing
+	streams_.clear();
+	std::string payload;
+	sAppend32(payload, lastStreamId_);
+	sAppend32(payload, static_cast<uint32_t>(error));
+	queueFrame(kGoaway, 0, 0, payload);
+}
+
+} // namespace ou::http
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Hpack.h"
+#include "HttpTypes.h"
+#include "RequestParser.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ou::http {
+
+// Server side of one HTTP/2 connection (RFC 9113), independent of the socket: frames are fed in as they arrive and
+// frames to send are pulled out. A request is dispatched as soon as its stream ends. Response bodies go out one DATA
+// frame per stream in turn, within the client's flow control windows, so a large or stalled response holds up no
+// other stream. File bodies stay file ranges, sent with sendfile() between the frame headers.
+class Http2Session {
+public:
+	// Returns nullopt if no response could be produced, which resets the stream. A pending response is kept with its
+	// stream until answer() is called for it.
+	using Dispatch = std::function<DispatchResult(Request &, uint32_t streamId)>;
+
+	// What a client sends first, with prior knowledge or after negotiating h2 with ALPN
+	static constexpr std::string_view kPreface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+	Http2Session(RequestParser::Limits limits, Dispatch dispatch);
+
+	// Consumes the client preface and every complete frame at the front of input, dispatching the requests they
+	// finish. Returns false once the connection has failed; the GOAWAY saying why is queued for sending.
+	bool receive(std::string &input);
+
+	// Appends frames that may be sent now to output, adding the size of the in-memory ones to bufferedBytes, until
+	// about maxBytes have been appended. Returns whether anything was.
+	bool pollOutput(std::deque<BodyPart> &output, size_t &bufferedBytes, size_t maxBytes);
+
+	// Whether the connection should close once the queued output is sent: it failed, or the client went away and
+	// every stream has finished
+	bool finished() const { return failed_ || (goawayReceived_ && streams_.empty()); }
+	size_t streamCount() const { return streams_.size(); }
+
+	// Responds on the stream with the result of its finished handler; does nothing if the client reset the stream
+	void answer(uint32_t streamId);
+	// Whether any stream waits for a handler to finish
+	bool awaitingHandlers() const;
+
+private:
+	enum class ErrorCode : uint32_t {
+		NoError = 0x0,
+		ProtocolError = 0x1,
+		InternalError = 0x2,
+		FlowControlError = 0x3,
+		StreamClosed = 0x5,
+		FrameSizeError = 0x6,
+		RefusedStream = 0x7,
+		CompressionError = 0x9,
+		EnhanceYourCalm = 0xb,
+	};
+
+	struct Stream {
+		bool headersReceived = false;
+		std::vector<HeaderField> fields;
+		std::string body;
+		bool requestComplete = false; // The client ended its side
+		std::string cookie;						 // The request's cookie fields joined, which it holds a view of
+		std::optional<PendingResponse> pendingResponse;
+		bool headOnly = false;
+		int64_t receiveWindow = 0;
+		uint32_t unacknowledged = 0; // Received bytes not yet returned with WINDOW_UPDATE
+
+		bool responded = false;
+		std::deque<BodyPart> output; // Response body not yet framed; never holds empty parts
+		size_t outputOffset = 0;		 // Bytes of the front part already framed
+		int64_t sendWindow = 0;
+	};
+
+	using StreamIterator = std::map<uint32_t, Stream>::iterator;
+
+	void onFrame(uint8_t type, uint8_t flags, uint32_t streamId, std::string_view payload);
+	void onHeaders(uint8_t flags, uint32_t streamId, std::string_view payload);
+	void onHeaderBlockEnd();
+	void onData(uint8_t flags, uint32_t streamId, std::string_view payload);
+	void onSettings(uint8_t flags, uint32_t streamId, std::string_view payload);
+	void onWindowUpdate(uint32_t streamId, std::string_view payload);
+
+	// These may forget the stream, so it must not be used afterwards
+	void dispatch(StreamIterator it);
+	void respond(StreamIterator it, std::optional<Response> response);
+	void respond(StreamIterator it, Response response, bool headOnly);
+	void respondWithError(StreamIterator it, int statusCode);
+	// Forgets a stream whose response has been sent, resetting it if the client is still sending its request
+	StreamIterator finishStream(StreamIterator it);
+
+	void queueFrame(uint8_t type, uint8_t flags, uint32_t streamId, std::string_view payload);
+	void resetStream(uint32_t streamId, ErrorCode error);
+	void fail(ErrorCode error);
+
+	const RequestParser::Limits limits_;
+	const Dispatch dispatch_;
+	HpackDecoder decoder_;
+	HpackEncoder encoder_;
+
+	std::map<uint32_t, Stream> streams_; // Open streams by ID, which is also the order they are served in
+	uint32_t lastStreamId_ = 0;					 // Highest stream the client has opened
+	std::string control_;								 // Frames that go out ahead of any DATA, in the order they were queued
+
+	bool prefaceReceived_ = false;
+	bool settingsReceived_ = false;
+	bool goawayReceived_ = false;
+	bool failed_ = false;
+
+	// A header block spread over CONTINUATION frames, which nothing may interrupt
+	uint32_t headerBlockStream_ = 0;
+	bool headerBlockEndsStream_ = false;
+	std::string headerBlock_;
+
+	int64_t connectionReceiveWindow_;
+	uint32_t connectionUnacknowledged_ = 0;
+	int64_t connectionSendWindow_ = 65535;
+	int64_t initialSendWindow_ = 65535; // The client's SETTINGS_INITIAL_WINDOW_SIZE
+	size_t maxSendFrameSize_ = 16384;
+};
+
+} // namespace ou::http
@@ -0,0 +1,210 @@
+#include "HttpHeaders.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ou::http {
+
+namespace {
+	// Canonical spellings, indexed by HeaderName
+	constexpr std::array<std::string_view, kHeaderNameCount> kHeaderNames{
+		"",
+		"Accept",
+		"Accept-Encoding",
+		"Accept-Language",
+		"Accept-Ranges",
+		"Authorization",
+		"Cache-Control",
+		"Connection",
+		"Content-Encoding",
+		"Content-Length",
+		"Content-Range",
+		"Content-Type",
+		"Cookie",
+		"Date",
+		"DNT",
+		"ETag",
+		"Expect",
+		"Host",
+		"If-Match",
+		"If-Modified-Since",
+		"If-None-Match",
+		"If-Range",
+		"If-Unmodified-Since",
+		"Keep-Alive",
+		"Last-Modified",
+		"Location",
+		"Origin",
+		"Pragma",
+		"Priority",
+		"Range",
+		"Referer",
+		"Sec-CH-UA",
+		"Sec-CH-UA-Mobile",
+		"Sec-CH-UA-Platform",
+		"Sec-Fetch-Dest",
+		"Sec-Fetch-Mode",
+		"Sec-Fetch-Site",
+		"Sec-Fetch-User",
+		"Server",
+		"Set-Cookie",
+		"Strict-Transport-Security",
+		"TE",
+		"Transfer-Encoding",
+		"Upgrade",
+		"Upgrade-Insecure-Requests",
+		"User-Agent",
+		"Vary",
+		"Via",
+		"X-Forwarded-For",
+		"X-Request-Id",
+	};
+
+	constexpr size_t kMaxHeaderNameLength = 25;
+	constexpr unsigned kNameHashBits = 8;
+	constexpr uint64_t kNameHashMultiplier = 0xc568f4a2c1290d9bULL; // Found by search, for having no collisions
+
+	constexpr char sAsciiLower(char c) { return static_cast<unsigned char>(c - 'A') < 26 ? static_cast<char>(c + ('a' - 'A')) : c; }
+
+	// Of the length and the last two and first characters, case-insensitively. Takes a name of at least two characters.
+	constexpr size_t sNameHash(std::string_view name) {
+		uint64_t key = (uint64_t{ name.size() } << 24) | (uint64_t{ static_cast<unsigned char>(sAsciiLower(name.front())) } << 16)
+									 | (uint64_t{ static_cast<unsigned char>(sAsciiLower(name[name.size() - 2])) } << 8)
+									 | uint64_t{ static_cast<unsigned char>(sAsciiLower(name.back())) };
+		return static_cast<size_t>((key * kNameHashMultiplier) >> (64 - kNameHashBits));
+	}
+
+	// A well-known name prepared for comparison eight bytes at a time: or-ing a byte with its fold mask lowercases it
+	// if it is a letter and leaves it alone otherwise
+	struct FoldedName {
+		std::array<char, 32> lowercase{};
+		std::array<char, 32> foldMask{};
+	};
+
+	constexpr auto kFoldedNames = [] {
+		std::array<FoldedName, kHeaderNameCount> folded{};
+		for (size_t i = 1; i < kHeaderNames.size(); ++i) {
+			for (size_t c = 0; c < kHeaderNames[i].size(); ++c) {
+				folded[i].lowercase[c] = sAsciiLower(kHeaderNames[i][c]);
+				bool letter = folded[i].lowercase[c] >= 'a' && folded[i].lowercase[c] <= 'z';
+				folded[i].foldMask[c] = letter ? 0x20 : 0;
+			}
+		}
+		return folded;
+	}();
+
+	// Each well-known name in the slot its hash picks; the rest are Other. A collision fails to compile.
+	constexpr auto kNameSlots = [] {
+		std::array<HeaderName, size_t{ 1 } << kNameHashBits> slots{};
+		for (size_t i = 1; i < kHeaderNames.size(); ++i) {
+			HeaderName &slot = slots[sNameHash(kHeaderNames[i])];
+			if (slot != HeaderName::Other)
+				throw "two well-known header names hash to the same slot";
+			slot = static_cast<HeaderName>(i);
+		}
+		return slots;
+	}();
+
+	uint64_t sWord(const char *data) {
+		uint64_t word = 0;
+		std::memcpy(&word, data, sizeof(word));
+		return word;
+	}
+
+	bool sEqualsFolded(std::string_view name, const FoldedName &folded) {
+		auto matchesAt = [&](size_t i) {
+			return (sWord(name.data() + i) | sWord(folded.foldMask.data() + i)) == sWord(folded.lowercase.data() + i);
+		};
+		if (name.size() < 8) {
+			for (size_t i = 0; i < name.size(); ++i) {
+				if ((name[i] | folded.foldMask[i]) != folded.lowercase[i])
+					return false;
+			}
+			return true;
+		}
+		// Whole words, then the last eight bytes, which may overlap the last word compared
+		for (size_t i = 0; i + 8 <= name.size(); i += 8) {
+			if (!matchesAt(i))
+				return false;
+		}
+		return matchesAt(name.size() - 8);
+	}
+} // namespace
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+	return std::ranges::equal(a, b, [](char x, char y) { return sAsciiLower(x) == sAsciiLower(y); });
+}
+
+HeaderName internHeaderName(std::string_view name) {
+	if (name.size() < 2 || name.size() > kMaxHeaderNameLength)
+		return HeaderName::Other;
+	// The candidate has the right hash; it is the name only if the lengths, and then the bytes, match
+	HeaderName candidate = kNameSlots[sNameHash(name)];
+	size_t index = static_cast<size_t>(candidate);
+	if (candidate == HeaderName::Other || kHeaderNames[index].size() != name.size() || !sEqualsFolded(name, kFoldedNames[index]))
+		return HeaderName::Other;
+	return candidate;
+}
+
+std::string_view headerNameString(HeaderName name) { return kHeaderNames[static_cast<size_t>(name)]; }
+
+std::optional<std::string_view> RequestHeaders::find(HeaderName name) const {
+	if (auto position = index_.find(name))
+		return fields_[*position].second;
+	return std::nullopt;
+}
+
+std::optional<std::string_view> RequestHeaders::find(std::string_view name) const {
+	if (HeaderName id = internHeaderName(name); id != HeaderName::Other)
+		return find(id);
+	for (const auto &[fieldName, value] : fields_) {
+		if (equalsIgnoreCase(fieldName, name))
+			return value;
+	}
+	return std::nullopt;
+}
+
+ResponseHeaders::ResponseHeaders(std::initializer_list<std::pair<std::string_view, std::string_view>> fields) {
+	fields_.reserve(fields.size());
+	for (const auto &[name, value] : fields)
+		(*this)[name] = value;
+}
+
+std::string &ResponseHeaders::operator[](HeaderName name) {
+	if (auto position = index_.find(name))
+		return fields_[*position].value;
+	index_.add(name, fields_.size());
+	return fields_.emplace_back(name, std::string(), std::string()).value;
+}
+
+std::string &ResponseHeaders::operator[](std::string_view name) {
+	if (HeaderName id = internHeaderName(name); id != HeaderName::Other)
+		return (*this)[id];
+	if (auto position = findOther(name))
+		return fields_[*position].value;
+	return fields_.emplace_back(HeaderName::Other, std::string(name), std::string()).value;
+}
+
+std::optional<std::string_view> ResponseHeaders::find(HeaderName name) const {
+	if (auto position = index_.find(name))
+		return fields_[*position].value;
+	return std::nullopt;
+}
+
+std::optional<std::string_view> ResponseHeaders::find(std::string_view name) const {
+	if (HeaderName id = internHeaderName(name); id != HeaderName::Other)
+		return find(id);
+	if (auto position = findOther(name))
+		return fields_[*position].value;
+	return std::nullopt;
+}
+
+std::optional<size_t> ResponseHeaders::findOther(std::string_view name) const {
+	for (size_t i = 0; i < fields_.size(); ++i) {
+		if (fields_[i].id == HeaderName::Other && equalsIgnoreCase(fields_[i].name, name))
+			return i;
+	}
+	return std::nullopt;
+}
+
+} // namespace ou::http
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ou::http {
+
+// ASCII case-insensitive comparison, as HTTP field names and tokens use
+bool equalsIgnoreCase(std::string_view a, std::string_view b);
+
+// Field names common enough in requests and responses to be worth interning. Header containers index fields by these,
+// so finding a well-known field is an array read rather than a string comparison per field.
+enum class HeaderName : uint8_t {
+	Other, // Any name not listed here
+	Accept,
+	AcceptEncoding,
+	AcceptLanguage,
+	AcceptRanges,
+	Authorization,
+	CacheControl,
+	Connection,
+	ContentEncoding,
+	ContentLength,
+	ContentRange,
+	ContentType,
+	Cookie,
+	Date,
+	DNT,
+	ETag,
+	Expect,
+	Host,
+	IfMatch,
+	IfModifiedSince,
+	IfNoneMatch,
+	IfRange,
+	IfUnmodifiedSince,
+	KeepAlive,
+	LastModified,
+	Location,
+	Origin,
+	Pragma,
+	Priority,
+	Range,
+	Referer,
+	SecChUa,
+	SecChUaMobile,
+	SecChUaPlatform,
+	SecFetchDest,
+	SecFetchMode,
+	SecFetchSite,
+	SecFetchUser,
+	Server,
+	SetCookie,
+	StrictTransportSecurity,
+	TE,
+	TransferEncoding,
+	Upgrade,
+	UpgradeInsecureRequests,
+	UserAgent,
+	Vary,
+	Via,
+	XForwardedFor,
+	XRequestId,
+};
+
+constexpr size_t kHeaderNameCount = static_cast<size_t>(HeaderName::XRequestId) + 1;
+
+// Case-insensitive; Other for a name that is not well known
+HeaderName internHeaderName(std::string_view name);
+// Canonical spelling, such as "Content-Type"; empty for Other
+std::string_view headerNameString(HeaderName name);
+
+// Position of the first field with each well-known name
+class HeaderIndex {
+public:
+	HeaderIndex() { clear(); }
+
+	void clear() { positions_.fill(kAbsent); }
+	void add(HeaderName name, size_t position) {
+		uint32_t &slot = positions_[static_cast<size_t>(name)];
+		if (name != HeaderName::Other && slot == kAbsent)
+			slot = static_cast<uint32_t>(position);
+	}
+	std::optional<size_t> find(HeaderName name) const {
+		uint32_t position = positions_[static_cast<size_t>(name)];
+		return position == kAbsent ? std::nullopt : std::optional<size_t>(position);
+	}
+
+private:
+	static constexpr uint32_t kAbsent = std::numeric_limits<uint32_t>::max();
+	std::array<uint32_t, kHeaderNameCount> positions_;
+};
+
+// Request header fields in arrival order, as views into the buffer the request was parsed from.
+// Field names compare case-insensitively. Clearing keeps the storage, so a parser reused across a connection's
+// requests stops allocating once it has seen the largest header section.
+class RequestHeaders {
+public:
+	using Field = std::pair<std::string_view, std::string_view>;
+
+	void add(std::string_view name, std::string_view value) { add(internHeaderName(name), name, value); }
+	// For a caller that has already interned name
+	void add(HeaderName id, std::string_view name, std::string_view value) {
+		index_.add(id, fields_.size());
+		fields_.emplace_back(name, value);
+	}
+	void clear() {
+		fields_.clear();
+		index_.clear();
+	}
+
+	std::optional<std::string_view> find(HeaderName name) const;
+	std::optional<std::string_view> find(std::string_view name) const;
+	bool contains(HeaderName name) const { return index_.find(name).has_value(); }
+	bool contains(std::string_view name) const { return find(name).has_value(); }
+	// Empty if the field is absent
+	std::string_view operator[](HeaderName name) const { return find(name).value_or(std::string_view{}); }
+	std::string_view operator[](std::string_view name) const { return find(name).value_or(std::string_view{}); }
+
+	size_t size() const { return fields_.size(); }
+	bool empty() const { return fields_.empty(); }
+	auto begin() const { return fields_.begin(); }
+	auto end() const { return fields_.end(); }
+
+private:
+	std::vector<Field> fields_;
+	HeaderIndex index_;
+};
+
+// Response header fields in the order they were first set. Names compare case-insensitively and setting a field
+// replaces its value, as in a map; well-known names are stored as their HeaderName and written in canonical spelling.
+class ResponseHeaders {
+	struct Field {
+		HeaderName id;
+		std::string name; // Only for Other
+		std::string value;
+	};
+
+public:
+	// Iterates over (name, value) pairs, made on the fly
+	class Iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = std::pair<std::string_view, std::string_view>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = value_type;
+
+		Iterator() = default;
+		explicit Iterator(std::vector<Field>::const_iterator it) : it_(it) {}
+
+		value_type operator*() const {
+			return { it_->id == HeaderName::Other ? std::string_view(it_->name) : headerNameString(it_->id), it_->value };
+		}
+		Iterator &operator++() {
+			++it_;
+			return *this;
+		}
+		Iterator operator++(int) { return Iterator(it_++); }
+		bool operator==(const Iterator &) const = default;
+
+	private:
+		std::vector<Field>::const_iterator it_;
+	};
+
+	ResponseHeaders() = default;
+	ResponseHeaders(std::initializer_list<std::pair<std::string_view, std::string_view>> fields);
+
+	// The field's value, added empty if the field is absent. name must not be Other.
+	std::string &operator[](HeaderName name);
+	std::string &operator[](std::string_view name);
+
+	std::optional<std::string_view> find(HeaderName name) const;
+	std::optional<std::string_view> find(std::string_view name) const;
+	bool contains(HeaderName name) const { return index_.find(name).has_value(); }
+	bool contains(std::string_view name) const { return find(name).has_value(); }
+
+	size_t size() const { return fields_.size(); }
+	bool empty() const { return fields_.empty(); }
+	Iterator begin() const { return Iterator(fields_.begin()); }
+	Iterator end() const { return Iterator(fields_.end()); }
+
+private:
+	// Position of the field named name, which is not well known
+	std::optional<size_t> findOther(std::string_view name) const;
+
+	std::vector<Field> fields_;
+	HeaderIndex index_;
+};
+
+} // namespace ou::http
@@ -1,38 +1,110 @@
 #include "HttpTypes.h"
+#include "ByteScan.h"
+#include "RequestParser.h"
 
 #include <algorithm>
+#include <array>
 #include <cctype>
-#include <ranges>
+#include <charconv>
+#include <concepts>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <unistd.h>
+
 namespace ou::http {
 
-inline Method stringToMethod(std::string_view method) {
-	if (method == "GET")
-		return Method::GET;
-	if (method == "POST")
-		return Method::POST;
-	if (method == "PUT")
-		return Method::PUT;
-	if (method == "DELETE")
-		return Method::DELETE;
-	if (method == "PATCH")
-		return Method::PATCH;
-	if (method == "HEAD")
-		return Method::HEAD;
-	if (method == "OPTIONS")
-		return Method::OPTIONS;
-	if (method == "CONNECT")
-		return Method::CONNECT;
-	if (method == "TRACE")
-		return Method::TRACE;
+namespace {
+	struct StatusLine {
+		int statusCode;
+		std::string_view reasonPhrase;
+		std::string_view line;
+	};
+
+	// Status lines of the statuses this server sends, with their standard reason phrases, ready to copy
+	constexpr std::array kStatusLines{
+		StatusLine{ 200, "OK", "HTTP/1.1 200 OK\r\n" },
+		StatusLine{ 201, "Created", "HTTP/1.1 201 Created\r\n" },
+		StatusLine{ 204, "No Content", "HTTP/1.1 204 No Content\r\n" },
+		StatusLine{ 206, "Partial Content", "HTTP/1.1 206 Partial Content\r\n" },
+		StatusLine{ 301, "Moved Permanently", "HTTP/1.1 301 Moved Permanently\r\n" },
+		StatusLine{ 302, "Found", "HTTP/1.1 302 Found\r\n" },
+		StatusLine{ 304, "Not Modified", "HTTP/1.1 304 Not Modified\r\n" },
+		StatusLine{ 400, "Bad Request", "HTTP/1.1 400 Bad Request\r\n" },
+		StatusLine{ 403, "Forbidden", "HTTP/1.1 403 Forbidden\r\n" },
+		StatusLine{ 404, "Not Found", "HTTP/1.1 404 Not Found\r\n" },
+		StatusLine{ 405, "Method Not Allowed", "HTTP/1.1 405 Method Not Allowed\r\n" },
+		StatusLine{ 412, "Precondition Failed", "HTTP/1.1 412 Precondition Failed\r\n" },
+		StatusLine{ 413, "Content Too Large", "HTTP/1.1 413 Content Too Large\r\n" },
+		StatusLine{ 416, "Range Not Satisfiable", "HTTP/1.1 416 Range Not Satisfiable\r\n" },
+		StatusLine{ 431, "Request Header Fields Too Large", "HTTP/1.1 431 Request Header Fields Too Large\r\n" },
+		StatusLine{ 500, "Internal Server Error", "HTTP/1.1 500 Internal Server Error\r\n" },
+		StatusLine{ 503, "Service Unavailable", "HTTP/1.1 503 Service Unavailable\r\n" },
+	};
+
+	// Empty unless the status line is in the table
+	std::string_view sStatusLine(int statusCode, std::string_view reasonPhrase) {
+		for (const auto &status : kStatusLines) {
+			if (status.statusCode == statusCode)
+				return status.reasonPhrase == reasonPhrase ? status.line : std::string_view{};
+		}
+		return {};
+	}
+
+	void sAppendNumber(std::string &out, std::integral auto value) {
+		std::array<char, 24> digits{};
+		auto [end, error] = std::to_chars(digits.data(), digits.data() + digits.size(), value);
+		out.append(digits.data(), end);
+	}
+} // namespace
+
+std::optional<Method> parseMethod(std::string_view method) {
+	// Dispatch on length first so each candidate costs at most one comparison
+	switch (method.size()) {
+	case 3:
+		if (method == "GET")
+			return Method::GET;
+		if (method == "PUT")
+			return Method::PUT;
+		break;
+	case 4:
+		if (method == "POST")
+			return Method::POST;
+		if (method == "HEAD")
+			return Method::HEAD;
+		break;
+	case 5:
+		if (method == "PATCH")
+			return Method::PATCH;
+		if (method == "TRACE")
+			return Method::TRACE;
+		break;
+	case 6:
+		if (method == "DELETE")
+			return Method::DELETE;
+		break;
+	case 7:
+		if (method == "OPTIONS")
+			return Method::OPTIONS;
+		if (method == "CONNECT")
+			return Method::CONNECT;
+		break;
+	default:
+		break;
+	}
+	return std::nullopt;
+}
+
+Method stringToMethod(std::string_view method) {
+	if (auto parsed = parseMethod(method))
+		return *parsed;
 
 	throw std::invalid_argument("Invalid HTTP method: " + std::string(method));
 }
 
-inline std::string methodToString(Method method) {
+std::string methodToString(Method method) {
 	switch (method) {
 	case Method::GET:
 		return "GET";
@@ -69,61 +141,149 @@ std::istream &operator>>(std::istream &is, Method &method) {
 	return is;
 }
 
-std::pair<std::string_view, std::string_view> Request::split_at(std::string_view str, char delimiter) {
-	size_t pos = str.find(delimiter);
-	if (pos == std::string_view::npos)
-		return { str, {} };
-	return { str.substr(0, pos), str.substr(pos + 1) };
+std::optional<std::string_view> RouteParams::find(std::string_view name) const {
+	for (const auto &[paramName, value] : params_) {
+		if (paramName == name)
+			return value;
+	}
+	return std::nullopt;
 }
 
-std::string_view Request::trim(std::string_view str) {
-	auto isSpace = [](unsigned char ch) {
-		return std::isspace(ch);
+std::optional<std::string_view> findQueryParameter(std::string_view query, std::string_view name) {
+	while (!query.empty()) {
+		size_t ampersand = query.find('&');
+		std::string_view pair = query.substr(0, ampersand);
+		query = ampersand == std::string_view::npos ? std::string_view{} : query.substr(ampersand + 1);
+
+		size_t equals = pair.find('=');
+		if (pair.substr(0, equals) == name)
+			return equals == std::string_view::npos ? std::string_view{} : pair.substr(equals + 1);
+	}
+	return std::nullopt;
+}
+
+std::string percentDecode(std::string_view text) {
+	auto hexValue = [](char c) {
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
 	};
-	str.remove_prefix(std::ranges::distance(str | std::views::take_while(isSpace)));
-	str.remove_suffix(std::ranges::distance(str | std::views::reverse | std::views::take_while(isSpace)));
-	return str;
+
+	std::string decoded;
+	decoded.reserve(text.size());
+	for (size_t i = 0; i < text.size(); ++i) {
+		if (text[i] == '%' && i + 2 < text.size() && hexValue(text[i + 1]) >= 0 && hexValue(text[i + 2]) >= 0) {
+			decoded += static_cast<char>(hexValue(text[i + 1]) * 16 + hexValue(text[i + 2]));
+			i += 2;
+		} else {
+			decoded += text[i];
+		}
+	}
+	return decoded;
 }
 
 Request Request::parse(std::string_view raw) {
-	Request req;
-	size_t pos = raw.find("\r\n\r\n");
-	std::string_view headerSection = raw.substr(0, pos);
-	std::string_view bodySection = (pos != std::string_view::npos) ? raw.substr(pos + 4) : "";
+	RequestParser parser;
+	// The body is whatever follows the header section, so only the head needs to be complete
+	size_t headEnd = findHeaderEnd(raw);
+	if (headEnd == std::string_view::npos)
+		throw std::runtime_error("Invalid request: incomplete header section");
 
-	std::string headerStr(headerSection); // Ensure persistent storage
-	std::istringstream headerStream(headerStr);
-	std::string line;
+	if (parser.parse(raw.substr(0, headEnd + 4)) != RequestParser::Status::Complete)
+		throw std::runtime_error(std::format("Invalid request: {}", parser.errorReason()));
 
-	if (!std::getline(headerStream, line) || line.empty()) {
-		throw std::runtime_error("Invalid request: missing request line");
-	}
+	Request req = parser.request();
+	req.body = raw.substr(headEnd + 4);
+	return req;
+}
 
-	std::istringstream requestLine(line);
-	if (!(requestLine >> req.method >> req.path)) {
-		throw std::runtime_error("Invalid request line format");
-	}
+std::string formatHttpDate(time_t time) {
+	std::tm tmStruct{};
+	gmtime_r(&time, &tmStruct);
+	std::array<char, 32> buffer{};
+	size_t length = std::strftime(buffer.data(), buffer.size(), "%a, %d %b %Y %H:%M:%S GMT", &tmStruct);
+	return { buffer.data(), length };
+}
+
+std::optional<time_t> parseHttpDate(std::string_view date) {
+	std::string terminated(date);
+	std::tm tmStruct{};
+	const char *end = strptime(terminated.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tmStruct);
+	if (end == nullptr || *end != '\0')
+		return std::nullopt;
+	return timegm(&tmStruct);
+}
+
+size_t bodyPartSize(const BodyPart &part) {
+	if (const auto *data = std::get_if<std::string>(&part))
+		return data->size();
+	if (const auto *shared = std::get_if<std::shared_ptr<const std::string>>(&part))
+		return (*shared)->size();
+	return std::get<FileRange>(part).length;
+}
+
+size_t Response::contentLength() const {
+	size_t length = body.size();
+	for (const auto &part : bodyParts)
+		length += bodyPartSize(part);
+	return length;
+}
+
+std::string Response::serializeHead() const {
+	std::string head;
+	appendHead(head);
+	return head;
+}
 
-	while (std::getline(headerStream, line) && !line.empty()) {
-		auto [key, value] = split_at(line, ':');
-		req.headers[std::string(trim(key))] = std::string(trim(value));
+void Response::appendHead(std::string &out) const {
+	if (std::string_view line = sStatusLine(statusCode, reasonPhrase); !line.empty()) {
+		out += line;
+	} else {
+		out += "HTTP/1.1 ";
+		sAppendNumber(out, statusCode);
+		out += ' ';
+		out += reasonPhrase;
+		out += "\r\n";
 	}
 
-	req.body = std::string(bodySection);
-	return req;
+	// A 304 describes the body it would have sent, so it must not claim a length of zero
+	bool bodyless = statusCode == 304 || statusCode == 204;
+	if (!bodyless) {
+		out += "Content-Length: ";
+		sAppendNumber(out, contentLength());
+		out += "\r\n";
+		if (!headers.contains(HeaderName::ContentType))
+			out += "Content-Type: text/html\r\n";
+	}
+	for (const auto &[name, value] : headers) {
+		// Well-known names are always spelled canonically
+		if (name == headerNameString(HeaderName::ContentLength))
+			continue;
+		out.append(name).append(": ").append(value).append("\r\n");
+	}
+	out += "\r\n";
 }
 
 std::string Response::serialize() const {
-	std::ostringstream oss;
-	oss << "HTTP/1.1 " << statusCode << " " << reasonPhrase << "\r\n";
-	oss << "Content-Length: " << body.size() << "\r\n";
-	if (headers.find("Content-Type") == headers.end())
-		oss << "Content-Type: text/html\r\n";
-	for (const auto &header : headers)
-		oss << header.first << ": " << header.second << "\r\n";
-	oss << "\r\n";
-	oss << body;
-	return oss.str();
+	std::string result;
+	result.reserve(256 + contentLength());
+	appendHead(result);
+	result += body;
+	for (const auto &part : bodyParts) {
+		if (const auto *data = std::get_if<std::string>(&part)) {
+			result += *data;
+		} else if (const auto *shared = std::get_if<std::shared_ptr<const std::string>>(&part)) {
+			result += **shared;
+		} else {
+			const auto &range = std::get<FileRange>(part);
+			size_t start = result.size();
+			result.resize(start + range.length);
+			ssize_t bytesRead = pread(range.file->fd(), result.data() + start, range.length, range.offset);
+			result.resize(start + static_cast<size_t>(std::max<ssize_t>(bytesRead, 0)));
+		}
+	}
+	return result;
 }
 
 } // namespace ou::http
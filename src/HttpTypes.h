@@ -1,48 +1,119 @@
 #pragma once
 
+#include "FileHandle.h"
+#include "HttpHeaders.h"
+#include "Task.h"
+
 #include <format>
-#include <map>
+#include <memory>
 #include <optional>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
 
+#include <ctime>
 #include <netinet/in.h>
+#include <sys/types.h>
 
 namespace ou::http {
 
 enum class Method { GET, POST, PUT, DELETE, PATCH, HEAD, OPTIONS, CONNECT, TRACE };
 
+std::optional<Method> parseMethod(std::string_view method);
 Method stringToMethod(std::string_view method);
 std::string methodToString(Method method);
 
 std::ostream &operator<<(std::ostream &os, Method method);
 std::istream &operator>>(std::istream &is, Method &method);
 
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+std::string formatHttpDate(time_t time);
+std::optional<time_t> parseHttpDate(std::string_view date);
+
+// Values captured by a route's ":name" and "*name" segments, in pattern order. Values are views into the request path.
+class RouteParams {
+public:
+	using Param = std::pair<std::string_view, std::string_view>;
+
+	void add(std::string_view name, std::string_view value) { params_.emplace_back(name, value); }
+	void removeLast() { params_.pop_back(); }
+	void clear() { params_.clear(); }
+
+	std::optional<std::string_view> find(std::string_view name) const;
+	// Empty if the parameter is absent
+	std::string_view operator[](std::string_view name) const { return find(name).value_or(std::string_view{}); }
+
+	size_t size() const { return params_.size(); }
+	bool empty() const { return params_.empty(); }
+	auto begin() const { return params_.begin(); }
+	auto end() const { return params_.end(); }
+
+private:
+	std::vector<Param> params_;
+};
+
+// Value of the first name=value pair with the given name in a query string (no percent-decoding)
+std::optional<std::string_view> findQueryParameter(std::string_view query, std::string_view name);
+
+// Decodes %XX escapes; malformed escapes are kept as they are
+std::string percentDecode(std::string_view text);
+
+// Views into the buffer the request was parsed from; they stay valid until the request has been handled.
 struct Request {
-	Method method;
-	std::string path;
-	std::map<std::string, std::string> headers;
-	std::string body;
+	Method method = Method::GET;
+	std::string_view path;	// Request target up to the '?'
+	std::string_view query; // Request target after the '?'
+	std::string_view version = "HTTP/1.1";
+	RequestHeaders headers;
+	std::string_view body;
+	RouteParams params;			// Filled in by the router for the matched route
+	std::string_view route; // What answered the request: a route pattern, a handler's regular expression, or "static"
 
 	std::optional<sockaddr_in> clientAddr;
 
+	// Parses a complete request held in raw; everything after the header section is taken as the body
 	static Request parse(std::string_view raw);
+};
 
-private:
-	static std::pair<std::string_view, std::string_view> split_at(std::string_view str, char delimiter);
-	static std::string_view trim(std::string_view str);
+// A byte range of an open file, sent with sendfile() rather than read into memory.
+struct FileRange {
+	std::shared_ptr<const FileHandle> file;
+	off_t offset = 0;
+	size_t length = 0;
 };
 
+// Piece of a response body sent without being copied into Response::body: a literal, an immutable buffer shared with a
+// cache, or a file range.
+using BodyPart = std::variant<std::string, std::shared_ptr<const std::string>, FileRange>;
+
+size_t bodyPartSize(const BodyPart &part);
+
 struct Response {
 	int statusCode = 200;
 	std::string reasonPhrase = "OK";
-	std::map<std::string, std::string> headers;
+	ResponseHeaders headers;
 	std::string body;
+	std::vector<BodyPart> bodyParts = {}; // Sent after `body`
 
+	size_t contentLength() const;
+
+	// Status line and headers, including the terminating blank line. Content-Length is always the length of the body
+	// parts, so one set in headers is left out.
+	std::string serializeHead() const;
+	// Appends the same text to out, reusing its capacity
+	void appendHead(std::string &out) const;
+	// Head followed by the whole body, with file parts read into memory
 	std::string serialize() const;
 };
 
+// What answering a request gives: a response, or the suspended task of an asynchronous handler that will produce it.
+// Either way, nullopt if no response could be produced.
+using PendingResponse = Task<std::optional<Response>>;
+using DispatchResult = std::variant<std::optional<Response>, PendingResponse>;
+
 } // namespace ou::http
 
 template <> struct std::formatter<ou::http::Method> : std::formatter<std::string> {
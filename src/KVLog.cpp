@@ -0,0 +1,478 @@
+#include "KVLog.h"
+#include "Logging.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace ou::http {
+
+namespace {
+	// Log record: crc32 of the rest | key length | value length | op | [expiry, SetExpiring only] | key | value
+	constexpr size_t kRecordHeader = 4 + 4 + 4 + 1;
+	// Snapshot: magic | (key length | value length | expiry | key | value)* | entry count | crc32 of everything before
+	// it. Version 1 snapshots have no expiry field.
+	constexpr std::string_view kSnapshotMagic = "OUKVSNP2";
+	constexpr std::string_view kSnapshotMagicV1 = "OUKVSNP1";
+	constexpr size_t kSnapshotTrailer = 8 + 4;
+
+	// Without an fsync per batch there is nothing to wait for, so batches are only written early once this large
+	constexpr size_t kEagerCommitBytes = 1024 * 1024;
+	constexpr size_t kSnapshotBufferBytes = 1024 * 1024;
+
+	void sAppendInt(std::string &out, uint64_t value, size_t bytes) {
+		for (size_t i = 0; i < bytes; ++i)
+			out += static_cast<char>(value >> (8 * i));
+	}
+
+	uint64_t sReadInt(const char *data, size_t bytes) {
+		uint64_t value = 0;
+		for (size_t i = 0; i < bytes; ++i)
+			value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+		return value;
+	}
+
+	uint32_t sCrc(uint32_t crc, const char *data, size_t size) {
+		return static_cast<uint32_t>(crc32_z(crc, reinterpret_cast<const Bytef *>(data), size));
+	}
+
+	bool sWriteAll(int fd, std::string_view data) {
+		while (!data.empty()) {
+			ssize_t written = write(fd, data.data(), data.size());
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			data.remove_prefix(static_cast<size_t>(written));
+		}
+		return true;
+	}
+
+	// Makes file creations, renames and deletions in the directory durable
+	void sSyncDirectory(const std::filesystem::path &directory) {
+		int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+
+	// Read-only mapping of a whole file; empty if the file is empty or cannot be mapped
+	class MappedFile {
+	public:
+		explicit MappedFile(const std::filesystem::path &path) {
+			int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return;
+			struct stat fileStat {};
+			if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+				void *data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data != MAP_FAILED) {
+					// Recovery reads front to back exactly once
+					madvise(data, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+					data_ = static_cast<const char *>(data);
+					size_ = static_cast<size_t>(fileStat.st_size);
+				}
+			}
+			close(fd);
+		}
+		~MappedFile() {
+			if (data_ != nullptr)
+				munmap(const_cast<char *>(data_), size_);
+		}
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		std::string_view contents() const { return { data_, size_ }; }
+
+	private:
+		const char *data_ = nullptr;
+		size_t size_ = 0;
+	};
+
+	// Matches "<prefix><generation><suffix>"
+	std::optional<uint64_t> sParseGeneration(std::string_view name, std::string_view prefix, std::string_view suffix) {
+		if (!name.starts_with(prefix) || !name.ends_with(suffix) || name.size() == prefix.size() + suffix.size())
+			return std::nullopt;
+		std::string_view digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+		uint64_t generation = 0;
+		auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), generation);
+		if (ec != std::errc() || end != digits.data() + digits.size())
+			return std::nullopt;
+		return generation;
+	}
+
+	// Returns the number of entries applied, or nullopt (having applied nothing) if the snapshot is corrupt
+	std::optional<uint64_t> sLoadSnapshot(const std::filesystem::path &path, const KVLog::Apply &apply) {
+		MappedFile file(path);
+		std::string_view data = file.contents();
+		if (data.size() < kSnapshotMagic.size() + kSnapshotTrailer || !(data.starts_with(kSnapshotMagic) || data.starts_with(kSnapshotMagicV1)))
+			return std::nullopt;
+		size_t entryHeader = data.starts_with(kSnapshotMagic) ? 16 : 8;
+		size_t trailer = data.size() - kSnapshotTrailer;
+		if (sCrc(0, data.data(), trailer + 8) != sReadInt(data.data() + trailer + 8, 4))
+			return std::nullopt;
+
+		uint64_t count = sReadInt(data.data() + trailer, 8);
+		size_t offset = kSnapshotMagic.size();
+		for (uint64_t i = 0; i < count; ++i) {
+			if (offset + entryHeader > trailer)
+				return std::nullopt;
+			size_t keyLength = sReadInt(data.data() + offset, 4);
+			size_t valueLength = sReadInt(data.data() + offset + 4, 4);
+			auto expiresAt = entryHeader == 16 ? static_cast<int64_t>(sReadInt(data.data() + offset + 8, 8)) : 0;
+			offset += entryHeader;
+			if (offset + keyLength + valueLength > trailer)
+				return std::nullopt;
+			apply(KVLog::Op::Set, data.substr(offset, keyLength), data.substr(offset + keyLength, valueLength), expiresAt);
+			offset += keyLength + valueLength;
+		}
+		return count;
+	}
+
+	// Returns the number of records replayed; a torn or corrupt tail is cut off so that appends continue after the
+	// last good record
+	uint64_t sReplayLog(const std::filesystem::path &path, const KVLog::Apply &apply) {
+		uint64_t records = 0;
+		size_t offset = 0;
+		size_t size = 0;
+		{
+			MappedFile file(path);
+			std::string_view data = file.contents();
+			size = data.size();
+			while (offset + kRecordHeader <= data.size()) {
+				const char *record = data.data() + offset;
+				size_t keyLength = sReadInt(record + 4, 4);
+				size_t valueLength = sReadInt(record + 8, 4);
+				auto op = static_cast<KVLog::Op>(record[12]);
+				if (op != KVLog::Op::Set && op != KVLog::Op::Remove && op != KVLog::Op::SetExpiring)
+					break;
+				size_t header = kRecordHeader + (op == KVLog::Op::SetExpiring ? 8 : 0);
+				size_t length = header + keyLength + valueLength;
+				if (length > data.size() - offset || sCrc(0, record + 4, length - 4) != sReadInt(record, 4))
+					break;
+				int64_t expiresAt = 0;
+				if (op == KVLog::Op::SetExpiring) {
+					expiresAt = static_cast<int64_t>(sReadInt(record + kRecordHeader, 8));
+					op = KVLog::Op::Set;
+				}
+				apply(op, data.substr(offset + header, keyLength), data.substr(offset + header + keyLength, valueLength), expiresAt);
+				offset += length;
+				++records;
+			}
+		}
+		if (offset < size) {
+			LOG_WARN("Discarding {} bytes of torn or corrupt records at the end of {}", size - offset, path.string());
+			if (truncate(path.c_str(), static_cast<off_t>(offset)) < 0)
+				LOG_ERROR("Failed to truncate {}: {}", path.string(), std::strerror(errno));
+		}
+		return records;
+	}
+} // namespace
+
+KVLog::KVLog(Config config, const Apply &apply, SnapshotSource snapshotSource)
+		: config_(std::move(config)), snapshotSource_(std::move(snapshotSource)) {
+	recover(apply);
+	lastSync_ = std::chrono::steady_clock::now();
+	committer_ = std::thread([this]() { committerThread(); });
+	compactor_ = std::thread([this]() { compactorThread(); });
+}
+
+KVLog::~KVLog() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	commitWake_.notify_one();
+	compactWake_.notify_one();
+	compactor_.join();
+	// The committer writes and syncs whatever is still pending before it exits
+	committer_.join();
+	close(fd_);
+}
+
+uint64_t KVLog::append(Op op, std::string_view key, std::string_view value, int64_t expiresAt) {
+	// Encoded and checksummed before taking the lock that all writers share
+	thread_local std::string record;
+	record.clear();
+	sAppendInt(record, 0, 4);
+	sAppendInt(record, key.size(), 4);
+	sAppendInt(record, value.size(), 4);
+	if (op == Op::Set && expiresAt != 0) {
+		record += static_cast<char>(Op::SetExpiring);
+		sAppendInt(record, static_cast<uint64_t>(expiresAt), 8);
+	} else {
+		record += static_cast<char>(op);
+	}
+	record += key;
+	record += value;
+	uint32_t crc = sCrc(0, record.data() + 4, record.size() - 4);
+	for (size_t i = 0; i < 4; ++i)
+		record[i] = static_cast<char>(crc >> (8 * i));
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (error_ != 0)
+		throw std::system_error(error_, std::generic_category(), "Write-ahead log failed earlier; no more records accepted");
+	pending_ += record;
+	if (config_.fsync == FsyncPolicy::Always || pending_.size() >= kEagerCommitBytes)
+		commitWake_.notify_one();
+	return ++appendedSequence_;
+}
+
+void KVLog::waitDurable(uint64_t sequence) {
+	if (config_.fsync != FsyncPolicy::Always)
+		return;
+	std::unique_lock<std::mutex> lock(mutex_);
+	durable_.wait(lock, [this, sequence]() { return durableSequence_ >= sequence || error_ != 0; });
+	if (durableSequence_ < sequence)
+		throw std::system_error(error_, std::generic_category(), "Failed to make write-ahead log record durable");
+}
+
+void KVLog::compact() {
+	std::lock_guard<std::mutex> compactLock(compactMutex_);
+
+	// Everything appended before the switch lands in the old log; the snapshot then reflects at least that much, and
+	// replaying the new log on top of it converges because sets and removes are absolute
+	uint64_t generation = 0;
+	{
+		std::lock_guard<std::mutex> fileLock(fileMutex_);
+		commitBatch(true);
+		{
+			// A failed log keeps its torn tail; recovery, not a new generation, deals with it
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (error_ != 0)
+				return;
+		}
+		int fd = -1;
+		try {
+			fd = openLog(generation_ + 1);
+		} catch (const std::system_error &error) {
+			LOG_ERROR("Compaction failed: {}", error.what());
+			return;
+		}
+		close(fd_);
+		fd_ = fd;
+		generation = ++generation_;
+		std::lock_guard<std::mutex> lock(mutex_);
+		logBytes_ = 0;
+	}
+
+	std::filesystem::path temporaryPath = snapshotPath(generation);
+	temporaryPath += ".tmp";
+	int fd = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		LOG_ERROR("Failed to create snapshot {}: {}", temporaryPath.string(), std::strerror(errno));
+		return;
+	}
+
+	std::string buffer(kSnapshotMagic);
+	uint32_t crc = 0;
+	uint64_t count = 0;
+	bool ok = true;
+	auto flushBuffer = [&]() {
+		crc = sCrc(crc, buffer.data(), buffer.size());
+		ok = ok && sWriteAll(fd, buffer);
+		buffer.clear();
+	};
+	snapshotSource_([&](std::string_view key, std::string_view value, int64_t expiresAt) {
+		sAppendInt(buffer, key.size(), 4);
+		sAppendInt(buffer, value.size(), 4);
+		sAppendInt(buffer, static_cast<uint64_t>(expiresAt), 8);
+		buffer += key;
+		buffer += value;
+		++count;
+		if (buffer.size() >= kSnapshotBufferBytes)
+			flushBuffer();
+	});
+	sAppendInt(buffer, count, 8);
+	flushBuffer();
+	std::string checksum;
+	sAppendInt(checksum, crc, 4);
+	ok = ok && sWriteAll(fd, checksum) && fdatasync(fd) == 0;
+	close(fd);
+	if (!ok || std::rename(temporaryPath.c_str(), snapshotPath(generation).c_str()) != 0) {
+		LOG_ERROR("Failed to write snapshot {}: {}", temporaryPath.string(), std::strerror(errno));
+		unlink(temporaryPath.c_str());
+		return;
+	}
+	sSyncDirectory(config_.directory);
+
+	// The new snapshot supersedes every older snapshot and log
+	std::error_code error;
+	for (const auto &entry : std::filesystem::directory_iterator(config_.directory, error)) {
+		std::string name = entry.path().filename().string();
+		auto older = sParseGeneration(name, "snapshot-", ".dat");
+		if (!older)
+			older = sParseGeneration(name, "log-", ".wal");
+		if (older && *older < generation)
+			std::filesystem::remove(entry.path(), error);
+	}
+	compactions_.fetch_add(1, std::memory_order_relaxed);
+	LOG_DEBUG("Compacted {} into a snapshot of {} keys", config_.directory.string(), count);
+}
+
+KVLog::Stats KVLog::stats() const {
+	Stats stats;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats.records = appendedSequence_;
+	}
+	stats.commits = commits_.load(std::memory_order_relaxed);
+	stats.syncs = syncs_.load(std::memory_order_relaxed);
+	stats.logBytes = logBytes_.load(std::memory_order_relaxed);
+	stats.compactions = compactions_.load(std::memory_order_relaxed);
+	stats.recoveredRecords = recoveredRecords_;
+	stats.recoveryTime = recoveryTime_;
+	return stats;
+}
+
+std::filesystem::path KVLog::logPath(uint64_t generation) const { return config_.directory / ("log-" + std::to_string(generation) + ".wal"); }
+
+std::filesystem::path KVLog::snapshotPath(uint64_t generation) const {
+	return config_.directory / ("snapshot-" + std::to_string(generation) + ".dat");
+}
+
+void KVLog::recover(const Apply &apply) {
+	auto start = std::chrono::steady_clock::now();
+	std::filesystem::create_directories(config_.directory);
+
+	std::map<uint64_t, std::filesystem::path> snapshots;
+	std::map<uint64_t, std::filesystem::path> logs;
+	for (const auto &entry : std::filesystem::directory_iterator(config_.directory)) {
+		std::string name = entry.path().filename().string();
+		if (auto generation = sParseGeneration(name, "snapshot-", ".dat"))
+			snapshots[*generation] = entry.path();
+		else if (auto generation = sParseGeneration(name, "log-", ".wal"))
+			logs[*generation] = entry.path();
+		else if (name.ends_with(".tmp"))
+			std::filesystem::remove(entry.path()); // A compaction that did not finish
+	}
+
+	uint64_t base = 0;
+	for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it) {
+		if (auto count = sLoadSnapshot(it->second, apply)) {
+			base = it->first;
+			recoveredRecords_ += *count;
+			break;
+		}
+		LOG_ERROR("Ignoring corrupt snapshot {}", it->second.string());
+	}
+
+	generation_ = base;
+	for (auto it = logs.lower_bound(base); it != logs.end(); ++it) {
+		recoveredRecords_ += sReplayLog(it->second, apply);
+		generation_ = it->first;
+	}
+
+	fd_ = openLog(generation_);
+	struct stat fileStat {};
+	logBytes_ = fstat(fd_, &fileStat) == 0 ? static_cast<uint64_t>(fileStat.st_size) : 0;
+	recoveryTime_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	LOG_INFO("Recovered {} records from {} in {} ms", recoveredRecords_, config_.directory.string(), recoveryTime_.count());
+}
+
+int KVLog::openLog(uint64_t generation) {
+	std::filesystem::path path = logPath(generation);
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(), "Failed to open " + path.string());
+	sSyncDirectory(config_.directory);
+	return fd;
+}
+
+void KVLog::commitBatch(bool sync) {
+	// Caller holds fileMutex_, so batches reach the file in the order they were taken. The two buffers trade places
+	// rather than being reallocated.
+	uint64_t sequence = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		// Nothing more goes after a torn record, which would hide it from replay
+		if (error_ != 0) {
+			pending_.clear();
+			return;
+		}
+		writing_.swap(pending_);
+		sequence = appendedSequence_;
+	}
+
+	int error = 0;
+	size_t written = writing_.size();
+	if (!writing_.empty()) {
+		if (!sWriteAll(fd_, writing_)) {
+			error = errno;
+			LOG_ERROR("Failed to write to {}: {}", logPath(generation_).string(), std::strerror(error));
+		}
+		writing_.clear();
+		unsynced_ = true;
+		commits_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	bool due = config_.fsync == FsyncPolicy::Always || (config_.fsync == FsyncPolicy::Interval && now - lastSync_ >= config_.syncInterval);
+	if (error == 0 && unsynced_ && (sync || due)) {
+		// After a failed fdatasync() the kernel may have dropped the dirty pages, so retrying cannot prove anything
+		if (fdatasync(fd_) < 0) {
+			error = errno;
+			LOG_ERROR("Failed to sync {}: {}", logPath(generation_).string(), std::strerror(error));
+		}
+		unsynced_ = false;
+		syncs_.fetch_add(1, std::memory_order_relaxed);
+		lastSync_ = now;
+	}
+
+	bool compact = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (error != 0)
+			error_ = error;
+		else
+			durableSequence_ = sequence;
+		logBytes_ += written;
+		compact = error_ == 0 && config_.compactionLogBytes > 0 && logBytes_ >= config_.compactionLogBytes;
+	}
+	durable_.notify_all();
+	if (compact)
+		compactWake_.notify_one();
+}
+
+void KVLog::committerThread() {
+	bool stopping = false;
+	while (!stopping) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			commitWake_.wait_for(lock, config_.syncInterval, [this]() {
+				return stopping_ || (!pending_.empty() && (config_.fsync == FsyncPolicy::Always || pending_.size() >= kEagerCommitBytes));
+			});
+			stopping = stopping_;
+		}
+		std::lock_guard<std::mutex> fileLock(fileMutex_);
+		commitBatch(stopping);
+	}
+}
+
+void KVLog::compactorThread() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		compactWake_.wait(lock, [this]() {
+			return stopping_ || (error_ == 0 && config_.compactionLogBytes > 0 && logBytes_ >= config_.compactionLogBytes);
+		});
+		if (stopping_)
+			return;
+		lock.unlock();
+		compact();
+		lock.lock();
+	}
+}
+
+} // namespace ou::http
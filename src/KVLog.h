@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace ou::http {
+
+// Durability backend for KVStore: an append-only write-ahead log plus periodic snapshots, both kept in one directory.
+// Records are appended to an in-memory batch and written by a committer thread, so one write() and one fdatasync()
+// cover every record appended while the previous batch was being synced (group commit). Once the log grows past a
+// threshold, a compactor thread switches to a new log, writes a snapshot of the store and deletes the files it
+// supersedes.
+//
+// Files are named snapshot-<generation>.dat and log-<generation>.wal. Recovery loads the newest valid snapshot and
+// replays every log of the same or a later generation, stopping at the first torn or corrupt record.
+class KVLog {
+public:
+	enum class FsyncPolicy {
+		Never,		// Leave flushing to the kernel; a crash loses what it had not written back
+		Interval, // fdatasync() at most once per syncInterval; a crash loses up to that much
+		Always,		// A write returns once its record is on disk, batched with concurrent writes
+	};
+
+	struct Config {
+		std::filesystem::path directory;
+		FsyncPolicy fsync = FsyncPolicy::Always;
+		std::chrono::milliseconds syncInterval{ 1000 };
+		size_t compactionLogBytes = 64 * 1024 * 1024; // Compact once the log grows past this; 0 disables
+	};
+
+	// SetExpiring is a Set whose record also carries an expiry time
+	enum class Op : uint8_t { Set = 1, Remove = 2, SetExpiring = 3 };
+
+	struct Stats {
+		uint64_t records = 0;		// Appended since startup
+		uint64_t commits = 0;		// Batches written
+		uint64_t syncs = 0;			// fdatasync() calls
+		uint64_t logBytes = 0;	// Size of the current log
+		uint64_t compactions = 0;
+		uint64_t recoveredRecords = 0; // Snapshot entries plus log records replayed at startup
+		std::chrono::milliseconds recoveryTime{ 0 };
+	};
+
+	// Called for every recovered entry with op Set or Remove; value is empty for Remove. expiresAt is in milliseconds
+	// since the Unix epoch, 0 for entries that do not expire.
+	using Apply = std::function<void(Op op, std::string_view key, std::string_view value, int64_t expiresAt)>;
+	using Emit = std::function<void(std::string_view key, std::string_view value, int64_t expiresAt)>;
+	// Passes every live entry to emit. Runs on the compactor thread while writes continue.
+	using SnapshotSource = std::function<void(const Emit &emit)>;
+
+	// Recovers through apply before returning. Throws std::system_error if the directory or log cannot be opened.
+	KVLog(Config config, const Apply &apply, SnapshotSource snapshotSource);
+	~KVLog();
+
+	KVLog(const KVLog &) = delete;
+	KVLog &operator=(const KVLog &) = delete;
+
+	// Must be called while the key is locked against other writers, so that the log orders each key's updates the
+	// same way the store applied them. Returns a sequence number for waitDurable(). Throws std::system_error once a
+	// write or sync of the log has failed: records after a torn one would be lost on replay.
+	uint64_t append(Op op, std::string_view key, std::string_view value, int64_t expiresAt = 0);
+
+	// Blocks until the record is durable under the configured policy; only FsyncPolicy::Always ever waits. Throws
+	// std::system_error if writing or syncing the log failed first.
+	void waitDurable(uint64_t sequence);
+
+	// Writes a snapshot and drops the log it covers before returning
+	void compact();
+
+	Stats stats() const;
+
+private:
+	std::filesystem::path logPath(uint64_t generation) const;
+	std::filesystem::path snapshotPath(uint64_t generation) const;
+	void recover(const Apply &apply);
+	int openLog(uint64_t generation);
+	// Writes the pending batch; syncs if the policy calls for it or sync is set. Requires fileMutex_.
+	void commitBatch(bool sync);
+	void committerThread();
+	void compactorThread();
+
+	const Config config_;
+	const SnapshotSource snapshotSource_;
+
+	// Held while writing to or switching the log file; taken before mutex_
+	std::mutex fileMutex_;
+	int fd_ = -1;
+	uint64_t generation_ = 0;
+	std::string writing_;
+	bool unsynced_ = false;
+	std::chrono::steady_clock::time_point lastSync_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable commitWake_;
+	std::condition_variable durable_;
+	std::condition_variable compactWake_;
+	std::string pending_;
+	uint64_t appendedSequence_ = 0;
+	uint64_t durableSequence_ = 0;
+	int error_ = 0; // errno of the first failed write or sync; durableSequence_ stops there
+	bool stopping_ = false;
+
+	std::mutex compactMutex_; // Serializes compactions
+
+	std::atomic<uint64_t> commits_{ 0 };
+	std::atomic<uint64_t> syncs_{ 0 };
+	std::atomic<uint64_t> logBytes_{ 0 };
+	std::atomic<uint64_t> compactions_{ 0 };
+	uint64_t recoveredRecords_ = 0;
+	std::chrono::milliseconds recoveryTime_{ 0 };
+
+	std::thread committer_;
+	std::thread compactor_;
+};
+
+} // namespace ou::http
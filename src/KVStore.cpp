@@ -1,61 +1,559 @@
 #include "KVStore.h"
 
-#include <sstream>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <tuple>
 
 namespace ou::http {
 
-void KVStore::set(const std::string &key, const std::string &value) {
-	std::lock_guard<std::mutex> lock(mutex_);
-	store_[key] = value;
+namespace {
+	// Rough heap cost of an entry beyond its key and value bytes: map node, string headers and the value's control block
+	constexpr size_t kEntryOverhead = 96;
+	// Added to that when the entry is also in the ordered index
+	constexpr size_t kIndexOverhead = 64;
+	// Keys examined per eviction; more samples approximate LRU better at a higher cost per write
+	constexpr int kEvictionSamples = 5;
+	// Upper bound on keys reclaimed per shard while its lock is held
+	constexpr size_t kMaxReclaimedPerPass = 256;
+
+	// Wall-clock time, so that expiry times survive a restart
+	int64_t sNowMillis() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	// Only differences between ticks matter, so truncation to 32 bits is harmless for ages below 49 days
+	uint32_t sAccessTick() {
+		return static_cast<uint32_t>(
+				std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	bool sExpired(int64_t expiresAt, int64_t now) { return expiresAt != 0 && expiresAt <= now; }
+
+	int64_t sExpiresAt(std::chrono::milliseconds ttl) { return ttl.count() > 0 ? sNowMillis() + ttl.count() : 0; }
+
+	constexpr size_t kDefaultScanLimit = 100;
+	constexpr size_t kMaxScanLimit = 10000;
+
+	// A ttl in seconds; at most a century
+	std::optional<uint64_t> sParseTtl(std::string_view text) {
+		uint64_t seconds = 0;
+		auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), seconds);
+		if (ec != std::errc() || end != text.data() + text.size() || seconds > 100ull * 365 * 24 * 3600)
+			return std::nullopt;
+		return seconds;
+	}
+
+	struct BatchOperation {
+		char type; // 'G', 'S' or 'D'
+		size_t keyLength = 0;
+		size_t valueLength = 0;
+		uint64_t ttlSeconds = 0;
+		std::string_view key;
+		std::string_view value;
+	};
+
+	// Parses a batch operation's header line, e.g. "S 5 11 60"
+	std::optional<BatchOperation> sParseBatchOperation(std::string_view line) {
+		std::array<std::string_view, 4> fields{};
+		size_t count = 0;
+		while (!line.empty()) {
+			if (count == fields.size())
+				return std::nullopt;
+			size_t space = line.find(' ');
+			fields[count++] = line.substr(0, space);
+			line = space == std::string_view::npos ? std::string_view{} : line.substr(space + 1);
+		}
+		auto number = [](std::string_view text, auto &value) {
+			auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+			return ec == std::errc() && end == text.data() + text.size();
+		};
+
+		if (count == 0 || fields[0].size() != 1)
+			return std::nullopt;
+		BatchOperation operation{ fields[0][0] };
+		bool isSet = operation.type == 'S';
+		if ((operation.type != 'G' && operation.type != 'D' && !isSet) || count < (isSet ? 3u : 2u) || count > (isSet ? 4u : 2u))
+			return std::nullopt;
+		if (!number(fields[1], operation.keyLength) || (isSet && !number(fields[2], operation.valueLength)))
+			return std::nullopt;
+		if (count == 4) {
+			std::optional<uint64_t> ttl = sParseTtl(fields[3]);
+			if (!ttl)
+				return std::nullopt;
+			operation.ttlSeconds = *ttl;
+		}
+		return operation;
+	}
+
+	Response sReadOnly() { return { 403, "Forbidden", { { "Content-Type", "text/plain" } }, "Read-only follower; write to the leader" }; }
+
+	Response sTooLarge(size_t shardBudget) {
+		return { 413, "Payload Too Large", { { "Content-Type", "text/plain" } }, std::format("Entries are limited to {} bytes", shardBudget) };
+	}
+
+	constexpr auto sHeapOrder = [](const std::pair<int64_t, std::string> &a, const std::pair<int64_t, std::string> &b) {
+		return a.first > b.first;
+	};
+} // namespace
+
+KVStore::KVStore() : KVStore(Config{}) {}
+
+KVStore::KVStore(Config config)
+		: shardBits_(static_cast<size_t>(std::countr_zero(std::bit_ceil(std::max<size_t>(config.shardCount, 1))))),
+			shardBudget_(config.maxBytes == 0 ? 0 : std::max<size_t>(config.maxBytes >> shardBits_, 1)),
+			orderedIndex_(config.orderedIndex),
+			entryOverhead_(kEntryOverhead + (config.orderedIndex ? kIndexOverhead : 0)),
+			expiryInterval_(config.expiryInterval),
+			shards_(std::make_unique<Shard[]>(shardCount())) {
+	if (config.persistence) {
+		// Nothing else can see the store yet, so recovery skips the locks
+		auto apply = [this, now = sNowMillis()](KVLog::Op op, std::string_view key, std::string_view value, int64_t expiresAt) {
+			Shard &shard = shardFor(key);
+			if (op == KVLog::Op::Set && !sExpired(expiresAt, now)) {
+				std::vector<Value> evicted;
+				store(shard, key, std::make_shared<const std::string>(value), expiresAt, evicted);
+			} else if (auto it = shard.map.find(key); it != shard.map.end()) {
+				erase(shard, it);
+			}
+		};
+		log_ = std::make_unique<KVLog>(std::move(*config.persistence), apply, [this](const KVLog::Emit &emit) { snapshot(emit); });
+	}
+	if (config.leader)
+		leader_ = std::make_unique<ReplicationLeader>(std::move(*config.leader), [this](const KVLog::Emit &emit) { snapshot(emit); });
+	if (config.follower) {
+		// Changes go through the ordinary write path, so a follower logs them and passes them on to its own followers
+		auto apply = [this](KVLog::Op op, std::string_view key, std::string_view value, int64_t expiresAt) {
+			if (op == KVLog::Op::Remove)
+				removeUnsynced(key);
+			else
+				setUnsynced(key, std::make_shared<const std::string>(value), expiresAt);
+		};
+		follower_ = std::make_unique<ReplicationFollower>(std::move(*config.follower), apply, [this]() { clear(); });
+	}
+	expirer_ = std::thread([this]() { expiryThread(); });
+}
+
+KVStore::~KVStore() {
+	{
+		std::lock_guard<std::mutex> lock(expiryMutex_);
+		stopping_ = true;
+	}
+	expiryWake_.notify_one();
+	expirer_.join();
+}
+
+void KVStore::set(std::string_view key, std::string value, std::chrono::milliseconds ttl) {
+	if (!fitsShard(key, value.size()))
+		throw std::length_error(std::format("Entry of {} bytes exceeds the per-shard budget of {}", key.size() + value.size(), shardBudget_));
+	// Allocated before taking the lock
+	waitDurable(setUnsynced(key, std::make_shared<const std::string>(std::move(value)), sExpiresAt(ttl)));
+}
+
+uint64_t KVStore::setUnsynced(std::string_view key, Value value, int64_t expiresAt) {
+	// The old value and any evicted ones are released after dropping the lock
+	Value previous;
+	std::vector<Value> evicted;
+	uint64_t sequence = 0;
+	{
+		Shard &shard = shardFor(key);
+		std::unique_lock<std::shared_mutex> lock(shard.mutex);
+		if (log_)
+			sequence = log_->append(KVLog::Op::Set, key, *value, expiresAt);
+		if (leader_)
+			leader_->publish(KVLog::Op::Set, key, *value, expiresAt);
+		previous = store(shard, key, std::move(value), expiresAt, evicted);
+	}
+	return sequence;
+}
+
+void KVStore::waitDurable(uint64_t sequence) {
+	if (log_ && sequence != 0)
+		log_->waitDurable(sequence);
 }
 
-std::optional<std::string> KVStore::get(const std::string &key) const {
-	std::lock_guard<std::mutex> lock(mutex_);
-	auto it = store_.find(key);
-	if (it != store_.end()) {
-		return it->second;
+KVStore::Value KVStore::get(std::string_view key) const {
+	Shard &shard = shardFor(key);
+	std::shared_lock<std::shared_mutex> lock(shard.mutex);
+	auto it = shard.map.find(key);
+	if (it == shard.map.end())
+		return nullptr;
+	const Entry &entry = it->second;
+	// Expired entries stay until a writer or the background sweep takes the exclusive lock
+	if (entry.expiresAt != 0 && sExpired(entry.expiresAt, sNowMillis()))
+		return nullptr;
+	if (shardBudget_ > 0) {
+		// Skipping the store when the tick has not moved keeps hot keys' cache lines shared between readers
+		uint32_t tick = sAccessTick();
+		if (entry.lastAccess.load(std::memory_order_relaxed) != tick)
+			entry.lastAccess.store(tick, std::memory_order_relaxed);
 	}
-	return std::nullopt;
+	return entry.value;
 }
 
-bool KVStore::remove(const std::string &key) {
-	std::lock_guard<std::mutex> lock(mutex_);
-	return store_.erase(key) > 0;
+bool KVStore::remove(std::string_view key) {
+	std::optional<uint64_t> sequence = removeUnsynced(key);
+	if (!sequence)
+		return false;
+	waitDurable(*sequence);
+	return true;
 }
 
-static std::optional<std::string> get_query_key(const std::string &path) {
-	auto pos = path.find('?');
-	if (pos == std::string::npos)
+std::optional<uint64_t> KVStore::removeUnsynced(std::string_view key) {
+	Value removed;
+	uint64_t sequence = 0;
+	Shard &shard = shardFor(key);
+	std::unique_lock<std::shared_mutex> lock(shard.mutex);
+	auto it = shard.map.find(key);
+	if (it == shard.map.end())
+		return std::nullopt;
+	if (sExpired(it->second.expiresAt, sNowMillis())) {
+		removed = erase(shard, it);
+		expirations_.fetch_add(1, std::memory_order_relaxed);
+		lock.unlock();
 		return std::nullopt;
-	std::string query = path.substr(pos + 1);
-	std::istringstream iss(query);
-	std::string pair;
-	while (std::getline(iss, pair, '&')) {
-		auto eq = pair.find('=');
-		if (eq != std::string::npos && pair.substr(0, eq) == "key") {
-			return pair.substr(eq + 1);
+	}
+	if (log_)
+		sequence = log_->append(KVLog::Op::Remove, key, {});
+	if (leader_)
+		leader_->publish(KVLog::Op::Remove, key, {});
+	removed = erase(shard, it);
+	// Freed outside the lock
+	lock.unlock();
+	return sequence;
+}
+
+KVStore::ScanResult KVStore::scan(std::string_view from, std::string_view to, size_t limit) const {
+	ScanResult result;
+	if (!orderedIndex_ || limit == 0)
+		return result;
+
+	// Merges the shards' ranges, holding every shard's shared lock so that only the limit + 1 keys that make up the
+	// page and the start of the next are visited. Locks are taken in shard order, and writers only ever hold one.
+	using Iterator = decltype(Shard::index)::const_iterator;
+	struct Cursor {
+		Iterator it;
+		Iterator end;
+	};
+	int64_t now = sNowMillis();
+	auto skipExpired = [now](Cursor &cursor) {
+		while (cursor.it != cursor.end && sExpired(cursor.it->second->expiresAt, now))
+			++cursor.it;
+	};
+	std::vector<std::shared_lock<std::shared_mutex>> locks;
+	std::vector<Cursor> cursors;
+	locks.reserve(shardCount());
+	cursors.reserve(shardCount());
+	for (size_t i = 0; i < shardCount(); ++i) {
+		const Shard &shard = shards_[i];
+		locks.emplace_back(shard.mutex);
+		Cursor cursor{ shard.index.lower_bound(from), to.empty() ? shard.index.end() : shard.index.lower_bound(to) };
+		skipExpired(cursor);
+		if (cursor.it != cursor.end)
+			cursors.push_back(cursor);
+	}
+
+	auto laterKey = [](const Cursor &a, const Cursor &b) { return a.it->first > b.it->first; };
+	std::make_heap(cursors.begin(), cursors.end(), laterKey);
+	while (!cursors.empty()) {
+		std::pop_heap(cursors.begin(), cursors.end(), laterKey);
+		Cursor &cursor = cursors.back();
+		if (result.entries.size() == limit) {
+			result.nextKey = std::string(cursor.it->first);
+			break;
 		}
+		result.entries.emplace_back(std::string(cursor.it->first), cursor.it->second->value);
+		++cursor.it;
+		skipExpired(cursor);
+		if (cursor.it == cursor.end)
+			cursors.pop_back();
+		else
+			std::push_heap(cursors.begin(), cursors.end(), laterKey);
+	}
+	return result;
+}
+
+KVStore::ScanResult KVStore::scanPrefix(std::string_view prefix, std::string_view from, size_t limit) const {
+	// The keys starting with prefix are those in [prefix, prefix with its last byte below 0xff incremented)
+	std::string end(prefix);
+	while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff)
+		end.pop_back();
+	if (!end.empty())
+		++end.back();
+	return scan(std::max(prefix, from), end, limit);
+}
+
+size_t KVStore::size() const {
+	size_t total = 0;
+	for (size_t i = 0; i < shardCount(); ++i) {
+		std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+		total += shards_[i].map.size();
+	}
+	return total;
+}
+
+KVStore::Stats KVStore::stats() const {
+	Stats stats;
+	stats.keys = keys_.load(std::memory_order_relaxed);
+	stats.usedBytes = usedBytes_.load(std::memory_order_relaxed);
+	stats.evictions = evictions_.load(std::memory_order_relaxed);
+	stats.expirations = expirations_.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void KVStore::compact() {
+	if (log_)
+		log_->compact();
+}
+
+std::optional<KVLog::Stats> KVStore::persistenceStats() const {
+	if (!log_)
+		return std::nullopt;
+	return log_->stats();
+}
+
+std::optional<ReplicationLeader::Stats> KVStore::leaderStats() const {
+	if (!leader_)
+		return std::nullopt;
+	return leader_->stats();
+}
+
+std::optional<ReplicationFollower::Stats> KVStore::followerStats() const {
+	if (!follower_)
+		return std::nullopt;
+	return follower_->stats();
+}
+
+void KVStore::clear() {
+	std::vector<Value> removed;
+	for (size_t i = 0; i < shardCount(); ++i) {
+		Shard &shard = shards_[i];
+		std::unique_lock<std::shared_mutex> lock(shard.mutex);
+		while (!shard.map.empty()) {
+			auto it = shard.map.begin();
+			if (log_)
+				log_->append(KVLog::Op::Remove, it->first, {});
+			if (leader_)
+				leader_->publish(KVLog::Op::Remove, it->first, {});
+			removed.push_back(erase(shard, it));
+		}
+		shard.expiryHeap.clear();
+		lock.unlock();
+		// Freed outside the lock
+		removed.clear();
+	}
+}
+
+KVStore::Shard &KVStore::shardFor(std::string_view key) const {
+	// Fibonacci hashing takes the shard from the high bits, leaving the low bits to pick buckets within the shard
+	uint64_t hash = KeyHash{}(key) * 0x9E3779B97F4A7C15ull;
+	return shards_[shardBits_ == 0 ? 0 : hash >> (64 - shardBits_)];
+}
+
+KVStore::Value KVStore::store(Shard &shard, std::string_view key, Value value, int64_t expiresAt, std::vector<Value> &evicted) {
+	size_t bytes = key.size() + value->size() + entryOverhead_;
+	auto it = shard.map.find(key);
+	if (it == shard.map.end()) {
+		it = shard.map
+						 .emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::move(value), expiresAt, sAccessTick()))
+						 .first;
+		if (orderedIndex_)
+			shard.index.emplace(it->first, &it->second);
+		keys_.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		size_t previousBytes = key.size() + it->second.value->size() + entryOverhead_;
+		shard.bytes -= previousBytes;
+		usedBytes_.fetch_sub(previousBytes, std::memory_order_relaxed);
+		it->second.value.swap(value);
+		it->second.expiresAt = expiresAt;
+		it->second.lastAccess.store(sAccessTick(), std::memory_order_relaxed);
+	}
+	shard.bytes += bytes;
+	usedBytes_.fetch_add(bytes, std::memory_order_relaxed);
+
+	if (expiresAt != 0) {
+		// Superseded heap entries are dropped when they reach the top; rebuild if they come to dominate the heap
+		if (shard.expiryHeap.size() > 2 * shard.map.size() + 1024) {
+			shard.expiryHeap.clear();
+			for (const auto &[entryKey, entry] : shard.map) {
+				if (entry.expiresAt != 0)
+					shard.expiryHeap.emplace_back(entry.expiresAt, entryKey);
+			}
+			std::make_heap(shard.expiryHeap.begin(), shard.expiryHeap.end(), sHeapOrder);
+		}
+		shard.expiryHeap.emplace_back(expiresAt, key);
+		std::push_heap(shard.expiryHeap.begin(), shard.expiryHeap.end(), sHeapOrder);
+	}
+
+	// The entry just written is never its own victim, even if it alone exceeds the budget, as a recovered or replicated
+	// one may
+	while (shardBudget_ > 0 && shard.bytes > shardBudget_ && shard.map.size() > 1)
+		evicted.push_back(evict(shard, &it->second));
+	return value;
+}
+
+KVStore::Value KVStore::erase(Shard &shard, Map::iterator it) {
+	size_t bytes = it->first.size() + it->second.value->size() + entryOverhead_;
+	shard.bytes -= bytes;
+	usedBytes_.fetch_sub(bytes, std::memory_order_relaxed);
+	keys_.fetch_sub(1, std::memory_order_relaxed);
+	Value value = std::move(it->second.value);
+	if (orderedIndex_)
+		shard.index.erase(it->first);
+	shard.map.erase(it);
+	return value;
+}
+
+KVStore::Value KVStore::evict(Shard &shard, const Entry *keep) {
+	// Sampled LRU: of a few keys drawn from random buckets, evict the one idle longest, or any that has expired
+	thread_local std::minstd_rand random(std::random_device{}());
+	int64_t now = sNowMillis();
+	uint32_t tick = sAccessTick();
+	size_t buckets = shard.map.bucket_count();
+
+	auto victim = shard.map.end();
+	uint32_t victimAge = 0;
+	for (int sampled = 0, probes = 0; sampled < kEvictionSamples && probes < kEvictionSamples * 8; ++probes) {
+		size_t bucket = random() % buckets;
+		if (shard.map.bucket_size(bucket) == 0)
+			continue;
+		++sampled;
+		auto candidate = shard.map.find(shard.map.begin(bucket)->first);
+		if (&candidate->second == keep)
+			continue;
+		uint32_t age = sExpired(candidate->second.expiresAt, now) ? std::numeric_limits<uint32_t>::max()
+																																	: tick - candidate->second.lastAccess.load(std::memory_order_relaxed);
+		if (victim == shard.map.end() || age > victimAge) {
+			victim = candidate;
+			victimAge = age;
+		}
+	}
+	if (victim == shard.map.end()) {
+		victim = shard.map.begin();
+		if (&victim->second == keep)
+			++victim;
+	}
+
+	if (sExpired(victim->second.expiresAt, now)) {
+		expirations_.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		evictions_.fetch_add(1, std::memory_order_relaxed);
+		// Logged so that recovery does not bring evicted keys back, and published so that followers drop them too
+		if (log_)
+			log_->append(KVLog::Op::Remove, victim->first, {});
+		if (leader_)
+			leader_->publish(KVLog::Op::Remove, victim->first, {});
+	}
+	return erase(shard, victim);
+}
+
+size_t KVStore::reclaimExpired(Shard &shard, int64_t now, std::vector<Value> &reclaimedValues) {
+	size_t reclaimed = 0;
+	size_t popped = 0;
+	while (!shard.expiryHeap.empty() && shard.expiryHeap.front().first <= now && popped < kMaxReclaimedPerPass) {
+		std::pop_heap(shard.expiryHeap.begin(), shard.expiryHeap.end(), sHeapOrder);
+		auto [expiresAt, key] = std::move(shard.expiryHeap.back());
+		shard.expiryHeap.pop_back();
+		++popped;
+
+		auto it = shard.map.find(key);
+		if (it != shard.map.end() && it->second.expiresAt == expiresAt) {
+			reclaimedValues.push_back(erase(shard, it));
+			++reclaimed;
+		}
+	}
+	expirations_.fetch_add(reclaimed, std::memory_order_relaxed);
+	return popped;
+}
+
+void KVStore::snapshot(const KVLog::Emit &emit) const {
+	// One shard at a time, so writers are held up only while their shard's references are copied
+	struct Live {
+		std::string key;
+		Value value;
+		int64_t expiresAt;
+	};
+	std::vector<Live> entries;
+	int64_t now = sNowMillis();
+	for (size_t i = 0; i < shardCount(); ++i) {
+		entries.clear();
+		{
+			std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+			for (const auto &[key, entry] : shards_[i].map) {
+				if (!sExpired(entry.expiresAt, now))
+					entries.push_back({ key, entry.value, entry.expiresAt });
+			}
+		}
+		for (const auto &entry : entries)
+			emit(entry.key, *entry.value, entry.expiresAt);
+	}
+}
+
+void KVStore::expiryThread() {
+	std::unique_lock<std::mutex> lock(expiryMutex_);
+	std::vector<Value> reclaimed;
+	bool backlog = false;
+	while (!stopping_) {
+		// Keep going without sleeping while some shard has more expired keys than one pass reclaims
+		if (!backlog)
+			expiryWake_.wait_for(lock, expiryInterval_, [this]() { return stopping_; });
+		lock.unlock();
+
+		backlog = false;
+		int64_t now = sNowMillis();
+		for (size_t i = 0; i < shardCount(); ++i) {
+			std::unique_lock<std::shared_mutex> shardLock(shards_[i].mutex);
+			backlog |= reclaimExpired(shards_[i], now, reclaimed) == kMaxReclaimedPerPass;
+			shardLock.unlock();
+			// Freed outside the lock
+			reclaimed.clear();
+		}
+		lock.lock();
 	}
-	return std::nullopt;
 }
 
 Response KVStore::handle(const Request &request) {
-	auto keyOpt = get_query_key(request.path);
+	Response methodNotAllowed{ 405, "Method Not Allowed", { { "Content-Type", "text/plain" } }, "Method Not Allowed" };
+	if (request.path.ends_with("/batch"))
+		return request.method == Method::POST ? handleBatch(request) : methodNotAllowed;
+	if (request.path.ends_with("/scan"))
+		return request.method == Method::GET ? handleScan(request) : methodNotAllowed;
+	if (request.path.ends_with("/replication"))
+		return request.method == Method::GET ? handleReplication() : methodNotAllowed;
+	if (follower_ && (request.method == Method::PUT || request.method == Method::DELETE))
+		return sReadOnly();
+
+	auto keyOpt = findQueryParameter(request.query, "key");
 	if (!keyOpt) {
 		return { 400, "Bad Request", { { "Content-Type", "text/plain" } }, "Missing key parameter" };
 	}
-	const std::string &key = *keyOpt;
+	std::string key = percentDecode(*keyOpt);
 
 	switch (request.method) {
 	case Method::GET: {
-		auto val = get(key);
-		if (val) {
-			return { 200, "OK", { { "Content-Type", "text/plain" } }, *val };
+		if (Value value = get(key)) {
+			// The response shares the stored value instead of copying it
+			return { 200, "OK", { { "Content-Type", "text/plain" } }, "", { std::move(value) } };
 		}
 		return { 404, "Not Found", { { "Content-Type", "text/plain" } }, "Key not found" };
 	}
 	case Method::PUT: {
-		set(key, request.body);
+		std::optional<std::string_view> ttlText = findQueryParameter(request.query, "ttl");
+		if (!ttlText)
+			ttlText = request.headers.find("X-TTL");
+		std::optional<uint64_t> ttlSeconds = ttlText ? sParseTtl(*ttlText) : 0;
+		if (!ttlSeconds)
+			return { 400, "Bad Request", { { "Content-Type", "text/plain" } }, "Invalid ttl" };
+		if (!fitsShard(key, request.body.size()))
+			return sTooLarge(shardBudget_);
+		set(key, std::string(request.body), std::chrono::seconds(*ttlSeconds));
 		return { 200, "OK", { { "Content-Type", "text/plain" } }, "OK" };
 	}
 	case Method::DELETE: {
@@ -65,8 +563,140 @@ Response KVStore::handle(const Request &request) {
 		return { 404, "Not Found", { { "Content-Type", "text/plain" } }, "Key not found" };
 	}
 	default:
-		return { 405, "Method Not Allowed", { { "Content-Type", "text/plain" } }, "Method Not Allowed" };
+		return methodNotAllowed;
+	}
+}
+
+Response KVStore::handleBatch(const Request &request) {
+	// Results are framed into text parts; found values are appended as shared parts rather than copied
+	Response response{ 200, "OK", { { "Content-Type", "application/octet-stream" } }, "" };
+	std::string framing;
+	auto flushFraming = [&]() {
+		if (!framing.empty())
+			response.bodyParts.emplace_back(std::move(framing));
+		framing.clear();
+	};
+
+	// The whole batch is validated before any of it is applied, so a bad operation leaves the store untouched
+	std::vector<BatchOperation> operations;
+	std::string_view body = request.body;
+	while (!body.empty()) {
+		size_t lineEnd = body.find('\n');
+		std::optional<BatchOperation> operation;
+		if (lineEnd != std::string_view::npos)
+			operation = sParseBatchOperation(body.substr(0, lineEnd));
+		// Each length is checked on its own, as their sum could wrap around
+		size_t rest = operation ? body.size() - lineEnd - 1 : 0;
+		if (!operation || operation->keyLength > rest || operation->valueLength > rest - operation->keyLength) {
+			return { 400, "Bad Request", { { "Content-Type", "text/plain" } },
+							 std::format("Malformed batch operation at byte {}", request.body.size() - body.size()) };
+		}
+		operation->key = body.substr(lineEnd + 1, operation->keyLength);
+		operation->value = body.substr(lineEnd + 1 + operation->keyLength, operation->valueLength);
+		body.remove_prefix(lineEnd + 1 + operation->keyLength + operation->valueLength);
+
+		if (follower_ && operation->type != 'G')
+			return sReadOnly();
+		if (operation->type == 'S' && !fitsShard(operation->key, operation->value.size()))
+			return sTooLarge(shardBudget_);
+		operations.push_back(*operation);
+	}
+
+	uint64_t lastSequence = 0;
+	for (const BatchOperation &operation : operations) {
+		std::string_view key = operation.key;
+		if (operation.type == 'G') {
+			if (Value found = get(key)) {
+				std::format_to(std::back_inserter(framing), "V {}\n", found->size());
+				flushFraming();
+				response.bodyParts.emplace_back(std::move(found));
+			} else {
+				framing += "N\n";
+			}
+		} else if (operation.type == 'S') {
+			auto shared = std::make_shared<const std::string>(operation.value);
+			lastSequence = std::max(lastSequence, setUnsynced(key, std::move(shared), sExpiresAt(std::chrono::seconds(operation.ttlSeconds))));
+			framing += "OK\n";
+		} else {
+			std::optional<uint64_t> sequence = removeUnsynced(key);
+			lastSequence = std::max(lastSequence, sequence.value_or(0));
+			framing += sequence ? "OK\n" : "N\n";
+		}
+	}
+	flushFraming();
+
+	// Every write in the batch shares one wait, and so usually one fsync
+	waitDurable(lastSequence);
+	return response;
+}
+
+Response KVStore::handleScan(const Request &request) const {
+	if (!orderedIndex_)
+		return { 501, "Not Implemented", { { "Content-Type", "text/plain" } }, "Scans need the ordered index" };
+
+	auto parameter = [&request](std::string_view name) { return percentDecode(findQueryParameter(request.query, name).value_or("")); };
+	std::string prefix = parameter("prefix");
+	std::string from = parameter("from");
+	std::string to = parameter("to");
+	size_t limit = kDefaultScanLimit;
+	if (auto limitText = findQueryParameter(request.query, "limit")) {
+		auto [end, ec] = std::from_chars(limitText->data(), limitText->data() + limitText->size(), limit);
+		if (ec != std::errc() || end != limitText->data() + limitText->size() || limit == 0 || limit > kMaxScanLimit)
+			return { 400, "Bad Request", { { "Content-Type", "text/plain" } }, std::format("limit must be between 1 and {}", kMaxScanLimit) };
+	}
+
+	ScanResult result = prefix.empty() ? scan(from, to, limit) : scanPrefix(prefix, from, limit);
+	if (!prefix.empty() && !to.empty()) {
+		// Both bounds apply; the prefix scan has already applied the lower one
+		std::erase_if(result.entries, [&to](const auto &entry) { return entry.first >= to; });
+		if (result.nextKey && *result.nextKey >= to)
+			result.nextKey.reset();
+	}
+
+	Response response{ 200, "OK", { { "Content-Type", "application/octet-stream" } }, "" };
+	std::string framing;
+	for (auto &[key, value] : result.entries) {
+		std::format_to(std::back_inserter(framing), "K {} {}\n", key.size(), value->size());
+		framing += key;
+		response.bodyParts.emplace_back(std::move(framing));
+		framing.clear();
+		response.bodyParts.emplace_back(std::move(value));
+	}
+	if (result.nextKey)
+		std::format_to(std::back_inserter(framing), "M {}\n{}", result.nextKey->size(), *result.nextKey);
+	if (!framing.empty())
+		response.bodyParts.emplace_back(std::move(framing));
+	return response;
+}
+
+Response KVStore::handleReplication() const {
+	std::string text;
+	auto line = [&text](std::string_view name, auto value) { std::format_to(std::back_inserter(text), "{} {}\n", name, value); };
+	if (leader_) {
+		ReplicationLeader::Stats stats = leader_->stats();
+		line("leader_sequence", stats.sequence);
+		line("leader_snapshots", stats.snapshots);
+		line("leader_disconnects", stats.disconnects);
+		line("leader_followers", stats.followers.size());
+		for (const auto &follower : stats.followers) {
+			line("follower " + follower.peer + " acked_sequence", follower.ackedSequence);
+			line("follower " + follower.peer + " lag", follower.lag);
+			line("follower " + follower.peer + " buffered_bytes", follower.bufferedBytes);
+		}
+	}
+	if (follower_) {
+		ReplicationFollower::Stats stats = follower_->stats();
+		line("follower_connected", stats.connected ? 1 : 0);
+		line("follower_snapshots", stats.snapshots);
+		line("follower_applied_sequence", stats.appliedSequence);
+		line("follower_leader_sequence", stats.leaderSequence);
+		line("follower_lag", stats.lag);
+		line("follower_lag_ms", stats.lagTime.count());
+		line("follower_since_heartbeat_ms", stats.sinceHeartbeat.count());
 	}
+	if (!leader_ && !follower_)
+		text = "replication disabled\n";
+	return { 200, "OK", { { "Content-Type", "text/plain" } }, std::move(text) };
 }
 
-} // namespace ou::http
\ No newline at end of file
+} // namespace ou::http
@@ -1,28 +1,196 @@
 #pragma once
 
+#include "KVLog.h"
+#include "Replication.h"
 #include "Server.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace ou::http {
 
+// Key-value store split into independently locked shards chosen by key hash, so operations on different keys rarely
+// contend. Values are immutable and shared: a reader takes a reference under a shared lock and reads the value after
+// releasing it, and a writer replaces the reference rather than the bytes. With persistence configured, every change
+// is logged before the write returns (subject to the fsync policy) and the contents are recovered on construction.
+//
+// As a cache, the store can hold keys with a time to live and stay within a byte budget. Expired keys are invisible
+// at once and are reclaimed by a background sweep that pops them from a per-shard expiry heap, so it never scans a
+// map. The byte budget is split evenly between the shards. Over its share, a write evicts the least recently used of a
+// few keys sampled from its shard; an entry larger than the share is refused.
+//
+// With the ordered index enabled, each shard also keeps its keys sorted, and scans merge the shards' ranges.
+//
+// A store can stream its changes to followers in other processes, and a follower keeps a read-only copy of a leader
+// (see ReplicationLeader). A follower can itself lead further followers.
 class KVStore : public RequestHandler {
 public:
-	void set(const std::string &key, const std::string &value);
+	using Value = std::shared_ptr<const std::string>;
 
-	std::optional<std::string> get(const std::string &key) const;
+	struct Config {
+		size_t shardCount = 64;																	 // Rounded up to a power of two
+		size_t maxBytes = 0;																		 // Evict to stay within this; 0 means unbounded
+		std::chrono::milliseconds expiryInterval{ 100 };				 // How often expired keys are reclaimed
+		bool orderedIndex = false;															 // Keep keys sorted for scan()
+		std::optional<KVLog::Config> persistence = std::nullopt; // In memory only if unset
+		std::optional<ReplicationLeader::Config> leader = std::nullopt;		// Serve followers
+		std::optional<ReplicationFollower::Config> follower = std::nullopt; // Follow a leader; HTTP writes are refused
+	};
+
+	struct Stats {
+		uint64_t keys = 0;
+		uint64_t usedBytes = 0; // Keys and values plus an estimate of the per-entry overhead
+		uint64_t evictions = 0;
+		uint64_t expirations = 0;
+	};
+
+	struct ScanResult {
+		std::vector<std::pair<std::string, Value>> entries;
+		std::optional<std::string> nextKey; // Where the next page starts; unset once the range is exhausted
+	};
+
+	KVStore();
+	// Throws std::system_error if persistence is configured and its directory cannot be used, or if the leader cannot
+	// listen on its address
+	explicit KVStore(Config config);
+	~KVStore() override;
+
+	KVStore(const KVStore &) = delete;
+	KVStore &operator=(const KVStore &) = delete;
+
+	// A zero ttl keeps the key until it is replaced, removed or evicted. Throws std::length_error if the entry exceeds
+	// a shard's share of maxBytes.
+	void set(std::string_view key, std::string value, std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
+
+	// Returns nullptr if the key is absent or expired
+	Value get(std::string_view key) const;
 
 	// Return true if removed
-	bool remove(const std::string &key);
+	bool remove(std::string_view key);
 
+	// Live keys in [from, to), in order, at most limit of them; an empty to means no upper bound. Requires the ordered
+	// index; returns nothing without it.
+	ScanResult scan(std::string_view from, std::string_view to, size_t limit) const;
+	// Live keys starting with prefix, beginning at from
+	ScanResult scanPrefix(std::string_view prefix, std::string_view from, size_t limit) const;
+
+	// Includes expired keys that have not been reclaimed yet
+	size_t size() const;
+
+	Stats stats() const;
+
+	// Snapshots the store and drops the log it covers; does nothing without persistence
+	void compact();
+	std::optional<KVLog::Stats> persistenceStats() const;
+	std::optional<ReplicationLeader::Stats> leaderStats() const;
+	std::optional<ReplicationFollower::Stats> followerStats() const;
+
+	// Serves four kinds of request:
+	//  - GET, PUT and DELETE of the key in the "key" query parameter. PUT takes a time to live in seconds from the
+	//    "ttl" query parameter or the X-TTL header.
+	//  - POST to a path ending in /batch, whose body is a sequence of operations, each a header line followed by raw
+	//    bytes: "G <key length>\n<key>", "S <key length> <value length> [<ttl>]\n<key><value>" or
+	//    "D <key length>\n<key>". The response holds one result per operation, in order: "V <length>\n<value>" for a
+	//    found key, "N\n" for a missing one, and "OK\n" for a set or a successful delete.
+	//  - GET of a path ending in /scan, with "prefix", "from", "to" and "limit" query parameters. The response holds
+	//    "K <key length> <value length>\n<key><value>" per entry, then "M <key length>\n<key>" giving the "from" of
+	//    the next page if there is one.
+	//  - GET of a path ending in /replication, which reports the replication role and lag as "name value" lines.
+	// Query parameters are percent-decoded. A follower refuses writes with 403.
 	Response handle(const Request &request) override;
 
 private:
-	mutable std::mutex mutex_;
-	std::unordered_map<std::string, std::string> store_;
+	struct KeyHash {
+		using is_transparent = void;
+		size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+	};
+
+	struct Entry {
+		Entry(Value value, int64_t expiresAt, uint32_t now) : value(std::move(value)), expiresAt(expiresAt), lastAccess(now) {}
+
+		Value value;
+		int64_t expiresAt;									 // Milliseconds since the Unix epoch; 0 if the entry does not expire
+		mutable std::atomic<uint32_t> lastAccess; // Truncated milliseconds; updated under the shared lock by readers
+	};
+
+	using Map = std::unordered_map<std::string, Entry, KeyHash, std::equal_to<>>;
+
+	// Padded to a cache line so that locking one shard does not invalidate its neighbours
+	struct alignas(64) Shard {
+		mutable std::shared_mutex mutex;
+		Map map;
+		std::map<std::string_view, const Entry *> index; // Views of the map's keys, which stay put while they exist
+		size_t bytes = 0;
+		// Min-heap of (expiresAt, key). Entries whose key was since removed or given another expiry are skipped.
+		std::vector<std::pair<int64_t, std::string>> expiryHeap;
+	};
+
+	Shard &shardFor(std::string_view key) const;
+	size_t shardCount() const { return size_t{ 1 } << shardBits_; }
+
+	// These require the shard to be locked exclusively. They return or collect the values they replace or remove, so
+	// that the caller can release them after unlocking; reclaimExpired() returns the number of heap entries it examined.
+	Value store(Shard &shard, std::string_view key, Value value, int64_t expiresAt, std::vector<Value> &evicted);
+	Value erase(Shard &shard, Map::iterator it);
+	// Picks a victim other than keep
+	Value evict(Shard &shard, const Entry *keep);
+	size_t reclaimExpired(Shard &shard, int64_t now, std::vector<Value> &reclaimed);
+	bool fitsShard(std::string_view key, size_t valueSize) const {
+		return shardBudget_ == 0 || key.size() + valueSize + entryOverhead_ <= shardBudget_;
+	}
+
+	// Writes without waiting for durability and return the sequence number to wait on (0 without persistence), so
+	// that a batch waits once. removeUnsynced() returns nullopt if the key was absent.
+	uint64_t setUnsynced(std::string_view key, Value value, int64_t expiresAt);
+	std::optional<uint64_t> removeUnsynced(std::string_view key);
+	void waitDurable(uint64_t sequence);
+	// Removes every key, as a follower does before loading a snapshot
+	void clear();
+
+	Response handleBatch(const Request &request);
+	Response handleScan(const Request &request) const;
+	Response handleReplication() const;
+
+	void snapshot(const KVLog::Emit &emit) const;
+	void expiryThread();
+
+	size_t shardBits_;
+	size_t shardBudget_;
+	bool orderedIndex_;
+	size_t entryOverhead_;
+	std::chrono::milliseconds expiryInterval_;
+	std::unique_ptr<Shard[]> shards_;
+
+	std::atomic<uint64_t> keys_{ 0 };
+	std::atomic<uint64_t> usedBytes_{ 0 };
+	std::atomic<uint64_t> evictions_{ 0 };
+	std::atomic<uint64_t> expirations_{ 0 };
+
+	std::mutex expiryMutex_;
+	std::condition_variable expiryWake_;
+	bool stopping_ = false;
+	std::thread expirer_;
+
+	// Declared after the shards, which their threads read, so that they stop first; the follower, which writes through
+	// the log and the leader, stops before them
+	std::unique_ptr<KVLog> log_;
+	std::unique_ptr<ReplicationLeader> leader_;
+	std::unique_ptr<ReplicationFollower> follower_;
 };
 
 } // namespace ou::http
@@ -1,82 +1,157 @@
 #include "Logging.h"
+#include "AsyncWriter.h"
 
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <chrono>
-#include <fstream>
-#include <iomanip>
-#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
 
-#include <arpa/inet.h>
+#include <unistd.h>
 
 namespace ou::http {
 
 namespace {
-	std::string sGetTimestamp() {
-		auto now = std::chrono::system_clock::now();
-		std::time_t nowTime = std::chrono::system_clock::to_time_t(now);
-		std::tm tmStruct{};
-		localtime_r(&nowTime, &tmStruct);
+	constexpr std::array<std::string_view, 5> kLevelNames = { "DEBUG", "INFO", "WARN", "ERROR", "OFF" };
+
+	struct LoggerState {
+		LoggerState()
+				: writer({ .threadBufferBytes = 256 * 1024, .flushInterval = std::chrono::milliseconds(50) },
+								 [this](std::vector<iovec> &iovecs, size_t) {
+									 std::lock_guard<std::mutex> lock(mutex);
+									 return AsyncWriter::writeAll(fd, iovecs);
+								 }) {}
+
+		std::mutex mutex; // Guards fd against reconfiguration while a batch is written
+		int fd = 1;
+		std::atomic<bool> json{ false };
+		AsyncWriter writer;
+	};
+
+	// Never destroyed, so that threads may log during static destruction; what is still buffered is flushed at exit
+	LoggerState &sState() {
+		static LoggerState *state = [] {
+			auto *created = new LoggerState();
+			std::atexit([] { Logger::flush(); });
+			return created;
+		}();
+		return *state;
+	}
 
-		std::ostringstream oss;
-		oss << std::put_time(&tmStruct, "%Y-%m-%d %H:%M:%S");
-		return oss.str();
+	// Calendar formatting is comparatively expensive, so each thread does it once per second
+	std::string_view sTimestamp() {
+		thread_local time_t cachedSecond = -1;
+		thread_local std::array<char, 32> cached{};
+		thread_local size_t length = 0;
+
+		auto now = std::chrono::system_clock::now();
+		time_t second = std::chrono::system_clock::to_time_t(now);
+		if (second != cachedSecond) {
+			std::tm tmStruct{};
+			gmtime_r(&second, &tmStruct);
+			length = std::strftime(cached.data(), cached.size(), "%Y-%m-%dT%H:%M:%S.000Z", &tmStruct);
+			cachedSecond = second;
+		}
+		auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+		cached[length - 4] = static_cast<char>('0' + millis / 100);
+		cached[length - 3] = static_cast<char>('0' + millis / 10 % 10);
+		cached[length - 2] = static_cast<char>('0' + millis % 10);
+		return { cached.data(), length };
 	}
 
-	std::string sFormatLogEntry(const Request &request, const Response &response, const sockaddr_in &clientAddr) {
-		std::ostringstream oss;
-		oss << "[" << sGetTimestamp() << "] " << inet_ntoa(clientAddr.sin_addr) << " - \"" << request.method << " " << request.path << "\" "
-				<< response.statusCode << " " << response.body.size() << "\n";
-		return oss.str();
+	void sAppendJsonString(std::string &out, std::string_view text) {
+		out += '"';
+		for (char c : text) {
+			switch (c) {
+			case '"':
+				out += "\\\"";
+				break;
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			case '\r':
+				out += "\\r";
+				break;
+			case '\t':
+				out += "\\t";
+				break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+					std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned>(c));
+				else
+					out += c;
+			}
+		}
+		out += '"';
 	}
 } // namespace
 
-AccessLog::AccessLog(Config config) : config_(std::move(config)) { std::ofstream logFile(config_.path, std::ios::app); }
+std::string_view logLevelToString(LogLevel level) { return kLevelNames[static_cast<size_t>(level)]; }
 
-void AccessLog::log(const Request &request, const Response &response, const sockaddr_in &clientAddr) {
-	std::ofstream logFile(config_.path, std::ios::app);
-	if (!logFile)
-		return;
-
-	std::string entry = sFormatLogEntry(request, response, clientAddr);
-	logFile << entry;
-	logFile.close();
-
-	enforceSizeLimit();
+std::optional<LogLevel> parseLogLevel(std::string_view name) {
+	for (size_t i = 0; i < kLevelNames.size(); ++i) {
+		if (std::ranges::equal(name, kLevelNames[i], [](char a, char b) { return std::toupper(static_cast<unsigned char>(a)) == b; }))
+			return static_cast<LogLevel>(i);
+	}
+	return std::nullopt;
 }
 
-void AccessLog::enforceSizeLimit() const {
-	if (std::filesystem::file_size(config_.path) <= config_.maxSizeBytes) {
-		return;
+void Logger::configure(const Config &config) {
+	LoggerState &state = sState();
+	state.writer.flush();
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.fd = config.fd;
 	}
+	state.json.store(config.json, std::memory_order_relaxed);
+	sLevel.store(config.level, std::memory_order_relaxed);
+}
 
-	std::ifstream file(config_.path);
-	std::deque<std::string> lines;
-	std::string line;
-
-	while (std::getline(file, line)) {
-		lines.push_back(line);
-	}
-	file.close();
+Logger::Config Logger::config() {
+	LoggerState &state = sState();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return { sLevel.load(std::memory_order_relaxed), state.json.load(std::memory_order_relaxed), state.fd };
+}
 
-	// Remove the oldest 20% of lines to limit truncation frequency
-	size_t linesToRemove = lines.size() / 5;
-	for (size_t i = 0; i < linesToRemove && !lines.empty(); ++i) {
-		lines.pop_front();
+void Logger::write(LogLevel level, std::string_view message) {
+	LoggerState &state = sState();
+	thread_local std::string record;
+	record.clear();
+
+	if (state.json.load(std::memory_order_relaxed)) {
+		thread_local const pid_t threadId = gettid();
+		record += "{\"time\":\"";
+		record += sTimestamp();
+		record += "\",\"level\":\"";
+		record += logLevelToString(level);
+		std::format_to(std::back_inserter(record), "\",\"thread\":{},\"message\":", threadId);
+		sAppendJsonString(record, message);
+		record += "}\n";
+	} else {
+		record += sTimestamp();
+		record += " [";
+		record += logLevelToString(level);
+		record += "] ";
+		record += message;
+		record += '\n';
 	}
 
-	// Write back to a temporary file and rename
-	std::ofstream tempFile(config_.path.string() + ".tmp");
-	for (const auto &l : lines) {
-		tempFile << l << "\n";
-	}
-	tempFile.close();
-	std::filesystem::rename(config_.path.string() + ".tmp", config_.path);
+	state.writer.append(record);
+	if (level >= LogLevel::Error)
+		state.writer.flush();
 }
 
-bool AccessLog::process(Request &request, Response &response) {
-	if (request.clientAddr.has_value()) {
-		log(request, response, request.clientAddr.value());
-	}
-	return false;
+void Logger::flush() { sState().writer.flush(); }
+
+Logger::Stats Logger::stats() {
+	AsyncWriter::Stats writerStats = sState().writer.stats();
+	return { writerStats.records, writerStats.dropped };
 }
 
-} // namespace ou::http
\ No newline at end of file
+} // namespace ou::http
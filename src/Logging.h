@@ -1,45 +1,80 @@
 #pragma once
 
-#include "HttpTypes.h"
-#include "Server.h"
-
-#include <cstdio>
-#include <filesystem>
+#include <atomic>
+#include <cstdint>
 #include <format>
-#include <iostream>
-#include <netinet/in.h>
+#include <iterator>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Log statements below this level are compiled out, argument evaluation included: 0 keeps everything (the default),
+// 1 drops DEBUG, 2 keeps WARN and ERROR, 3 keeps ERROR, 4 removes logging entirely
+#ifndef OU_LOG_COMPILE_LEVEL
+#define OU_LOG_COMPILE_LEVEL 0
+#endif
 
-#define LOG_INFO(fmt, ...) log_helper("[INFO] " fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...) log_helper("[WARNING] " fmt, ##__VA_ARGS__)
-#define LOG_ERROR(fmt, ...) log_helper("[ERROR] " fmt, ##__VA_ARGS__)
+// Arguments are only evaluated when the level is enabled both at compile time and at run time
+#define OU_LOG(level, ...)                                                                                                                           \
+	do {                                                                                                                                               \
+		if constexpr (static_cast<int>(level) >= OU_LOG_COMPILE_LEVEL) {                                                                                 \
+			if (::ou::http::Logger::enabled(level))                                                                                                        \
+				::ou::http::Logger::log(level, __VA_ARGS__);                                                                                                 \
+		}                                                                                                                                                \
+	} while (false)
 
-template <typename... Args> void log_helper(std::string_view format, Args &&...args) {
-	std::cout << std::vformat(format, std::make_format_args(args...)) << '\n';
-}
+#define LOG_DEBUG(...) OU_LOG(::ou::http::LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...) OU_LOG(::ou::http::LogLevel::Info, __VA_ARGS__)
+#define LOG_WARN(...) OU_LOG(::ou::http::LogLevel::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) OU_LOG(::ou::http::LogLevel::Error, __VA_ARGS__)
 
 namespace ou::http {
 
-class Middleware;
+enum class LogLevel { Debug, Info, Warn, Error, Off };
+
+std::string_view logLevelToString(LogLevel level);
+// Accepts the names logLevelToString() returns, in any case
+std::optional<LogLevel> parseLogLevel(std::string_view name);
 
-class AccessLog : public Middleware {
+// Process-wide logger. Messages are formatted on the calling thread into that thread's buffer and written by a
+// background thread, so callers never wait on the terminal or disk. Errors are the exception: they are written before
+// log() returns, so the last words of a crashing process are not lost.
+class Logger {
 public:
 	struct Config {
-		std::filesystem::path path;
-		size_t maxSizeBytes;
+		LogLevel level = LogLevel::Info;
+		bool json = false; // One JSON object per line instead of plain text
+		int fd = 1;				 // Not owned; stdout by default
 	};
 
-	explicit AccessLog(Config config);
-	~AccessLog() override = default;
+	struct Stats {
+		uint64_t logged = 0;
+		uint64_t dropped = 0; // Discarded because the writing thread's buffer was full
+	};
 
-	void log(const Request &request, const Response &response, const sockaddr_in &clientAddr);
+	// Flushes what was logged under the previous configuration first
+	static void configure(const Config &config);
+	static Config config();
 
-	bool process(Request &request, Response &response) override;
+	static bool enabled(LogLevel level) { return level >= sLevel.load(std::memory_order_relaxed); }
 
-private:
-	void enforceSizeLimit() const;
+	template <typename... Args> static void log(LogLevel level, std::format_string<Args...> format, Args &&...args) {
+		thread_local std::string message;
+		message.clear();
+		std::format_to(std::back_inserter(message), format, std::forward<Args>(args)...);
+		write(level, message);
+	}
 
-	Config config_;
+	static void write(LogLevel level, std::string_view message);
+
+	// Writes everything logged so far before returning
+	static void flush();
+
+	static Stats stats();
+
+private:
+	inline static std::atomic<LogLevel> sLevel{ LogLevel::Info };
 };
 
 } // namespace ou::http
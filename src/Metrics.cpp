@@ -0,0 +1,190 @@
+#include "Metrics.h"
+
+#include <format>
+#include <map>
+#include <numeric>
+#include <tuple>
+
+namespace ou::http {
+
+namespace {
+	std::atomic<uint64_t> sNextId{ 1 };
+
+	// Prometheus buckets, in seconds. Each counts the latency buckets that lie entirely below it, so it can be short by
+	// up to 1/16 of its bound.
+	constexpr std::array kHistogramBounds{ 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+
+	std::string sEscapeLabel(std::string_view value) {
+		std::string escaped;
+		escaped.reserve(value.size());
+		for (char c : value) {
+			if (c == '\\' || c == '"')
+				escaped += '\\';
+			if (c == '\n')
+				escaped += "\\n";
+			else
+				escaped += c;
+		}
+		return escaped;
+	}
+
+	void sAppendHeader(std::string &out, std::string_view name, std::string_view help, std::string_view type) {
+		std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+	}
+} // namespace
+
+std::chrono::nanoseconds Metrics::RequestStats::quantile(double q) const {
+	// Counts are read one by one while requests are being recorded, so the buckets are the total that is consistent
+	uint64_t counted = std::accumulate(buckets.begin(), buckets.end(), uint64_t{ 0 });
+	if (counted == 0)
+		return std::chrono::nanoseconds(0);
+	uint64_t rank = std::min(static_cast<uint64_t>(q * static_cast<double>(counted)), counted - 1);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < buckets.size(); ++i) {
+		seen += buckets[i];
+		if (seen > rank)
+			return std::chrono::nanoseconds(LatencyBuckets::upperBound(i));
+	}
+	return std::chrono::nanoseconds(0);
+}
+
+Metrics::Metrics() : id_(sNextId++) {}
+
+void Metrics::recordRequest(std::string_view route, Method method, int statusCode, std::chrono::nanoseconds duration) {
+	Shard &shard = threadShard();
+	SeriesKey key{ route.data(), route.size(), method, statusCode };
+	auto &[recentKey, series] = shard.recent[SeriesKeyHash{}(key) >> (64 - kRecentSeriesBits)];
+	if (series == nullptr || !(recentKey == key)) {
+		auto it = shard.index.find(key);
+		if (it != shard.index.end()) {
+			series = it->second;
+		} else {
+			auto created = std::make_unique<Series>();
+			created->route = route;
+			created->method = method;
+			created->statusCode = statusCode;
+			series = created.get();
+			shard.index.emplace(key, series);
+			std::lock_guard<std::mutex> lock(shard.seriesMutex);
+			shard.series.push_back(std::move(created));
+		}
+		recentKey = key;
+	}
+
+	auto nanoseconds = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+	increment(series->count);
+	increment(series->totalNanoseconds, nanoseconds);
+	increment(series->buckets[LatencyBuckets::index(nanoseconds)]);
+}
+
+void Metrics::addGauge(std::string name, std::string help, std::function<double()> read) {
+	std::lock_guard<std::mutex> lock(callbacksMutex_);
+	callbacks_.push_back({ std::move(name), std::move(help), "gauge", std::move(read) });
+}
+
+void Metrics::addCounter(std::string name, std::string help, std::function<double()> read) {
+	std::lock_guard<std::mutex> lock(callbacksMutex_);
+	callbacks_.push_back({ std::move(name), std::move(help), "counter", std::move(read) });
+}
+
+std::vector<Metrics::RequestStats> Metrics::requestStats() const {
+	// Each thread has its own series, and one route's text can reach a thread from more than one place, so series are
+	// merged by content
+	std::map<std::tuple<std::string_view, Method, int>, RequestStats> merged;
+	std::lock_guard<std::mutex> lock(shardsMutex_);
+	for (const auto &shard : shards_) {
+		std::lock_guard<std::mutex> seriesLock(shard->seriesMutex);
+		for (const auto &series : shard->series) {
+			RequestStats &stats = merged[{ series->route, series->method, series->statusCode }];
+			if (stats.buckets.empty()) {
+				stats.route = series->route;
+				stats.method = series->method;
+				stats.statusCode = series->statusCode;
+				stats.buckets.resize(LatencyBuckets::kCount);
+			}
+			stats.count += series->count.load(std::memory_order_relaxed);
+			stats.total += std::chrono::nanoseconds(series->totalNanoseconds.load(std::memory_order_relaxed));
+			for (size_t i = 0; i < LatencyBuckets::kCount; ++i)
+				stats.buckets[i] += series->buckets[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	std::vector<RequestStats> result;
+	result.reserve(merged.size());
+	for (auto &[key, stats] : merged)
+		result.push_back(std::move(stats));
+	return result;
+}
+
+Metrics::ConnectionStats Metrics::connectionStats() const {
+	ConnectionStats stats;
+	std::lock_guard<std::mutex> lock(shardsMutex_);
+	for (const auto &shard : shards_) {
+		stats.opened += shard->connectionsOpened.load(std::memory_order_relaxed);
+		stats.closed += shard->connectionsClosed.load(std::memory_order_relaxed);
+		stats.malformedRequests += shard->malformedRequests.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+std::string Metrics::render() const {
+	std::string out;
+	auto appendLine = [&out](std::string_view name, std::string_view labels, auto value) {
+		std::format_to(std::back_inserter(out), "{}{}{}{} {}\n", name, labels.empty() ? "" : "{", labels, labels.empty() ? "" : "}", value);
+	};
+
+	auto requests = requestStats();
+	sAppendHeader(out, "http_request_duration_seconds", "Time from dispatching a request to having its response, by route, method and status.",
+								"histogram");
+	for (const auto &stats : requests) {
+		std::string labels = std::format(R"(route="{}",method="{}",status="{}")", sEscapeLabel(stats.route), stats.method, stats.statusCode);
+		uint64_t cumulative = 0;
+		size_t bucket = 0;
+		for (double bound : kHistogramBounds) {
+			auto boundNanoseconds = static_cast<uint64_t>(bound * 1e9);
+			for (; bucket < stats.buckets.size() && LatencyBuckets::upperBound(bucket) <= boundNanoseconds; ++bucket)
+				cumulative += stats.buckets[bucket];
+			appendLine("http_request_duration_seconds_bucket", std::format(R"({},le="{}")", labels, bound), cumulative);
+		}
+		// Buckets stay cumulative even if a request was recorded while they were being read
+		cumulative = std::accumulate(stats.buckets.begin() + static_cast<ptrdiff_t>(bucket), stats.buckets.end(), cumulative);
+		appendLine("http_request_duration_seconds_bucket", labels + R"(,le="+Inf")", cumulative);
+		appendLine("http_request_duration_seconds_sum", labels, std::chrono::duration<double>(stats.total).count());
+		appendLine("http_request_duration_seconds_count", labels, cumulative);
+	}
+
+	ConnectionStats connections = connectionStats();
+	sAppendHeader(out, "http_connections_total", "Connections accepted.", "counter");
+	appendLine("http_connections_total", "", connections.opened);
+	sAppendHeader(out, "http_open_connections", "Connections accepted and not yet closed.", "gauge");
+	appendLine("http_open_connections", "", connections.opened - std::min(connections.closed, connections.opened));
+	sAppendHeader(out, "http_malformed_requests_total", "Requests rejected by the parser before reaching a handler.", "counter");
+	appendLine("http_malformed_requests_total", "", connections.malformedRequests);
+
+	std::lock_guard<std::mutex> lock(callbacksMutex_);
+	for (const auto &callback : callbacks_) {
+		sAppendHeader(out, callback.name, callback.help, callback.type);
+		appendLine(callback.name, "", callback.read());
+	}
+	return out;
+}
+
+Metrics::Shard &Metrics::threadShard() {
+	// The same scheme as AsyncWriter's per-thread buffers: a short list, keyed by never-reused instance ids, that keeps
+	// its shards alive
+	thread_local std::vector<std::pair<uint64_t, std::shared_ptr<Shard>>> threadShards;
+	for (const auto &[id, shard] : threadShards) {
+		if (id == id_)
+			return *shard;
+	}
+
+	auto shard = std::make_shared<Shard>();
+	{
+		std::lock_guard<std::mutex> lock(shardsMutex_);
+		shards_.push_back(shard);
+	}
+	threadShards.emplace_back(id_, shard);
+	return *shard;
+}
+
+} // namespace ou::http
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "HttpTypes.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ou::http {
+
+// Log-linear bucketing in the style of HdrHistogram: values below 16 get a bucket each, and every power of two above
+// is split into 16 equal buckets, so a bucket's width is at most 1/16 of the values it holds. Values are nanoseconds;
+// anything above about 68 seconds lands in the last bucket.
+struct LatencyBuckets {
+	static constexpr unsigned kSubBucketBits = 4;
+	static constexpr uint64_t kSubBuckets = uint64_t{ 1 } << kSubBucketBits;
+	static constexpr unsigned kMaxBits = 36;
+	static constexpr size_t kCount = kSubBuckets + (kMaxBits - kSubBucketBits) * kSubBuckets;
+
+	static constexpr size_t index(uint64_t value) {
+		if (value < kSubBuckets)
+			return static_cast<size_t>(value);
+		value = std::min(value, (uint64_t{ 1 } << kMaxBits) - 1);
+		unsigned shift = static_cast<unsigned>(std::bit_width(value)) - kSubBucketBits - 1;
+		return static_cast<size_t>(kSubBuckets + shift * kSubBuckets + ((value >> shift) - kSubBuckets));
+	}
+
+	// Largest value counted in the bucket
+	static constexpr uint64_t upperBound(size_t index) {
+		if (index < kSubBuckets)
+			return index;
+		uint64_t shift = (index - kSubBuckets) / kSubBuckets;
+		uint64_t subBucket = (index - kSubBuckets) % kSubBuckets;
+		return ((kSubBuckets + subBucket + 1) << shift) - 1;
+	}
+};
+
+// Request counts and latencies by route, method and status, plus connection counters and gauges read on demand.
+// Recording touches only the calling thread's shard, with plain stores that no other thread writes, so it costs a few
+// nanoseconds and never contends. Shards are summed when the metrics are read, typically when /metrics is scraped.
+class Metrics {
+public:
+	struct RequestStats {
+		std::string route;
+		Method method = Method::GET;
+		int statusCode = 0;
+		uint64_t count = 0;
+		std::chrono::nanoseconds total{ 0 };
+		std::vector<uint64_t> buckets; // Counts by LatencyBuckets index
+
+		// Upper bound of the bucket holding the given quantile (0 to 1) of the latencies
+		std::chrono::nanoseconds quantile(double q) const;
+	};
+
+	struct ConnectionStats {
+		uint64_t opened = 0;
+		uint64_t closed = 0;
+		uint64_t malformedRequests = 0;
+	};
+
+	Metrics();
+
+	Metrics(const Metrics &) = delete;
+	Metrics &operator=(const Metrics &) = delete;
+
+	// Series are looked up by the address of route's text, which should stay put, like a registered route pattern or a
+	// literal. The text is copied when a series is created.
+	void recordRequest(std::string_view route, Method method, int statusCode, std::chrono::nanoseconds duration);
+	void connectionOpened() { increment(threadShard().connectionsOpened); }
+	void connectionClosed() { increment(threadShard().connectionsClosed); }
+	void malformedRequest() { increment(threadShard().malformedRequests); }
+
+	// Values read when the metrics are rendered; name must be a valid Prometheus metric name
+	void addGauge(std::string name, std::string help, std::function<double()> read);
+	void addCounter(std::string name, std::string help, std::function<double()> read);
+
+	// Aggregated over every thread, sorted by route, method and status
+	std::vector<RequestStats> requestStats() const;
+	ConnectionStats connectionStats() const;
+
+	// Prometheus text exposition format, version 0.0.4
+	std::string render() const;
+
+private:
+	static constexpr unsigned kRecentSeriesBits = 6;
+	static constexpr size_t kRecentSeries = size_t{ 1 } << kRecentSeriesBits;
+
+	struct SeriesKey {
+		const char *route;
+		size_t routeSize;
+		Method method;
+		int statusCode;
+
+		bool operator==(const SeriesKey &) const = default;
+	};
+
+	struct SeriesKeyHash {
+		size_t operator()(const SeriesKey &key) const {
+			auto bits = reinterpret_cast<uintptr_t>(key.route) ^ (key.routeSize << 20) ^ (static_cast<size_t>(key.method) << 16)
+									^ static_cast<size_t>(key.statusCode);
+			// Fibonacci hashing spreads the bits, so the top ones are usable as a table index
+			return static_cast<size_t>(bits * 0x9e3779b97f4a7c15ULL);
+		}
+	};
+
+	// Written only by the owning thread
+	struct Series {
+		std::string route;
+		Method method;
+		int statusCode;
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<uint64_t> totalNanoseconds{ 0 };
+		std::array<std::atomic<uint64_t>, LatencyBuckets::kCount> buckets{};
+	};
+
+	// Aligned so that no two threads' counters share a cache line
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> connectionsOpened{ 0 };
+		std::atomic<uint64_t> connectionsClosed{ 0 };
+		std::atomic<uint64_t> malformedRequests{ 0 };
+		// Used only by the owning thread. Recent lookups are cached in a small direct-mapped table in front of the map.
+		std::array<std::pair<SeriesKey, Series *>, kRecentSeries> recent{};
+		std::unordered_map<SeriesKey, Series *, SeriesKeyHash> index;
+
+		std::mutex seriesMutex; // Guards the list against readers while the owner appends
+		std::vector<std::unique_ptr<Series>> series;
+	};
+
+	struct Callback {
+		std::string name;
+		std::string help;
+		std::string_view type;
+		std::function<double()> read;
+	};
+
+	// Only the owning thread writes, so a load and a store make an increment without a locked instruction
+	static void increment(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	Shard &threadShard();
+
+	const uint64_t id_; // Distinguishes instances in the per-thread shard lookup
+
+	mutable std::mutex shardsMutex_;
+	std::vector<std::shared_ptr<Shard>> shards_;
+
+	mutable std::mutex callbacksMutex_;
+	std::vector<Callback> callbacks_;
+};
+
+} // namespace ou::http
@@ -0,0 +1,66 @@
+#include "MimeTypes.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <string>
+#include <utility>
+
+namespace ou::http {
+
+namespace {
+
+	// Sorted by extension for binary search
+	constexpr std::array<std::pair<std::string_view, std::string_view>, 32> kMimeTypes{ {
+			{ "avif", "image/avif" },
+			{ "bmp", "image/bmp" },
+			{ "css", "text/css; charset=utf-8" },
+			{ "csv", "text/csv; charset=utf-8" },
+			{ "gif", "image/gif" },
+			{ "gz", "application/gzip" },
+			{ "htm", "text/html; charset=utf-8" },
+			{ "html", "text/html; charset=utf-8" },
+			{ "ico", "image/x-icon" },
+			{ "jpeg", "image/jpeg" },
+			{ "jpg", "image/jpeg" },
+			{ "js", "text/javascript; charset=utf-8" },
+			{ "json", "application/json" },
+			{ "log", "text/plain; charset=utf-8" },
+			{ "map", "application/json" },
+			{ "md", "text/markdown; charset=utf-8" },
+			{ "mjs", "text/javascript; charset=utf-8" },
+			{ "mp3", "audio/mpeg" },
+			{ "mp4", "video/mp4" },
+			{ "pdf", "application/pdf" },
+			{ "png", "image/png" },
+			{ "svg", "image/svg+xml" },
+			{ "tar", "application/x-tar" },
+			{ "txt", "text/plain; charset=utf-8" },
+			{ "wasm", "application/wasm" },
+			{ "webm", "video/webm" },
+			{ "webp", "image/webp" },
+			{ "woff", "font/woff" },
+			{ "woff2", "font/woff2" },
+			{ "xml", "application/xml" },
+			{ "yaml", "application/yaml" },
+			{ "zip", "application/zip" },
+	} };
+
+	static_assert(std::ranges::is_sorted(kMimeTypes, {}, &std::pair<std::string_view, std::string_view>::first));
+
+} // namespace
+
+std::string_view mimeTypeForPath(const std::filesystem::path &path) {
+	std::string extension = path.extension().string();
+	if (extension.size() < 2)
+		return "application/octet-stream";
+	extension.erase(0, 1);
+	std::ranges::transform(extension, extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+	auto it = std::ranges::lower_bound(kMimeTypes, std::string_view(extension), {}, &std::pair<std::string_view, std::string_view>::first);
+	if (it == kMimeTypes.end() || it->first != extension)
+		return "application/octet-stream";
+	return it->second;
+}
+
+} // namespace ou::http
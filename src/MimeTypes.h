@@ -0,0 +1,11 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+namespace ou::http {
+
+// Content-Type for a served file, chosen by extension; unknown extensions are application/octet-stream
+std::string_view mimeTypeForPath(const std::filesystem::path &path);
+
+} // namespace ou::http
@@ -0,0 +1,192 @@
+#include "RangeRequest.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <random>
+#include <string>
+
+namespace ou::http {
+
+namespace {
+
+	// Requests asking for more ranges than this are served in full rather than split into many tiny parts
+	constexpr size_t kMaxRanges = 32;
+
+	std::string_view sTrim(std::string_view str) {
+		while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+			str.remove_prefix(1);
+		while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+			str.remove_suffix(1);
+		return str;
+	}
+
+	bool sParsePosition(std::string_view str, uint64_t &value) {
+		auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+		return ec == std::errc() && end == str.data() + str.size() && !str.empty();
+	}
+
+	// If-Range holds either a strong entity tag or the exact Last-Modified date of the representation being ranged
+	bool sIfRangeMatches(const Request &request, const Response &response) {
+		auto ifRange = request.headers.find(HeaderName::IfRange);
+		if (!ifRange)
+			return true;
+		if (ifRange->starts_with('"')) {
+			auto etag = response.headers.find(HeaderName::ETag);
+			return etag && *etag == *ifRange;
+		}
+		auto lastModified = response.headers.find(HeaderName::LastModified);
+		if (!lastModified)
+			return false;
+		auto requested = parseHttpDate(*ifRange);
+		return requested && requested == parseHttpDate(*lastModified);
+	}
+
+	std::string sContentRange(const ByteRange &range, const std::string &total) {
+		return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" + total;
+	}
+
+	std::string sMakeBoundary() {
+		thread_local std::mt19937_64 random{ std::random_device{}() };
+		std::array<char, 16> digits{};
+		auto [end, ec] = std::to_chars(digits.data(), digits.data() + digits.size(), random(), 16);
+		return "ou_http_" + std::string(digits.data(), end);
+	}
+
+	// Appends the bytes [first, first + length) of the response body as parts that share storage with it where possible
+	void sAppendSlice(const Response &response, uint64_t first, uint64_t length, std::vector<BodyPart> &parts) {
+		uint64_t position = 0; // Offset of the current part within the whole body
+		auto overlap = [&](uint64_t partSize, auto &&emit) {
+			uint64_t begin = std::max(first, position);
+			uint64_t end = std::min(first + length, position + partSize);
+			if (begin < end)
+				emit(begin - position, end - begin);
+			position += partSize;
+		};
+
+		overlap(response.body.size(), [&](uint64_t offset, uint64_t count) {
+			parts.emplace_back(response.body.substr(offset, count));
+		});
+		for (const auto &part : response.bodyParts) {
+			overlap(bodyPartSize(part), [&](uint64_t offset, uint64_t count) {
+				if (const auto *data = std::get_if<std::string>(&part)) {
+					parts.emplace_back(data->substr(offset, count));
+				} else if (const auto *shared = std::get_if<std::shared_ptr<const std::string>>(&part)) {
+					if (offset == 0 && count == (*shared)->size())
+						parts.push_back(part);
+					else
+						parts.emplace_back((*shared)->substr(offset, count));
+				} else {
+					FileRange range = std::get<FileRange>(part);
+					range.offset += static_cast<off_t>(offset);
+					range.length = count;
+					parts.emplace_back(std::move(range));
+				}
+			});
+		}
+	}
+
+} // namespace
+
+std::optional<std::vector<ByteRange>> parseRangeHeader(std::string_view value, uint64_t length) {
+	size_t equals = value.find('=');
+	if (equals == std::string_view::npos || !equalsIgnoreCase(sTrim(value.substr(0, equals)), "bytes"))
+		return std::nullopt;
+	value.remove_prefix(equals + 1);
+
+	std::vector<ByteRange> ranges;
+	size_t specCount = 0;
+	while (!value.empty()) {
+		size_t comma = value.find(',');
+		std::string_view spec = sTrim(value.substr(0, comma));
+		value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+		if (spec.empty())
+			continue;
+		if (++specCount > kMaxRanges)
+			return std::nullopt;
+
+		size_t dash = spec.find('-');
+		if (dash == std::string_view::npos)
+			return std::nullopt;
+		std::string_view firstText = spec.substr(0, dash);
+		std::string_view lastText = spec.substr(dash + 1);
+
+		if (firstText.empty()) {
+			// Suffix range: the final N bytes
+			uint64_t suffix = 0;
+			if (!sParsePosition(lastText, suffix))
+				return std::nullopt;
+			if (suffix > 0 && length > 0)
+				ranges.push_back({ length - std::min(suffix, length), length - 1 });
+			continue;
+		}
+
+		uint64_t first = 0;
+		uint64_t last = UINT64_MAX;
+		if (!sParsePosition(firstText, first) || (!lastText.empty() && !sParsePosition(lastText, last)) || last < first)
+			return std::nullopt;
+		if (first < length)
+			ranges.push_back({ first, std::min(last, length - 1) });
+	}
+	if (specCount == 0)
+		return std::nullopt;
+
+	std::sort(ranges.begin(), ranges.end(), [](const ByteRange &a, const ByteRange &b) {
+		return a.first < b.first;
+	});
+	std::vector<ByteRange> merged;
+	for (const auto &range : ranges) {
+		if (!merged.empty() && range.first <= merged.back().last + 1)
+			merged.back().last = std::max(merged.back().last, range.last);
+		else
+			merged.push_back(range);
+	}
+	return merged;
+}
+
+void applyRangeRequest(const Request &request, Response &response) {
+	if (request.method != Method::GET || response.statusCode != 200)
+		return;
+	uint64_t length = response.contentLength();
+	response.headers[HeaderName::AcceptRanges] = "bytes";
+
+	auto rangeHeader = request.headers.find(HeaderName::Range);
+	if (!rangeHeader || !sIfRangeMatches(request, response))
+		return;
+	auto ranges = parseRangeHeader(*rangeHeader, length);
+	if (!ranges)
+		return;
+
+	std::string total = std::to_string(length);
+	if (ranges->empty()) {
+		response.statusCode = 416;
+		response.reasonPhrase = "Range Not Satisfiable";
+		response.headers[HeaderName::ContentRange] = "bytes */" + total;
+		response.headers[HeaderName::ContentType] = "text/plain";
+		response.body = "416 Range Not Satisfiable";
+		response.bodyParts.clear();
+		return;
+	}
+
+	std::vector<BodyPart> parts;
+	if (ranges->size() == 1) {
+		sAppendSlice(response, ranges->front().first, ranges->front().length(), parts);
+		response.headers[HeaderName::ContentRange] = sContentRange(ranges->front(), total);
+	} else {
+		std::string partType(response.headers.find(HeaderName::ContentType).value_or("text/html"));
+		std::string boundary = sMakeBoundary();
+		for (const auto &range : *ranges) {
+			parts.emplace_back("\r\n--" + boundary + "\r\nContent-Type: " + partType + "\r\nContent-Range: " + sContentRange(range, total) + "\r\n\r\n");
+			sAppendSlice(response, range.first, range.length(), parts);
+		}
+		parts.emplace_back("\r\n--" + boundary + "--\r\n");
+		response.headers[HeaderName::ContentType] = "multipart/byteranges; boundary=" + boundary;
+	}
+
+	response.statusCode = 206;
+	response.reasonPhrase = "Partial Content";
+	response.body.clear();
+	response.bodyParts = std::move(parts);
+}
+
+} // namespace ou::http
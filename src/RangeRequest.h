@@ -0,0 +1,30 @@
+#pragma once
+
+#include "HttpTypes.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace ou::http {
+
+// Inclusive byte positions within a representation
+struct ByteRange {
+	uint64_t first = 0;
+	uint64_t last = 0;
+
+	uint64_t length() const { return last - first + 1; }
+};
+
+// Parses a Range header value against a representation of `length` bytes. Returns nullopt when the header should be
+// ignored (malformed, unknown unit or too many ranges) and an empty vector when no range is satisfiable. Overlapping
+// and adjacent ranges are merged, so the result is sorted and disjoint.
+std::optional<std::vector<ByteRange>> parseRangeHeader(std::string_view value, uint64_t length);
+
+// Turns a complete 200 response to a GET into a 206 (single range or multipart/byteranges) or 416 response when the
+// request carries a satisfiable Range header and If-Range, if present, still matches. File parts are narrowed to an
+// offset and length, so a range of a large file is sent with sendfile() just like the whole file.
+void applyRangeRequest(const Request &request, Response &response);
+
+} // namespace ou::http
@@ -0,0 +1,521 @@
+#include "Replication.h"
+#include "Logging.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <system_error>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace ou::http {
+
+namespace {
+	constexpr std::string_view kMagic = "OUKVREP1";
+	// type | sequence | expiry (changes) or leader time in milliseconds since the Unix epoch (heartbeats) | key length |
+	// value length
+	constexpr size_t kFrameHeader = 1 + 8 + 8 + 4 + 4;
+	constexpr size_t kReadBytes = 256 * 1024;
+	constexpr size_t kMaxSendBytes = 1024 * 1024;
+	constexpr auto kPollInterval = std::chrono::milliseconds(100);
+
+	enum class Frame : uint8_t { Set = 1, Remove = 2, SnapshotBegin = 3, SnapshotEnd = 4, Heartbeat = 5 };
+
+	void sAppendInt(std::string &out, uint64_t value, size_t bytes) {
+		for (size_t i = 0; i < bytes; ++i)
+			out += static_cast<char>(value >> (8 * i));
+	}
+
+	uint64_t sReadInt(const char *data, size_t bytes) {
+		uint64_t value = 0;
+		for (size_t i = 0; i < bytes; ++i)
+			value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+		return value;
+	}
+
+	void sAppendFrame(std::string &out, Frame type, uint64_t sequence, int64_t stamp, std::string_view key = {},
+										std::string_view value = {}) {
+		out += static_cast<char>(type);
+		sAppendInt(out, sequence, 8);
+		sAppendInt(out, static_cast<uint64_t>(stamp), 8);
+		sAppendInt(out, key.size(), 4);
+		sAppendInt(out, value.size(), 4);
+		out += key;
+		out += value;
+	}
+
+	int64_t sWallMillis() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	struct SocketAddress {
+		sockaddr_storage storage{};
+		socklen_t length = 0;
+		std::string unixPath; // Set for Unix sockets
+	};
+
+	// "unix:/path" or "host:port"; an empty host means every interface
+	std::optional<SocketAddress> sResolve(std::string_view address) {
+		SocketAddress result;
+		if (address.starts_with("unix:")) {
+			result.unixPath = address.substr(5);
+			auto &unixAddress = reinterpret_cast<sockaddr_un &>(result.storage);
+			if (result.unixPath.empty() || result.unixPath.size() >= sizeof(unixAddress.sun_path))
+				return std::nullopt;
+			unixAddress.sun_family = AF_UNIX;
+			std::memcpy(unixAddress.sun_path, result.unixPath.c_str(), result.unixPath.size() + 1);
+			result.length = sizeof(unixAddress);
+			return result;
+		}
+
+		size_t colon = address.rfind(':');
+		if (colon == std::string_view::npos)
+			return std::nullopt;
+		std::string host(address.substr(0, colon));
+		std::string port(address.substr(colon + 1));
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = host.empty() ? AI_PASSIVE : 0;
+		addrinfo *info = nullptr;
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &info) != 0 || info == nullptr)
+			return std::nullopt;
+		std::memcpy(&result.storage, info->ai_addr, info->ai_addrlen);
+		result.length = info->ai_addrlen;
+		freeaddrinfo(info);
+		return result;
+	}
+
+	int sSocket(const SocketAddress &address, int flags) {
+		int fd = socket(address.storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC | flags, 0);
+		if (fd >= 0 && address.unixPath.empty()) {
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		return fd;
+	}
+
+	bool sSendAll(int fd, std::string_view data) {
+		while (!data.empty()) {
+			ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+			if (sent < 0) {
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			data.remove_prefix(static_cast<size_t>(sent));
+		}
+		return true;
+	}
+} // namespace
+
+struct ReplicationLeader::Follower {
+	int fd = -1;
+	std::string peer;
+	std::string out;
+	size_t sent = 0;				// Bytes at the front of out already written
+	size_t snapshotEnd = 0; // Bytes at the front of out that belong to the snapshot, which maxBufferedBytes does not cover
+	uint64_t acked = 0;
+	std::string acks; // A partly received acknowledgement
+};
+
+ReplicationLeader::ReplicationLeader(Config config, KVLog::SnapshotSource snapshotSource)
+		: config_(std::move(config)), snapshotSource_(std::move(snapshotSource)) {
+	std::optional<SocketAddress> address = sResolve(config_.address);
+	if (!address)
+		throw std::system_error(EINVAL, std::generic_category(), "Invalid replication address " + config_.address);
+	listenFd_ = sSocket(*address, SOCK_NONBLOCK);
+	if (listenFd_ < 0)
+		throw std::system_error(errno, std::generic_category(), "Failed to create replication socket");
+	int one = 1;
+	if (address->unixPath.empty())
+		setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	else
+		unlink(address->unixPath.c_str());
+	if (bind(listenFd_, reinterpret_cast<const sockaddr *>(&address->storage), address->length) < 0 || listen(listenFd_, 16) < 0) {
+		int error = errno;
+		close(listenFd_);
+		throw std::system_error(error, std::generic_category(), "Failed to listen for followers on " + config_.address);
+	}
+	struct stat socketStat {};
+	if (!address->unixPath.empty() && stat(address->unixPath.c_str(), &socketStat) == 0)
+		socketInode_ = socketStat.st_ino;
+	wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	LOG_INFO("Replicating to followers on {}", config_.address);
+	thread_ = std::thread([this]() { leaderThread(); });
+}
+
+ReplicationLeader::~ReplicationLeader() {
+	stopping_ = true;
+	wake();
+	thread_.join();
+	close(wakeFd_);
+	close(listenFd_);
+	// Unless another leader has since taken over the path
+	struct stat socketStat {};
+	const char *path = config_.address.c_str() + 5;
+	if (socketInode_ != 0 && stat(path, &socketStat) == 0 && socketStat.st_ino == socketInode_)
+		unlink(path);
+}
+
+void ReplicationLeader::publish(KVLog::Op op, std::string_view key, std::string_view value, int64_t expiresAt) {
+	// A change published while no follower is registered needs no frame: a follower registered afterwards snapshots
+	// the key's shard, which waits for the caller's lock, so the snapshot includes the change
+	if (!active_.load()) {
+		sequence_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	bool wasEmpty;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		uint64_t sequence = sequence_.fetch_add(1, std::memory_order_relaxed) + 1;
+		wasEmpty = pending_.empty();
+		if (op == KVLog::Op::Remove)
+			sAppendFrame(pending_, Frame::Remove, sequence, 0, key);
+		else
+			sAppendFrame(pending_, Frame::Set, sequence, expiresAt, key, value);
+	}
+	if (wasEmpty)
+		wake();
+}
+
+ReplicationLeader::Stats ReplicationLeader::stats() const {
+	Stats stats;
+	stats.sequence = sequence_.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(statsMutex_);
+	stats.snapshots = snapshots_;
+	stats.disconnects = disconnects_;
+	stats.followers = followerStats_;
+	return stats;
+}
+
+void ReplicationLeader::wake() {
+	uint64_t one = 1;
+	[[maybe_unused]] ssize_t written = write(wakeFd_, &one, sizeof(one));
+}
+
+void ReplicationLeader::acceptFollowers(std::vector<Follower> &followers) {
+	// Requires mutex_, so that the followers are registered before any change published after their snapshot begins
+	sockaddr_storage peerAddress{};
+	socklen_t peerLength = sizeof(peerAddress);
+	int fd;
+	while ((fd = accept4(listenFd_, reinterpret_cast<sockaddr *>(&peerAddress), &peerLength, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		Follower follower;
+		follower.fd = fd;
+		if (peerAddress.ss_family == AF_UNIX) {
+			follower.peer = config_.address;
+		} else {
+			std::array<char, NI_MAXHOST> host{};
+			std::array<char, NI_MAXSERV> port{};
+			getnameinfo(reinterpret_cast<sockaddr *>(&peerAddress), peerLength, host.data(), host.size(), port.data(), port.size(),
+									NI_NUMERICHOST | NI_NUMERICSERV);
+			follower.peer = std::string(host.data()) + ":" + port.data();
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		follower.acked = sequence_.load(std::memory_order_relaxed);
+		followers.push_back(std::move(follower));
+		peerLength = sizeof(peerAddress);
+	}
+}
+
+void ReplicationLeader::leaderThread() {
+	std::vector<Follower> followers;
+	std::vector<pollfd> pollFds;
+	std::string batch;
+	auto lastHeartbeat = std::chrono::steady_clock::now();
+
+	while (!stopping_) {
+		pollFds.clear();
+		pollFds.push_back({ listenFd_, POLLIN, 0 });
+		pollFds.push_back({ wakeFd_, POLLIN, 0 });
+		for (const Follower &follower : followers)
+			pollFds.push_back({ follower.fd, static_cast<short>(POLLIN | (follower.sent < follower.out.size() ? POLLOUT : 0)), 0 });
+		poll(pollFds.data(), pollFds.size(), static_cast<int>(config_.heartbeatInterval.count()));
+		if (pollFds[1].revents & POLLIN) {
+			uint64_t count;
+			[[maybe_unused]] ssize_t drained = read(wakeFd_, &count, sizeof(count));
+		}
+
+		// Changes taken in the same critical section as new followers are registered go only to existing followers;
+		// the new ones get them through their snapshot
+		size_t existing = followers.size();
+		batch.clear();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			batch.swap(pending_);
+			if (pollFds[0].revents & POLLIN)
+				acceptFollowers(followers);
+			active_ = !followers.empty();
+		}
+		for (size_t i = 0; i < existing; ++i)
+			followers[i].out += batch;
+
+		for (size_t i = existing; i < followers.size(); ++i) {
+			Follower &follower = followers[i];
+			auto start = std::chrono::steady_clock::now();
+			follower.out = kMagic;
+			sAppendFrame(follower.out, Frame::SnapshotBegin, follower.acked, 0);
+			size_t entries = 0;
+			snapshotSource_([&follower, &entries](std::string_view key, std::string_view value, int64_t expiresAt) {
+				sAppendFrame(follower.out, Frame::Set, follower.acked, expiresAt, key, value);
+				++entries;
+			});
+			sAppendFrame(follower.out, Frame::SnapshotEnd, follower.acked, 0);
+			follower.snapshotEnd = follower.out.size();
+			LOG_INFO("Follower {} connected; sending a snapshot of {} keys ({} bytes, built in {} ms)", follower.peer, entries,
+							 follower.out.size(),
+							 std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+			std::lock_guard<std::mutex> lock(statsMutex_);
+			++snapshots_;
+		}
+
+		// Heartbeats follow everything published so far, so a follower that applies one is current as of its time
+		auto now = std::chrono::steady_clock::now();
+		if (!batch.empty() || now - lastHeartbeat >= config_.heartbeatInterval) {
+			lastHeartbeat = now;
+			uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+			for (Follower &follower : followers)
+				sAppendFrame(follower.out, Frame::Heartbeat, sequence, sWallMillis());
+		}
+
+		for (Follower &follower : followers) {
+			bool failed = false;
+			while (follower.sent < follower.out.size()) {
+				size_t size = std::min(follower.out.size() - follower.sent, kMaxSendBytes);
+				ssize_t sent = send(follower.fd, follower.out.data() + follower.sent, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+				if (sent < 0) {
+					failed = errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+					break;
+				}
+				follower.sent += static_cast<size_t>(sent);
+			}
+			if (follower.sent == follower.out.size() || follower.sent > follower.out.size() / 2) {
+				follower.out.erase(0, follower.sent);
+				follower.snapshotEnd -= std::min(follower.snapshotEnd, follower.sent);
+				follower.sent = 0;
+			}
+
+			std::array<char, 4096> buffer;
+			ssize_t received;
+			while ((received = recv(follower.fd, buffer.data(), buffer.size(), MSG_DONTWAIT)) > 0) {
+				follower.acks.append(buffer.data(), static_cast<size_t>(received));
+				size_t complete = follower.acks.size() / 8 * 8;
+				if (complete > 0)
+					follower.acked = sReadInt(follower.acks.data() + complete - 8, 8);
+				follower.acks.erase(0, complete);
+			}
+			if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				failed = true;
+
+			if (follower.out.size() - std::max(follower.sent, follower.snapshotEnd) > config_.maxBufferedBytes) {
+				LOG_WARN("Disconnecting follower {}: more than {} bytes behind", follower.peer, config_.maxBufferedBytes);
+				failed = true;
+			} else if (failed) {
+				LOG_INFO("Follower {} disconnected", follower.peer);
+			}
+			if (failed) {
+				close(follower.fd);
+				follower.fd = -1;
+			}
+		}
+		size_t before = followers.size();
+		std::erase_if(followers, [](const Follower &follower) { return follower.fd < 0; });
+
+		uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+		std::lock_guard<std::mutex> lock(statsMutex_);
+		disconnects_ += before - followers.size();
+		followerStats_.clear();
+		for (const Follower &follower : followers) {
+			followerStats_.push_back(
+					{ follower.peer, follower.acked, sequence - std::min(sequence, follower.acked), follower.out.size() - follower.sent });
+		}
+	}
+
+	for (const Follower &follower : followers)
+		close(follower.fd);
+	active_ = false;
+}
+
+ReplicationFollower::ReplicationFollower(Config config, KVLog::Apply apply, std::function<void()> clear)
+		: config_(std::move(config)), apply_(std::move(apply)), clear_(std::move(clear)) {
+	thread_ = std::thread([this]() { followerThread(); });
+}
+
+ReplicationFollower::~ReplicationFollower() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	stopWake_.notify_one();
+	thread_.join();
+}
+
+ReplicationFollower::Stats ReplicationFollower::stats() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	Stats stats = stats_;
+	if (stats.connected && lastHeartbeat_ != std::chrono::steady_clock::time_point{})
+		stats.sinceHeartbeat = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastHeartbeat_);
+	return stats;
+}
+
+void ReplicationFollower::followerThread() {
+	bool warned = false;
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!stopping_) {
+		lock.unlock();
+		int fd = -1;
+		if (std::optional<SocketAddress> address = sResolve(config_.leader)) {
+			fd = sSocket(*address, 0);
+			if (fd >= 0 && connect(fd, reinterpret_cast<const sockaddr *>(&address->storage), address->length) < 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+		if (fd >= 0) {
+			LOG_INFO("Following leader {}", config_.leader);
+			warned = false;
+			follow(fd);
+			close(fd);
+			std::lock_guard<std::mutex> stoppingLock(mutex_);
+			if (!stopping_)
+				LOG_WARN("Lost connection to leader {}", config_.leader);
+		} else if (!warned) {
+			LOG_WARN("Cannot connect to leader {}: {}; retrying every {} ms", config_.leader, std::strerror(errno),
+							 config_.reconnectInterval.count());
+			warned = true;
+		}
+		lock.lock();
+		stats_.connected = false;
+		stopWake_.wait_for(lock, config_.reconnectInterval, [this]() { return stopping_; });
+	}
+}
+
+void ReplicationFollower::follow(int fd) {
+	std::string buffer;
+	size_t parsed = 0;
+	bool greeted = false;
+	uint64_t applied = 0;
+	uint64_t acknowledged = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats_.connected = true;
+		lastHeartbeat_ = {};
+	}
+
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (stopping_)
+				return;
+		}
+		pollfd pollFd{ fd, POLLIN, 0 };
+		if (poll(&pollFd, 1, static_cast<int>(kPollInterval.count())) == 0)
+			continue;
+		size_t size = buffer.size();
+		buffer.resize(size + kReadBytes);
+		ssize_t received = recv(fd, buffer.data() + size, kReadBytes, 0);
+		if (received <= 0) {
+			if (received < 0 && errno == EINTR) {
+				buffer.resize(size);
+				continue;
+			}
+			return;
+		}
+		buffer.resize(size + static_cast<size_t>(received));
+
+		if (!greeted) {
+			if (buffer.size() < kMagic.size())
+				continue;
+			if (std::string_view(buffer).substr(0, kMagic.size()) != kMagic) {
+				LOG_ERROR("Leader {} does not speak the replication protocol", config_.leader);
+				return;
+			}
+			parsed = kMagic.size();
+			greeted = true;
+		}
+
+		std::optional<Stats> heartbeat;
+		while (buffer.size() - parsed >= kFrameHeader) {
+			const char *header = buffer.data() + parsed;
+			size_t keyLength = sReadInt(header + 17, 4);
+			size_t valueLength = sReadInt(header + 21, 4);
+			if (buffer.size() - parsed - kFrameHeader < keyLength + valueLength)
+				break;
+			auto type = static_cast<Frame>(header[0]);
+			uint64_t sequence = sReadInt(header + 1, 8);
+			auto stamp = static_cast<int64_t>(sReadInt(header + 9, 8));
+			std::string_view key(header + kFrameHeader, keyLength);
+			std::string_view value(header + kFrameHeader + keyLength, valueLength);
+			parsed += kFrameHeader + keyLength + valueLength;
+
+			// A store that cannot take the changes, e.g. because its log failed, stops following until it reconnects
+			try {
+				switch (type) {
+				case Frame::Set:
+					apply_(KVLog::Op::Set, key, value, stamp);
+					applied = sequence;
+					break;
+				case Frame::Remove:
+					apply_(KVLog::Op::Remove, key, {}, 0);
+					applied = sequence;
+					break;
+				case Frame::SnapshotBegin:
+					clear_();
+					break;
+				case Frame::SnapshotEnd: {
+					applied = sequence;
+					std::lock_guard<std::mutex> lock(mutex_);
+					++stats_.snapshots;
+					break;
+				}
+				case Frame::Heartbeat:
+					heartbeat = Stats{};
+					heartbeat->leaderSequence = sequence;
+					heartbeat->lag = sequence - std::min(sequence, applied);
+					heartbeat->lagTime = std::chrono::milliseconds(std::max<int64_t>(sWallMillis() - stamp, 0));
+					break;
+				default:
+					LOG_ERROR("Unknown replication frame type {} from leader {}", static_cast<int>(type), config_.leader);
+					return;
+				}
+			} catch (const std::exception &e) {
+				LOG_ERROR("Failed to apply changes from leader {}: {}", config_.leader, e.what());
+				return;
+			}
+		}
+		buffer.erase(0, parsed);
+		parsed = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stats_.appliedSequence = applied;
+			if (heartbeat) {
+				stats_.leaderSequence = heartbeat->leaderSequence;
+				stats_.lag = heartbeat->lag;
+				stats_.lagTime = heartbeat->lagTime;
+				lastHeartbeat_ = std::chrono::steady_clock::now();
+			}
+		}
+		if (applied != acknowledged) {
+			std::string ack;
+			sAppendInt(ack, applied, 8);
+			if (!sSendAll(fd, ack))
+				return;
+			acknowledged = applied;
+		}
+	}
+}
+
+} // namespace ou::http
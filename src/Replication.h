@@ -0,0 +1,136 @@
+#pragma once
+
+#include "KVLog.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ou::http {
+
+// Streams a KVStore's changes to read-only followers over TCP ("host:port") or a Unix socket ("unix:/path").
+//
+// A follower that connects first receives a snapshot of the store and then every change published after it was
+// accepted. Changes are published under the key's shard lock, so a change either reaches the follower's stream or is
+// already in the snapshot, which locks the shard after acceptance; replaying the stream over the snapshot converges
+// because every change carries the whole new state of its key. Followers acknowledge what they have applied, which
+// gives the leader each follower's lag. A follower that falls too far behind is disconnected and catches up again
+// with a fresh snapshot when it reconnects.
+//
+// Frames: type | sequence | expiry or leader time | key length | value length | key | value, integers little-endian.
+class ReplicationLeader {
+public:
+	struct Config {
+		std::string address;																		// Listens here
+		std::chrono::milliseconds heartbeatInterval{ 100 };				// Idle followers still hear this often
+		size_t maxBufferedBytes = 64 * 1024 * 1024;							// Per follower, beyond its snapshot
+	};
+
+	struct FollowerStats {
+		std::string peer;
+		uint64_t ackedSequence = 0; // The last change the follower has applied
+		uint64_t lag = 0;						// Changes published but not yet applied by the follower
+		uint64_t bufferedBytes = 0; // Waiting to be sent
+	};
+
+	struct Stats {
+		uint64_t sequence = 0; // Changes published since startup
+		uint64_t snapshots = 0;
+		uint64_t disconnects = 0; // Followers lost, including those dropped for falling behind
+		std::vector<FollowerStats> followers;
+	};
+
+	// Throws std::system_error if the address cannot be listened on
+	ReplicationLeader(Config config, KVLog::SnapshotSource snapshotSource);
+	~ReplicationLeader();
+
+	ReplicationLeader(const ReplicationLeader &) = delete;
+	ReplicationLeader &operator=(const ReplicationLeader &) = delete;
+
+	// Must be called while the key is locked against other writers. Cheap when no follower is connected.
+	void publish(KVLog::Op op, std::string_view key, std::string_view value, int64_t expiresAt = 0);
+
+	Stats stats() const;
+
+private:
+	struct Follower;
+
+	void leaderThread();
+	void acceptFollowers(std::vector<Follower> &followers);
+	void wake();
+
+	const Config config_;
+	const KVLog::SnapshotSource snapshotSource_;
+	int listenFd_ = -1;
+	uint64_t socketInode_ = 0; // Of a Unix socket, which is removed on destruction
+	int wakeFd_ = -1;
+
+	// Publishers only take mutex_ while a follower is connected
+	std::atomic<bool> active_{ false };
+	std::atomic<uint64_t> sequence_{ 0 };
+	mutable std::mutex mutex_;
+	std::string pending_; // Frames published since the leader thread last took them
+
+	mutable std::mutex statsMutex_;
+	std::vector<FollowerStats> followerStats_;
+	uint64_t snapshots_ = 0;
+	uint64_t disconnects_ = 0;
+
+	std::atomic<bool> stopping_{ false };
+	std::thread thread_;
+};
+
+// Keeps a store in step with a ReplicationLeader, reconnecting and reloading the snapshot whenever the connection
+// drops.
+class ReplicationFollower {
+public:
+	struct Config {
+		std::string leader;																		 // The leader's address
+		std::chrono::milliseconds reconnectInterval{ 1000 };
+	};
+
+	struct Stats {
+		bool connected = false;
+		uint64_t snapshots = 0;				 // Loaded since startup
+		uint64_t appliedSequence = 0;	 // The leader's sequence number of the last change applied
+		uint64_t leaderSequence = 0;	 // As of the last heartbeat
+		uint64_t lag = 0;							 // Changes the leader had published but this follower had not applied, at that heartbeat
+		std::chrono::milliseconds lagTime{ 0 }; // How long the last heartbeat took to be applied after the leader sent it
+		std::chrono::milliseconds sinceHeartbeat{ 0 };
+	};
+
+	// apply receives every change, snapshot entries included; clear is called before a snapshot is loaded
+	ReplicationFollower(Config config, KVLog::Apply apply, std::function<void()> clear);
+	~ReplicationFollower();
+
+	ReplicationFollower(const ReplicationFollower &) = delete;
+	ReplicationFollower &operator=(const ReplicationFollower &) = delete;
+
+	Stats stats() const;
+
+private:
+	void followerThread();
+	// Returns once the connection fails or the follower is stopping
+	void follow(int fd);
+
+	const Config config_;
+	const KVLog::Apply apply_;
+	const std::function<void()> clear_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable stopWake_;
+	bool stopping_ = false;
+	Stats stats_;
+	std::chrono::steady_clock::time_point lastHeartbeat_;
+
+	std::thread thread_;
+};
+
+} // namespace ou::http
@@ -0,0 +1,250 @@
+#include "RequestParser.h"
+#include "ByteScan.h"
+
+#include <algorithm>
+#include <charconv>
+#include <optional>
+
+namespace ou::http {
+
+namespace {
+
+	bool sIsOptionalWhitespace(char c) { return c == ' ' || c == '\t'; }
+
+	bool sParseDecimal(std::string_view str, size_t &value) {
+		auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+		return ec == std::errc() && end == str.data() + str.size() && !str.empty();
+	}
+
+} // namespace
+
+void RequestParser::reset() {
+	stage_ = Stage::Head;
+	pos_ = 0;
+	fields_.clear();
+	bodyLength_ = 0;
+	chunked_ = false;
+	chunkRemaining_ = 0;
+	trailersStart_ = 0;
+	chunkedBody_.clear();
+	request_.headers.clear();
+	request_.body = {};
+	request_.params.clear();
+	request_.clientAddr.reset();
+	errorStatus_ = 0;
+	errorReason_ = {};
+}
+
+RequestParser::Status RequestParser::parse(std::string_view buffer) {
+	switch (stage_) {
+	case Stage::Head: {
+		// Resume the terminator search a few bytes back in case it straddles the previous read
+		size_t searchFrom = pos_ >= 3 ? pos_ - 3 : 0;
+		size_t headEnd = findHeaderEnd(buffer, searchFrom);
+		if (headEnd == std::string_view::npos) {
+			pos_ = buffer.size();
+			if (buffer.size() > limits_.maxHeaderSize)
+				return fail(431, "request header fields too large");
+			return Status::Incomplete;
+		}
+		if (headEnd + 4 > limits_.maxHeaderSize)
+			return fail(431, "request header fields too large");
+		return parseHead(buffer, headEnd);
+	}
+	case Stage::Body:
+		if (buffer.size() < pos_ + bodyLength_)
+			return Status::Incomplete;
+		pos_ += bodyLength_;
+		stage_ = Stage::Done;
+		return complete(buffer);
+	case Stage::ChunkSize:
+	case Stage::ChunkData:
+	case Stage::ChunkDataEnd:
+	case Stage::Trailers:
+		return parseChunked(buffer);
+	case Stage::Done:
+		return complete(buffer);
+	case Stage::Failed:
+		return Status::Error;
+	}
+	return Status::Error;
+}
+
+RequestParser::Status RequestParser::parseHead(std::string_view buffer, size_t headEnd) {
+	auto span = [](size_t begin, size_t end) {
+		return Span{ static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin) };
+	};
+
+	// Each scan runs over the rest of the header section and stops at the first byte its element cannot hold, so finding
+	// where an element ends also validates it. The section ends in "\r\n\r\n", which stops every scan.
+	std::string_view head = buffer.substr(0, headEnd + 4);
+
+	// Request line: method SP request-target SP HTTP-version
+	size_t methodEnd = tokenLength(head);
+	if (head[methodEnd] != ' ')
+		return fail(400, head[methodEnd] == '\r' ? "malformed request line" : "malformed method");
+	size_t targetEnd = methodEnd + 1 + targetLength(head.substr(methodEnd + 1));
+	if (targetEnd == methodEnd + 1 || head[targetEnd] == '\r')
+		return fail(400, "malformed request line");
+	if (head[targetEnd] != ' ')
+		return fail(400, "malformed request target");
+
+	auto method = parseMethod(head.substr(0, methodEnd));
+	if (!method)
+		return fail(501, "unsupported method");
+	method_ = *method;
+	target_ = span(methodEnd + 1, targetEnd);
+
+	size_t lineEnd = head.find("\r\n", targetEnd);
+	std::string_view version = head.substr(targetEnd + 1, lineEnd - targetEnd - 1);
+	if (version.size() != 8 || !version.starts_with("HTTP/1.") || version[7] < '0' || version[7] > '9')
+		return fail(version.starts_with("HTTP/") ? 505 : 400, "unsupported HTTP version");
+	version_ = span(targetEnd + 1, lineEnd);
+
+	// Header fields: name ":" OWS value OWS
+	bool chunked = false;
+	std::optional<size_t> contentLength;
+	for (size_t lineStart = lineEnd + 2; lineStart < headEnd + 2; lineStart = lineEnd + 2) {
+		std::string_view rest = head.substr(lineStart);
+		size_t colon = tokenLength(rest);
+		if (colon == 0 || rest[colon] != ':')
+			return fail(400, "malformed header field");
+
+		// The value runs to the first byte a field value cannot hold, which must be the CR ending the line
+		size_t valueBegin = colon + 1;
+		size_t valueEnd = valueBegin + fieldValueLength(rest.substr(valueBegin));
+		if (!rest.substr(valueEnd).starts_with("\r\n"))
+			return fail(400, "malformed header value");
+		lineEnd = lineStart + valueEnd;
+		while (valueBegin < valueEnd && sIsOptionalWhitespace(rest[valueBegin]))
+			++valueBegin;
+		while (valueEnd > valueBegin && sIsOptionalWhitespace(rest[valueEnd - 1]))
+			--valueEnd;
+		HeaderName id = internHeaderName(rest.substr(0, colon));
+		std::string_view value = rest.substr(valueBegin, valueEnd - valueBegin);
+
+		if (id == HeaderName::ContentLength) {
+			size_t length = 0;
+			if (!sParseDecimal(value, length) || (contentLength && *contentLength != length))
+				return fail(400, "invalid Content-Length");
+			contentLength = length;
+		} else if (id == HeaderName::TransferEncoding) {
+			// chunked must be the final coding; no other request codings are supported
+			if (!equalsIgnoreCase(value, "chunked"))
+				return fail(501, "unsupported Transfer-Encoding");
+			chunked = true;
+		}
+
+		fields_.push_back({ id, span(lineStart, lineStart + colon), span(lineStart + valueBegin, lineStart + valueEnd) });
+	}
+
+	pos_ = headEnd + 4;
+
+	if (chunked) {
+		// A message with both framings is a request smuggling vector, so refuse it outright
+		if (contentLength)
+			return fail(400, "both Content-Length and Transfer-Encoding present");
+		chunked_ = true;
+		stage_ = Stage::ChunkSize;
+		return parseChunked(buffer);
+	}
+
+	bodyLength_ = contentLength.value_or(0);
+	if (bodyLength_ > limits_.maxBodySize)
+		return fail(413, "request body too large");
+	stage_ = Stage::Body;
+	return parse(buffer);
+}
+
+RequestParser::Status RequestParser::parseChunked(std::string_view buffer) {
+	while (true) {
+		switch (stage_) {
+		case Stage::ChunkSize: {
+			size_t lineEnd = buffer.find("\r\n", pos_);
+			if (lineEnd == std::string_view::npos) {
+				if (buffer.size() - pos_ > 1024)
+					return fail(400, "malformed chunk size");
+				return Status::Incomplete;
+			}
+			// Chunk extensions after ';' are ignored
+			std::string_view line = buffer.substr(pos_, lineEnd - pos_);
+			line = line.substr(0, line.find(';'));
+			while (!line.empty() && sIsOptionalWhitespace(line.back()))
+				line.remove_suffix(1);
+
+			size_t size = 0;
+			auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+			if (ec != std::errc() || end != line.data() + line.size() || line.empty())
+				return fail(400, "malformed chunk size");
+			if (size > limits_.maxBodySize - chunkedBody_.size())
+				return fail(413, "request body too large");
+
+			pos_ = lineEnd + 2;
+			chunkRemaining_ = size;
+			stage_ = size == 0 ? Stage::Trailers : Stage::ChunkData;
+			trailersStart_ = pos_;
+			break;
+		}
+		case Stage::ChunkData: {
+			size_t available = std::min(buffer.size() - pos_, chunkRemaining_);
+			chunkedBody_.append(buffer.substr(pos_, available));
+			pos_ += available;
+			chunkRemaining_ -= available;
+			if (chunkRemaining_ > 0)
+				return Status::Incomplete;
+			stage_ = Stage::ChunkDataEnd;
+			break;
+		}
+		case Stage::ChunkDataEnd:
+			if (buffer.size() - pos_ < 2)
+				return Status::Incomplete;
+			if (buffer.substr(pos_, 2) != "\r\n")
+				return fail(400, "malformed chunk terminator");
+			pos_ += 2;
+			stage_ = Stage::ChunkSize;
+			break;
+		case Stage::Trailers: {
+			// Trailer fields are read past and dropped, but the section as a whole, pending line included, is limited
+			size_t lineEnd = buffer.find("\r\n", pos_);
+			size_t sectionEnd = lineEnd == std::string_view::npos ? buffer.size() : lineEnd + 2;
+			if (sectionEnd - trailersStart_ > limits_.maxHeaderSize)
+				return fail(431, "trailer fields too large");
+			if (lineEnd == std::string_view::npos)
+				return Status::Incomplete;
+			bool lastLine = lineEnd == pos_;
+			pos_ = lineEnd + 2;
+			if (lastLine) {
+				stage_ = Stage::Done;
+				return complete(buffer);
+			}
+			break;
+		}
+		default:
+			return Status::Error;
+		}
+	}
+}
+
+RequestParser::Status RequestParser::complete(std::string_view buffer) {
+	request_.method = method_;
+	std::string_view target = target_.in(buffer);
+	size_t question = target.find('?');
+	request_.path = target.substr(0, question);
+	request_.query = question == std::string_view::npos ? std::string_view{} : target.substr(question + 1);
+	request_.version = version_.in(buffer);
+	request_.headers.clear();
+	for (const auto &[id, name, value] : fields_)
+		request_.headers.add(id, name.in(buffer), value.in(buffer));
+
+	request_.body = chunked_ ? std::string_view(chunkedBody_) : buffer.substr(pos_ - bodyLength_, bodyLength_);
+	return Status::Complete;
+}
+
+RequestParser::Status RequestParser::fail(int status, std::string_view reason) {
+	stage_ = Stage::Failed;
+	errorStatus_ = status;
+	errorReason_ = reason;
+	return Status::Error;
+}
+
+} // namespace ou::http
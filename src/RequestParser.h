@@ -0,0 +1,82 @@
+#pragma once
+
+#include "HttpTypes.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ou::http {
+
+// Resumable HTTP/1.x request parser. Feed it the connection buffer every time more bytes arrive; it picks up where it
+// left off, so a request split across many reads is only scanned once. The parsed request refers into that buffer
+// rather than copying out of it, except for chunked bodies, which are reassembled into storage owned by the parser.
+class RequestParser {
+public:
+	enum class Status { Incomplete, Complete, Error };
+
+	struct Limits {
+		size_t maxHeaderSize = 64 * 1024;
+		size_t maxBodySize = 8 * 1024 * 1024;
+	};
+
+	RequestParser() = default;
+	explicit RequestParser(Limits limits) : limits_(limits) {}
+
+	// buffer must start at the first byte of the current request and keep every byte passed to previous calls; it may
+	// have been reallocated in between.
+	Status parse(std::string_view buffer);
+
+	// Valid once parse() returned Complete, until the buffer changes or reset() is called
+	Request &request() { return request_; }
+	size_t messageLength() const { return pos_; }
+
+	// Valid once parse() returned Error
+	int errorStatus() const { return errorStatus_; }
+	std::string_view errorReason() const { return errorReason_; }
+
+	// Prepares for the next request, keeping allocated capacity
+	void reset();
+
+private:
+	enum class Stage { Head, Body, ChunkSize, ChunkData, ChunkDataEnd, Trailers, Done, Failed };
+
+	// Offsets rather than views, so progress survives the buffer moving between calls
+	struct Span {
+		uint32_t offset = 0;
+		uint32_t length = 0;
+		std::string_view in(std::string_view buffer) const { return buffer.substr(offset, length); }
+	};
+
+	Status parseHead(std::string_view buffer, size_t headEnd);
+	Status parseChunked(std::string_view buffer);
+	Status complete(std::string_view buffer);
+	Status fail(int status, std::string_view reason);
+
+	Limits limits_;
+	Stage stage_ = Stage::Head;
+	size_t pos_ = 0; // Offset of the next unconsumed byte
+
+	Method method_ = Method::GET;
+	Span target_;
+	Span version_;
+	struct Field {
+		HeaderName id;
+		Span name;
+		Span value;
+	};
+	std::vector<Field> fields_;
+
+	size_t bodyLength_ = 0; // Content-Length framing only
+	bool chunked_ = false;
+	size_t chunkRemaining_ = 0;
+	size_t trailersStart_ = 0; // Offset of the trailer section, whose total size is limited like the head's
+	std::string chunkedBody_;
+
+	Request request_;
+	int errorStatus_ = 0;
+	std::string_view errorReason_;
+};
+
+} // namespace ou::http
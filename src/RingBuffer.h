@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+namespace ou::http {
+
+// Lock-free single-producer, single-consumer byte ring. The producer appends whole records or nothing; the consumer
+// reads what is available in place (as at most two regions, because of wrap-around) and then releases it.
+class ByteRingBuffer {
+public:
+	// capacity is rounded up to a power of two
+	explicit ByteRingBuffer(size_t capacity)
+			: capacity_(std::bit_ceil(capacity)), mask_(capacity_ - 1), buffer_(std::make_unique<char[]>(capacity_)) {}
+
+	ByteRingBuffer(const ByteRingBuffer &) = delete;
+	ByteRingBuffer &operator=(const ByteRingBuffer &) = delete;
+
+	// Producer only. Returns false, writing nothing, if the record does not fit.
+	bool tryPush(std::string_view record) {
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (capacity_ - (head - cachedTail_) < record.size()) {
+			cachedTail_ = tail_.load(std::memory_order_acquire);
+			if (capacity_ - (head - cachedTail_) < record.size())
+				return false;
+		}
+
+		size_t offset = head & mask_;
+		size_t first = std::min(record.size(), capacity_ - offset);
+		std::memcpy(buffer_.get() + offset, record.data(), first);
+		std::memcpy(buffer_.get(), record.data() + first, record.size() - first);
+		head_.store(head + record.size(), std::memory_order_release);
+		return true;
+	}
+
+	// Producer only. Cheap, but may overestimate: it uses the producer's last view of the consumer's progress.
+	size_t sizeUpperBound() const { return head_.load(std::memory_order_relaxed) - cachedTail_; }
+
+	// Producer only. Exact, at the cost of reading the consumer's cache line.
+	size_t size() {
+		cachedTail_ = tail_.load(std::memory_order_acquire);
+		return head_.load(std::memory_order_relaxed) - cachedTail_;
+	}
+
+	// Consumer only. The regions stay valid until consume() releases them.
+	std::array<std::string_view, 2> readable() const {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		size_t size = head_.load(std::memory_order_acquire) - tail;
+		size_t offset = tail & mask_;
+		size_t first = std::min(size, capacity_ - offset);
+		return { std::string_view(buffer_.get() + offset, first), std::string_view(buffer_.get(), size - first) };
+	}
+
+	// Consumer only
+	void consume(size_t bytes) { tail_.store(tail_.load(std::memory_order_relaxed) + bytes, std::memory_order_release); }
+
+	size_t capacity() const { return capacity_; }
+
+private:
+	const size_t capacity_;
+	const size_t mask_;
+	std::unique_ptr<char[]> buffer_;
+
+	// Monotonic byte counts; kept on separate cache lines so the two sides do not contend
+	alignas(64) std::atomic<size_t> head_{ 0 };
+	size_t cachedTail_ = 0; // Producer's last view of tail_
+	alignas(64) std::atomic<size_t> tail_{ 0 };
+};
+
+} // namespace ou::http
@@ -0,0 +1,155 @@
+#include "Router.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+namespace ou::http {
+
+Router::Route &Router::insert(Method method, std::string_view pattern) {
+	if (!pattern.starts_with('/'))
+		throw std::invalid_argument(std::format("Route pattern must start with '/': {}", pattern));
+
+	// Parameters and wildcards start right after a '/'; everything else is literal text
+	auto startsDynamic = [pattern](size_t pos) {
+		return (pattern[pos] == ':' || pattern[pos] == '*') && pattern[pos - 1] == '/';
+	};
+
+	Node *node = &root_;
+	size_t pos = 0;
+	while (pos < pattern.size()) {
+		if (!startsDynamic(pos)) {
+			size_t end = pos + 1;
+			while (end < pattern.size() && !startsDynamic(end))
+				++end;
+			node = insertStatic(node, pattern.substr(pos, end - pos));
+			pos = end;
+			continue;
+		}
+
+		size_t end = std::min(pattern.find('/', pos), pattern.size());
+		std::string_view name = pattern.substr(pos + 1, end - pos - 1);
+		if (name.empty())
+			throw std::invalid_argument(std::format("Route parameter without a name: {}", pattern));
+		if (pattern[pos] == ':') {
+			node = insertDynamic(node->paramChild, name, pattern);
+		} else {
+			if (end != pattern.size())
+				throw std::invalid_argument(std::format("Route wildcard must be the last segment: {}", pattern));
+			node = insertDynamic(node->wildcardChild, name, pattern);
+		}
+		pos = end;
+	}
+
+	if (!node->routes) {
+		node->routes = std::make_unique<std::array<Route, kMethodCount>>();
+		node->pattern = pattern;
+	}
+	return (*node->routes)[static_cast<size_t>(method)];
+}
+
+void Router::add(Method method, std::string_view pattern, Handler handler) { insert(method, pattern) = Route{ std::move(handler), nullptr }; }
+
+void Router::add(Method method, std::string_view pattern, AsyncHandler handler) {
+	insert(method, pattern) = Route{ nullptr, std::move(handler) };
+}
+
+const Router::Route *Router::findRoute(Method method, std::string_view path, RouteParams &params, std::string_view *pattern) const {
+	params.clear();
+	const Node *node = match(root_, method, path, params);
+	if (node == nullptr)
+		return nullptr;
+	if (pattern != nullptr)
+		*pattern = node->pattern;
+	return &(*node->routes)[static_cast<size_t>(method)];
+}
+
+const Router::Handler *Router::find(Method method, std::string_view path, RouteParams &params, std::string_view *pattern) const {
+	const Route *route = findRoute(method, path, params, pattern);
+	return route != nullptr && route->handler ? &route->handler : nullptr;
+}
+
+Router::Node *Router::insertStatic(Node *node, std::string_view text) {
+	while (!text.empty()) {
+		size_t index = node->indices.find(text.front());
+		if (index == std::string::npos) {
+			auto child = std::make_unique<Node>();
+			child->label = text;
+			node->indices += text.front();
+			node->staticChildren.push_back(std::move(child));
+			return node->staticChildren.back().get();
+		}
+
+		Node *child = node->staticChildren[index].get();
+		size_t common = 0;
+		while (common < child->label.size() && common < text.size() && child->label[common] == text[common])
+			++common;
+		if (common < child->label.size()) {
+			// Split the edge: the shared prefix becomes a new node holding the rest of the old one
+			auto split = std::make_unique<Node>();
+			split->label = child->label.substr(0, common);
+			child->label.erase(0, common);
+			split->indices += child->label.front();
+			split->staticChildren.push_back(std::move(node->staticChildren[index]));
+			node->staticChildren[index] = std::move(split);
+			child = node->staticChildren[index].get();
+		}
+		text.remove_prefix(common);
+		node = child;
+	}
+	return node;
+}
+
+Router::Node *Router::insertDynamic(std::unique_ptr<Node> &slot, std::string_view name, std::string_view pattern) {
+	if (!slot) {
+		slot = std::make_unique<Node>();
+		slot->label = name;
+	} else if (slot->label != name) {
+		throw std::invalid_argument(std::format("Route {} names parameter '{}' where another route uses '{}'", pattern, name, slot->label));
+	}
+	return slot.get();
+}
+
+const Router::Node *Router::match(const Node &node, Method method, std::string_view path, RouteParams &params) {
+	auto handles = [method](const Node &candidate) {
+		if (!candidate.routes)
+			return false;
+		const Route &route = (*candidate.routes)[static_cast<size_t>(method)];
+		return route.handler || route.asyncHandler;
+	};
+
+	if (path.empty()) {
+		if (handles(node))
+			return &node;
+	} else {
+		// Only backtrack into a parameter when the literal branch leads nowhere
+		size_t index = node.indices.find(path.front());
+		if (index != std::string::npos) {
+			const Node &child = *node.staticChildren[index];
+			if (path.starts_with(child.label)) {
+				if (const Node *matched = match(child, method, path.substr(child.label.size()), params))
+					return matched;
+			}
+		}
+
+		if (node.paramChild) {
+			std::string_view segment = path.substr(0, path.find('/'));
+			if (!segment.empty()) {
+				params.add(node.paramChild->label, segment);
+				if (const Node *matched = match(*node.paramChild, method, path.substr(segment.size()), params))
+					return matched;
+				params.removeLast();
+			}
+		}
+	}
+
+	if (node.wildcardChild) {
+		if (handles(*node.wildcardChild)) {
+			params.add(node.wildcardChild->label, path);
+			return node.wildcardChild.get();
+		}
+	}
+	return nullptr;
+}
+
+} // namespace ou::http
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "HttpTypes.h"
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ou::http {
+
+// Radix tree of route patterns. A pattern is a path whose segments may be ":name", matching one non-empty segment,
+// or, as the last segment, "*name", matching the rest of the path (possibly empty). Matching walks the path once,
+// so its cost depends on the path length rather than on the number of routes. Literal segments take precedence over
+// parameters, and parameters over wildcards.
+class Router {
+public:
+	using Handler = std::function<Response(const Request &)>;
+	// For handlers that wait on sockets, timers or files, which suspend rather than block the worker
+	using AsyncHandler = std::function<Task<Response>(const Request &)>;
+
+	// What a route runs for one method: one handler or the other
+	struct Route {
+		Handler handler;
+		AsyncHandler asyncHandler;
+	};
+
+	// Throws std::invalid_argument for malformed patterns and for parameters that conflict with an existing route,
+	// e.g. "/users/:id" next to "/users/:name". Either kind of handler replaces the method's previous one.
+	void add(Method method, std::string_view pattern, Handler handler);
+	void add(Method method, std::string_view pattern, AsyncHandler handler);
+
+	// Returns nullptr if no route matches; otherwise params holds the captured values and pattern, if given, the
+	// matched route as it was registered
+	const Route *findRoute(Method method, std::string_view path, RouteParams &params, std::string_view *pattern = nullptr) const;
+	// The same, for a route's synchronous handler; nullptr if the matched route's handler is asynchronous
+	const Handler *find(Method method, std::string_view path, RouteParams &params, std::string_view *pattern = nullptr) const;
+
+private:
+	static constexpr size_t kMethodCount = static_cast<size_t>(Method::TRACE) + 1;
+
+	struct Node {
+		std::string label;																// Edge text for static nodes, parameter name otherwise
+		std::string indices;															// First byte of each static child's label
+		std::vector<std::unique_ptr<Node>> staticChildren; // Parallel to indices
+		std::unique_ptr<Node> paramChild;
+		std::unique_ptr<Node> wildcardChild;
+		std::unique_ptr<std::array<Route, kMethodCount>> routes;
+		std::string pattern; // Of the routes ending here
+	};
+
+	// The route of pattern's node for method, creating the node as needed
+	Route &insert(Method method, std::string_view pattern);
+	static Node *insertStatic(Node *node, std::string_view text);
+	static Node *insertDynamic(std::unique_ptr<Node> &slot, std::string_view name, std::string_view pattern);
+	// Returns the node of the matched route
+	static const Node *match(const Node &node, Method method, std::string_view path, RouteParams &params);
+
+	Node root_;
+};
+
+} // namespace ou::http
@@ -1,57 +1,309 @@
 #include "SSLSocketHandler.h"
+#include "Logging.h"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <limits>
+#include <mutex>
 #include <stdexcept>
 #include <unistd.h>
 
-SSLSocketHandler::SSLSocketHandler(const Config &config) : sslCtx_(SSL_CTX_new(TLS_server_method())) {
+#include <openssl/core_names.h>
+#include <openssl/rand.h>
+
+namespace {
+
+constexpr std::string_view kSessionIdContext = "ou-http";
+// ALPN protocol lists, in order of preference, each name prefixed with its length
+constexpr std::string_view kHttp2Protocols = "\x02h2\x08http/1.1";
+constexpr std::string_view kHttp1Protocols = "\x08http/1.1";
+
+} // namespace
+
+SSLSocket::~SSLSocket() {
+	// A failed or unfinished handshake has no session to close; shutting it down would only queue more errors
+	if (SSL_is_init_finished(ssl_) != 0) {
+		ERR_clear_error();
+		SSL_shutdown(ssl_);
+		ERR_clear_error();
+	}
+	SSL_free(ssl_);
+}
+
+// OpenSSL's error queue is per thread and shared by every connection a worker serves. SSL_get_error() consults it, so
+// it is cleared before each call that may fail and drained after failures, lest one connection's error be taken for another's.
+SSLSocket::Handshake SSLSocket::handshake() {
+	ERR_clear_error();
+	int result = SSL_accept(ssl_);
+	if (result == 1) {
+		handler_.handshakes_.fetch_add(1, std::memory_order_relaxed);
+		if (SSL_session_reused(ssl_) != 0)
+			handler_.resumed_.fetch_add(1, std::memory_order_relaxed);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+		if (BIO_get_ktls_send(SSL_get_wbio(ssl_)) != 0)
+			handler_.kernelTls_.fetch_add(1, std::memory_order_relaxed);
+#endif
+		return Handshake::Complete;
+	}
+	switch (SSL_get_error(ssl_, result)) {
+	case SSL_ERROR_WANT_READ:
+		return Handshake::WantRead;
+	case SSL_ERROR_WANT_WRITE:
+		return Handshake::WantWrite;
+	default:
+		ERR_clear_error();
+		handler_.failed_.fetch_add(1, std::memory_order_relaxed);
+		return Handshake::Failed;
+	}
+}
+
+std::string_view SSLSocket::protocol() const {
+	const unsigned char *name = nullptr;
+	unsigned int length = 0;
+	SSL_get0_alpn_selected(ssl_, &name, &length);
+	return { reinterpret_cast<const char *>(name), length };
+}
+
+ssize_t SSLSocket::read(char *buffer, size_t size) {
+	if (size > std::numeric_limits<int>::max())
+		throw std::overflow_error("Buffer size exceeds maximum int value for SSL_read");
+	ERR_clear_error();
+	return translate(SSL_read(ssl_, buffer, static_cast<int>(size)));
+}
+
+ssize_t SSLSocket::write(std::string_view data) {
+	if (data.size() > static_cast<size_t>(std::numeric_limits<int>::max()))
+		throw std::overflow_error("Data size exceeds maximum int value for SSL_write");
+	ERR_clear_error();
+	return translate(SSL_write(ssl_, data.data(), static_cast<int>(data.size())));
+}
+
+ssize_t SSLSocket::writev(std::span<const iovec> buffers) {
+	if (buffers.empty())
+		return 0;
+	// Each SSL_write() makes at least one record and one send, so small buffers are gathered into a single record.
+	// A retry after EAGAIN gathers the same bytes again, which SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER allows.
+	thread_local std::array<char, 16384> record;
+	if (buffers.size() == 1 || buffers.front().iov_len >= record.size())
+		return write({ static_cast<const char *>(buffers.front().iov_base), buffers.front().iov_len });
+	size_t gathered = 0;
+	for (const iovec &buffer : buffers) {
+		size_t length = std::min(buffer.iov_len, record.size() - gathered);
+		std::memcpy(record.data() + gathered, buffer.iov_base, length);
+		gathered += length;
+		if (gathered == record.size())
+			break;
+	}
+	ERR_clear_error();
+	return translate(SSL_write(ssl_, record.data(), static_cast<int>(gathered)));
+}
+
+ssize_t SSLSocket::translate(int result) {
+	if (result > 0)
+		return result;
+	int error = SSL_get_error(ssl_, result);
+	if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+		waitingFor_ = error == SSL_ERROR_WANT_READ ? Readiness::Readable : Readiness::Writable;
+		errno = EAGAIN;
+		return -1;
+	}
+	if (error == SSL_ERROR_ZERO_RETURN)
+		return 0;
+	ERR_clear_error();
+	errno = EIO;
+	return -1;
+}
+
+ssize_t SSLSocket::sendFile(int fileFd, off_t offset, size_t count) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+	// With kernel TLS the kernel encrypts file pages itself, so the body never enters userspace
+	if (BIO_get_ktls_send(SSL_get_wbio(ssl_)) != 0) {
+		ERR_clear_error();
+		ossl_ssize_t sent = SSL_sendfile(ssl_, fileFd, offset, count, 0);
+		if (sent < 0) {
+			int savedErrno = errno;
+			bool wantWrite = SSL_get_error(ssl_, static_cast<int>(sent)) == SSL_ERROR_WANT_WRITE || savedErrno == EAGAIN;
+			ERR_clear_error();
+			if (wantWrite) {
+				waitingFor_ = Readiness::Writable;
+				errno = EAGAIN;
+				return -1;
+			}
+			errno = savedErrno;
+		}
+		return sent;
+	}
+#endif
+
+	// Userspace TLS has to encrypt from a buffer; on a retry the same offset is re-read, so SSL_write sees the same bytes
+	std::array<char, 16384> buffer{};
+	ssize_t bytesRead = ::pread(fileFd, buffer.data(), std::min(count, buffer.size()), offset);
+	if (bytesRead <= 0)
+		return bytesRead;
+	ERR_clear_error();
+	return translate(SSL_write(ssl_, buffer.data(), static_cast<int>(bytesRead)));
+}
+
+SSLSocketHandler::SSLSocketHandler(const Config &config)
+		: sslCtx_(SSL_CTX_new(TLS_server_method())), sessionLifetime_(config.sessionLifetime), ticketKeyRotation_(config.ticketKeyRotation),
+			http2_(config.http2) {
 	SSL_library_init();
 	OpenSSL_add_all_algorithms();
 	SSL_load_error_strings();
+	// OpenSSL writes to the socket with write(), which raises SIGPIPE once the client has closed the connection
+	std::signal(SIGPIPE, SIG_IGN);
 
 	if ((sslCtx_ == nullptr) || SSL_CTX_use_certificate_file(sslCtx_, config.certPath.c_str(), SSL_FILETYPE_PEM) <= 0
 			|| SSL_CTX_use_PrivateKey_file(sslCtx_, config.keyPath.c_str(), SSL_FILETYPE_PEM) <= 0) {
+		SSL_CTX_free(sslCtx_);
 		throw std::runtime_error("Failed to initialize SSL.");
 	}
+
+	// Connections are non-blocking, so writes may complete partially and be retried from a different buffer address
+	SSL_CTX_set_mode(sslCtx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	// OpenSSL locks its session cache internally, so every worker can share it
+	SSL_CTX_set_session_id_context(sslCtx_, reinterpret_cast<const unsigned char *>(kSessionIdContext.data()),
+																 static_cast<unsigned int>(kSessionIdContext.size()));
+	SSL_CTX_set_timeout(sslCtx_, static_cast<long>(config.sessionLifetime.count()));
+	if (config.sessionCacheSize > 0) {
+		SSL_CTX_set_session_cache_mode(sslCtx_, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(sslCtx_, static_cast<long>(config.sessionCacheSize));
+	} else {
+		SSL_CTX_set_session_cache_mode(sslCtx_, SSL_SESS_CACHE_OFF);
+	}
+
+	SSL_CTX_set_alpn_select_cb(sslCtx_, &SSLSocketHandler::alpnCallback, this);
+
+	if (config.kernelTls) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+		// OpenSSL tries to enable it on each connection once the handshake completes and quietly carries on without it
+		SSL_CTX_set_options(sslCtx_, SSL_OP_ENABLE_KTLS);
+#else
+		LOG_WARN("Kernel TLS requested, but OpenSSL was built without it; encrypting in userspace");
+#endif
+	}
+
+	if (config.sessionTickets) {
+		addTicketKey();
+		SSL_CTX_set_app_data(sslCtx_, this);
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(sslCtx_, &SSLSocketHandler::ticketKeyCallback);
+	} else {
+		SSL_CTX_set_options(sslCtx_, SSL_OP_NO_TICKET);
+	}
 }
 
 SSLSocketHandler::~SSLSocketHandler() { SSL_CTX_free(sslCtx_); }
 
-bool SSLSocketHandler::acceptConnection(int clientSocket) {
+std::unique_ptr<Socket> SSLSocketHandler::acceptConnection(int clientSocket) {
 	SSL *ssl = SSL_new(sslCtx_);
-	SSL_set_fd(ssl, clientSocket);
-	if (SSL_accept(ssl) <= 0) {
+	if (ssl == nullptr || SSL_set_fd(ssl, clientSocket) != 1) {
+		failed_.fetch_add(1, std::memory_order_relaxed);
 		SSL_free(ssl);
-		return false;
+		::close(clientSocket);
+		return nullptr;
 	}
-	sslSessions_[clientSocket] = ssl;
-	return true;
+	SSL_set_accept_state(ssl);
+	started_.fetch_add(1, std::memory_order_relaxed);
+	return std::make_unique<SSLSocket>(clientSocket, ssl, *this);
 }
 
-ssize_t SSLSocketHandler::read(int clientSocket, char *buffer, size_t size) {
-	auto it = sslSessions_.find(clientSocket);
-	if (it == sslSessions_.end())
-		return -1;
-	if (size > std::numeric_limits<int>::max())
-		throw std::overflow_error("Buffer size exceeds maximum int value for SSL_read");
-	return SSL_read(it->second, buffer, static_cast<int>(size));
+void SSLSocketHandler::rotateTicketKeys() {
+	std::unique_lock<std::shared_mutex> lock(ticketKeysMutex_);
+	addTicketKey();
 }
 
-ssize_t SSLSocketHandler::write(int clientSocket, const std::string &data) {
-	auto it = sslSessions_.find(clientSocket);
-	if (it == sslSessions_.end())
-		return -1;
-	if (data.size() > static_cast<size_t>(std::numeric_limits<int>::max()))
-		throw std::overflow_error("Data size exceeds maximum int value for SSL_write");
-	return SSL_write(it->second, data.c_str(), static_cast<int>(data.size()));
+SSLSocketHandler::Stats SSLSocketHandler::stats() const {
+	Stats stats;
+	stats.handshakes = handshakes_.load(std::memory_order_relaxed);
+	stats.resumed = resumed_.load(std::memory_order_relaxed);
+	stats.failed = failed_.load(std::memory_order_relaxed);
+	stats.kernelTls = kernelTls_.load(std::memory_order_relaxed);
+	uint64_t started = started_.load(std::memory_order_relaxed);
+	stats.inProgress = started - std::min(started, stats.handshakes + stats.failed);
+	stats.ticketKeyRotations = ticketKeyRotations_.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void SSLSocketHandler::addTicketKey() {
+	TicketKey key{};
+	auto fill = [](auto &bytes) { return RAND_bytes(bytes.data(), static_cast<int>(bytes.size())) == 1; };
+	if (!fill(key.name) || !fill(key.aesKey) || !fill(key.hmacKey)) {
+		throw std::runtime_error("Failed to generate a session ticket key.");
+	}
+	key.created = std::chrono::steady_clock::now();
+	if (!ticketKeys_.empty())
+		ticketKeyRotations_.fetch_add(1, std::memory_order_relaxed);
+	ticketKeys_.push_front(key);
+
+	// A key issues tickets until the next one replaces it, and those tickets can be resumed for a session lifetime after
+	while (ticketKeys_.size() > 1 && ticketKeys_.back().created + ticketKeyRotation_ + sessionLifetime_ < key.created)
+		ticketKeys_.pop_back();
+}
+
+int SSLSocketHandler::alpnCallback(SSL * /*ssl*/, const unsigned char **out, unsigned char *outLength, const unsigned char *in,
+																		unsigned int inLength, void *handler) {
+	std::string_view supported = static_cast<SSLSocketHandler *>(handler)->http2_ ? kHttp2Protocols : kHttp1Protocols;
+	// Clients offering nothing this server speaks carry on without ALPN rather than failing the handshake
+	if (SSL_select_next_proto(const_cast<unsigned char **>(out), outLength, reinterpret_cast<const unsigned char *>(supported.data()),
+														static_cast<unsigned int>(supported.size()), in, inLength)
+			!= OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+	return SSL_TLSEXT_ERR_OK;
 }
 
-void SSLSocketHandler::closeConnection(int clientSocket) {
-	auto it = sslSessions_.find(clientSocket);
-	if (it != sslSessions_.end()) {
-		SSL_shutdown(it->second);
-		SSL_free(it->second);
-		sslSessions_.erase(it);
+int SSLSocketHandler::ticketKeyCallback(SSL *ssl, unsigned char *keyName, unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac,
+																				int encrypt) {
+	auto *handler = static_cast<SSLSocketHandler *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+	return handler->useTicketKey(keyName, iv, cipher, mac, encrypt != 0, SSL_version(ssl) >= TLS1_3_VERSION);
+}
+
+int SSLSocketHandler::useTicketKey(unsigned char *keyName, unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac, bool encrypt,
+																	 bool tls13) {
+	if (encrypt) {
+		// Rotation happens on the first ticket issued after the interval expires, so an idle server does no work
+		auto now = std::chrono::steady_clock::now();
+		std::shared_lock<std::shared_mutex> readLock(ticketKeysMutex_);
+		if (now - ticketKeys_.front().created >= ticketKeyRotation_) {
+			readLock.unlock();
+			std::unique_lock<std::shared_mutex> writeLock(ticketKeysMutex_);
+			if (now - ticketKeys_.front().created >= ticketKeyRotation_)
+				addTicketKey();
+			writeLock.unlock();
+			readLock.lock();
+		}
+		const TicketKey &key = ticketKeys_.front();
+		if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1)
+			return -1;
+		std::memcpy(keyName, key.name.data(), key.name.size());
+		std::array<OSSL_PARAM, 3> params{
+			OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char *>(key.hmacKey.data()), key.hmacKey.size()),
+			OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0),
+			OSSL_PARAM_construct_end(),
+		};
+		if (EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aesKey.data(), iv) != 1
+				|| EVP_MAC_CTX_set_params(mac, params.data()) != 1) {
+			return -1;
+		}
+		return 1;
 	}
-	::close(clientSocket);
+
+	std::shared_lock<std::shared_mutex> readLock(ticketKeysMutex_);
+	auto it = std::find_if(ticketKeys_.begin(), ticketKeys_.end(),
+												 [keyName](const TicketKey &key) { return std::memcmp(key.name.data(), keyName, key.name.size()) == 0; });
+	if (it == ticketKeys_.end())
+		return 0; // Unknown or dropped key: fall back to a full handshake
+	std::array<OSSL_PARAM, 3> params{
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char *>(it->hmacKey.data()), it->hmacKey.size()),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0),
+		OSSL_PARAM_construct_end(),
+	};
+	if (EVP_MAC_CTX_set_params(mac, params.data()) != 1 || EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, it->aesKey.data(), iv) != 1)
+		return -1;
+	// 2 asks OpenSSL to issue a replacement ticket under the current key. TLS 1.3 clients use each ticket once, and
+	// OpenSSL only sends a TLS 1.3 ticket after a resumption when asked to, so those are always renewed.
+	return it == ticketKeys_.begin() && !tls13 ? 1 : 2;
 }
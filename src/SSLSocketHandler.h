@@ -4,32 +4,112 @@
 
 #include "SocketHandler.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
-#include <string>
-#include <unordered_map>
+#include <shared_mutex>
+#include <string_view>
 
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
+class SSLSocketHandler;
+
+// TLS transport of one connection; shuts the session down and frees it when destroyed
+class SSLSocket : public Socket {
+public:
+	SSLSocket(int fd, SSL *ssl, SSLSocketHandler &handler) : Socket(fd), ssl_(ssl), handler_(handler) {}
+	~SSLSocket() override final;
+
+	Handshake handshake() override final;
+	ssize_t read(char *buffer, size_t size) override final;
+	ssize_t write(std::string_view data) override final;
+	ssize_t writev(std::span<const iovec> buffers) override final;
+	ssize_t sendFile(int fileFd, off_t offset, size_t count) override final;
+	size_t pending() const override final { return static_cast<size_t>(SSL_pending(ssl_)); }
+	std::string_view protocol() const override final;
+
+private:
+	// Maps OpenSSL's want-read/want-write to EAGAIN, recording which one it was
+	ssize_t translate(int result);
+
+	SSL *ssl_;
+	SSLSocketHandler &handler_; // For its statistics
+};
+
+// Performs TLS handshakes with one shared SSL_CTX. Returning clients can skip the full handshake in two ways: by
+// session ID, looked up in OpenSSL's server-side session cache, or with a session ticket, which carries the session
+// encrypted under a key only this server knows. Ticket keys are rotated periodically; older keys are kept for as long
+// as the tickets they issued may be resumed, and such tickets are renewed under the current key.
 class SSLSocketHandler : public SocketHandler {
 public:
 	struct Config {
 		bool enabled = false;
 		std::filesystem::path certPath;
 		std::filesystem::path keyPath;
+		size_t sessionCacheSize = 20480;							 // Sessions cached for resumption by ID; 0 disables the cache
+		std::chrono::seconds sessionLifetime{ 7200 };	 // How long after its handshake a session can be resumed
+		bool sessionTickets = true;
+		std::chrono::seconds ticketKeyRotation{ 3600 }; // How often tickets start being issued under a new key
+		// Hands record encryption to the kernel after the handshake, which lets file bodies go out with sendfile().
+		// Connections whose cipher the kernel lacks, or all of them when its tls module is missing, stay in userspace.
+		bool kernelTls = false;
+		bool http2 = false; // Offer h2 to clients through ALPN; otherwise, and to clients without it, HTTP/1.1
+	};
+
+	struct Stats {
+		uint64_t handshakes = 0; // Completed, including resumptions
+		uint64_t inProgress = 0; // Neither completed nor failed, including abandoned and timed out ones
+		uint64_t resumed = 0;
+		uint64_t failed = 0;
+		uint64_t kernelTls = 0; // Handshakes after which the kernel encrypts what is sent
+		uint64_t ticketKeyRotations = 0;
 	};
 
 	explicit SSLSocketHandler(const Config &config);
 	~SSLSocketHandler() override final;
 
-	bool acceptConnection(int clientSocket) override final;
-	ssize_t read(int clientSocket, char *buffer, size_t size) override final;
-	ssize_t write(int clientSocket, const std::string &data) override final;
-	void closeConnection(int clientSocket) override final;
+	std::unique_ptr<Socket> acceptConnection(int clientSocket) override final;
+
+	// Starts issuing tickets under a fresh key now instead of when the rotation interval next expires
+	void rotateTicketKeys();
+
+	Stats stats() const;
 
 private:
+	friend class SSLSocket;
+
+	struct TicketKey {
+		std::array<unsigned char, 16> name;
+		std::array<unsigned char, 32> aesKey;
+		std::array<unsigned char, 32> hmacKey;
+		std::chrono::steady_clock::time_point created;
+	};
+
+	static int alpnCallback(SSL *ssl, const unsigned char **out, unsigned char *outLength, const unsigned char *in, unsigned int inLength,
+													void *handler);
+	static int ticketKeyCallback(SSL *ssl, unsigned char *keyName, unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac, int encrypt);
+	int useTicketKey(unsigned char *keyName, unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac, bool encrypt, bool tls13);
+	// Adds a key for new tickets and drops keys whose tickets have all expired. Requires ticketKeysMutex_ held exclusively.
+	void addTicketKey();
+
 	SSL_CTX *sslCtx_;
-	std::unordered_map<int, SSL *> sslSessions_;
+	const std::chrono::seconds sessionLifetime_;
+	const std::chrono::seconds ticketKeyRotation_;
+	const bool http2_;
+
+	mutable std::shared_mutex ticketKeysMutex_;
+	std::deque<TicketKey> ticketKeys_; // Newest first; the front one encrypts new tickets
+
+	std::atomic<uint64_t> handshakes_{ 0 };
+	std::atomic<uint64_t> started_{ 0 };
+	std::atomic<uint64_t> resumed_{ 0 };
+	std::atomic<uint64_t> failed_{ 0 };
+	std::atomic<uint64_t> kernelTls_{ 0 };
+	std::atomic<uint64_t> ticketKeyRotations_{ 0 };
 };
 
 #endif // DISABLE_HTTPS
@@ -1,17 +1,266 @@
 #include "Server.h"
+#include "EventLoop.h"
 #include "Logging.h"
+#include "MimeTypes.h"
+#include "RangeRequest.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
-#include <fstream>
 #include <iostream>
+#include <list>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 namespace {
 
+constexpr size_t kMaxEvents = 256;
+constexpr size_t kReadChunkSize = 4096;
+constexpr size_t kMaxPendingOutput = 1024 * 1024;
+constexpr size_t kMaxSpareBuffer = 16 * 1024;
+constexpr size_t kMaxGatheredChunks = 64;
+
+// inet_ntoa() returns a shared static buffer, which concurrent workers would overwrite
+std::string sAddressToString(const sockaddr_in &addr) {
+	std::array<char, INET_ADDRSTRLEN> text{};
+	inet_ntop(AF_INET, &addr.sin_addr, text.data(), text.size());
+	return text.data();
+}
+
+// Appends a response to the connection's output. Only the head is serialized, into a buffer of its own; the body
+// follows as chunks that are moved or shared rather than copied, and onWritable() gathers them into one write.
+void sQueueResponse(ou::http::Connection &connection, ou::http::Response &response, bool headOnly) {
+	std::string head = std::move(connection.spareBuffer);
+	head.clear();
+	response.appendHead(head);
+	connection.bufferedOutput += head.size();
+	connection.output.emplace_back(std::move(head));
+
+	// The head of a HEAD response describes the body a GET would have sent
+	if (headOnly || response.statusCode == 304 || response.statusCode == 204)
+		return;
+	if (!response.body.empty()) {
+		connection.bufferedOutput += response.body.size();
+		connection.output.emplace_back(std::move(response.body));
+	}
+	for (auto &part : response.bodyParts) {
+		size_t size = ou::http::bodyPartSize(part);
+		if (size == 0)
+			continue;
+		if (std::holds_alternative<std::string>(part))
+			connection.bufferedOutput += size;
+		connection.output.push_back(std::move(part));
+	}
+}
+
+// Drops the sent front chunk, keeping a string's buffer for the next head to be serialized into
+void sPopOutput(ou::http::Connection &connection) {
+	if (auto *data = std::get_if<std::string>(&connection.output.front())) {
+		connection.bufferedOutput -= data->size();
+		if (data->capacity() <= kMaxSpareBuffer && data->capacity() > connection.spareBuffer.capacity())
+			connection.spareBuffer = std::move(*data);
+	}
+	connection.output.pop_front();
+	connection.outputOffset = 0;
+}
+
+// Strong ETag built from the file's identity, size and modification time
+std::string sEntityTag(const struct stat &fileStat) {
+	auto mtimeNs = static_cast<uint64_t>(fileStat.st_mtim.tv_sec) * 1000000000ULL + static_cast<uint64_t>(fileStat.st_mtim.tv_nsec);
+	return std::format("\"{:x}-{:x}-{:x}\"", fileStat.st_ino, fileStat.st_size, mtimeNs);
+}
+
+bool sEntityTagListMatches(std::string_view list, std::string_view etag) {
+	while (!list.empty()) {
+		size_t comma = list.find(',');
+		std::string_view candidate = list.substr(0, comma);
+		list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+		candidate.remove_prefix(std::min(candidate.find_first_not_of(" \t"), candidate.size()));
+		candidate.remove_suffix(candidate.size() - std::min(candidate.find_last_not_of(" \t") + 1, candidate.size()));
+		// If-None-Match uses weak comparison, so a W/ prefix is ignored
+		if (candidate.starts_with("W/"))
+			candidate.remove_prefix(2);
+		if (candidate == "*" || candidate == etag)
+			return true;
+	}
+	return false;
+}
+
+// RFC 9110 section 13.2.2: If-None-Match takes precedence and If-Modified-Since is only consulted without it
+bool sNotModified(const ou::http::Request &request, std::string_view etag, time_t mtime) {
+	if (request.method != ou::http::Method::GET && request.method != ou::http::Method::HEAD)
+		return false;
+	if (auto ifNoneMatch = request.headers.find(ou::http::HeaderName::IfNoneMatch))
+		return sEntityTagListMatches(*ifNoneMatch, etag);
+	if (auto ifModifiedSince = request.headers.find(ou::http::HeaderName::IfModifiedSince)) {
+		auto since = ou::http::parseHttpDate(*ifModifiedSince);
+		return since && mtime <= *since;
+	}
+	return false;
+}
+
+std::optional<std::string> sReadFile(int fd, size_t size) {
+	std::string contents(size, '\0');
+	for (size_t offset = 0; offset < size;) {
+		ssize_t bytesRead = pread(fd, contents.data() + offset, size - offset, static_cast<off_t>(offset));
+		if (bytesRead < 0 && errno == EINTR)
+			continue;
+		if (bytesRead <= 0)
+			return std::nullopt;
+		offset += static_cast<size_t>(bytesRead);
+	}
+	return contents;
+}
+
+// A path below the serving directory, resolved through the static file cache when it is enabled
+struct ResolvedFile {
+	enum class Kind { Missing, File, Directory, Error };
+
+	Kind kind = Kind::Missing;
+	std::shared_ptr<const ou::http::StaticFileCache::Entry> entry; // Validators, plus the contents when they are cached
+	std::shared_ptr<ou::http::FileHandle> file;										 // Open descriptor when the contents are not cached
+	size_t size = 0;
+
+	ou::http::BodyPart body() const {
+		if (entry->body)
+			return entry->body;
+		return ou::http::FileRange{ file, 0, size };
+	}
+};
+
+ResolvedFile sResolveFile(ou::http::StaticFileCache &cache, const std::filesystem::path &root, const std::string &key) {
+	using Entry = ou::http::StaticFileCache::Entry;
+
+	// Hits, including paths known to be missing, are answered without touching the disk
+	if (cache.enabled()) {
+		if (auto entry = cache.find(key)) {
+			if (!entry->body)
+				return {};
+			return { ResolvedFile::Kind::File, entry, nullptr, entry->body->size() };
+		}
+	}
+	std::optional<uint64_t> generation = cache.enabled() ? cache.beginLoad(key) : std::nullopt;
+
+	std::filesystem::path path = root / key;
+	auto file = ou::http::FileHandle::open(path);
+	struct stat fileStat {};
+	if (!file) {
+		if (errno == ENOENT || errno == ENOTDIR) {
+			if (generation)
+				cache.insert(key, std::make_shared<const Entry>(), *generation);
+			return {};
+		}
+		LOG_ERROR("Failed to open file: {}", path.string());
+		return { ResolvedFile::Kind::Error, nullptr, nullptr };
+	}
+	if (fstat(file->fd(), &fileStat) < 0) {
+		LOG_ERROR("Failed to stat file: {}", path.string());
+		return { ResolvedFile::Kind::Error, nullptr, nullptr };
+	}
+
+	auto size = static_cast<size_t>(fileStat.st_size);
+	auto entry = std::make_shared<Entry>(Entry{ nullptr, sEntityTag(fileStat), ou::http::formatHttpDate(fileStat.st_mtime), fileStat.st_mtime });
+	if (S_ISDIR(fileStat.st_mode))
+		return { ResolvedFile::Kind::Directory, entry, std::move(file), size };
+
+	if (generation && size <= cache.maxEntryBytes()) {
+		if (auto contents = sReadFile(file->fd(), size)) {
+			entry->body = std::make_shared<const std::string>(std::move(*contents));
+			cache.insert(key, entry, *generation);
+			LOG_DEBUG("Cached file: {}", path.string());
+			return { ResolvedFile::Kind::File, entry, nullptr, size };
+		}
+	}
+	return { ResolvedFile::Kind::File, entry, std::move(file), size };
+}
+
+// Entity tag of a representation derived from the file with the given tag, e.g. its gzipped form
+std::string sDerivedEntityTag(std::string_view etag, std::string_view suffix) {
+	std::string derived(etag.substr(0, etag.size() - 1));
+	derived += '-';
+	derived += suffix;
+	derived += '"';
+	return derived;
+}
+
+ou::http::Response sFileResponse(const ou::http::Request &request, const ou::http::StaticFileCache::Entry &file, const std::string &etag,
+																 std::string_view contentType, std::string_view contentEncoding, ou::http::BodyPart body) {
+	ou::http::Response response{ 200, "OK", { { "ETag", etag }, { "Last-Modified", file.lastModified } }, {} };
+	if (!contentEncoding.empty())
+		response.headers[ou::http::HeaderName::ContentEncoding] = contentEncoding;
+	if (sNotModified(request, etag, file.mtime)) {
+		response.statusCode = 304;
+		response.reasonPhrase = "Not Modified";
+		return response;
+	}
+	response.headers[ou::http::HeaderName::ContentType] = contentType;
+	response.bodyParts.push_back(std::move(body));
+	ou::http::applyRangeRequest(request, response);
+	return response;
+}
+
+bool sSetNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+void sUpdateInterest(int epollFd, int op, int fd, uint32_t events) {
+	epoll_event event{};
+	event.events = events;
+	event.data.fd = fd;
+	epoll_ctl(epollFd, op, fd, &event);
+}
+
+uint32_t sEvents(std::optional<Socket::Readiness> readiness) {
+	if (!readiness)
+		return 0;
+	return *readiness == Socket::Readiness::Writable ? EPOLLOUT : EPOLLIN;
+}
+
+// Runs fn on the loop once the suspended task has finished
+void sWhenFinished(ou::http::EventLoop &loop, ou::http::PendingResponse &task, std::function<void()> fn) {
+	task.onComplete([&loop, fn = std::move(fn)]() mutable { loop.defer(std::move(fn)); });
+}
+
+// HTTP/1.1 connections persist unless the client opts out; HTTP/1.0 ones only if it opts in
+bool sWantsKeepAlive(const ou::http::Request &request) {
+	if (auto connection = request.headers.find(ou::http::HeaderName::Connection)) {
+		if (ou::http::equalsIgnoreCase(*connection, "close"))
+			return false;
+		if (ou::http::equalsIgnoreCase(*connection, "keep-alive"))
+			return true;
+	}
+	return request.version == "HTTP/1.1";
+}
+
+std::string sReasonPhrase(int statusCode) {
+	switch (statusCode) {
+	case 400:
+		return "Bad Request";
+	case 413:
+		return "Content Too Large";
+	case 431:
+		return "Request Header Fields Too Large";
+	case 501:
+		return "Not Implemented";
+	case 505:
+		return "HTTP Version Not Supported";
+	default:
+		return "Error";
+	}
+}
+
 std::string sGenerateDirectoryIndex(const std::string &requestPath, const std::filesystem::path &dirPath) {
 	std::stringstream ss;
 	ss << "<!DOCTYPE html><html><head><title>Index of " << requestPath << "</title></head><body>";
@@ -43,22 +292,63 @@ std::string sGenerateDirectoryIndex(const std::string &requestPath, const std::f
 
 namespace ou::http {
 
-Server::Server(Config config) : config_(std::move(config)) {
+Server::Server(Config config)
+		: config_(std::move(config)), staticFileCache_(std::make_unique<StaticFileCache>(config_.servingDirectory, config_.staticFileCache)),
+			compressionCache_(std::make_unique<CompressionCache>(config_.compression.cacheBytes)), metrics_(std::make_unique<Metrics>()) {
 #ifndef DISABLE_HTTPS
 	if (config_.https.enabled) {
-		socketHandler_ = std::make_unique<SSLSocketHandler>(config_.https);
+		SSLSocketHandler::Config https = config_.https;
+		https.http2 = config_.http2;
+		socketHandler_ = std::make_unique<SSLSocketHandler>(https);
 	} else
 #endif
 	{
 		socketHandler_ = std::make_unique<PlainSocketHandler>();
 	}
+
+	metrics_->addCounter("static_file_cache_hits_total", "Static file lookups answered from the cache.",
+											 [this]() { return static_cast<double>(staticFileCache_->stats().hits); });
+	metrics_->addCounter("static_file_cache_misses_total", "Static file lookups that went to the disk.",
+											 [this]() { return static_cast<double>(staticFileCache_->stats().misses); });
+	metrics_->addGauge("static_file_cache_bytes", "Bytes of file contents held by the static file cache.",
+										 [this]() { return static_cast<double>(staticFileCache_->stats().bytes); });
+	metrics_->addCounter("compression_cache_hits_total", "Compressed bodies served from the cache.",
+											 [this]() { return static_cast<double>(compressionCache_->stats().hits); });
+#ifndef DISABLE_HTTPS
+	if (config_.https.enabled) {
+		metrics_->addCounter("tls_handshakes_total", "Completed TLS handshakes, including resumptions.",
+												 [this]() { return static_cast<double>(tlsStats()->handshakes); });
+		metrics_->addCounter("tls_resumed_handshakes_total", "TLS handshakes that resumed a session.",
+												 [this]() { return static_cast<double>(tlsStats()->resumed); });
+		metrics_->addCounter("tls_failed_handshakes_total", "TLS handshakes that failed.", [this]() { return static_cast<double>(tlsStats()->failed); });
+	}
+#endif
+	if (!config_.metricsPath.empty()) {
+		router_.add(Method::GET, config_.metricsPath, [this](const Request &) {
+			return Response{ 200, "OK", { { "Content-Type", "text/plain; version=0.0.4; charset=utf-8" }, { "Cache-Control", "no-store" } }, metrics_->render() };
+		});
+	}
 }
 
 Server::~Server() { stop(); }
 
+#ifndef DISABLE_HTTPS
+std::optional<SSLSocketHandler::Stats> Server::tlsStats() const {
+	if (const auto *handler = dynamic_cast<const SSLSocketHandler *>(socketHandler_.get()))
+		return handler->stats();
+	return std::nullopt;
+}
+#endif
+
 bool Server::init() {
 	LOG_INFO("Initializing server on port {} with {} threads...", config_.port, config_.threadCount);
 
+	wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wakeFd_ < 0) {
+		LOG_ERROR("Failed to create wake-up eventfd");
+		return false;
+	}
+
 	for (int i = 0; i < config_.threadCount; ++i) {
 		int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
 		if (serverSocket < 0) {
@@ -90,6 +380,12 @@ bool Server::init() {
 			return false;
 		}
 
+		if (!sSetNonBlocking(serverSocket)) {
+			LOG_ERROR("Failed to make socket non-blocking");
+			close(serverSocket);
+			return false;
+		}
+
 		LOG_INFO("Server socket {} bound and listening...", serverSocket);
 		sockets_.push_back(serverSocket);
 	}
@@ -108,36 +404,61 @@ void Server::start() {
 void Server::stop() {
 	LOG_INFO("Stopping server...");
 	running_.store(false);
-	for (int socket : sockets_) {
-		close(socket);
-		LOG_INFO("Closed socket {}", socket);
+	if (wakeFd_ >= 0) {
+		// Never read back, so the eventfd stays readable and wakes every worker
+		uint64_t one = 1;
+		(void)::write(wakeFd_, &one, sizeof(one));
 	}
 	for (auto &thread : threads_) {
 		if (thread.joinable()) {
 			thread.join();
 		}
 	}
+	threads_.clear();
+	for (int socket : sockets_) {
+		close(socket);
+		LOG_INFO("Closed socket {}", socket);
+	}
+	sockets_.clear();
+	if (wakeFd_ >= 0) {
+		close(wakeFd_);
+		wakeFd_ = -1;
+	}
 	LOG_INFO("Server stopped");
 }
 
 void Server::addMiddleware(std::shared_ptr<Middleware> middleware) { middlewares_.push_back(std::move(middleware)); }
 
 void Server::registerPathHandler(Method method, const std::string &path, const std::shared_ptr<RequestHandler> &handler) {
-	routeHandlers_[method][path] = [handler](const Request &req) {
-		return handler->handle(req);
-	};
+	router_.add(method, path, [handler](const Request &req) { return handler->handle(req); });
 }
 
 void Server::registerPathHandler(Method method, const std::string &path, std::function<Response(const Request &)> handler) {
-	routeHandlers_[method][path] = std::move(handler);
+	router_.add(method, path, std::move(handler));
 }
 
 void Server::registerPatternHandler(Method method, const std::string &pattern, const std::shared_ptr<RequestHandler> &handler) {
-	patternHandlers_[method].emplace_back(std::regex(pattern), [handler](const Request &req) { return handler->handle(req); });
+	patternHandlers_[method].push_back({ pattern, std::regex(pattern), [handler](const Request &req) { return handler->handle(req); }, nullptr });
 }
 
 void Server::registerPatternHandler(Method method, const std::string &pattern, std::function<Response(const Request &)> handler) {
-	patternHandlers_[method].emplace_back(std::regex(pattern), std::move(handler));
+	patternHandlers_[method].push_back({ pattern, std::regex(pattern), std::move(handler), nullptr });
+}
+
+void Server::registerPathHandler(Method method, const std::string &path, const std::shared_ptr<AsyncRequestHandler> &handler) {
+	router_.add(method, path, Router::AsyncHandler([handler](const Request &req) { return handler->handle(req); }));
+}
+
+void Server::registerPathHandler(Method method, const std::string &path, Router::AsyncHandler handler) {
+	router_.add(method, path, std::move(handler));
+}
+
+void Server::registerPatternHandler(Method method, const std::string &pattern, const std::shared_ptr<AsyncRequestHandler> &handler) {
+	patternHandlers_[method].push_back({ pattern, std::regex(pattern), nullptr, [handler](const Request &req) { return handler->handle(req); } });
+}
+
+void Server::registerPatternHandler(Method method, const std::string &pattern, Router::AsyncHandler handler) {
+	patternHandlers_[method].push_back({ pattern, std::regex(pattern), nullptr, std::move(handler) });
 }
 
 void Server::registerPathHandler(const std::set<Method> &methods, const std::string &path, const std::shared_ptr<RequestHandler> &handler) {
@@ -167,119 +488,634 @@ void Server::registerPatternHandler(const std::set<Method> &methods, const std::
 	}
 }
 
+void Server::registerPathHandler(const std::set<Method> &methods, const std::string &path,
+																 const std::shared_ptr<AsyncRequestHandler> &handler) {
+	for (const auto &method : methods) {
+		registerPathHandler(method, path, handler);
+	}
+}
+
+void Server::registerPathHandler(const std::set<Method> &methods, const std::string &path, const Router::AsyncHandler &handler) {
+	for (const auto &method : methods) {
+		registerPathHandler(method, path, handler);
+	}
+}
+
+void Server::registerPatternHandler(const std::set<Method> &methods, const std::string &pattern,
+																		const std::shared_ptr<AsyncRequestHandler> &handler) {
+	for (const auto &method : methods) {
+		registerPatternHandler(method, pattern, handler);
+	}
+}
+
+void Server::registerPatternHandler(const std::set<Method> &methods, const std::string &pattern, const Router::AsyncHandler &handler) {
+	for (const auto &method : methods) {
+		registerPatternHandler(method, pattern, handler);
+	}
+}
+
+// Per-thread event loop state
+struct Server::Worker {
+	int serverSocket = -1;
+	int epollFd = -1;
+	std::optional<EventLoop> loop; // Resumes asynchronous handlers; outlives the connections, which own them
+	std::unordered_map<int, std::unique_ptr<Connection>> connections;
+	std::list<Connection *> handshakes; // Connections still handshaking, oldest first, for handshake timeouts
+	std::list<Connection *> activity;		// The others, least recently active first, for idle timeouts
+};
+
 void Server::workerThread(int serverSocket) {
+	Worker worker;
+	worker.serverSocket = serverSocket;
+	worker.epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (worker.epollFd < 0) {
+		LOG_ERROR("Failed to create epoll instance for socket {}", serverSocket);
+		return;
+	}
+
+	sUpdateInterest(worker.epollFd, EPOLL_CTL_ADD, serverSocket, EPOLLIN);
+	sUpdateInterest(worker.epollFd, EPOLL_CTL_ADD, wakeFd_, EPOLLIN);
+	try {
+		worker.loop.emplace(worker.epollFd);
+	} catch (const std::exception &e) {
+		LOG_ERROR("Failed to start event loop for socket {}: {}", serverSocket, e.what());
+		close(worker.epollFd);
+		return;
+	}
+
+	std::array<epoll_event, kMaxEvents> events{};
+	auto sweepInterval = std::min({ std::chrono::milliseconds(1000), config_.keepAliveTimeout, config_.handshakeTimeout });
+
 	while (running_.load()) {
+		auto timeout = std::min(sweepInterval, worker.loop->timeUntilNextTimer().value_or(sweepInterval));
+		int eventCount = epoll_wait(worker.epollFd, events.data(), static_cast<int>(events.size()), static_cast<int>(timeout.count()));
+		if (eventCount < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_ERROR("epoll_wait failed on socket {}: {}", serverSocket, std::strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < eventCount; ++i) {
+			int fd = events[i].data.fd;
+			if (fd == wakeFd_)
+				continue;
+			if (fd == serverSocket) {
+				acceptConnections(worker);
+				continue;
+			}
+
+			auto it = worker.connections.find(fd);
+			if (it == worker.connections.end()) {
+				// Sockets and wake-ups that asynchronous handlers wait on
+				worker.loop->dispatch(fd, events[i].events);
+				continue;
+			}
+			Connection &connection = *it->second;
+			Connection::State previousState = connection.state;
+
+			if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0 && (events[i].events & EPOLLIN) == 0) {
+				connection.state = Connection::State::Closing;
+			} else if (connection.state == Connection::State::Handshaking) {
+				onHandshake(worker, connection);
+			} else if (connection.state == Connection::State::Reading) {
+				onReadable(worker, connection);
+			} else if (connection.state == Connection::State::Writing) {
+				onWritable(worker, connection);
+			}
+			afterEvent(worker, connection, previousState);
+		}
+
+		worker.loop->runTimers();
+		closeIdleConnections(worker);
+	}
+
+	while (!worker.connections.empty()) {
+		closeConnection(worker, *worker.connections.begin()->second);
+	}
+	close(worker.epollFd);
+}
+
+void Server::acceptConnections(Worker &worker) const {
+	while (true) {
 		sockaddr_in clientAddr{};
 		socklen_t clientLen = sizeof(clientAddr);
-		int clientSocket = accept(serverSocket, reinterpret_cast<struct sockaddr *>(&clientAddr), &clientLen);
+		int clientSocket = accept4(worker.serverSocket, reinterpret_cast<struct sockaddr *>(&clientAddr), &clientLen, SOCK_CLOEXEC);
 		if (clientSocket < 0) {
-			if (!running_)
-				break;
-			continue;
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG_WARN("Failed to accept connection: {}", std::strerror(errno));
+			return;
 		}
 
-		LOG_INFO("Accepted connection from {}", inet_ntoa(clientAddr.sin_addr));
+		LOG_DEBUG("Accepted connection from {}", sAddressToString(clientAddr));
 
-		if (!socketHandler_->acceptConnection(clientSocket)) {
+		// A response head is written separately from a sendfile() body; with Nagle's algorithm the body would wait for
+		// the client's delayed ACK of the head
+		int noDelay = 1;
+		setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		if (!sSetNonBlocking(clientSocket)) {
 			close(clientSocket);
 			continue;
 		}
+		std::unique_ptr<Socket> transport = socketHandler_->acceptConnection(clientSocket);
+		if (!transport)
+			continue;
 
-		std::array<char, 4096> buffer{};
-		ssize_t bytesRead = socketHandler_->read(clientSocket, buffer.data(), buffer.size());
+		auto connection = std::make_unique<Connection>(config_.requestLimits);
+		connection->socket = clientSocket;
+		connection->transport = std::move(transport);
+		connection->clientAddr = clientAddr;
+		connection->lastActivity = std::chrono::steady_clock::now();
+		// Plain connections are ready at once; TLS ones wait here for the client's hello without blocking the worker
+		onHandshake(worker, *connection);
+		if (connection->state == Connection::State::Closing)
+			continue;
+		metrics_->connectionOpened();
+		auto &timeouts = connection->state == Connection::State::Handshaking ? worker.handshakes : worker.activity;
+		connection->activityIt = timeouts.insert(timeouts.end(), connection.get());
+		sUpdateInterest(worker.epollFd, EPOLL_CTL_ADD, clientSocket, sEvents(connection->waitingFor));
+		connection->polledFor = connection->waitingFor;
+		worker.connections[clientSocket] = std::move(connection);
+	}
+}
 
-		if (bytesRead <= 0) {
-			LOG_WARN("Failed to read request from client {}", inet_ntoa(clientAddr.sin_addr));
-			socketHandler_->closeConnection(clientSocket);
+void Server::closeConnection(Worker &worker, Connection &connection) const {
+	int fd = connection.socket;
+	epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	LOG_DEBUG("Closed connection from {}", sAddressToString(connection.clientAddr));
+	metrics_->connectionClosed();
+	(connection.state == Connection::State::Handshaking ? worker.handshakes : worker.activity).erase(connection.activityIt);
+	worker.connections.erase(fd);
+}
+
+void Server::closeIdleConnections(Worker &worker) const {
+	auto now = std::chrono::steady_clock::now();
+	while (!worker.handshakes.empty() && worker.handshakes.front()->lastActivity < now - config_.handshakeTimeout) {
+		LOG_DEBUG("Handshake with client {} timed out", sAddressToString(worker.handshakes.front()->clientAddr));
+		closeConnection(worker, *worker.handshakes.front());
+	}
+	while (!worker.activity.empty() && worker.activity.front()->lastActivity < now - config_.keepAliveTimeout) {
+		Connection &connection = *worker.activity.front();
+		// Waiting for a handler is not idling
+		if (connection.pendingResponse || (connection.http2 && connection.http2->awaitingHandlers())) {
+			connection.lastActivity = now;
+			worker.activity.splice(worker.activity.end(), worker.activity, connection.activityIt);
 			continue;
 		}
+		closeConnection(worker, connection);
+	}
+}
 
-		Request request = Request::parse(std::string_view(buffer.data(), bytesRead));
-		LOG_INFO("Received request: {} {}", request.method, request.path);
+void Server::afterEvent(Worker &worker, Connection &connection, Connection::State previousState) const {
+	if (previousState == Connection::State::Handshaking && connection.state != previousState)
+		worker.activity.splice(worker.activity.end(), worker.handshakes, connection.activityIt);
+	if (connection.state == Connection::State::Closing) {
+		closeConnection(worker, connection);
+		return;
+	}
+	// TLS can need the socket to become writable before it reads, or readable before it writes
+	std::optional<Socket::Readiness> interest = connection.waitingFor;
+	if (connection.state == Connection::State::Reading && connection.pendingResponse)
+		interest = std::nullopt;
+	if (interest != connection.polledFor) {
+		sUpdateInterest(worker.epollFd, EPOLL_CTL_MOD, connection.socket, sEvents(interest));
+		connection.polledFor = interest;
+	}
+	if (connection.state != Connection::State::Handshaking) {
+		connection.lastActivity = std::chrono::steady_clock::now();
+		worker.activity.splice(worker.activity.end(), worker.activity, connection.activityIt);
+	}
+}
 
-		request.clientAddr = clientAddr;
+void Server::onHandshake(Worker &worker, Connection &connection) const {
+	switch (connection.transport->handshake()) {
+	case Socket::Handshake::Complete:
+		connection.state = Connection::State::Reading;
+		connection.waitingFor = Socket::Readiness::Readable;
+		if (config_.http2 && connection.transport->protocol() == "h2")
+			startHttp2(worker, connection);
+		break;
+	case Socket::Handshake::WantRead:
+		connection.waitingFor = Socket::Readiness::Readable;
+		break;
+	case Socket::Handshake::WantWrite:
+		connection.waitingFor = Socket::Readiness::Writable;
+		break;
+	case Socket::Handshake::Failed:
+		LOG_DEBUG("Handshake with client {} failed", sAddressToString(connection.clientAddr));
+		connection.state = Connection::State::Closing;
+		break;
+	}
+}
 
-		auto response = handleRequest(request);
+void Server::onReadable(Worker &worker, Connection &connection) const {
+	// A TLS record can hold more than one chunk; what stays decrypted inside the transport raises no readiness event,
+	// so it is read now
+	ssize_t bytesRead = 0;
+	do {
+		size_t previousSize = connection.inBuffer.size();
+		size_t chunkSize = std::max(kReadChunkSize, connection.transport->pending());
+		connection.inBuffer.resize(previousSize + chunkSize);
+		bytesRead = connection.transport->read(connection.inBuffer.data() + previousSize, chunkSize);
+		connection.inBuffer.resize(previousSize + static_cast<size_t>(std::max<ssize_t>(bytesRead, 0)));
+	} while (bytesRead > 0 && connection.transport->pending() > 0);
 
-		if (response) {
-			std::string responseStr = response->serialize();
-			LOG_INFO("Sending response: {} {}", response->statusCode, response->reasonPhrase);
-			socketHandler_->write(clientSocket, responseStr);
-		} else {
-			LOG_WARN("No response generated for request: {} {}", request.method, request.path);
+	if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		connection.waitingFor = connection.transport->waitingFor();
+		return;
+	}
+
+	if (bytesRead <= 0) {
+		if (!connection.inBuffer.empty() || bytesRead < 0)
+			LOG_WARN("Failed to read request from client {}", sAddressToString(connection.clientAddr));
+		connection.state = Connection::State::Closing;
+		return;
+	}
+
+	processRequests(worker, connection);
+}
+
+void Server::processRequests(Worker &worker, Connection &connection) const {
+	// A cleartext client with prior knowledge of HTTP/2 opens with the preface instead of a request
+	if (config_.http2 && !connection.http2 && connection.requestCount == 0) {
+		std::string_view received = std::string_view(connection.inBuffer).substr(0, Http2Session::kPreface.size());
+		if (!received.empty() && Http2Session::kPreface.starts_with(received)) {
+			if (received.size() < Http2Session::kPreface.size()) {
+				connection.waitingFor = Socket::Readiness::Readable;
+				return;
+			}
+			startHttp2(worker, connection);
+		}
+	}
+	if (connection.http2) {
+		if (!connection.http2->receive(connection.inBuffer) || connection.http2->finished())
+			connection.closeAfterWrite = true;
+		afterProcessing(worker, connection);
+		return;
+	}
+
+	// Answer every complete request already buffered, in order, stopping early if the output backs up or a handler has
+	// to wait
+	while (!connection.pendingResponse && !connection.closeAfterWrite && connection.bufferedOutput < kMaxPendingOutput) {
+		RequestParser::Status status = connection.parser.parse(connection.inBuffer);
+		if (status == RequestParser::Status::Incomplete)
+			break;
+
+		if (status == RequestParser::Status::Error) {
+			LOG_WARN("Malformed request from client {}: {}", sAddressToString(connection.clientAddr), connection.parser.errorReason());
+			metrics_->malformedRequest();
+			int statusCode = connection.parser.errorStatus();
+			std::string reason = sReasonPhrase(statusCode);
+			Response response{ statusCode, reason, { { "Content-Type", "text/plain" }, { "Connection", "close" } }, std::format("{} {}", statusCode, reason) };
+			sQueueResponse(connection, response, false);
+			connection.closeAfterWrite = true;
+			break;
 		}
 
-		socketHandler_->closeConnection(clientSocket);
-		LOG_INFO("Closed connection from {}", inet_ntoa(clientAddr.sin_addr));
+		Request &request = connection.parser.request();
+		LOG_DEBUG("Received request: {} {}", request.method, request.path);
+		request.clientAddr = connection.clientAddr;
+
+		DispatchResult result = startRequest(request);
+		if (auto *pending = std::get_if<PendingResponse>(&result)) {
+			sWhenFinished(*worker.loop, *pending, [this, &worker, &connection] { onHandlerFinished(worker, connection); });
+			connection.pendingResponse = std::move(*pending);
+			break;
+		}
+		finishRequest(connection, std::move(std::get<std::optional<Response>>(result)));
 	}
+
+	afterProcessing(worker, connection);
 }
 
-std::optional<Response> Server::handleRequest(const Request &request) const {
+void Server::finishRequest(Connection &connection, std::optional<Response> response) const {
+	const Request &request = connection.parser.request();
+	if (!response) {
+		LOG_WARN("No response generated for request: {} {}", request.method, request.path);
+		connection.closeAfterWrite = true;
+		return;
+	}
+	bool keepAlive = sWantsKeepAlive(request);
+	bool headOnly = request.method == Method::HEAD;
+	if (keepAlive && request.version == "HTTP/1.0")
+		response->headers[HeaderName::Connection] = "keep-alive";
+
+	// Views into the buffer die here, so the request is consumed only after it has been handled
+	connection.inBuffer.erase(0, connection.parser.messageLength());
+	connection.parser.reset();
+
+	++connection.requestCount;
+	if (!keepAlive || connection.requestCount >= config_.maxRequestsPerConnection) {
+		response->headers[HeaderName::Connection] = "close";
+		connection.closeAfterWrite = true;
+	}
+
+	LOG_DEBUG("Sending response: {} {}", response->statusCode, response->reasonPhrase);
+	sQueueResponse(connection, *response, headOnly);
+}
+
+void Server::onHandlerFinished(Worker &worker, Connection &connection) const {
+	Connection::State previousState = connection.state;
+	std::optional<Response> response = connection.pendingResponse->result();
+	connection.pendingResponse.reset();
+	finishRequest(connection, std::move(response));
+	// While earlier responses are still being written, onWritable() carries on with this one and any requests after it
+	if (connection.state == Connection::State::Reading)
+		processRequests(worker, connection);
+	afterEvent(worker, connection, previousState);
+}
+
+void Server::startHttp2(Worker &worker, Connection &connection) const {
+	LOG_DEBUG("Client {} switched to HTTP/2", sAddressToString(connection.clientAddr));
+	connection.http2 = std::make_unique<Http2Session>(config_.requestLimits, [this, &worker, &connection](Request &request, uint32_t streamId) {
+		LOG_DEBUG("Received request: {} {}", request.method, request.path);
+		request.clientAddr = connection.clientAddr;
+		DispatchResult result = startRequest(request);
+		if (auto *pending = std::get_if<PendingResponse>(&result)) {
+			sWhenFinished(*worker.loop, *pending, [this, &worker, &connection, streamId] {
+				Connection::State previousState = connection.state;
+				connection.http2->answer(streamId);
+				if (connection.state == Connection::State::Reading)
+					afterProcessing(worker, connection);
+				afterEvent(worker, connection, previousState);
+			});
+		}
+		return result;
+	});
+}
+
+void Server::afterProcessing(Worker &worker, Connection &connection) const {
+	if (connection.http2)
+		connection.http2->pollOutput(connection.output, connection.bufferedOutput, kMaxPendingOutput);
+	if (!connection.output.empty()) {
+		connection.state = Connection::State::Writing;
+		// Most responses fit in the socket buffer, so try to send right away instead of waiting for EPOLLOUT
+		onWritable(worker, connection);
+	} else if (connection.closeAfterWrite) {
+		connection.state = Connection::State::Closing;
+	} else {
+		connection.waitingFor = Socket::Readiness::Readable;
+	}
+}
+
+void Server::onWritable(Worker &worker, Connection &connection) const {
+	// An HTTP/2 session hands out frames a bounded batch at a time, as flow control allows
+	do {
+		while (!connection.output.empty()) {
+			ssize_t bytesWritten = 0;
+			if (const auto *range = std::get_if<FileRange>(&connection.output.front())) {
+				bytesWritten = connection.transport->sendFile(range->file->fd(), range->offset + static_cast<off_t>(connection.outputOffset),
+																								range->length - connection.outputOffset);
+			} else {
+				// Consecutive in-memory chunks, such as a head and its body or pipelined responses, go out in one call
+				std::array<iovec, kMaxGatheredChunks> buffers;
+				size_t count = 0;
+				for (auto it = connection.output.begin(); it != connection.output.end() && count < buffers.size(); ++it) {
+					std::string_view data;
+					if (const auto *owned = std::get_if<std::string>(&*it))
+						data = *owned;
+					else if (const auto *shared = std::get_if<std::shared_ptr<const std::string>>(&*it))
+						data = **shared;
+					else
+						break;
+					if (count == 0)
+						data.remove_prefix(connection.outputOffset);
+					buffers[count++] = iovec{ const_cast<char *>(data.data()), data.size() };
+				}
+				bytesWritten = connection.transport->writev(std::span(buffers.data(), count));
+			}
+
+			if (bytesWritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+				connection.waitingFor = connection.transport->waitingFor();
+				return;
+			}
+			if (bytesWritten <= 0) {
+				// A zero-byte sendfile() means the file shrank below the Content-Length already sent
+				LOG_WARN("Failed to send response to client {}", sAddressToString(connection.clientAddr));
+				connection.state = Connection::State::Closing;
+				return;
+			}
+
+			auto remaining = static_cast<size_t>(bytesWritten);
+			while (!connection.output.empty()) {
+				size_t unsent = bodyPartSize(connection.output.front()) - connection.outputOffset;
+				if (unsent > remaining) {
+					connection.outputOffset += remaining;
+					break;
+				}
+				remaining -= unsent;
+				sPopOutput(connection);
+			}
+		}
+	} while (connection.http2 && connection.http2->pollOutput(connection.output, connection.bufferedOutput, kMaxPendingOutput));
+
+	if (connection.closeAfterWrite) {
+		connection.state = Connection::State::Closing;
+		return;
+	}
+
+	// Pipelined requests may already be waiting in the input buffer
+	connection.state = Connection::State::Reading;
+	processRequests(worker, connection);
+}
+
+DispatchResult Server::startRequest(const Request &request) const {
+	auto start = std::chrono::steady_clock::now();
 	Request processedRequest = request;
+	std::variant<std::optional<Response>, const Router::AsyncHandler *> dispatched;
+	try {
+		dispatched = dispatchRequest(processedRequest);
+	} catch (const std::exception &e) {
+		// A failing handler or middleware costs its own request, not the worker and every connection on it
+		LOG_ERROR("Handler for {} {} failed: {}", processedRequest.method, processedRequest.path, e.what());
+		dispatched = Response{ 500, "Internal Server Error", { { "Content-Type", "text/plain" } }, "500 Internal Server Error" };
+	}
+	if (auto *handler = std::get_if<const Router::AsyncHandler *>(&dispatched)) {
+		PendingResponse task = runAsyncHandler(std::move(processedRequest), **handler, start);
+		task.start();
+		if (!task.done())
+			return task;
+		return task.result();
+	}
+
+	auto &response = std::get<std::optional<Response>>(dispatched);
+	if (response)
+		recordResponse(processedRequest, *response, start);
+	return std::move(response);
+}
+
+std::optional<Response> Server::handleRequest(const Request &request) const {
+	DispatchResult result = startRequest(request);
+	if (auto *response = std::get_if<std::optional<Response>>(&result))
+		return std::move(*response);
+	LOG_WARN("Handler for {} {} suspended where nothing can resume it", request.method, request.path);
+	return std::nullopt;
+}
+
+PendingResponse Server::runAsyncHandler(Request request, const Router::AsyncHandler &handler, std::chrono::steady_clock::time_point start) const {
+	std::optional<Response> response;
+	try {
+		response = co_await handler(request);
+	} catch (const std::exception &e) {
+		LOG_ERROR("Handler for {} {} failed: {}", request.method, request.path, e.what());
+	}
+	if (response)
+		recordResponse(request, *response, start);
+	co_return response;
+}
+
+void Server::recordResponse(const Request &request, const Response &response, std::chrono::steady_clock::time_point start) const {
+	for (const auto &middleware : middlewares_)
+		middleware->onResponse(request, response);
+	metrics_->recordRequest(request.route, request.method, response.statusCode, std::chrono::steady_clock::now() - start);
+}
+
+std::variant<std::optional<Response>, const Router::AsyncHandler *> Server::dispatchRequest(Request &request) const {
 	Response response;
 	bool handled = false;
 
 	for (const auto &middleware : middlewares_) {
-		if (middleware->process(processedRequest, response)) {
+		if (middleware->process(request, response)) {
 			handled = true;
 			break;
 		}
 	}
 
-	if (handled)
+	if (handled) {
+		if (request.route.empty())
+			request.route = "middleware";
 		return response;
+	}
 
-	auto methodIt = routeHandlers_.find(request.method);
-	if (methodIt != routeHandlers_.end()) {
-		auto handlerIt = methodIt->second.find(request.path);
-		if (handlerIt != methodIt->second.end()) {
-			return handlerIt->second(processedRequest);
-		}
+	if (const auto *route = router_.findRoute(request.method, request.path, request.params, &request.route)) {
+		if (route->asyncHandler)
+			return &route->asyncHandler;
+		return route->handler(request);
 	}
 
+	// Regex patterns are tried one by one, so they are only a fallback for routes the router cannot express
 	auto patternIt = patternHandlers_.find(request.method);
 	if (patternIt != patternHandlers_.end()) {
-		for (const auto &[pattern, handler] : patternIt->second) {
-			if (std::regex_match(request.path, pattern)) {
-				return handler(processedRequest);
+		for (const auto &[pattern, regex, handler, asyncHandler] : patternIt->second) {
+			if (std::regex_match(request.path.begin(), request.path.end(), regex)) {
+				request.route = pattern;
+				if (asyncHandler)
+					return &asyncHandler;
+				return handler(request);
 			}
 		}
 	}
 
-	return handleStaticFileRequest(processedRequest);
+	request.route = "static";
+	return handleStaticFileRequest(request);
 }
 
 std::optional<Response> Server::handleStaticFileRequest(const Request &request) const {
-	std::filesystem::path filePath = config_.servingDirectory / (request.path == "/" ? "" : request.path.substr(1));
+	// Cache keys are normalized paths relative to the serving directory; anything escaping it is treated as missing
+	std::filesystem::path relativePath = std::filesystem::path(request.path == "/" ? std::string_view{} : request.path.substr(1)).lexically_normal();
+	if (!relativePath.empty() && *relativePath.begin() == "..")
+		return Response{ 404, "Not Found", { { "Content-Type", "text/plain" } }, "404 Not Found" };
+	std::string key = relativePath.generic_string();
+	std::filesystem::path filePath = config_.servingDirectory / relativePath;
 
-	LOG_INFO("Handling request for path: {}", request.path);
+	LOG_DEBUG("Handling request for path: {}", request.path);
 
-	if (!std::filesystem::exists(filePath)) {
-		LOG_ERROR("File not found: {}", filePath.string());
+	ResolvedFile resolved = sResolveFile(*staticFileCache_, config_.servingDirectory, key);
+	switch (resolved.kind) {
+	case ResolvedFile::Kind::Missing:
+		LOG_DEBUG("File not found: {}", filePath.string());
 		return Response{ 404, "Not Found", { { "Content-Type", "text/plain" } }, "404 Not Found" };
-	}
-
-	if (std::filesystem::is_directory(filePath)) {
-		LOG_INFO("Request is a directory: {}", filePath.string());
+	case ResolvedFile::Kind::Error:
+		return Response{ 500, "Internal Server Error", { { "Content-Type", "text/plain" } }, "500 Internal Server Error" };
+	case ResolvedFile::Kind::Directory: {
+		LOG_DEBUG("Request is a directory: {}", filePath.string());
 		if (!config_.enableDirectoryIndexing) {
 			LOG_WARN("Directory indexing is disabled, returning 403 Forbidden.");
 			return Response{ 403, "Forbidden", { { "Content-Type", "text/plain" } }, "403 Forbidden" };
 		}
 
-		std::string indexHtml = sGenerateDirectoryIndex(request.path, filePath);
-		LOG_INFO("Generated directory index for {}", request.path);
-		return Response{ 200, "OK", { { "Content-Type", "text/html" }, { "Content-Length", std::to_string(indexHtml.size()) } }, indexHtml };
+		auto indexHtml = std::make_shared<const std::string>(sGenerateDirectoryIndex(std::string(request.path), filePath));
+		LOG_DEBUG("Generated directory index for {}", request.path);
+		Response response{ 200, "OK", { { "Content-Type", "text/html" } }, {} };
+		// The directory's entity tag changes whenever an entry is added, removed or renamed. The page also embeds the
+		// request path, which is why that (rather than the normalized key) identifies it.
+		std::shared_ptr<const std::string> compressed;
+		if (config_.compression.enabled && acceptsEncoding(request, "gzip") && indexHtml->size() >= config_.compression.minSize)
+			compressed = gzipBody(std::string(request.path), resolved.entry->etag, [&indexHtml] { return indexHtml; });
+		if (compressed) {
+			response.headers[HeaderName::ContentEncoding] = "gzip";
+			response.bodyParts.emplace_back(std::move(compressed));
+		} else {
+			response.bodyParts.emplace_back(std::move(indexHtml));
+		}
+		if (config_.compression.enabled)
+			response.headers[HeaderName::Vary] = "Accept-Encoding";
+		return response;
+	}
+	case ResolvedFile::Kind::File:
+		break;
 	}
 
-	std::ifstream file(filePath, std::ios::binary);
-	if (!file) {
-		LOG_ERROR("Failed to open file: {}", filePath.string());
-		return Response{ 500, "Internal Server Error", { { "Content-Type", "text/plain" } }, "500 Internal Server Error" };
+	std::string_view contentType = mimeTypeForPath(relativePath);
+	const std::string &etag = resolved.entry->etag;
+	if (config_.compression.enabled) {
+		// Precompressed siblings (file.br, file.gz) are served as they are, in order of preference
+		for (auto [coding, extension] : { std::pair{ "br", ".br" }, std::pair{ "gzip", ".gz" } }) {
+			if (!acceptsEncoding(request, coding))
+				continue;
+			ResolvedFile sibling = sResolveFile(*staticFileCache_, config_.servingDirectory, key + extension);
+			if (sibling.kind == ResolvedFile::Kind::File) {
+				LOG_DEBUG("Serving precompressed file: {}{}", filePath.string(), extension);
+				Response response = sFileResponse(request, *sibling.entry, sibling.entry->etag, contentType, coding, sibling.body());
+				response.headers[HeaderName::Vary] = "Accept-Encoding";
+				return response;
+			}
+		}
+
+		if (isCompressible(contentType) && resolved.size >= config_.compression.minSize && resolved.size <= config_.compression.maxSize
+				&& acceptsEncoding(request, "gzip")) {
+			auto compressed = gzipBody(key, etag, [&resolved]() -> std::shared_ptr<const std::string> {
+				if (resolved.entry->body)
+					return resolved.entry->body;
+				auto contents = sReadFile(resolved.file->fd(), resolved.size);
+				return contents ? std::make_shared<const std::string>(std::move(*contents)) : nullptr;
+			});
+			if (compressed) {
+				Response response = sFileResponse(request, *resolved.entry, sDerivedEntityTag(etag, "gzip"), contentType, "gzip", compressed);
+				response.headers[HeaderName::Vary] = "Accept-Encoding";
+				return response;
+			}
+		}
 	}
 
-	std::string body((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-	LOG_INFO("Successfully read file: {}", filePath.string());
-	return Response{ 200, "OK", { { "Content-Length", std::to_string(body.size()) }, { "Content-Type", "text/plain" } }, body };
+	// The body (or the requested ranges of it) is streamed from the descriptor when the response is written, never copied
+	// into memory, so serving a huge file costs no more than a small one
+	LOG_DEBUG("Serving file: {}", filePath.string());
+	Response response = sFileResponse(request, *resolved.entry, etag, contentType, {}, resolved.body());
+	if (config_.compression.enabled && isCompressible(contentType))
+		response.headers[HeaderName::Vary] = "Accept-Encoding";
+	return response;
+}
+
+std::shared_ptr<const std::string> Server::gzipBody(const std::string &key, const std::string &version,
+																										const std::function<std::shared_ptr<const std::string>()> &load) const {
+	if (auto cached = compressionCache_->find(key, version, "gzip"))
+		return cached;
+
+	auto data = load();
+	if (!data)
+		return nullptr;
+	auto compressed = gzipCompress(*data, config_.compression.gzipLevel);
+	// Bodies that do not shrink are sent as they are
+	if (!compressed || compressed->size() >= data->size())
+		return nullptr;
+
+	auto body = std::make_shared<const std::string>(std::move(*compressed));
+	compressionCache_->insert(key, version, "gzip", body);
+	return body;
 }
 
 } // namespace ou::http
@@ -1,10 +1,17 @@
 #pragma once
 
+#include "Compression.h"
+#include "Connection.h"
 #include "HttpTypes.h"
+#include "Metrics.h"
+#include "Router.h"
 #include "SSLSocketHandler.h"
 #include "SocketHandler.h"
+#include "StaticFileCache.h"
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <filesystem>
 #include <functional>
 #include <map>
@@ -16,6 +23,7 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <variant>
 #include <vector>
 
 namespace ou::http {
@@ -25,6 +33,8 @@ public:
 	virtual ~Middleware() = default;
 	// Return true if the middleware handled the request, optionally modify request, and set response
 	virtual bool process(Request &request, Response &response) = 0;
+	// Called with the final response, whoever produced it, before it is sent
+	virtual void onResponse(const Request &, const Response &) {}
 };
 
 class RequestHandler {
@@ -33,6 +43,14 @@ public:
 	virtual Response handle(const Request &request) = 0;
 };
 
+// A handler that waits on sockets, timers or files (see EventLoop.h, AsyncSocket.h, AsyncFile.h) by suspending, which
+// frees the worker to serve other connections meanwhile. The request stays valid until the task finishes.
+class AsyncRequestHandler {
+public:
+	virtual ~AsyncRequestHandler() = default;
+	virtual Task<Response> handle(const Request &request) = 0;
+};
+
 class Server {
 public:
 	struct Config {
@@ -40,6 +58,15 @@ public:
 		uint16_t port = 8080;
 		int threadCount = 4;
 		bool enableDirectoryIndexing = false;
+		std::chrono::milliseconds keepAliveTimeout{ 5000 }; // Idle time after which a persistent connection is closed
+		std::chrono::milliseconds handshakeTimeout{ 10000 }; // Time a client has after connecting to complete the TLS handshake
+		size_t maxRequestsPerConnection = 1000; // HTTP/1.x only
+		// Over TLS for clients that negotiate h2 with ALPN, and in cleartext for clients that start with the HTTP/2 preface
+		bool http2 = true;
+		std::string metricsPath = "/metrics"; // Serves metrics in the Prometheus text format; empty disables the endpoint
+		RequestParser::Limits requestLimits;
+		StaticFileCache::Config staticFileCache;
+		CompressionConfig compression;
 #ifndef DISABLE_HTTPS
 		SSLSocketHandler::Config https;
 #endif
@@ -53,6 +80,8 @@ public:
 	void stop();
 
 	void addMiddleware(std::shared_ptr<Middleware> middleware);
+	// Path handlers take Router patterns such as "/users/:id" or "/files/*path"; pattern handlers take regular
+	// expressions matched against the whole path, and are only consulted when no path handler matches
 	void registerPathHandler(Method method, const std::string &path, const std::shared_ptr<RequestHandler> &handler);
 	void registerPathHandler(Method method, const std::string &path, std::function<Response(const Request &)> handler);
 	void registerPatternHandler(Method method, const std::string &pattern, const std::shared_ptr<RequestHandler> &handler);
@@ -65,23 +94,85 @@ public:
 	void registerPatternHandler(const std::set<Method> &methods, const std::string &pattern,
 															const std::function<Response(const Request &)> &handler);
 
+	// Asynchronous handlers register the same way, for the same patterns
+	void registerPathHandler(Method method, const std::string &path, const std::shared_ptr<AsyncRequestHandler> &handler);
+	void registerPathHandler(Method method, const std::string &path, Router::AsyncHandler handler);
+	void registerPatternHandler(Method method, const std::string &pattern, const std::shared_ptr<AsyncRequestHandler> &handler);
+	void registerPatternHandler(Method method, const std::string &pattern, Router::AsyncHandler handler);
+
+	void registerPathHandler(const std::set<Method> &methods, const std::string &path, const std::shared_ptr<AsyncRequestHandler> &handler);
+	void registerPathHandler(const std::set<Method> &methods, const std::string &path, const Router::AsyncHandler &handler);
+	void registerPatternHandler(const std::set<Method> &methods, const std::string &pattern,
+															const std::shared_ptr<AsyncRequestHandler> &handler);
+	void registerPatternHandler(const std::set<Method> &methods, const std::string &pattern, const Router::AsyncHandler &handler);
+
+	// Requests, latencies and connections, with gauges and counters from the caches; add more, e.g. for a KVStore,
+	// before starting the server
+	Metrics &metrics() { return *metrics_; }
+	StaticFileCache::Stats staticFileCacheStats() const { return staticFileCache_->stats(); }
+	CompressionCache::Stats compressionCacheStats() const { return compressionCache_->stats(); }
+#ifndef DISABLE_HTTPS
+	// Empty unless HTTPS is enabled
+	std::optional<SSLSocketHandler::Stats> tlsStats() const;
+#endif
+
 protected:
+	// Runs the request's handler until it returns or, if it is asynchronous, first suspends
+	DispatchResult startRequest(const Request &request) const;
+	// For callers that cannot wait, and outside a worker, where asynchronous handlers cannot suspend: nullopt if the
+	// handler does
 	std::optional<Response> handleRequest(const Request &request) const;
+	// The response, or the asynchronous handler that will produce it
+	std::variant<std::optional<Response>, const Router::AsyncHandler *> dispatchRequest(Request &request) const;
 	std::optional<Response> handleStaticFileRequest(const Request &request) const;
 
 private:
+	struct Worker;
+
+	struct PatternHandler {
+		std::string pattern; // Source of the expression, which labels the requests it answers
+		std::regex regex;
+		std::function<Response(const Request &)> handler;
+		Router::AsyncHandler asyncHandler; // Instead of handler
+	};
+
 	void workerThread(int serverSocket);
+	void acceptConnections(Worker &worker) const;
+	void closeConnection(Worker &worker, Connection &connection) const;
+	void closeIdleConnections(Worker &worker) const;
+	// Updates the worker's bookkeeping after the connection was served, closing it if it is done
+	void afterEvent(Worker &worker, Connection &connection, Connection::State previousState) const;
+	void onHandshake(Worker &worker, Connection &connection) const;
+	void onReadable(Worker &worker, Connection &connection) const;
+	void onWritable(Worker &worker, Connection &connection) const;
+	void processRequests(Worker &worker, Connection &connection) const;
+	// Queues the response to the request at the front of the input and consumes the request
+	void finishRequest(Connection &connection, std::optional<Response> response) const;
+	void onHandlerFinished(Worker &worker, Connection &connection) const;
+	void startHttp2(Worker &worker, Connection &connection) const;
+	// Starts writing whatever processing queued, or goes back to waiting for input
+	void afterProcessing(Worker &worker, Connection &connection) const;
+	// The asynchronous handler's response, passed to the middlewares and recorded like any other
+	PendingResponse runAsyncHandler(Request request, const Router::AsyncHandler &handler, std::chrono::steady_clock::time_point start) const;
+	void recordResponse(const Request &request, const Response &response, std::chrono::steady_clock::time_point start) const;
+	std::shared_ptr<const std::string> gzipBody(const std::string &key, const std::string &version,
+																							const std::function<std::shared_ptr<const std::string>()> &load) const;
 
 	Config config_;
 	std::atomic<bool> running_{ false };
 	std::vector<std::thread> threads_;
 	std::vector<int> sockets_; // One per worker thread
+	int wakeFd_ = -1;					 // eventfd signalled by stop() to wake every worker's epoll loop
 
-	std::unordered_map<Method, std::unordered_map<std::string, std::function<Response(const Request &)>>> routeHandlers_;
-	std::unordered_map<Method, std::vector<std::pair<std::regex, std::function<Response(const Request &)>>>> patternHandlers_;
+	Router router_;
+	// A deque keeps each pattern's text where it is as more are added
+	std::unordered_map<Method, std::deque<PatternHandler>> patternHandlers_;
 	std::vector<std::shared_ptr<Middleware>> middlewares_;
 
 	std::unique_ptr<SocketHandler> socketHandler_;
+	std::unique_ptr<StaticFileCache> staticFileCache_;
+	std::unique_ptr<CompressionCache> compressionCache_;
+	std::unique_ptr<Metrics> metrics_;
 };
 
 } // namespace ou::http
@@ -1,25 +1,93 @@
 #pragma once
 
-#include <string>
+#include <cerrno>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+// Transport of one accepted connection, owned by the connection, so workers share no per-connection state. Closes the
+// socket when destroyed.
+//
+// The socket is non-blocking: an operation that cannot make progress fails with EAGAIN, and waitingFor() tells which
+// readiness event to wait for before retrying. That is not always the obvious one: a TLS read may have to write and
+// a TLS write may have to read.
+class Socket {
+public:
+	enum class Readiness { Readable, Writable };
+	enum class Handshake { Complete, WantRead, WantWrite, Failed };
+
+	explicit Socket(int fd) : fd_(fd) {}
+	virtual ~Socket() { ::close(fd_); }
+
+	Socket(const Socket &) = delete;
+	Socket &operator=(const Socket &) = delete;
+
+	int fd() const { return fd_; }
+
+	// Advances the connection's handshake; called until it returns Complete or Failed, then never again
+	virtual Handshake handshake() { return Handshake::Complete; }
+	virtual ssize_t read(char *buffer, size_t size) = 0;
+	virtual ssize_t write(std::string_view data) = 0;
+	// Sends the buffers in order as one stream of bytes, possibly only a prefix of it, in as few calls as it can
+	virtual ssize_t writev(std::span<const iovec> buffers) = 0;
+	// Sends up to count bytes of fileFd starting at offset, without changing the file position
+	virtual ssize_t sendFile(int fileFd, off_t offset, size_t count) = 0;
+
+	// After an operation failed with EAGAIN, what it is waiting for
+	Readiness waitingFor() const { return waitingFor_; }
+	// Bytes already received and decoded that read() returns without touching the socket, so no readiness event will
+	// announce them
+	virtual size_t pending() const { return 0; }
+	// Application protocol agreed during the handshake, such as "h2" through TLS ALPN; empty if none was
+	virtual std::string_view protocol() const { return {}; }
+
+protected:
+	// Records what the operation that just returned is waiting for, if it failed with EAGAIN
+	ssize_t waitIfBlocked(ssize_t result, Readiness readiness) {
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			waitingFor_ = readiness;
+		return result;
+	}
+
+	const int fd_;
+	Readiness waitingFor_ = Readiness::Readable;
+};
+
+class PlainSocket : public Socket {
+public:
+	using Socket::Socket;
+
+	ssize_t read(char *buffer, size_t size) override final { return waitIfBlocked(::read(fd_, buffer, size), Readiness::Readable); }
+	ssize_t write(std::string_view data) override final {
+		return waitIfBlocked(::send(fd_, data.data(), data.size(), MSG_NOSIGNAL), Readiness::Writable);
+	}
+	ssize_t writev(std::span<const iovec> buffers) override final {
+		// sendmsg() rather than writev(), which has no way to suppress SIGPIPE
+		msghdr message{};
+		message.msg_iov = const_cast<iovec *>(buffers.data());
+		message.msg_iovlen = buffers.size();
+		return waitIfBlocked(::sendmsg(fd_, &message, MSG_NOSIGNAL), Readiness::Writable);
+	}
+	ssize_t sendFile(int fileFd, off_t offset, size_t count) override final {
+		return waitIfBlocked(::sendfile(fd_, fileFd, &offset, count), Readiness::Writable);
+	}
+};
+
+// Creates the transport of each accepted socket. One handler serves every worker, so implementations must be
+// thread-safe.
 class SocketHandler {
 public:
 	virtual ~SocketHandler() = default;
-	virtual bool acceptConnection(int clientSocket) = 0;
-	virtual ssize_t read(int clientSocket, char *buffer, size_t size) = 0;
-	virtual ssize_t write(int clientSocket, const std::string &data) = 0;
-	virtual void closeConnection(int clientSocket) = 0;
+	// Takes ownership of clientSocket, which is already non-blocking, without waiting for the client; the handshake is
+	// driven through Socket::handshake(). Returns nullptr, having closed the socket, if no transport can be created.
+	virtual std::unique_ptr<Socket> acceptConnection(int clientSocket) = 0;
 };
 
 class PlainSocketHandler : public SocketHandler {
 public:
-	bool acceptConnection(int clientSocket) override final {
-		(void)clientSocket;
-		return true;
-	}
-	ssize_t read(int clientSocket, char *buffer, size_t size) override final { return ::read(clientSocket, buffer, size); }
-	ssize_t write(int clientSocket, const std::string &data) override final { return ::send(clientSocket, data.c_str(), data.size(), 0); }
-	void closeConnection(int clientSocket) override final { ::close(clientSocket); }
+	std::unique_ptr<Socket> acceptConnection(int clientSocket) override final { return std::make_unique<PlainSocket>(clientSocket); }
 };
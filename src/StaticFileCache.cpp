@@ -0,0 +1,233 @@
+#include "StaticFileCache.h"
+#include "Logging.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace ou::http {
+
+namespace {
+	// Rough per-entry bookkeeping overhead counted against the byte budget
+	constexpr size_t kEntryOverhead = 256;
+
+	constexpr uint32_t kWatchMask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+																	| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+} // namespace
+
+StaticFileCache::StaticFileCache(std::filesystem::path root, Config config) : root_(std::move(root)), config_(config) {
+	if (!enabled())
+		return;
+
+	inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (inotifyFd_ < 0 || wakeFd_ < 0) {
+		// Without change notifications cached content could go stale, so run uncached instead
+		LOG_WARN("Failed to set up inotify ({}), static file cache disabled", std::strerror(errno));
+		config_.maxBytes = 0;
+		return;
+	}
+	watcher_ = std::thread([this]() { watcherThread(); });
+}
+
+StaticFileCache::~StaticFileCache() {
+	if (watcher_.joinable()) {
+		uint64_t one = 1;
+		(void)::write(wakeFd_, &one, sizeof(one));
+		watcher_.join();
+	}
+	if (inotifyFd_ >= 0)
+		close(inotifyFd_);
+	if (wakeFd_ >= 0)
+		close(wakeFd_);
+}
+
+std::shared_ptr<const StaticFileCache::Entry> StaticFileCache::find(const std::string &key) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = entries_.find(key);
+	if (it == entries_.end()) {
+		++stats_.misses;
+		return nullptr;
+	}
+	++stats_.hits;
+	lru_.splice(lru_.begin(), lru_, it->second.lruIt);
+	return it->second.entry;
+}
+
+std::optional<uint64_t> StaticFileCache::beginLoad(const std::string &key) {
+	// Watch before the caller reads the file, so a change made during the read is guaranteed to bump the generation
+	if (!watchDirectory(std::filesystem::path(key).parent_path()))
+		return std::nullopt;
+	std::lock_guard<std::mutex> lock(mutex_);
+	return generation_;
+}
+
+void StaticFileCache::insert(const std::string &key, std::shared_ptr<const Entry> entry, uint64_t generation) {
+	size_t cost = (entry->body ? entry->body->size() : 0) + key.size() + kEntryOverhead;
+	if (cost > config_.maxBytes)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (generation != generation_)
+		return;
+
+	if (entries_.contains(key))
+		evictLocked(key);
+	while (bytes_ + cost > config_.maxBytes && !lru_.empty()) {
+		evictLocked(lru_.back());
+		++stats_.evictions;
+	}
+
+	lru_.push_front(key);
+	entries_[key] = Slot{ std::move(entry), lru_.begin(), cost };
+	bytes_ += cost;
+}
+
+StaticFileCache::Stats StaticFileCache::stats() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	Stats stats = stats_;
+	stats.entries = entries_.size();
+	stats.bytes = bytes_;
+	return stats;
+}
+
+bool StaticFileCache::watchDirectory(const std::filesystem::path &relativeDir) {
+	std::string dir = relativeDir.generic_string();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (watchByDir_.contains(dir))
+			return true;
+	}
+
+	int wd = inotify_add_watch(inotifyFd_, (root_ / relativeDir).c_str(), kWatchMask);
+	if (wd < 0) {
+		// Requests for paths under missing directories are common and not worth a warning
+		if (errno != ENOENT && errno != ENOTDIR)
+			LOG_WARN("Failed to watch {} for changes: {}", (root_ / relativeDir).string(), std::strerror(errno));
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	watchedDirs_[wd] = dir;
+	watchByDir_[dir] = wd;
+	return true;
+}
+
+void StaticFileCache::watcherThread() {
+	alignas(inotify_event) std::array<char, 16 * 1024> buffer{};
+	std::array<pollfd, 2> fds{ pollfd{ inotifyFd_, POLLIN, 0 }, pollfd{ wakeFd_, POLLIN, 0 } };
+
+	while (true) {
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if ((fds[1].revents & POLLIN) != 0)
+			break;
+
+		ssize_t length = read(inotifyFd_, buffer.data(), buffer.size());
+		if (length <= 0)
+			continue;
+
+		for (ssize_t offset = 0; offset < length;) {
+			const auto *event = reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+			offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+			if ((event->mask & IN_Q_OVERFLOW) != 0) {
+				// Events may have been lost; start over
+				invalidateAll();
+				continue;
+			}
+			if ((event->mask & IN_IGNORED) != 0) {
+				// Also queued for every watch invalidateAll() removed, which must not start it over yet again
+				forgetWatch(event->wd);
+				continue;
+			}
+
+			std::string dir;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto it = watchedDirs_.find(event->wd);
+				if (it == watchedDirs_.end())
+					continue;
+				dir = it->second;
+			}
+			if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) != 0) {
+				// A whole directory went away, and whatever is cached beneath it; start over
+				invalidateAll();
+				continue;
+			}
+			if (event->len == 0)
+				continue;
+			std::string name(event->name);
+			invalidate(dir.empty() ? name : dir + "/" + name);
+		}
+	}
+}
+
+void StaticFileCache::invalidate(const std::string &key) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	++generation_;
+	if (entries_.contains(key)) {
+		evictLocked(key);
+		++stats_.invalidations;
+	}
+}
+
+void StaticFileCache::invalidateAll() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	++generation_;
+	stats_.invalidations += entries_.size();
+	entries_.clear();
+	lru_.clear();
+	bytes_ = 0;
+
+	// Watches on directories that were removed are already gone; re-establish the rest lazily
+	for (const auto &[wd, dir] : watchedDirs_)
+		inotify_rm_watch(inotifyFd_, wd);
+	watchedDirs_.clear();
+	watchByDir_.clear();
+}
+
+void StaticFileCache::forgetWatch(int wd) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = watchedDirs_.find(wd);
+	if (it == watchedDirs_.end())
+		return;
+
+	// The kernel dropped a watch still in use, so the files directly in its directory are no longer watched
+	std::string dir = std::move(it->second);
+	watchedDirs_.erase(it);
+	watchByDir_.erase(dir);
+	++generation_;
+	for (auto entryIt = entries_.begin(); entryIt != entries_.end();) {
+		const std::string &key = entryIt->first;
+		size_t slash = key.rfind('/');
+		bool inDir = slash == std::string::npos ? dir.empty() : std::string_view(key).substr(0, slash) == dir;
+		auto next = std::next(entryIt);
+		if (inDir) {
+			evictLocked(key);
+			++stats_.invalidations;
+		}
+		entryIt = next;
+	}
+}
+
+void StaticFileCache::evictLocked(const std::string &key) {
+	// key may refer into lru_, so it must stay alive until the map entry is gone
+	auto it = entries_.find(key);
+	auto lruIt = it->second.lruIt;
+	bytes_ -= it->second.cost;
+	entries_.erase(it);
+	lru_.erase(lruIt);
+}
+
+} // namespace ou::http
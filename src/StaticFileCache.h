@@ -0,0 +1,95 @@
+#pragma once
+
+#include "HttpTypes.h"
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace ou::http {
+
+// Byte-budgeted LRU cache of small files under a serving directory. Entries are dropped as soon as inotify reports a
+// change to the file, so a hit never needs to touch the disk.
+class StaticFileCache {
+public:
+	struct Config {
+		size_t maxBytes = 64 * 1024 * 1024; // 0 disables the cache
+		size_t maxEntryBytes = 1024 * 1024; // Larger files are always streamed from disk
+	};
+
+	struct Entry {
+		std::shared_ptr<const std::string> body; // Null for a path known not to exist
+		std::string etag;
+		std::string lastModified;
+		time_t mtime = 0;
+	};
+
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		uint64_t invalidations = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+	};
+
+	StaticFileCache(std::filesystem::path root, Config config);
+	~StaticFileCache();
+
+	StaticFileCache(const StaticFileCache &) = delete;
+	StaticFileCache &operator=(const StaticFileCache &) = delete;
+
+	bool enabled() const { return config_.maxBytes > 0; }
+	size_t maxEntryBytes() const { return config_.maxEntryBytes; }
+
+	// key is the file path relative to the root
+	std::shared_ptr<const Entry> find(const std::string &key);
+
+	// Returns the generation to pass to insert(); an invalidation in between makes that insert a no-op, so content read
+	// while the file was changing is never cached. Returns nullopt if changes to the key cannot be watched, in which case
+	// it must not be cached at all.
+	std::optional<uint64_t> beginLoad(const std::string &key);
+	void insert(const std::string &key, std::shared_ptr<const Entry> entry, uint64_t generation);
+
+	Stats stats() const;
+
+private:
+	struct Slot {
+		std::shared_ptr<const Entry> entry;
+		std::list<std::string>::iterator lruIt;
+		size_t cost = 0;
+	};
+
+	bool watchDirectory(const std::filesystem::path &relativeDir);
+	void watcherThread();
+	void invalidate(const std::string &key);
+	void invalidateAll();
+	// Drops a watch the kernel removed, with the entries it covered; a no-op for one invalidateAll() already dropped
+	void forgetWatch(int wd);
+	void evictLocked(const std::string &key);
+
+	std::filesystem::path root_;
+	Config config_;
+
+	mutable std::mutex mutex_;
+	std::unordered_map<std::string, Slot> entries_;
+	std::list<std::string> lru_; // Most recently used first
+	size_t bytes_ = 0;
+	uint64_t generation_ = 0;
+	Stats stats_;
+
+	int inotifyFd_ = -1;
+	int wakeFd_ = -1;
+	std::unordered_map<int, std::string> watchedDirs_;	// inotify watch descriptor to directory relative to root_
+	std::unordered_map<std::string, int> watchByDir_;
+	std::thread watcher_;
+};
+
+} // namespace ou::http
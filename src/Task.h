@@ -0,0 +1,118 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+namespace ou::http {
+
+template <typename T> class Task;
+
+namespace detail {
+
+	struct TaskPromiseBase {
+		struct FinalAwaiter {
+			bool await_ready() const noexcept { return false; }
+			template <typename Promise> std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+				TaskPromiseBase &promise = finished.promise();
+				if (promise.continuation)
+					return promise.continuation;
+				// The hook may destroy the finished task, promise included
+				if (promise.onComplete) {
+					auto onComplete = std::move(promise.onComplete);
+					onComplete();
+				}
+				return std::noop_coroutine();
+			}
+			void await_resume() const noexcept {}
+		};
+
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		FinalAwaiter final_suspend() const noexcept { return {}; }
+		void unhandled_exception() { error = std::current_exception(); }
+
+		std::coroutine_handle<> continuation; // The coroutine awaiting this one
+		std::function<void()> onComplete;			// For a task nothing awaits
+		std::exception_ptr error;
+	};
+
+	template <typename T> struct TaskPromise : TaskPromiseBase {
+		Task<T> get_return_object();
+		template <typename U = T> void return_value(U &&value) { result.emplace(std::forward<U>(value)); }
+		T take() {
+			if (this->error)
+				std::rethrow_exception(this->error);
+			return std::move(*result);
+		}
+
+		std::optional<T> result;
+	};
+
+	template <> struct TaskPromise<void> : TaskPromiseBase {
+		Task<void> get_return_object();
+		void return_void() const {}
+		void take() const {
+			if (error)
+				std::rethrow_exception(error);
+		}
+	};
+
+} // namespace detail
+
+// Result of a coroutine that runs on a worker's event loop, e.g. an asynchronous request handler. A task does nothing
+// until it is awaited or started; awaiting it resumes the awaiting coroutine when it finishes, without growing the
+// stack. Destroying a task destroys its coroutine, which cancels whatever it is waiting for.
+template <typename T> class [[nodiscard]] Task {
+public:
+	using promise_type = detail::TaskPromise<T>;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	Task() = default;
+	explicit Task(Handle handle) : handle_(handle) {}
+	Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+	Task &operator=(Task &&other) noexcept {
+		if (this != &other) {
+			if (handle_)
+				handle_.destroy();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+		return *this;
+	}
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+	~Task() {
+		if (handle_)
+			handle_.destroy();
+	}
+
+	bool valid() const { return static_cast<bool>(handle_); }
+	bool done() const { return handle_.done(); }
+
+	// For a task nothing awaits: runs it until it first suspends or finishes
+	void start() { handle_.resume(); }
+	// Called, on the thread that resumed the task, when a started task finishes after having suspended
+	void onComplete(std::function<void()> onComplete) { handle_.promise().onComplete = std::move(onComplete); }
+	// The finished task's value; rethrows what escaped the coroutine
+	T result() { return handle_.promise().take(); }
+
+	bool await_ready() const { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+		handle_.promise().continuation = awaiting;
+		return handle_;
+	}
+	T await_resume() { return result(); }
+
+private:
+	Handle handle_;
+};
+
+namespace detail {
+
+	template <typename T> Task<T> TaskPromise<T>::get_return_object() { return Task<T>(Task<T>::Handle::from_promise(*this)); }
+	inline Task<void> TaskPromise<void>::get_return_object() { return Task<void>(Task<void>::Handle::from_promise(*this)); }
+
+} // namespace detail
+
+} // namespace ou::http
@@ -1,3 +1,4 @@
+#include "AccessLog.h"
 #include "KVStore.h"
 #include "Logging.h"
 #include "Server.h"
@@ -5,12 +6,17 @@
 #include <atomic>
 #include <chrono>
 #include <csignal>
+#include <cstdlib>
+#include <string_view>
+#include <system_error>
 #include <thread>
 
 std::atomic<bool> g_running{ true };
+std::atomic<int> g_signal{ 0 };
 
 void signalHandler(int signum) {
-	LOG_INFO("Interrupt signal ({}) received", signum);
+	// Logging is not async-signal-safe, so the main loop reports the signal
+	g_signal.store(signum);
 	g_running.store(false);
 }
 
@@ -18,13 +24,27 @@ int main(int argc, char *argv[]) {
 	using namespace ou::http;
 	std::signal(SIGINT, signalHandler);
 
+	// e.g. OU_LOG_LEVEL=debug OU_LOG_FORMAT=json
+	Logger::Config logConfig;
+	if (const char *level = std::getenv("OU_LOG_LEVEL"))
+		logConfig.level = parseLogLevel(level).value_or(logConfig.level);
+	if (const char *format = std::getenv("OU_LOG_FORMAT"))
+		logConfig.json = std::string_view(format) == "json";
+	Logger::configure(logConfig);
+
 	Server::Config config;
 	config.servingDirectory = "./example/www";
 	config.port = 8080;
+	// e.g. OU_PORT=8081, to run several servers on one host
+	if (const char *port = std::getenv("OU_PORT"))
+		config.port = static_cast<uint16_t>(std::strtoul(port, nullptr, 10));
 	config.threadCount = 4;
 	config.enableDirectoryIndexing = true;
 #ifndef DISABLE_HTTPS
 	config.https = { .enabled = true, .certPath = "./example/certs/cert.pem", .keyPath = "./example/certs/key.pem" };
+	// e.g. OU_KTLS=1 lets the kernel encrypt responses where its tls module is loaded
+	if (const char *kernelTls = std::getenv("OU_KTLS"))
+		config.https.kernelTls = std::string_view(kernelTls) == "1";
 #endif
 
 	Server server(config);
@@ -36,8 +56,32 @@ int main(int argc, char *argv[]) {
 	AccessLog::Config accessLogConfig = { .path = "access.log", .maxSizeBytes = 10 * 1024 * 1024 };
 	server.addMiddleware(std::make_shared<AccessLog>(accessLogConfig));
 
-	server.registerPatternHandler(std::set<Method>{ Method::GET, Method::PUT, Method::DELETE }, R"(^/kv(\?.*)?$)",
-																std::make_shared<KVStore>());
+	// e.g. OU_KV_DIR=./kvdata keeps /kv across restarts
+	KVStore::Config kvConfig{ .orderedIndex = true };
+	if (const char *directory = std::getenv("OU_KV_DIR"))
+		kvConfig.persistence = KVLog::Config{ .directory = directory };
+	// e.g. OU_KV_REPLICATE=unix:/tmp/ou-kv.sock on the leader and OU_KV_FOLLOW=unix:/tmp/ou-kv.sock on its followers
+	if (const char *address = std::getenv("OU_KV_REPLICATE"))
+		kvConfig.leader = ReplicationLeader::Config{ .address = address };
+	if (const char *address = std::getenv("OU_KV_FOLLOW"))
+		kvConfig.follower = ReplicationFollower::Config{ .leader = address };
+	std::shared_ptr<KVStore> kvStore;
+	try {
+		kvStore = std::make_shared<KVStore>(kvConfig);
+	} catch (const std::system_error &error) {
+		LOG_ERROR("KV store initialization failed: {}", error.what());
+		return EXIT_FAILURE;
+	}
+	server.registerPathHandler(std::set<Method>{ Method::GET, Method::PUT, Method::DELETE }, "/kv", kvStore);
+	server.registerPathHandler(Method::POST, "/kv/batch", kvStore);
+	server.registerPathHandler(Method::GET, "/kv/scan", kvStore);
+	server.registerPathHandler(Method::GET, "/kv/replication", kvStore);
+	server.metrics().addGauge("kvstore_keys", "Keys in the KV store, including expired ones not yet reclaimed.",
+														[kvStore]() { return static_cast<double>(kvStore->size()); });
+	server.metrics().addGauge("kvstore_used_bytes", "Bytes used by KV store keys and values, with an estimate of their overhead.",
+														[kvStore]() { return static_cast<double>(kvStore->stats().usedBytes); });
+	server.metrics().addCounter("kvstore_evictions_total", "KV store keys evicted to stay within the memory budget.",
+															[kvStore]() { return static_cast<double>(kvStore->stats().evictions); });
 
 	std::thread serverThread([&server]() { server.start(); });
 
@@ -45,6 +89,7 @@ int main(int argc, char *argv[]) {
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 	}
 
+	LOG_INFO("Interrupt signal ({}) received", g_signal.load());
 	server.stop();
 	if (serverThread.joinable()) {
 		serverThread.join();
@@ -1,19 +1,47 @@
 #define BOOST_TEST_MODULE ToyHttpServerTest
 #include <boost/test/included/unit_test.hpp>
 
+#include "AccessLog.h"
+#include "AsyncFile.h"
+#include "AsyncSocket.h"
+#include "ByteScan.h"
+#include "Compression.h"
+#include "EventLoop.h"
+#include "Hpack.h"
+#include "Http2Session.h"
 #include "HttpTypes.h"
+#include "KVStore.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "RangeRequest.h"
+#include "RequestParser.h"
+#include "RingBuffer.h"
+#include "Router.h"
 #include "Server.h"
 
+#include <arpa/inet.h>
+#include <array>
 #include <chrono>
+#include <csignal>
 #include <filesystem>
+#include <format>
 #include <fstream>
+#include <map>
 #include <memory>
 #include <netinet/in.h>
+#include <random>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <system_error>
 #include <thread>
 #include <unistd.h>
+#include <utility>
+#include <variant>
 #include <vector>
+#include <zlib.h>
 
 using namespace ou::http;
 
@@ -48,6 +76,232 @@ BOOST_AUTO_TEST_CASE(test_response_serialization) {
 	BOOST_CHECK(responseStr.find("Hello, world!") != std::string::npos);
 }
 
+BOOST_AUTO_TEST_CASE(test_response_head_serialization) {
+	// Content-Length always comes from the body, so a handler's own is dropped rather than repeated
+	Response res{ 200, "OK", { { "content-length", "999" }, { "content-type", "text/plain" }, { "X-Id", "7" } }, "Hello" };
+	BOOST_CHECK_EQUAL(res.serializeHead(), "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nContent-Type: text/plain\r\nX-Id: 7\r\n\r\n");
+
+	// Reason phrases other than the standard one are kept
+	Response custom{ 299, "Fine", {}, "" };
+	custom.bodyParts.emplace_back(std::make_shared<const std::string>(12345, 'x'));
+	BOOST_CHECK_EQUAL(custom.serializeHead(), "HTTP/1.1 299 Fine\r\nContent-Length: 12345\r\nContent-Type: text/html\r\n\r\n");
+	Response renamed{ 404, "Nowhere", { { "Content-Type", "text/plain" } }, "" };
+	BOOST_CHECK_EQUAL(renamed.serializeHead(), "HTTP/1.1 404 Nowhere\r\nContent-Length: 0\r\nContent-Type: text/plain\r\n\r\n");
+
+	// appendHead() adds to what the buffer holds
+	std::string buffer = "previous";
+	res.appendHead(buffer);
+	BOOST_CHECK_EQUAL(buffer, "previous" + res.serializeHead());
+	BOOST_CHECK_EQUAL(res.serialize(), res.serializeHead() + "Hello");
+}
+
+BOOST_AUTO_TEST_CASE(test_header_containers) {
+	BOOST_CHECK(internHeaderName("content-TYPE") == HeaderName::ContentType);
+	BOOST_CHECK(internHeaderName("Strict-Transport-Security") == HeaderName::StrictTransportSecurity);
+	BOOST_CHECK(internHeaderName("X-TTL") == HeaderName::Other);
+	BOOST_CHECK(internHeaderName("Content-Typ") == HeaderName::Other);
+	BOOST_CHECK_EQUAL(headerNameString(HeaderName::IfNoneMatch), "If-None-Match");
+
+	// Well-known and other names are found in any case; the first of repeated fields wins
+	RequestHeaders request;
+	request.add("HOST", "example.com");
+	request.add("x-ttl", "60");
+	request.add("Host", "second.example.com");
+	BOOST_CHECK_EQUAL(request[HeaderName::Host], "example.com");
+	BOOST_CHECK_EQUAL(request["host"], "example.com");
+	BOOST_CHECK_EQUAL(request["X-TTL"], "60");
+	BOOST_CHECK(!request.contains(HeaderName::Cookie));
+	BOOST_CHECK_EQUAL(request.size(), 3);
+	request.clear();
+	BOOST_CHECK(!request.contains(HeaderName::Host));
+
+	// Setting a field again replaces it, whatever the case of its name
+	ResponseHeaders response{ { "content-type", "text/plain" }, { "x-custom", "1" } };
+	response["Content-Type"] = "application/json";
+	response["X-Custom"] = "2";
+	response[HeaderName::Vary] = "Accept-Encoding";
+	BOOST_CHECK_EQUAL(response.size(), 3);
+	std::vector<std::pair<std::string, std::string>> fields(response.begin(), response.end());
+	std::vector<std::pair<std::string, std::string>> expected{ { "Content-Type", "application/json" }, { "x-custom", "2" }, { "Vary", "Accept-Encoding" } };
+	BOOST_CHECK(fields == expected);
+	BOOST_CHECK_EQUAL(response.find("VARY").value_or(""), "Accept-Encoding");
+	BOOST_CHECK(!response.find(HeaderName::ETag));
+
+	ResponseHeaders copy = response;
+	copy[HeaderName::ContentType] = "text/html";
+	BOOST_CHECK_EQUAL(copy["content-type"], "text/html");
+	BOOST_CHECK_EQUAL(response["content-type"], "application/json");
+}
+
+// --- Incremental parser tests ---
+
+BOOST_AUTO_TEST_CASE(test_parser_resumes_across_reads) {
+	std::string body(10000, 'x');
+	std::string raw = "PUT /upload HTTP/1.1\r\n"
+										"host: localhost\r\n"
+										"Content-Length: "
+										+ std::to_string(body.size()) + "\r\n\r\n" + body + "GET /next HTTP/1.1\r\n\r\n";
+
+	// Deliver the request one byte at a time into a growing buffer that reallocates as it goes
+	RequestParser parser;
+	std::string buffer;
+	size_t delivered = 0;
+	RequestParser::Status status = RequestParser::Status::Incomplete;
+	while (status == RequestParser::Status::Incomplete && delivered < raw.size()) {
+		buffer.push_back(raw[delivered++]);
+		status = parser.parse(buffer);
+	}
+
+	BOOST_REQUIRE(status == RequestParser::Status::Complete);
+	Request &req = parser.request();
+	BOOST_CHECK_EQUAL(req.method, Method::PUT);
+	BOOST_CHECK_EQUAL(req.path, "/upload");
+	BOOST_CHECK_EQUAL(req.headers["Host"], "localhost");
+	BOOST_CHECK_EQUAL(req.body.size(), body.size());
+	BOOST_CHECK_EQUAL(parser.messageLength(), delivered);
+
+	// The pipelined request after it is parsed once the first is consumed
+	buffer = raw.substr(parser.messageLength());
+	parser.reset();
+	BOOST_REQUIRE(parser.parse(buffer) == RequestParser::Status::Complete);
+	BOOST_CHECK_EQUAL(parser.request().path, "/next");
+	BOOST_CHECK(parser.request().body.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_parser_chunked_body) {
+	std::string raw = "POST /chunks HTTP/1.1\r\n"
+										"Transfer-Encoding: chunked\r\n"
+										"\r\n"
+										"5;ext=1\r\nHello\r\n"
+										"8\r\n, world!\r\n"
+										"0\r\n"
+										"X-Trailer: ignored\r\n"
+										"\r\n";
+
+	RequestParser parser;
+	BOOST_CHECK(parser.parse(raw.substr(0, 60)) == RequestParser::Status::Incomplete);
+	BOOST_REQUIRE(parser.parse(raw) == RequestParser::Status::Complete);
+	BOOST_CHECK_EQUAL(parser.request().body, "Hello, world!");
+	BOOST_CHECK_EQUAL(parser.messageLength(), raw.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_parser_rejects_malformed_requests) {
+	auto errorFor = [](const std::string &raw, RequestParser::Limits limits = {}) {
+		RequestParser parser(limits);
+		return parser.parse(raw) == RequestParser::Status::Error ? parser.errorStatus() : 0;
+	};
+
+	BOOST_CHECK_EQUAL(errorFor("GET /\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("BREW /pot HTTP/1.1\r\n\r\n"), 501);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/2.0\r\n\r\n"), 505);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nBad Header: x\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("POST / HTTP/1.1\r\nContent-Length: 100\r\n\r\n", { .maxHeaderSize = 1024, .maxBodySize = 10 }), 413);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nCookie: " + std::string(2000, 'c'), { .maxHeaderSize = 1024, .maxBodySize = 10 }), 431);
+}
+
+BOOST_AUTO_TEST_CASE(test_parser_limits_trailer_section) {
+	auto errorFor = [](const std::string &raw) {
+		RequestParser parser({ .maxHeaderSize = 1024, .maxBodySize = 10 });
+		return parser.parse(raw) == RequestParser::Status::Error ? parser.errorStatus() : 0;
+	};
+	std::string head = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\na\r\n0\r\n";
+
+	// Many lines that are each small still add up against the limit, whether or not the section is finished
+	std::string trailers;
+	for (int i = 0; i < 200; ++i)
+		trailers += std::format("X-T{}: v\r\n", i);
+	BOOST_CHECK_EQUAL(errorFor(head + trailers), 431);
+	BOOST_CHECK_EQUAL(errorFor(head + trailers + "\r\n"), 431);
+	BOOST_CHECK_EQUAL(errorFor(head + trailers.substr(0, 500) + "\r\n"), 0);
+	BOOST_CHECK_EQUAL(errorFor(head + trailers.substr(0, 1000) + std::string(100, 'x')), 431);
+}
+
+BOOST_AUTO_TEST_CASE(test_parser_scans_validate_fields) {
+	auto errorFor = [](const std::string &raw) {
+		RequestParser parser;
+		return parser.parse(raw) == RequestParser::Status::Error ? parser.errorStatus() : 0;
+	};
+
+	// Long values cross several vectors before the byte that ends or breaks them
+	std::string cookie(3000, 'c');
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nCookie: " + cookie + "\r\n\r\n"), 0);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nCookie: " + cookie + "\x01" + cookie + "\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nCookie: " + cookie + "\n" + cookie + "\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nCookie: " + cookie + "\r" + cookie + "\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nX-Long-" + cookie + ": 1\r\n\r\n"), 0);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nX-Long-" + cookie + "\x80: 1\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("GET /" + cookie + "\x7f HTTP/1.1\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("G\x01T / HTTP/1.1\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\nNo-Colon\r\n\r\n"), 400);
+	BOOST_CHECK_EQUAL(errorFor("GET / HTTP/1.1\r\n: empty name\r\n\r\n"), 400);
+
+	// Tabs and obs-text are allowed in values, and surrounding whitespace is trimmed
+	RequestParser parser;
+	BOOST_REQUIRE(parser.parse("GET / HTTP/1.1\r\nX-Value: \t a\tb\xe9 \t\r\n\r\n") == RequestParser::Status::Complete);
+	BOOST_CHECK_EQUAL(parser.request().headers["X-Value"], "a\tb\xe9");
+}
+
+BOOST_AUTO_TEST_CASE(test_scanners_agree) {
+	// Every vector level finds the same boundaries as the scalar scans, wherever the deciding byte falls in a vector
+	auto scanAll = [](ScanLevel level, std::string_view data, size_t from) {
+		setScanLevel(level);
+		return std::array<size_t, 4>{ findHeaderEnd(data, from), tokenLength(data.substr(from)), targetLength(data.substr(from)),
+																	fieldValueLength(data.substr(from)) };
+	};
+	std::vector<ScanLevel> levels;
+	for (ScanLevel level : { ScanLevel::Sse42, ScanLevel::Avx2 }) {
+		if (level <= supportedScanLevel())
+			levels.push_back(level);
+	}
+
+	size_t mismatches = 0;
+	auto compare = [&](std::string_view data, size_t from) {
+		auto expected = scanAll(ScanLevel::Scalar, data, from);
+		for (ScanLevel level : levels) {
+			if (scanAll(level, data, from) != expected)
+				++mismatches;
+		}
+	};
+
+	// One byte of every value at every position of inputs around the vector widths
+	for (size_t length : { 1, 15, 16, 17, 31, 32, 33, 35, 36, 64, 100 }) {
+		for (size_t position = 0; position < length; ++position) {
+			for (int byte = 0; byte < 256; ++byte) {
+				std::string input(length, 'a');
+				input[position] = static_cast<char>(byte);
+				compare(input, 0);
+				compare(input, position / 2);
+			}
+		}
+	}
+
+	// The terminator and near misses of it at every position
+	for (size_t position = 0; position < 80; ++position) {
+		for (std::string_view terminator : { "\r\n\r\n", "\r\n\r", "\r\r\n\n", "\n\r\n\r\n" }) {
+			std::string input(80, 'x');
+			input.replace(position, terminator.size(), terminator);
+			compare(input, 0);
+			compare(input, position);
+		}
+	}
+
+	// Random header-like bytes
+	std::mt19937 random(42);
+	constexpr std::string_view kAlphabet = "aZ09-:;= \t\r\n\x01\x7f\x80\xff\"/";
+	for (int round = 0; round < 5000; ++round) {
+		std::string input(random() % 200, '\0');
+		for (char &c : input)
+			c = kAlphabet[random() % kAlphabet.size()];
+		compare(input, input.empty() ? 0 : random() % input.size());
+	}
+
+	setScanLevel(supportedScanLevel());
+	BOOST_CHECK_EQUAL(mismatches, 0);
+	BOOST_CHECK(scanLevel() == supportedScanLevel());
+}
+
 // --- Custom handler and middleware tests ---
 
 class TestServer : public Server {
@@ -116,6 +370,15 @@ BOOST_AUTO_TEST_CASE(test_custom_handler_and_middleware) {
 	BOOST_CHECK_EQUAL(resp4->statusCode, 200);
 	BOOST_CHECK(resp4->body.find("Pattern function handler") != std::string::npos);
 
+	// A handler that throws answers 500 rather than taking the worker down
+	server.registerPathHandler(Method::GET, "/throws", [](const Request &) -> Response { throw std::runtime_error("handler failed"); });
+	Request req3;
+	req3.method = Method::GET;
+	req3.path = "/throws";
+	auto resp3 = server.handleRequest(req3);
+	BOOST_REQUIRE(resp3.has_value());
+	BOOST_CHECK_EQUAL(resp3->statusCode, 500);
+
 	// Other requests fall through to static file handler
 	Request req5;
 	req5.method = Method::GET;
@@ -124,3 +387,1859 @@ BOOST_AUTO_TEST_CASE(test_custom_handler_and_middleware) {
 	BOOST_REQUIRE(resp5.has_value());
 	BOOST_CHECK_EQUAL(resp5->statusCode, 404);
 }
+
+// --- Event loop tests ---
+
+namespace {
+
+int connectToServer(uint16_t port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void sendAll(int fd, const std::string &data) {
+	size_t sent = 0;
+	while (sent < data.size()) {
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+		if (n <= 0)
+			return;
+		sent += static_cast<size_t>(n);
+	}
+}
+
+// Reads exactly one response, using its Content-Length to find the end of the body; bytes past it stay in pending
+std::string readResponse(int fd, std::string &pending) {
+	std::array<char, 4096> buffer{};
+	while (true) {
+		size_t headerEnd = pending.find("\r\n\r\n");
+		if (headerEnd != std::string::npos) {
+			size_t lengthPos = pending.find("Content-Length: ");
+			size_t length = lengthPos < headerEnd ? std::stoul(pending.substr(lengthPos + 16)) : 0;
+			if (pending.size() >= headerEnd + 4 + length) {
+				std::string response = pending.substr(0, headerEnd + 4 + length);
+				pending.erase(0, response.size());
+				return response;
+			}
+		}
+		ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+		if (n <= 0)
+			return std::exchange(pending, {});
+		pending.append(buffer.data(), static_cast<size_t>(n));
+	}
+}
+
+std::string readUntilClosed(int fd) {
+	std::string result;
+	std::array<char, 4096> buffer{};
+	ssize_t n = 0;
+	while ((n = recv(fd, buffer.data(), buffer.size(), 0)) > 0)
+		result.append(buffer.data(), static_cast<size_t>(n));
+	return result;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_slow_client_does_not_block_worker) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18081;
+	config.threadCount = 1;
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/ping", [](const Request &) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "pong" };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	// A client that sends half a request must not stall the only worker thread
+	int slowClient = connectToServer(config.port);
+	BOOST_REQUIRE(slowClient >= 0);
+	sendAll(slowClient, "GET /ping HTTP/1.1\r\nHost: loc");
+
+	int fastClient = connectToServer(config.port);
+	BOOST_REQUIRE(fastClient >= 0);
+	sendAll(fastClient, "GET /ping HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+	std::string fastResponse = readUntilClosed(fastClient);
+	BOOST_CHECK(fastResponse.find("HTTP/1.1 200 OK") != std::string::npos);
+	BOOST_CHECK(fastResponse.find("pong") != std::string::npos);
+	close(fastClient);
+
+	// Once the slow client finishes its request it is answered too
+	sendAll(slowClient, "alhost\r\nConnection: close\r\n\r\n");
+	std::string slowResponse = readUntilClosed(slowClient);
+	BOOST_CHECK(slowResponse.find("pong") != std::string::npos);
+	close(slowClient);
+
+	server.stop();
+}
+
+BOOST_AUTO_TEST_CASE(test_keep_alive_and_pipelining) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18082;
+	config.threadCount = 1;
+	config.maxRequestsPerConnection = 4;
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/echo", [](const Request &req) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(req.headers["X-Id"]) };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	std::string pending;
+
+	// HTTP/1.1 connections stay open between requests
+	sendAll(client, "GET /echo HTTP/1.1\r\nX-Id: first\r\n\r\n");
+	std::string first = readResponse(client, pending);
+	BOOST_CHECK(first.find("first") != std::string::npos);
+	BOOST_CHECK(first.find("Connection: close") == std::string::npos);
+
+	// Pipelined requests in a single write are answered in order
+	sendAll(client, "GET /echo HTTP/1.1\r\nX-Id: second\r\n\r\nGET /echo HTTP/1.1\r\nX-Id: third\r\n\r\n");
+	std::string second = readResponse(client, pending);
+	std::string third = readResponse(client, pending);
+	BOOST_CHECK(second.find("second") != std::string::npos);
+	BOOST_CHECK(third.find("third") != std::string::npos);
+
+	// The connection is closed after maxRequestsPerConnection responses
+	sendAll(client, "GET /echo HTTP/1.1\r\nX-Id: fourth\r\n\r\n");
+	std::string fourth = readUntilClosed(client);
+	BOOST_CHECK(fourth.find("fourth") != std::string::npos);
+	BOOST_CHECK(fourth.find("Connection: close") != std::string::npos);
+	close(client);
+
+	// HTTP/1.0 clients are closed unless they ask for keep-alive
+	int legacyClient = connectToServer(config.port);
+	BOOST_REQUIRE(legacyClient >= 0);
+	sendAll(legacyClient, "GET /echo HTTP/1.0\r\nX-Id: legacy\r\n\r\n");
+	BOOST_CHECK(readUntilClosed(legacyClient).find("legacy") != std::string::npos);
+	close(legacyClient);
+
+	server.stop();
+}
+
+BOOST_AUTO_TEST_CASE(test_pipelined_responses_share_writes) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18089;
+	config.threadCount = 1;
+	TestServer server(config);
+	auto shared = std::make_shared<const std::string>(40000, 's');
+	server.registerPathHandler(Method::GET, "/large", [shared](const Request &) {
+		Response response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(300000, 'b') };
+		response.bodyParts.emplace_back(shared);
+		response.bodyParts.emplace_back(std::string("end"));
+		return response;
+	});
+	server.registerPathHandler(Method::HEAD, "/large", [](const Request &) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(300003, 'b') };
+	});
+	server.registerPathHandler(Method::GET, "/small", [](const Request &req) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(req.headers["X-Id"]) };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	std::string pending;
+
+	// Heads, owned bodies and shared bodies of several responses are gathered into the same writes, in order
+	std::string requests;
+	for (int i = 0; i < 40; ++i)
+		requests += std::format("GET /small HTTP/1.1\r\nX-Id: {}\r\n\r\n", i);
+	requests += "GET /large HTTP/1.1\r\n\r\nHEAD /large HTTP/1.1\r\n\r\nGET /small HTTP/1.1\r\nX-Id: last\r\n\r\n";
+	sendAll(client, requests);
+	for (int i = 0; i < 40; ++i) {
+		std::string response = readResponse(client, pending);
+		BOOST_CHECK(response.ends_with("\r\n\r\n" + std::to_string(i)));
+	}
+	std::string large = readResponse(client, pending);
+	BOOST_CHECK(large.find("Content-Length: 340003\r\n") != std::string::npos);
+	BOOST_CHECK(large.ends_with(std::string(300000, 'b') + std::string(40000, 's') + "end"));
+
+	// A HEAD response announces the body's length without sending it
+	size_t headEnd = pending.find("\r\n\r\n");
+	while (headEnd == std::string::npos) {
+		std::array<char, 4096> buffer{};
+		ssize_t n = recv(client, buffer.data(), buffer.size(), 0);
+		BOOST_REQUIRE(n > 0);
+		pending.append(buffer.data(), static_cast<size_t>(n));
+		headEnd = pending.find("\r\n\r\n");
+	}
+	BOOST_CHECK(pending.substr(0, headEnd).find("Content-Length: 300003") != std::string::npos);
+	pending.erase(0, headEnd + 4);
+	BOOST_CHECK(readResponse(client, pending).ends_with("\r\n\r\nlast"));
+	close(client);
+	server.stop();
+}
+
+// --- Static file tests ---
+
+BOOST_AUTO_TEST_CASE(test_static_file_streamed_from_disk) {
+	auto servingDirectory = std::filesystem::temp_directory_path() / "ou_http_static_test";
+	std::filesystem::create_directories(servingDirectory);
+	std::string contents;
+	for (int i = 0; contents.size() < 3 * 1024 * 1024; ++i)
+		contents += std::to_string(i) + '\n';
+	std::ofstream(servingDirectory / "large.txt", std::ios::binary) << contents;
+
+	TestServer::Config config;
+	config.servingDirectory = servingDirectory;
+	config.port = 18083;
+	config.threadCount = 1;
+	TestServer server(config);
+
+	// The response references the file instead of holding its contents
+	Request req;
+	req.method = Method::GET;
+	req.path = "/large.txt";
+	auto resp = server.handleRequest(req);
+	BOOST_REQUIRE(resp.has_value());
+	BOOST_REQUIRE_EQUAL(resp->bodyParts.size(), 1);
+	BOOST_CHECK(std::holds_alternative<FileRange>(resp->bodyParts[0]));
+	BOOST_CHECK(resp->body.empty());
+	BOOST_CHECK_EQUAL(resp->contentLength(), contents.size());
+
+	BOOST_REQUIRE(server.init());
+	server.start();
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	sendAll(client, "GET /large.txt HTTP/1.1\r\nConnection: close\r\n\r\n");
+	std::string response = readUntilClosed(client);
+	close(client);
+	server.stop();
+
+	size_t headerEnd = response.find("\r\n\r\n");
+	BOOST_REQUIRE(headerEnd != std::string::npos);
+	BOOST_CHECK(response.find("Content-Length: " + std::to_string(contents.size())) != std::string::npos);
+	BOOST_CHECK(response.compare(headerEnd + 4, std::string::npos, contents) == 0);
+
+	std::filesystem::remove_all(servingDirectory);
+}
+
+BOOST_AUTO_TEST_CASE(test_static_file_cache_and_conditional_requests) {
+	auto servingDirectory = std::filesystem::temp_directory_path() / "ou_http_cache_test";
+	std::filesystem::create_directories(servingDirectory);
+	std::ofstream(servingDirectory / "small.txt") << "version 1";
+
+	TestServer::Config config;
+	config.servingDirectory = servingDirectory;
+	TestServer server(config);
+
+	Request req;
+	req.method = Method::GET;
+	req.path = "/small.txt";
+
+	auto first = server.handleRequest(req);
+	BOOST_REQUIRE(first.has_value());
+	BOOST_CHECK_EQUAL(first->serialize().substr(first->serializeHead().size()), "version 1");
+	std::string etag = first->headers["ETag"];
+	std::string lastModified = first->headers["Last-Modified"];
+	BOOST_CHECK(!etag.empty() && !lastModified.empty());
+
+	auto second = server.handleRequest(req);
+	BOOST_REQUIRE(second.has_value());
+	// Both responses share the cached buffer
+	BOOST_REQUIRE(second->bodyParts.size() == 1 && first->bodyParts.size() == 1);
+	BOOST_CHECK(std::get<std::shared_ptr<const std::string>>(second->bodyParts[0]) == std::get<std::shared_ptr<const std::string>>(first->bodyParts[0]));
+	BOOST_CHECK_EQUAL(server.staticFileCacheStats().hits, 1);
+	BOOST_CHECK_EQUAL(server.staticFileCacheStats().misses, 1);
+
+	// Validators that match the cached entry produce 304 without a body
+	Request conditional = req;
+	conditional.headers.add("If-None-Match", etag);
+	auto notModified = server.handleRequest(conditional);
+	BOOST_REQUIRE(notModified.has_value());
+	BOOST_CHECK_EQUAL(notModified->statusCode, 304);
+	BOOST_CHECK(notModified->serialize().find("Content-Length") == std::string::npos);
+
+	Request sinceRequest = req;
+	sinceRequest.headers.add("If-Modified-Since", lastModified);
+	BOOST_CHECK_EQUAL(server.handleRequest(sinceRequest)->statusCode, 304);
+
+	Request staleRequest = req;
+	staleRequest.headers.add("If-None-Match", "\"stale\"");
+	BOOST_CHECK_EQUAL(server.handleRequest(staleRequest)->statusCode, 200);
+
+	// Changing the file invalidates the entry through inotify
+	std::ofstream(servingDirectory / "small.txt", std::ios::trunc) << "version 2";
+	for (int i = 0; i < 200 && server.staticFileCacheStats().invalidations == 0; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	BOOST_CHECK(server.staticFileCacheStats().invalidations >= 1);
+
+	auto updated = server.handleRequest(req);
+	BOOST_REQUIRE(updated.has_value());
+	BOOST_CHECK_EQUAL(updated->serialize().substr(updated->serializeHead().size()), "version 2");
+	BOOST_CHECK(updated->headers["ETag"] != etag);
+
+	// Removing a watched directory starts the cache over once; the watches that removes must not keep doing so while
+	// requests re-add them
+	std::filesystem::create_directories(servingDirectory / "gone");
+	std::ofstream(servingDirectory / "gone" / "file.txt") << "soon gone";
+	Request goneRequest = req;
+	goneRequest.path = "/gone/file.txt";
+	BOOST_CHECK_EQUAL(server.handleRequest(goneRequest)->statusCode, 200);
+	BOOST_CHECK_EQUAL(server.handleRequest(req)->statusCode, 200);
+	uint64_t invalidations = server.staticFileCacheStats().invalidations;
+	std::filesystem::remove_all(servingDirectory / "gone");
+	auto requestFor = [&](std::chrono::milliseconds duration) {
+		for (auto end = std::chrono::steady_clock::now() + duration; std::chrono::steady_clock::now() < end;)
+			server.handleRequest(req);
+	};
+	for (int i = 0; i < 200 && server.staticFileCacheStats().invalidations == invalidations; ++i)
+		requestFor(std::chrono::milliseconds(10));
+	requestFor(std::chrono::milliseconds(100));
+	invalidations = server.staticFileCacheStats().invalidations;
+	requestFor(std::chrono::milliseconds(100));
+	BOOST_CHECK_EQUAL(server.staticFileCacheStats().invalidations, invalidations);
+
+	std::filesystem::remove_all(servingDirectory);
+}
+
+BOOST_AUTO_TEST_CASE(test_range_header_parsing) {
+	auto ranges = parseRangeHeader("bytes=0-99, 50-149, -10, 500-", 1000);
+	BOOST_REQUIRE(ranges.has_value());
+	BOOST_REQUIRE_EQUAL(ranges->size(), 2);
+	BOOST_CHECK_EQUAL((*ranges)[0].first, 0);
+	BOOST_CHECK_EQUAL((*ranges)[0].last, 149);
+	BOOST_CHECK_EQUAL((*ranges)[1].first, 500);
+	BOOST_CHECK_EQUAL((*ranges)[1].last, 999);
+
+	// Ends past the representation are clamped; starts past it are unsatisfiable
+	BOOST_CHECK_EQUAL(parseRangeHeader("bytes=990-2000", 1000)->front().last, 999);
+	BOOST_CHECK(parseRangeHeader("bytes=1000-", 1000)->empty());
+	BOOST_CHECK(parseRangeHeader("bytes=-0", 1000)->empty());
+
+	// Malformed headers are ignored
+	BOOST_CHECK(!parseRangeHeader("items=0-1", 1000));
+	BOOST_CHECK(!parseRangeHeader("bytes=5-1", 1000));
+	BOOST_CHECK(!parseRangeHeader("bytes=abc", 1000));
+	BOOST_CHECK(!parseRangeHeader("bytes=", 1000));
+}
+
+BOOST_AUTO_TEST_CASE(test_static_file_range_requests) {
+	auto servingDirectory = std::filesystem::temp_directory_path() / "ou_http_range_test";
+	std::filesystem::create_directories(servingDirectory);
+	std::string contents;
+	for (int i = 0; contents.size() < 2 * 1024 * 1024; ++i)
+		contents += std::to_string(i) + '\n';
+	std::ofstream(servingDirectory / "large.txt", std::ios::binary) << contents;
+	std::ofstream(servingDirectory / "small.txt") << "0123456789";
+
+	TestServer::Config config;
+	config.servingDirectory = servingDirectory;
+	config.port = 18084;
+	config.threadCount = 1;
+	TestServer server(config);
+
+	auto bodyOf = [](const Response &response) {
+		return response.serialize().substr(response.serializeHead().size());
+	};
+
+	// A single range of a large file is still a file part, just narrowed
+	Request req;
+	req.method = Method::GET;
+	req.path = "/large.txt";
+	req.headers.add("Range", "bytes=1000000-1000099");
+	auto partial = server.handleRequest(req);
+	BOOST_REQUIRE(partial.has_value());
+	BOOST_CHECK_EQUAL(partial->statusCode, 206);
+	BOOST_CHECK_EQUAL(partial->headers["Content-Range"], "bytes 1000000-1000099/" + std::to_string(contents.size()));
+	BOOST_REQUIRE_EQUAL(partial->bodyParts.size(), 1);
+	BOOST_CHECK_EQUAL(std::get<FileRange>(partial->bodyParts[0]).offset, 1000000);
+	BOOST_CHECK_EQUAL(bodyOf(*partial), contents.substr(1000000, 100));
+
+	// Multiple ranges of a cached file become multipart/byteranges
+	Request multi;
+	multi.method = Method::GET;
+	multi.path = "/small.txt";
+	multi.headers.add("Range", "bytes=0-1,-2");
+	auto multipart = server.handleRequest(multi);
+	BOOST_REQUIRE(multipart.has_value());
+	BOOST_CHECK_EQUAL(multipart->statusCode, 206);
+	std::string contentType = multipart->headers["Content-Type"];
+	BOOST_REQUIRE(contentType.starts_with("multipart/byteranges; boundary="));
+	std::string boundary = contentType.substr(contentType.find('=') + 1);
+	BOOST_CHECK_EQUAL(bodyOf(*multipart), "\r\n--" + boundary + "\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Range: bytes 0-1/10\r\n\r\n01"
+																						 "\r\n--" + boundary + "\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Range: bytes 8-9/10\r\n\r\n89"
+																						 "\r\n--" + boundary + "--\r\n");
+	BOOST_CHECK_EQUAL(multipart->contentLength(), bodyOf(*multipart).size());
+
+	Request unsatisfiable = multi;
+	unsatisfiable.headers.clear();
+	unsatisfiable.headers.add("Range", "bytes=10-");
+	auto rejected = server.handleRequest(unsatisfiable);
+	BOOST_CHECK_EQUAL(rejected->statusCode, 416);
+	BOOST_CHECK_EQUAL(rejected->headers["Content-Range"], "bytes */10");
+
+	// A stale If-Range validator gets the whole representation instead
+	Request stale = multi;
+	stale.headers.add("If-Range", "\"stale\"");
+	auto full = server.handleRequest(stale);
+	BOOST_CHECK_EQUAL(full->statusCode, 200);
+	BOOST_CHECK_EQUAL(full->headers["Accept-Ranges"], "bytes");
+	BOOST_CHECK_EQUAL(bodyOf(*full), "0123456789");
+
+	Request current = multi;
+	current.headers.clear();
+	current.headers.add("Range", "bytes=2-4");
+	current.headers.add("If-Range", full->headers["ETag"]);
+	auto ranged = server.handleRequest(current);
+	BOOST_CHECK_EQUAL(ranged->statusCode, 206);
+	BOOST_CHECK_EQUAL(bodyOf(*ranged), "234");
+
+	// Over the wire, the range is sent straight from the file
+	BOOST_REQUIRE(server.init());
+	server.start();
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	sendAll(client, "GET /large.txt HTTP/1.1\r\nRange: bytes=-5000\r\nConnection: close\r\n\r\n");
+	std::string response = readUntilClosed(client);
+	close(client);
+	server.stop();
+
+	size_t headerEnd = response.find("\r\n\r\n");
+	BOOST_REQUIRE(headerEnd != std::string::npos);
+	BOOST_CHECK(response.starts_with("HTTP/1.1 206 Partial Content\r\n"));
+	BOOST_CHECK(response.find("Content-Length: 5000\r\n") != std::string::npos);
+	BOOST_CHECK(response.compare(headerEnd + 4, std::string::npos, contents.substr(contents.size() - 5000)) == 0);
+
+	std::filesystem::remove_all(servingDirectory);
+}
+
+// --- Compression tests ---
+
+BOOST_AUTO_TEST_CASE(test_accept_encoding_negotiation) {
+	auto acceptsWith = [](std::string_view acceptEncoding, std::string_view coding) {
+		Request req;
+		req.headers.add("Accept-Encoding", acceptEncoding);
+		return acceptsEncoding(req, coding);
+	};
+	BOOST_CHECK(acceptsEncoding(Request{}, "gzip") == false);
+	BOOST_CHECK(acceptsWith("gzip, deflate, br", "br"));
+	BOOST_CHECK(acceptsWith("GZIP;q=0.5", "gzip"));
+	BOOST_CHECK(!acceptsWith("gzip;q=0, br", "gzip"));
+	BOOST_CHECK(acceptsWith("*", "gzip"));
+	BOOST_CHECK(!acceptsWith("*;q=0", "br"));
+	BOOST_CHECK(!acceptsWith("identity", "gzip"));
+
+	BOOST_CHECK(isCompressible("text/html; charset=utf-8"));
+	BOOST_CHECK(isCompressible("application/json"));
+	BOOST_CHECK(isCompressible("image/svg+xml"));
+	BOOST_CHECK(!isCompressible("image/png"));
+}
+
+BOOST_AUTO_TEST_CASE(test_static_file_compression) {
+	auto servingDirectory = std::filesystem::temp_directory_path() / "ou_http_compression_test";
+	std::filesystem::create_directories(servingDirectory);
+	std::string json = "[";
+	for (int i = 0; i < 500; ++i)
+		json += "{\"id\": " + std::to_string(i) + ", \"name\": \"item\"},";
+	json.back() = ']';
+	std::ofstream(servingDirectory / "data.json") << json;
+	std::ofstream(servingDirectory / "app.js") << std::string(1000, 'x');
+	std::ofstream(servingDirectory / "app.js.br") << "precompressed";
+
+	TestServer::Config config;
+	config.servingDirectory = servingDirectory;
+	config.enableDirectoryIndexing = true;
+	TestServer server(config);
+
+	auto bodyOf = [](const Response &response) {
+		return response.serialize().substr(response.serializeHead().size());
+	};
+	auto gunzip = [](const std::string &data) {
+		std::string output(1024 * 1024, '\0');
+		z_stream stream{};
+		inflateInit2(&stream, 15 + 16);
+		stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+		stream.avail_in = static_cast<uInt>(data.size());
+		stream.next_out = reinterpret_cast<Bytef *>(output.data());
+		stream.avail_out = static_cast<uInt>(output.size());
+		inflate(&stream, Z_FINISH);
+		output.resize(stream.total_out);
+		inflateEnd(&stream);
+		return output;
+	};
+
+	Request req;
+	req.method = Method::GET;
+	req.path = "/data.json";
+	req.headers.add("Accept-Encoding", "gzip, deflate");
+
+	auto compressed = server.handleRequest(req);
+	BOOST_REQUIRE(compressed.has_value());
+	BOOST_CHECK_EQUAL(compressed->headers["Content-Encoding"], "gzip");
+	BOOST_CHECK_EQUAL(compressed->headers["Content-Type"], "application/json");
+	BOOST_CHECK_EQUAL(compressed->headers["Vary"], "Accept-Encoding");
+	BOOST_CHECK(compressed->contentLength() < json.size() / 4);
+	BOOST_CHECK_EQUAL(gunzip(bodyOf(*compressed)), json);
+
+	// The compressed body is reused, and its entity tag differs from the identity representation's
+	auto again = server.handleRequest(req);
+	BOOST_CHECK_EQUAL(server.compressionCacheStats().hits, 1);
+	Request identity = req;
+	identity.headers.clear();
+	auto plain = server.handleRequest(identity);
+	BOOST_CHECK_EQUAL(bodyOf(*plain), json);
+	BOOST_CHECK(!plain->headers.contains("Content-Encoding"));
+	BOOST_CHECK(plain->headers["ETag"] != again->headers["ETag"]);
+
+	Request conditional = req;
+	conditional.headers.add("If-None-Match", again->headers["ETag"]);
+	BOOST_CHECK_EQUAL(server.handleRequest(conditional)->statusCode, 304);
+
+	// Precompressed siblings win over on-the-fly compression
+	Request script = req;
+	script.path = "/app.js";
+	script.headers.clear();
+	script.headers.add("Accept-Encoding", "gzip, br");
+	auto precompressed = server.handleRequest(script);
+	BOOST_CHECK_EQUAL(precompressed->headers["Content-Encoding"], "br");
+	BOOST_CHECK_EQUAL(precompressed->headers["Content-Type"], "text/javascript; charset=utf-8");
+	BOOST_CHECK_EQUAL(bodyOf(*precompressed), "precompressed");
+
+	script.headers.clear();
+	script.headers.add("Accept-Encoding", "gzip");
+	auto gzipped = server.handleRequest(script);
+	BOOST_CHECK_EQUAL(gzipped->headers["Content-Encoding"], "gzip");
+	BOOST_CHECK_EQUAL(gunzip(bodyOf(*gzipped)), std::string(1000, 'x'));
+
+	// Directory indexes are compressed as well
+	for (int i = 0; i < 20; ++i)
+		std::ofstream(servingDirectory / ("file_" + std::to_string(i) + ".txt")) << i;
+	Request index = req;
+	index.path = "/";
+	auto listing = server.handleRequest(index);
+	BOOST_CHECK_EQUAL(listing->headers["Content-Encoding"], "gzip");
+	BOOST_CHECK(gunzip(bodyOf(*listing)).find("data.json") != std::string::npos);
+
+	std::filesystem::remove_all(servingDirectory);
+}
+
+// --- Routing tests ---
+
+BOOST_AUTO_TEST_CASE(test_router_matching) {
+	Router router;
+	auto respond = [](std::string text) {
+		return [text](const Request &) {
+			return Response{ 200, "OK", {}, text };
+		};
+	};
+	router.add(Method::GET, "/users", respond("list"));
+	router.add(Method::GET, "/users/new", respond("new"));
+	router.add(Method::GET, "/users/:id", respond("show"));
+	router.add(Method::DELETE, "/users/:id", respond("delete"));
+	router.add(Method::GET, "/users/:id/posts/:post", respond("post"));
+	router.add(Method::GET, "/usersettings", respond("settings"));
+	router.add(Method::GET, "/files/*path", respond("file"));
+
+	auto route = [&router](Method method, std::string_view path, RouteParams &params) -> std::string {
+		const auto *handler = router.find(method, path, params);
+		return handler ? (*handler)(Request{}).body : "";
+	};
+
+	RouteParams params;
+	BOOST_CHECK_EQUAL(route(Method::GET, "/users", params), "list");
+	BOOST_CHECK_EQUAL(route(Method::GET, "/usersettings", params), "settings");
+	// Literal segments win over parameters
+	BOOST_CHECK_EQUAL(route(Method::GET, "/users/new", params), "new");
+	BOOST_CHECK(params.empty());
+
+	BOOST_CHECK_EQUAL(route(Method::GET, "/users/42", params), "show");
+	BOOST_CHECK_EQUAL(params["id"], "42");
+	BOOST_CHECK_EQUAL(route(Method::DELETE, "/users/42", params), "delete");
+	BOOST_CHECK_EQUAL(route(Method::GET, "/users/newer", params), "show");
+	BOOST_CHECK_EQUAL(params["id"], "newer");
+
+	BOOST_CHECK_EQUAL(route(Method::GET, "/users/7/posts/99", params), "post");
+	BOOST_CHECK_EQUAL(params.size(), 2);
+	BOOST_CHECK_EQUAL(params["id"], "7");
+	BOOST_CHECK_EQUAL(params["post"], "99");
+
+	BOOST_CHECK_EQUAL(route(Method::GET, "/files/css/site.css", params), "file");
+	BOOST_CHECK_EQUAL(params["path"], "css/site.css");
+	BOOST_CHECK_EQUAL(route(Method::GET, "/files/", params), "file");
+	BOOST_CHECK_EQUAL(params["path"], "");
+
+	std::string_view pattern;
+	BOOST_REQUIRE(router.find(Method::GET, "/users/7/posts/99", params, &pattern) != nullptr);
+	BOOST_CHECK_EQUAL(pattern, "/users/:id/posts/:post");
+	BOOST_REQUIRE(router.find(Method::GET, "/files/a/b", params, &pattern) != nullptr);
+	BOOST_CHECK_EQUAL(pattern, "/files/*path");
+
+	// No match: unknown paths, empty parameters, unregistered methods
+	BOOST_CHECK_EQUAL(route(Method::GET, "/users/", params), "");
+	BOOST_CHECK_EQUAL(route(Method::GET, "/users/7/posts", params), "");
+	BOOST_CHECK_EQUAL(route(Method::PUT, "/users/7", params), "");
+	BOOST_CHECK(params.empty());
+
+	BOOST_CHECK_THROW(router.add(Method::GET, "/users/:name/edit", respond("")), std::invalid_argument);
+	BOOST_CHECK_THROW(router.add(Method::GET, "/files/*path/more", respond("")), std::invalid_argument);
+	BOOST_CHECK_THROW(router.add(Method::GET, "relative", respond("")), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_routes_with_query_strings_and_params) {
+	Request parsed = Request::parse("GET /kv?key=a&mode=fast HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	BOOST_CHECK_EQUAL(parsed.path, "/kv");
+	BOOST_CHECK_EQUAL(parsed.query, "key=a&mode=fast");
+	BOOST_CHECK_EQUAL(findQueryParameter(parsed.query, "mode").value_or(""), "fast");
+	BOOST_CHECK(!findQueryParameter(parsed.query, "missing").has_value());
+
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/kv", [](const Request &req) {
+		return Response{ 200, "OK", {}, std::string(findQueryParameter(req.query, "key").value_or("")) };
+	});
+	server.registerPathHandler(Method::GET, "/items/:id", [](const Request &req) {
+		return Response{ 200, "OK", {}, "item " + std::string(req.params["id"]) };
+	});
+
+	// The query string no longer gets in the way of exact routes
+	auto kv = server.handleRequest(parsed);
+	BOOST_REQUIRE(kv.has_value());
+	BOOST_CHECK_EQUAL(kv->body, "a");
+
+	auto item = server.handleRequest(Request::parse("GET /items/12?verbose=1 HTTP/1.1\r\n\r\n"));
+	BOOST_REQUIRE(item.has_value());
+	BOOST_CHECK_EQUAL(item->body, "item 12");
+}
+
+// --- Access log tests ---
+
+BOOST_AUTO_TEST_CASE(test_byte_ring_buffer_wraps) {
+	ByteRingBuffer ring(16);
+	BOOST_CHECK(ring.tryPush("abcdefghij"));
+	BOOST_CHECK(!ring.tryPush("0123456789")); // Records are all or nothing
+	ring.consume(8);
+	BOOST_CHECK(ring.tryPush("0123456789"));
+
+	auto regions = ring.readable();
+	BOOST_CHECK_EQUAL(std::string(regions[0]) + std::string(regions[1]), "ij0123456789");
+	BOOST_CHECK(!regions[1].empty());
+	ring.consume(12);
+	BOOST_CHECK(ring.readable()[0].empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_access_log_batches_and_rotates) {
+	auto logDirectory = std::filesystem::temp_directory_path() / "ou_http_access_log_test";
+	std::filesystem::remove_all(logDirectory);
+	std::filesystem::create_directories(logDirectory);
+	auto readFile = [](const std::filesystem::path &path) {
+		std::ifstream file(path);
+		return std::string(std::istreambuf_iterator<char>(file), {});
+	};
+
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	TestServer server(config);
+	auto accessLog = std::make_shared<AccessLog>(AccessLog::Config{ .path = logDirectory / "access.log", .maxSizeBytes = 4096, .maxFiles = 2 });
+	server.addMiddleware(accessLog);
+	server.registerPathHandler(Method::POST, "/items", [](const Request &) {
+		return Response{ 201, "Created", {}, "created" };
+	});
+
+	// Entries are written after the handler, so they carry its status and body size
+	sockaddr_in clientAddr{};
+	clientAddr.sin_family = AF_INET;
+	clientAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	Request req;
+	req.method = Method::POST;
+	req.path = "/items";
+	req.query = "x=1";
+	req.clientAddr = clientAddr;
+	server.handleRequest(req);
+	accessLog->flush();
+	BOOST_CHECK(readFile(logDirectory / "access.log").find("127.0.0.1 - \"POST /items?x=1\" 201 7\n") != std::string::npos);
+
+	// Concurrent writers fill the file past its limit, which moves it aside instead of rewriting it
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&server, &req] {
+			for (int i = 0; i < 50; ++i)
+				server.handleRequest(req);
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	accessLog->flush();
+
+	auto stats = accessLog->stats();
+	BOOST_CHECK_EQUAL(stats.logged + stats.dropped, 201);
+	BOOST_CHECK(stats.rotations >= 1);
+	BOOST_CHECK(std::filesystem::exists(logDirectory / "access.log.1"));
+	BOOST_CHECK(!std::filesystem::exists(logDirectory / "access.log.3"));
+
+	// A full ring drops entries instead of blocking the caller
+	AccessLog tinyLog(
+			AccessLog::Config{ .path = logDirectory / "tiny.log", .maxSizeBytes = 0, .threadBufferBytes = 64, .flushInterval = std::chrono::hours(1) });
+	Response response{ 200, "OK", {}, "" };
+	for (int i = 0; i < 10; ++i)
+		tinyLog.log(req, response, clientAddr);
+	BOOST_CHECK_EQUAL(tinyLog.stats().logged, 1);
+	BOOST_CHECK_EQUAL(tinyLog.stats().dropped, 9);
+	tinyLog.flush();
+	BOOST_CHECK_EQUAL(tinyLog.stats().bytesWritten, readFile(logDirectory / "tiny.log").size());
+
+	std::filesystem::remove_all(logDirectory);
+}
+
+BOOST_AUTO_TEST_CASE(test_logger_filters_levels_and_writes_json) {
+	int pipeFds[2];
+	BOOST_REQUIRE(pipe(pipeFds) == 0);
+	Logger::Config previous = Logger::config();
+	Logger::configure({ .level = LogLevel::Warn, .json = true, .fd = pipeFds[1] });
+
+	// Disabled levels do not even evaluate their arguments
+	int evaluations = 0;
+	auto expensive = [&evaluations] {
+		++evaluations;
+		return std::string("value");
+	};
+	LOG_DEBUG("debug {}", expensive());
+	LOG_INFO("info {}", expensive());
+	LOG_WARN("warn {} \"quoted\"\n", expensive());
+	BOOST_CHECK_EQUAL(evaluations, 1);
+
+	std::thread([] { LOG_ERROR("error from another thread"); }).join();
+	Logger::flush();
+	Logger::configure(previous);
+	close(pipeFds[1]);
+
+	std::string output;
+	std::array<char, 4096> buffer{};
+	for (ssize_t n; (n = read(pipeFds[0], buffer.data(), buffer.size())) > 0;)
+		output.append(buffer.data(), static_cast<size_t>(n));
+	close(pipeFds[0]);
+
+	BOOST_CHECK(output.find("info") == std::string::npos);
+	BOOST_CHECK(output.find("\"level\":\"WARN\"") != std::string::npos);
+	BOOST_CHECK(output.find("\"message\":\"warn value \\\"quoted\\\"\\n\"}\n") != std::string::npos);
+	BOOST_CHECK(output.find("\"message\":\"error from another thread\"") != std::string::npos);
+	BOOST_CHECK_EQUAL(std::count(output.begin(), output.end(), '\n'), 2);
+
+	BOOST_CHECK(parseLogLevel("debug") == LogLevel::Debug);
+	BOOST_CHECK(parseLogLevel("Error") == LogLevel::Error);
+	BOOST_CHECK(!parseLogLevel("verbose").has_value());
+}
+
+BOOST_AUTO_TEST_CASE(test_kvstore_shards_and_shares_values) {
+	KVStore store({ .shardCount = 8 });
+	store.set("alpha", "1");
+	BOOST_REQUIRE(store.get("alpha"));
+	BOOST_CHECK_EQUAL(*store.get("alpha"), "1");
+	BOOST_CHECK(!store.get("missing"));
+
+	// A reader keeps the value it was handed even after it is replaced or removed
+	KVStore::Value held = store.get("alpha");
+	store.set("alpha", "2");
+	BOOST_CHECK_EQUAL(*held, "1");
+	BOOST_CHECK_EQUAL(*store.get("alpha"), "2");
+	BOOST_CHECK(store.remove("alpha"));
+	BOOST_CHECK(!store.remove("alpha"));
+	BOOST_CHECK_EQUAL(*held, "1");
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&store, t] {
+			for (int i = 0; i < 1000; ++i) {
+				std::string key = "key" + std::to_string(t * 1000 + i);
+				store.set(key, key);
+				if (i % 2 == 0)
+					store.remove(key);
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	BOOST_CHECK_EQUAL(store.size(), 2000);
+	BOOST_CHECK_EQUAL(*store.get("key3999"), "key3999");
+
+	// GET responses share the stored value rather than copying it
+	Request request;
+	request.method = Method::GET;
+	request.query = "key=key1";
+	Response response = store.handle(request);
+	BOOST_CHECK_EQUAL(response.statusCode, 200);
+	BOOST_REQUIRE_EQUAL(response.bodyParts.size(), 1);
+	BOOST_CHECK(std::get<std::shared_ptr<const std::string>>(response.bodyParts[0]) == store.get("key1"));
+	BOOST_CHECK_EQUAL(response.contentLength(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_kvstore_persists_and_recovers) {
+	auto directory = std::filesystem::temp_directory_path() / "ou_http_kvstore_test";
+	std::filesystem::remove_all(directory);
+	KVStore::Config config{ .shardCount = 4, .persistence = KVLog::Config{ .directory = directory, .compactionLogBytes = 0 } };
+
+	{
+		KVStore store(config);
+		store.set("kept", "1");
+		store.set("replaced", "old");
+		store.set("replaced", "new");
+		store.set("removed", "x");
+		BOOST_CHECK(store.remove("removed"));
+		BOOST_CHECK_EQUAL(store.persistenceStats()->records, 5);
+	}
+	{
+		KVStore store(config);
+		BOOST_CHECK_EQUAL(store.size(), 2);
+		BOOST_CHECK_EQUAL(*store.get("kept"), "1");
+		BOOST_CHECK_EQUAL(*store.get("replaced"), "new");
+		BOOST_CHECK(!store.get("removed"));
+		BOOST_CHECK_EQUAL(store.persistenceStats()->recoveredRecords, 5);
+
+		// Compaction replaces the log with a snapshot; later writes go to a new log
+		store.compact();
+		store.set("after", "snapshot");
+		BOOST_CHECK(std::filesystem::exists(directory / "snapshot-1.dat"));
+		BOOST_CHECK(std::filesystem::exists(directory / "log-1.wal"));
+		BOOST_CHECK(!std::filesystem::exists(directory / "log-0.wal"));
+	}
+
+	// A torn record at the end of the log, as left by a crash mid-write, is discarded
+	{
+		std::ofstream log(directory / "log-1.wal", std::ios::app | std::ios::binary);
+		log.write("\x01\x02\x03\x04\x05\x00\x00\x00", 8);
+	}
+	{
+		KVStore store(config);
+		BOOST_CHECK_EQUAL(store.size(), 3);
+		BOOST_CHECK_EQUAL(*store.get("replaced"), "new");
+		BOOST_CHECK_EQUAL(*store.get("after"), "snapshot");
+		BOOST_CHECK_EQUAL(store.persistenceStats()->recoveredRecords, 3);
+		store.set("appended", "after truncation");
+	}
+	{
+		KVStore store(config);
+		BOOST_CHECK_EQUAL(*store.get("appended"), "after truncation");
+	}
+
+	std::filesystem::remove_all(directory);
+}
+
+BOOST_AUTO_TEST_CASE(test_kvstore_log_failure_refuses_writes) {
+	auto directory = std::filesystem::temp_directory_path() / "ou_http_kvlog_failure_test";
+	std::filesystem::remove_all(directory);
+	KVStore::Config config{ .shardCount = 4, .persistence = KVLog::Config{ .directory = directory, .compactionLogBytes = 0 } };
+
+	{
+		KVStore store(config);
+		store.set("kept", "1");
+
+		// A file size limit lets only part of the next record reach the log
+		rlimit original{};
+		BOOST_REQUIRE_EQUAL(getrlimit(RLIMIT_FSIZE, &original), 0);
+		auto previousHandler = std::signal(SIGXFSZ, SIG_IGN);
+		rlimit limited = original;
+		limited.rlim_cur = std::filesystem::file_size(directory / "log-0.wal") + 100;
+		BOOST_REQUIRE_EQUAL(setrlimit(RLIMIT_FSIZE, &limited), 0);
+		BOOST_CHECK_THROW(store.set("torn", std::string(1000, 'x')), std::system_error);
+		setrlimit(RLIMIT_FSIZE, &original);
+		std::signal(SIGXFSZ, previousHandler);
+
+		// Nothing is appended after the torn record, where replay would never reach it
+		BOOST_CHECK_THROW(store.set("after", "1"), std::system_error);
+		BOOST_CHECK_THROW(store.remove("kept"), std::system_error);
+	}
+	{
+		KVStore store(config);
+		BOOST_CHECK_EQUAL(store.size(), 1);
+		BOOST_CHECK_EQUAL(*store.get("kept"), "1");
+		store.set("after", "recovery");
+	}
+	{
+		KVStore store(config);
+		BOOST_CHECK_EQUAL(*store.get("after"), "recovery");
+	}
+
+	std::filesystem::remove_all(directory);
+}
+
+BOOST_AUTO_TEST_CASE(test_kvstore_expires_and_evicts) {
+	using namespace std::chrono_literals;
+	KVStore store({ .shardCount = 1, .maxBytes = 64 * 1024, .expiryInterval = 10ms });
+
+	// Expired keys disappear immediately and are reclaimed in the background
+	store.set("short", "lived", 30ms);
+	store.set("long", "lived", 1h);
+	BOOST_CHECK(store.get("short"));
+	std::this_thread::sleep_for(60ms);
+	BOOST_CHECK(!store.get("short"));
+	BOOST_CHECK(store.get("long"));
+	for (int i = 0; i < 100 && store.stats().expirations == 0; ++i)
+		std::this_thread::sleep_for(10ms);
+	BOOST_CHECK_EQUAL(store.stats().expirations, 1);
+	BOOST_CHECK_EQUAL(store.size(), 1);
+
+	// Writing past the budget evicts; recently read keys tend to survive
+	std::string value(1024, 'x');
+	store.set("hot", value);
+	for (int i = 0; i < 200; ++i) {
+		store.set("cold" + std::to_string(i), value);
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		BOOST_CHECK(store.get("hot"));
+	}
+	auto stats = store.stats();
+	BOOST_CHECK(stats.evictions > 100);
+	BOOST_CHECK(stats.usedBytes <= 64 * 1024);
+	BOOST_CHECK_EQUAL(stats.keys, store.size());
+	BOOST_CHECK(store.get("hot"));
+
+	// Each of several shards gets an even share of the budget; an entry must fit in one, and is never its own victim
+	KVStore sharded({ .shardCount = 4, .maxBytes = 64 * 1024 });
+	BOOST_CHECK_THROW(sharded.set("huge", std::string(20 * 1024, 'x')), std::length_error);
+	Request huge = Request::parse("PUT /kv?key=huge HTTP/1.1\r\nHost: localhost\r\n\r\n" + std::string(20 * 1024, 'x'));
+	BOOST_CHECK_EQUAL(sharded.handle(huge).statusCode, 413);
+	BOOST_CHECK(!sharded.get("huge"));
+	for (int i = 0; i < 100; ++i) {
+		std::string key = "large" + std::to_string(i);
+		sharded.set(key, std::string(6 * 1024, 'x'));
+		BOOST_CHECK(sharded.get(key));
+	}
+	BOOST_CHECK(sharded.stats().usedBytes <= 64 * 1024);
+
+	// The TTL of a PUT comes from the ttl parameter or the X-TTL header
+	Request put = Request::parse("PUT /kv?key=a&ttl=60 HTTP/1.1\r\nHost: localhost\r\n\r\nbody");
+	BOOST_CHECK_EQUAL(store.handle(put).statusCode, 200);
+	put = Request::parse("PUT /kv?key=b HTTP/1.1\r\nX-TTL: soon\r\n\r\nbody");
+	BOOST_CHECK_EQUAL(store.handle(put).statusCode, 400);
+}
+
+BOOST_AUTO_TEST_CASE(test_kvstore_persists_expiry) {
+	using namespace std::chrono_literals;
+	auto directory = std::filesystem::temp_directory_path() / "ou_http_kvstore_ttl_test";
+	std::filesystem::remove_all(directory);
+	KVStore::Config config{ .persistence = KVLog::Config{ .directory = directory, .compactionLogBytes = 0 } };
+	{
+		KVStore store(config);
+		store.set("expiring", "1", 50ms);
+		store.set("lasting", "2", 1h);
+		store.compact();
+		store.set("logged", "3", 50ms);
+	}
+	std::this_thread::sleep_for(100ms);
+	KVStore store(config);
+	BOOST_CHECK(!store.get("expiring"));
+	BOOST_CHECK(!store.get("logged"));
+	BOOST_CHECK_EQUAL(*store.get("lasting"), "2");
+	std::filesystem::remove_all(directory);
+}
+
+BOOST_AUTO_TEST_CASE(test_kvstore_batches_and_scans) {
+	KVStore store({ .shardCount = 4, .orderedIndex = true });
+	auto bodyText = [](const Response &response) {
+		std::string text = response.body;
+		for (const BodyPart &part : response.bodyParts) {
+			if (auto *literal = std::get_if<std::string>(&part))
+				text += *literal;
+			else
+				text += *std::get<std::shared_ptr<const std::string>>(part);
+		}
+		return text;
+	};
+
+	Request batch;
+	batch.method = Method::POST;
+	batch.path = "/kv/batch";
+	batch.body = "S 5 3\nuser1abcS 5 3 60\nuser2defG 5\nuser1G 5\nuser9D 5\nuser2D 5\nuser2";
+	Response response = store.handle(batch);
+	BOOST_CHECK_EQUAL(response.statusCode, 200);
+	BOOST_CHECK_EQUAL(bodyText(response), "OK\nOK\nV 3\nabcN\nOK\nN\n");
+	BOOST_CHECK_EQUAL(response.contentLength(), bodyText(response).size());
+	BOOST_CHECK(!store.get("user2"));
+
+	batch.body = "G 10\nuser1";
+	BOOST_CHECK_EQUAL(store.handle(batch).statusCode, 400);
+	batch.body = "X 5\nuser1";
+	BOOST_CHECK_EQUAL(store.handle(batch).statusCode, 400);
+	// A bad operation anywhere in the batch rejects all of it, including the writes before it
+	batch.body = "S 5 3\nuser3abcD 5\nuser1G 10\nuser1";
+	BOOST_CHECK_EQUAL(store.handle(batch).statusCode, 400);
+	BOOST_CHECK(!store.get("user3"));
+	BOOST_CHECK(store.get("user1"));
+	// Lengths whose sum wraps around must not pass as fitting
+	batch.body = "S 18446744073709551516 100\nabc";
+	BOOST_CHECK_EQUAL(store.handle(batch).statusCode, 400);
+	batch.body = "S 1 18446744073709551615\nabc";
+	BOOST_CHECK_EQUAL(store.handle(batch).statusCode, 400);
+
+	for (int i = 0; i < 50; ++i)
+		store.set(std::format("item{:03}", i), std::to_string(i));
+	store.set("other", "x");
+
+	// Pages follow each other without gaps or repeats, in key order across shards
+	std::vector<std::string> keys;
+	std::optional<std::string> from = "";
+	while (from) {
+		KVStore::ScanResult page = store.scanPrefix("item", *from, 7);
+		BOOST_CHECK_LE(page.entries.size(), 7);
+		for (const auto &[key, value] : page.entries)
+			keys.push_back(key);
+		from = page.nextKey;
+	}
+	BOOST_REQUIRE_EQUAL(keys.size(), 50);
+	BOOST_CHECK(std::is_sorted(keys.begin(), keys.end()));
+	BOOST_CHECK_EQUAL(keys.front(), "item000");
+
+	KVStore::ScanResult range = store.scan("item010", "item013", 10);
+	BOOST_REQUIRE_EQUAL(range.entries.size(), 3);
+	BOOST_CHECK_EQUAL(*range.entries[2].second, "12");
+	BOOST_CHECK(!range.nextKey);
+
+	Request scan;
+	scan.method = Method::GET;
+	scan.path = "/kv/scan";
+	scan.query = "prefix=item04&from=item048&limit=1";
+	response = store.handle(scan);
+	BOOST_CHECK_EQUAL(response.statusCode, 200);
+	BOOST_CHECK_EQUAL(bodyText(response), "K 7 2\nitem04848M 7\nitem049");
+	scan.query = "from=o&to=p";
+	BOOST_CHECK_EQUAL(bodyText(store.handle(scan)), "K 5 1\notherx");
+
+	// Keys in the query are percent-decoded
+	store.set("a b/c", "1");
+	Request get;
+	get.method = Method::GET;
+	get.query = "key=a%20b%2Fc";
+	BOOST_CHECK_EQUAL(store.handle(get).statusCode, 200);
+	BOOST_CHECK_EQUAL(percentDecode("100%25%2x"), "100%%2x");
+
+	KVStore unordered;
+	BOOST_CHECK_EQUAL(unordered.handle(scan).statusCode, 501);
+}
+
+BOOST_AUTO_TEST_CASE(test_kvstore_replicates_to_followers) {
+	using namespace std::chrono_literals;
+	std::string address = "unix:" + (std::filesystem::temp_directory_path() / "ou_http_replication_test.sock").string();
+	auto waitFor = [](auto condition) {
+		for (int i = 0; i < 500 && !condition(); ++i)
+			std::this_thread::sleep_for(10ms);
+		return condition();
+	};
+
+	auto leader = std::make_unique<KVStore>(KVStore::Config{ .shardCount = 4, .leader = ReplicationLeader::Config{ .address = address } });
+	leader->set("before", "1");
+	leader->set("removed", "1");
+	KVStore follower({ .shardCount = 4, .follower = ReplicationFollower::Config{ .leader = address, .reconnectInterval = 20ms } });
+
+	// The snapshot brings the follower up to date, and later changes are streamed
+	BOOST_REQUIRE(waitFor([&]() { return follower.get("before") != nullptr; }));
+	leader->set("after", "2", 1h);
+	leader->remove("removed");
+	BOOST_REQUIRE(waitFor([&]() { return follower.get("after") != nullptr && !follower.get("removed"); }));
+	BOOST_CHECK_EQUAL(*follower.get("after"), "2");
+	BOOST_REQUIRE(waitFor([&]() {
+		auto stats = leader->leaderStats();
+		return stats->followers.size() == 1 && stats->followers[0].lag == 0 && follower.followerStats()->lag == 0;
+	}));
+	BOOST_CHECK_EQUAL(follower.followerStats()->appliedSequence, leader->leaderStats()->sequence);
+
+	Request put;
+	put.method = Method::PUT;
+	put.query = "key=direct";
+	BOOST_CHECK_EQUAL(follower.handle(put).statusCode, 403);
+	Request replication;
+	replication.method = Method::GET;
+	replication.path = "/kv/replication";
+	BOOST_CHECK(follower.handle(replication).body.find("follower_connected 1\n") != std::string::npos);
+
+	// A follower that loses its leader reconnects and replaces its contents with the new leader's snapshot
+	leader = std::make_unique<KVStore>(KVStore::Config{ .shardCount = 4, .leader = ReplicationLeader::Config{ .address = address } });
+	leader->set("fresh", "3");
+	BOOST_REQUIRE(waitFor([&]() { return follower.get("fresh") != nullptr && !follower.get("before"); }));
+	BOOST_CHECK_EQUAL(follower.followerStats()->snapshots, 2);
+}
+
+// --- Metrics tests ---
+
+BOOST_AUTO_TEST_CASE(test_latency_buckets) {
+	// Every value lies within its bucket, and buckets are never wider than 1/16 of what they hold
+	for (uint64_t value : { 0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 31ULL, 32ULL, 33ULL, 1000ULL, 999999ULL, 1000000ULL, 123456789ULL, (1ULL << 36) - 1 }) {
+		size_t index = LatencyBuckets::index(value);
+		BOOST_REQUIRE_LT(index, LatencyBuckets::kCount);
+		uint64_t lower = index == 0 ? 0 : LatencyBuckets::upperBound(index - 1) + 1;
+		uint64_t upper = LatencyBuckets::upperBound(index);
+		BOOST_CHECK(lower <= value && value <= upper);
+		BOOST_CHECK_LE((upper - lower) * 16, std::max<uint64_t>(lower, 16));
+	}
+	BOOST_CHECK_EQUAL(LatencyBuckets::index(1ULL << 40), LatencyBuckets::kCount - 1);
+	for (size_t i = 1; i < LatencyBuckets::kCount; ++i)
+		BOOST_REQUIRE_EQUAL(LatencyBuckets::index(LatencyBuckets::upperBound(i - 1) + 1), i);
+}
+
+BOOST_AUTO_TEST_CASE(test_metrics_aggregate_threads) {
+	Metrics metrics;
+	// Two copies of the same route text make separate series, which are merged when read
+	std::string copy = "/items/:id";
+	std::thread other([&metrics, &copy]() {
+		for (int i = 0; i < 100; ++i)
+			metrics.recordRequest(copy, Method::GET, 200, std::chrono::microseconds(900));
+		metrics.connectionOpened();
+	});
+	for (int i = 0; i < 900; ++i)
+		metrics.recordRequest("/items/:id", Method::GET, 200, std::chrono::microseconds(100));
+	metrics.recordRequest("/items/:id", Method::GET, 404, std::chrono::microseconds(50));
+	metrics.connectionOpened();
+	metrics.connectionClosed();
+	other.join();
+
+	auto stats = metrics.requestStats();
+	BOOST_REQUIRE_EQUAL(stats.size(), 2);
+	BOOST_CHECK_EQUAL(stats[0].route, "/items/:id");
+	BOOST_CHECK_EQUAL(stats[0].statusCode, 200);
+	BOOST_CHECK_EQUAL(stats[0].count, 1000);
+	BOOST_CHECK(stats[0].total == std::chrono::microseconds(900 * 100 + 100 * 900));
+	auto median = stats[0].quantile(0.5);
+	BOOST_CHECK(median >= std::chrono::microseconds(100) && median <= std::chrono::microseconds(107));
+	auto p99 = stats[0].quantile(0.99);
+	BOOST_CHECK(p99 >= std::chrono::microseconds(900) && p99 <= std::chrono::microseconds(957));
+	BOOST_CHECK_EQUAL(stats[1].statusCode, 404);
+
+	auto connections = metrics.connectionStats();
+	BOOST_CHECK_EQUAL(connections.opened, 2);
+	BOOST_CHECK_EQUAL(connections.closed, 1);
+
+	metrics.addGauge("queue_depth", "Items waiting.", []() { return 7.0; });
+	std::string text = metrics.render();
+	BOOST_CHECK(text.find("# TYPE http_request_duration_seconds histogram\n") != std::string::npos);
+	BOOST_CHECK(text.find(R"(http_request_duration_seconds_bucket{route="/items/:id",method="GET",status="200",le="0.0001"} 0)") != std::string::npos);
+	BOOST_CHECK(text.find(R"(http_request_duration_seconds_bucket{route="/items/:id",method="GET",status="200",le="0.00025"} 900)")
+							!= std::string::npos);
+	BOOST_CHECK(text.find(R"(http_request_duration_seconds_bucket{route="/items/:id",method="GET",status="200",le="+Inf"} 1000)") != std::string::npos);
+	BOOST_CHECK(text.find(R"(http_request_duration_seconds_count{route="/items/:id",method="GET",status="404"} 1)") != std::string::npos);
+	BOOST_CHECK(text.find("\nhttp_open_connections 1\n") != std::string::npos);
+	BOOST_CHECK(text.find("# TYPE queue_depth gauge\nqueue_depth 7\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_metrics_endpoint) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18088;
+	config.threadCount = 2;
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/items/:id",
+														 [](const Request &) { return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "item" }; });
+	server.registerPatternHandler(Method::GET, "/legacy/[0-9]+",
+																[](const Request &) { return Response{ 410, "Gone", { { "Content-Type", "text/plain" } }, "gone" }; });
+	server.addMiddleware(std::make_shared<TestMiddleware>());
+	server.metrics().addGauge("test_items", "Items registered by the test.", []() { return 3.0; });
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	std::string pending;
+	for (std::string_view path : { "/items/1", "/items/2", "/legacy/7", "/middleware", "/missing.txt" }) {
+		sendAll(client, std::format("GET {} HTTP/1.1\r\nHost: localhost\r\n\r\n", path));
+		readResponse(client, pending);
+	}
+	// Malformed requests are counted apart, since they never reach a route
+	int malformed = connectToServer(config.port);
+	sendAll(malformed, "NONSENSE\r\n\r\n");
+	readUntilClosed(malformed);
+	close(malformed);
+
+	sendAll(client, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	std::string response = readResponse(client, pending);
+	close(client);
+	BOOST_CHECK(response.starts_with("HTTP/1.1 200 OK\r\n"));
+	BOOST_CHECK(response.find("Content-Type: text/plain; version=0.0.4") != std::string::npos);
+	for (std::string_view line : { R"(http_request_duration_seconds_count{route="/items/:id",method="GET",status="200"} 2)",
+																 R"(http_request_duration_seconds_count{route="/legacy/[0-9]+",method="GET",status="410"} 1)",
+																 R"(http_request_duration_seconds_count{route="middleware",method="GET",status="200"} 1)",
+																 R"(http_request_duration_seconds_count{route="static",method="GET",status="404"} 1)",
+																 "\nhttp_connections_total 2\n", "\nhttp_malformed_requests_total 1\n", "\ntest_items 3\n",
+																 "\nstatic_file_cache_misses_total " })
+		BOOST_CHECK_MESSAGE(response.find(line) != std::string::npos, line);
+
+	// The scrape itself is recorded once it has been answered
+	auto stats = server.metrics().requestStats();
+	BOOST_CHECK(std::any_of(stats.begin(), stats.end(), [](const auto &series) { return series.route == "/metrics" && series.count == 1; }));
+	server.stop();
+	BOOST_CHECK_EQUAL(server.metrics().connectionStats().closed, 2);
+}
+
+// --- HTTP/2 tests ---
+
+namespace {
+
+std::string sHex(std::string_view hex) {
+	std::string bytes;
+	for (size_t i = 0; i + 1 < hex.size(); i += 2)
+		bytes.push_back(static_cast<char>(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+	return bytes;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_hpack_round_trips) {
+	// RFC 7541 appendix C.4: requests with Huffman-coded literals, the second referring to the first's table entry
+	HpackDecoder decoder;
+	std::vector<HeaderField> fields;
+	BOOST_REQUIRE(decoder.decode(sHex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), fields));
+	std::vector<HeaderField> expected{ { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" } };
+	BOOST_CHECK(fields == expected);
+	fields.clear();
+	BOOST_REQUIRE(decoder.decode(sHex("828684be5886a8eb10649cbf"), fields));
+	expected.emplace_back("cache-control", "no-cache");
+	BOOST_CHECK(fields == expected);
+
+	std::string encoded;
+	huffmanEncode("www.example.com", encoded);
+	BOOST_CHECK(encoded == sHex("f1e3c2e5f23a6ba0ab90f4ff"));
+	std::string decoded;
+	BOOST_CHECK(huffmanDecode(encoded, decoded));
+	BOOST_CHECK_EQUAL(decoded, "www.example.com");
+	// Padding must be a prefix of end-of-string: all ones, shorter than a byte
+	decoded.clear();
+	BOOST_CHECK(!huffmanDecode(sHex("f1e3c2e5f23a6ba0ab90f4ff") + sHex("ff"), decoded));
+
+	// Repeated response headers shrink to a byte once indexed; varying ones stay literal
+	HpackEncoder encoder;
+	HpackDecoder responseDecoder;
+	std::vector<HeaderField> response{ { ":status", "200" }, { "content-type", "application/json" }, { "content-length", "1234" },
+																		 { "x-request-handler", "kvstore" } };
+	std::string first;
+	std::string second;
+	for (const auto &[name, value] : response)
+		encoder.encode(name, value, first);
+	for (const auto &[name, value] : response)
+		encoder.encode(name, value, second);
+	BOOST_CHECK_LT(second.size(), 12);
+	BOOST_CHECK_LT(second.size() * 3, first.size());
+	fields.clear();
+	BOOST_REQUIRE(responseDecoder.decode(first, fields));
+	BOOST_REQUIRE(responseDecoder.decode(second, fields));
+	BOOST_CHECK(std::equal(response.begin(), response.end(), fields.begin()));
+	BOOST_CHECK(std::equal(response.begin(), response.end(), fields.begin() + 4));
+
+	// A shrunken table is announced before the next field
+	encoder.setMaxTableSize(0);
+	std::string afterShrink;
+	encoder.encode("x-request-handler", "kvstore", afterShrink);
+	fields.clear();
+	BOOST_REQUIRE(responseDecoder.decode(afterShrink, fields));
+	BOOST_CHECK(fields.back() == response.back());
+
+	// References past the table are malformed
+	BOOST_CHECK(!HpackDecoder().decode(sHex("ff00"), fields));
+
+	// One-byte references to a large table entry stop decoding once the list passes its limit, not after expanding
+	HpackEncoder bombEncoder;
+	std::string bomb;
+	for (int i = 0; i < 1000; ++i)
+		bombEncoder.encode("x-padding", std::string(4000, 'p'), bomb);
+	BOOST_CHECK_LT(bomb.size(), 6000);
+	fields.clear();
+	BOOST_CHECK(!HpackDecoder().decode(bomb, fields, 16384));
+	BOOST_CHECK_LE(fields.size(), 4);
+	fields.clear();
+	BOOST_REQUIRE(HpackDecoder().decode(bomb, fields));
+	BOOST_CHECK_EQUAL(fields.size(), 1000);
+}
+
+namespace {
+
+struct Http2Frame {
+	uint8_t type = 0;
+	uint8_t flags = 0;
+	uint32_t streamId = 0;
+	std::string payload;
+};
+
+std::string sHttp2Frame(uint8_t type, uint8_t flags, uint32_t streamId, std::string_view payload) {
+	std::string frame{ static_cast<char>(payload.size() >> 16), static_cast<char>(payload.size() >> 8), static_cast<char>(payload.size()),
+										 static_cast<char>(type), static_cast<char>(flags), static_cast<char>(streamId >> 24), static_cast<char>(streamId >> 16),
+										 static_cast<char>(streamId >> 8), static_cast<char>(streamId) };
+	return frame.append(payload);
+}
+
+std::optional<Http2Frame> sReadHttp2Frame(int fd) {
+	auto readExactly = [fd](size_t size) -> std::optional<std::string> {
+		std::string data(size, '\0');
+		size_t received = 0;
+		while (received < size) {
+			ssize_t n = recv(fd, data.data() + received, size - received, 0);
+			if (n <= 0)
+				return std::nullopt;
+			received += static_cast<size_t>(n);
+		}
+		return data;
+	};
+	auto header = readExactly(9);
+	if (!header)
+		return std::nullopt;
+	auto byte = [&header](size_t i) { return static_cast<uint32_t>(static_cast<uint8_t>((*header)[i])); };
+	Http2Frame frame{ static_cast<uint8_t>(byte(3)), static_cast<uint8_t>(byte(4)),
+										(byte(5) << 24 | byte(6) << 16 | byte(7) << 8 | byte(8)) & 0x7fffffff, {} };
+	auto payload = readExactly(byte(0) << 16 | byte(1) << 8 | byte(2));
+	if (!payload)
+		return std::nullopt;
+	frame.payload = std::move(*payload);
+	return frame;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_http2_multiplexes_streams) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18087;
+	config.threadCount = 1;
+	TestServer server(config);
+	std::string large(200 * 1024, 'L');
+	server.registerPathHandler(Method::GET, "/large",
+														 [&large](const Request &) { return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, large }; });
+	server.registerPathHandler(Method::POST, "/echo", [](const Request &request) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" }, { "X-Host", std::string(request.headers["Host"]) } },
+										 std::string(request.body) };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	// Prior-knowledge cleartext HTTP/2; the client keeps the default 64 KiB windows and never raises them
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	HpackEncoder encoder;
+	auto request = [&encoder](uint32_t streamId, std::string_view method, std::string_view path, bool endStream) {
+		std::string block;
+		for (auto [name, value] : std::initializer_list<std::pair<std::string_view, std::string_view>>{
+						 { ":method", method }, { ":scheme", "http" }, { ":path", path }, { ":authority", "localhost" } })
+			encoder.encode(name, value, block);
+		return sHttp2Frame(0x1, 0x4 | (endStream ? 0x1 : 0), streamId, block);
+	};
+	std::string out(Http2Session::kPreface);
+	out += sHttp2Frame(0x4, 0, 0, "");
+	out += request(1, "GET", "/large", true);
+	out += request(3, "POST", "/echo", false);
+	out += sHttp2Frame(0x0, 0x1, 3, "ping");
+	sendAll(client, out);
+
+	HpackDecoder decoder;
+	std::map<uint32_t, std::vector<HeaderField>> headers;
+	std::map<uint32_t, std::string> bodies;
+	std::set<uint32_t> ended;
+	auto readUntil = [&](auto done) {
+		while (!done()) {
+			auto frame = sReadHttp2Frame(client);
+			BOOST_REQUIRE(frame.has_value());
+			BOOST_REQUIRE_NE(frame->type, 0x7); // GOAWAY
+			if (frame->type == 0x1)
+				BOOST_REQUIRE(decoder.decode(frame->payload, headers[frame->streamId]));
+			else if (frame->type == 0x0)
+				bodies[frame->streamId] += frame->payload;
+			if ((frame->type == 0x0 || frame->type == 0x1) && (frame->flags & 0x1) != 0)
+				ended.insert(frame->streamId);
+		}
+	};
+
+	// The small response is not stuck behind the large one, which stops when the window is used up
+	readUntil([&]() { return ended.contains(3) && bodies[1].size() + bodies[3].size() == 65535; });
+	BOOST_CHECK(!ended.contains(1));
+	BOOST_CHECK_EQUAL(bodies[3], "ping");
+	BOOST_CHECK(std::find(headers[3].begin(), headers[3].end(), HeaderField{ "x-host", "localhost" }) != headers[3].end());
+	BOOST_CHECK(headers[1].front() == (HeaderField{ ":status", "200" }));
+
+	// Raising the windows lets the rest through
+	std::string increment{ 0, 0x10, 0, 0 };
+	sendAll(client, sHttp2Frame(0x8, 0, 0, increment) + sHttp2Frame(0x8, 0, 1, increment));
+	readUntil([&]() { return ended.contains(1); });
+	BOOST_CHECK(bodies[1] == large);
+
+	// Protocol errors close the connection with GOAWAY
+	sendAll(client, sHttp2Frame(0x0, 0, 0, "data on stream zero"));
+	auto frame = sReadHttp2Frame(client);
+	BOOST_REQUIRE(frame.has_value());
+	BOOST_CHECK_EQUAL(frame->type, 0x7);
+	BOOST_CHECK(!sReadHttp2Frame(client).has_value());
+	close(client);
+
+	// HTTP/1.1 clients are unaffected
+	client = connectToServer(config.port);
+	sendAll(client, "POST /echo HTTP/1.1\r\nHost: h1\r\nContent-Length: 2\r\nConnection: close\r\n\r\nhi");
+	BOOST_CHECK(readUntilClosed(client).ends_with("\r\n\r\nhi"));
+	close(client);
+
+	server.stop();
+}
+
+// --- Asynchronous handler tests ---
+
+namespace {
+
+Task<int> sAdd(int a, int b) { co_return a + b; }
+
+Task<int> sSum(int count) {
+	int total = 0;
+	for (int i = 0; i < count; ++i)
+		total += co_await sAdd(i, 1);
+	co_return total;
+}
+
+Task<void> sFail() {
+	throw std::runtime_error("failed");
+	co_return;
+}
+
+Task<std::string> sCatch() {
+	try {
+		co_await sFail();
+	} catch (const std::runtime_error &e) {
+		co_return e.what();
+	}
+	co_return "not thrown";
+}
+
+Task<void> sSleep() { co_await sleepFor(std::chrono::milliseconds(1)); }
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_tasks_compose) {
+	// Tasks start when awaited or started, and hand back values and exceptions
+	Task<int> sum = sSum(10000);
+	BOOST_CHECK(!sum.done());
+	sum.start();
+	BOOST_REQUIRE(sum.done());
+	BOOST_CHECK_EQUAL(sum.result(), 50005000);
+
+	Task<std::string> caught = sCatch();
+	caught.start();
+	BOOST_CHECK_EQUAL(caught.result(), "failed");
+
+	// Only a worker's event loop can resume a suspended task
+	BOOST_CHECK(EventLoop::current() == nullptr);
+	Task<void> sleep = sSleep();
+	sleep.start();
+	BOOST_REQUIRE(sleep.done());
+	BOOST_CHECK_THROW(sleep.result(), std::logic_error);
+
+	// So outside a worker, an asynchronous handler answers only if it never has to wait
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/ready/:name", [](const Request &request) -> Task<Response> {
+		co_return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(request.params["name"]) };
+	});
+	server.registerPathHandler(Method::GET, "/waits", [](const Request &) -> Task<Response> {
+		co_await sleepFor(std::chrono::milliseconds(1));
+		co_return Response{};
+	});
+	auto ready = server.handleRequest(Request::parse("GET /ready/async HTTP/1.1\r\n\r\n"));
+	BOOST_REQUIRE(ready.has_value());
+	BOOST_CHECK_EQUAL(ready->body, "async");
+	BOOST_CHECK(!server.handleRequest(Request::parse("GET /waits HTTP/1.1\r\n\r\n")).has_value());
+}
+
+BOOST_AUTO_TEST_CASE(test_async_handlers_do_not_block_worker) {
+	auto directory = std::filesystem::temp_directory_path() / "ou_http_async_test";
+	std::filesystem::create_directories(directory);
+	std::ofstream(directory / "data.txt") << "from disk";
+
+	TestServer::Config config;
+	config.servingDirectory = directory;
+	config.port = 18090;
+	config.threadCount = 1;
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/fast", [](const Request &) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "fast" };
+	});
+	server.registerPathHandler(Method::GET, "/slow", [](const Request &request) -> Task<Response> {
+		co_await sleepFor(std::chrono::milliseconds(300));
+		co_return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(request.headers["X-Id"]) };
+	});
+	server.registerPathHandler(Method::GET, "/file", [&directory](const Request &) -> Task<Response> {
+		std::optional<std::string> contents = co_await readFile(directory / "data.txt");
+		if (!contents)
+			co_return Response{ 404, "Not Found", { { "Content-Type", "text/plain" } }, "404 Not Found" };
+		co_return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, *contents };
+	});
+	// Calls the server itself, which on one worker only works if waiting for the answer frees the worker to give it
+	server.registerPathHandler(Method::GET, "/proxy", [&config](const Request &) -> Task<Response> {
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(config.port);
+		std::unique_ptr<AsyncSocket> upstream = co_await AsyncSocket::connect(address);
+		if (!upstream)
+			co_return Response{ 502, "Bad Gateway", {}, "" };
+		if (co_await upstream->write("GET /fast HTTP/1.1\r\nConnection: close\r\n\r\n") < 0)
+			co_return Response{ 502, "Bad Gateway", {}, "" };
+		std::string answer;
+		std::array<char, 1024> buffer{};
+		ssize_t bytesRead = 0;
+		while ((bytesRead = co_await upstream->read(buffer.data(), buffer.size())) > 0)
+			answer.append(buffer.data(), static_cast<size_t>(bytesRead));
+		co_return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, answer };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	// A sleeping handler holds up neither other connections nor the only worker
+	auto start = std::chrono::steady_clock::now();
+	int slowClient = connectToServer(config.port);
+	BOOST_REQUIRE(slowClient >= 0);
+	sendAll(slowClient, "GET /slow HTTP/1.1\r\nX-Id: slow\r\nConnection: close\r\n\r\n");
+	int fastClient = connectToServer(config.port);
+	BOOST_REQUIRE(fastClient >= 0);
+	sendAll(fastClient, "GET /fast HTTP/1.1\r\nConnection: close\r\n\r\n");
+	BOOST_CHECK(readUntilClosed(fastClient).ends_with("fast"));
+	BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(250));
+	close(fastClient);
+	BOOST_CHECK(readUntilClosed(slowClient).ends_with("slow"));
+	BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(300));
+	close(slowClient);
+
+	// Pipelined requests are still answered in order around a handler that waits
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	std::string pending;
+	sendAll(client, "GET /slow HTTP/1.1\r\nX-Id: first\r\n\r\nGET /fast HTTP/1.1\r\n\r\nGET /file HTTP/1.1\r\n\r\n");
+	BOOST_CHECK(readResponse(client, pending).ends_with("first"));
+	BOOST_CHECK(readResponse(client, pending).ends_with("fast"));
+	BOOST_CHECK(readResponse(client, pending).ends_with("from disk"));
+
+	sendAll(client, "GET /proxy HTTP/1.1\r\n\r\n");
+	std::string proxied = readResponse(client, pending);
+	BOOST_CHECK(proxied.starts_with("HTTP/1.1 200 OK"));
+	BOOST_CHECK(proxied.find("\r\n\r\nHTTP/1.1 200 OK") != std::string::npos);
+	BOOST_CHECK(proxied.ends_with("fast"));
+
+	// A handler still waiting when the server stops is cancelled
+	sendAll(client, "GET /slow HTTP/1.1\r\n\r\n");
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	server.stop();
+	BOOST_CHECK(readUntilClosed(client).empty());
+	close(client);
+	std::filesystem::remove_all(directory);
+}
+
+BOOST_AUTO_TEST_CASE(test_http2_async_handlers) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18091;
+	config.threadCount = 1;
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/fast", [](const Request &) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "fast" };
+	});
+	server.registerPathHandler(Method::GET, "/slow", [](const Request &request) -> Task<Response> {
+		co_await sleepFor(std::chrono::milliseconds(200));
+		co_return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(request.headers["Cookie"]) };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	int client = connectToServer(config.port);
+	BOOST_REQUIRE(client >= 0);
+	HpackEncoder encoder;
+	auto request = [&encoder](uint32_t streamId, std::string_view path) {
+		std::string block;
+		for (auto [name, value] : std::initializer_list<std::pair<std::string_view, std::string_view>>{
+						 { ":method", "GET" }, { ":scheme", "http" }, { ":path", path }, { "cookie", "a=1" }, { "cookie", "b=2" } })
+			encoder.encode(name, value, block);
+		return sHttp2Frame(0x1, 0x5, streamId, block);
+	};
+	// Encoded in order, as HPACK state carries from one block to the next
+	std::string out(Http2Session::kPreface);
+	out += sHttp2Frame(0x4, 0, 0, "");
+	out += request(1, "/slow");
+	out += request(3, "/fast");
+	sendAll(client, out);
+
+	// The stream whose handler waits is answered after the one behind it, with the request it was given intact
+	std::vector<uint32_t> order;
+	std::map<uint32_t, std::string> bodies;
+	while (order.size() < 2) {
+		auto frame = sReadHttp2Frame(client);
+		BOOST_REQUIRE(frame.has_value());
+		BOOST_REQUIRE(frame->type != 0x3 && frame->type != 0x7); // RST_STREAM, GOAWAY
+		if (frame->type == 0x0) {
+			bodies[frame->streamId] += frame->payload;
+			if ((frame->flags & 0x1) != 0)
+				order.push_back(frame->streamId);
+		}
+	}
+	BOOST_CHECK(order == (std::vector<uint32_t>{ 3, 1 }));
+	BOOST_CHECK_EQUAL(bodies[3], "fast");
+	BOOST_CHECK_EQUAL(bodies[1], "a=1; b=2");
+	close(client);
+
+	server.stop();
+}
+
+#ifndef DISABLE_HTTPS
+
+namespace {
+
+// Handshakes over a socket pair, offering session if set. Returns the client's session, to offer next time, and
+// whether this handshake resumed.
+std::pair<SSL_SESSION *, bool> sTlsHandshake(SSLSocketHandler &handler, SSL_CTX *clientCtx, SSL_SESSION *session) {
+	std::array<int, 2> fds{};
+	BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data()), 0);
+	std::unique_ptr<Socket> server;
+	std::thread serverThread([&]() {
+		// The socket is blocking, so the handshake completes or fails in one call
+		server = handler.acceptConnection(fds[0]);
+		if (server && server->handshake() == Socket::Handshake::Complete)
+			server->write("x");
+	});
+	SSL *ssl = SSL_new(clientCtx);
+	SSL_set_fd(ssl, fds[1]);
+	if (session != nullptr)
+		SSL_set_session(ssl, session);
+	char byte = 0;
+	// TLS 1.3 tickets arrive after the handshake, ahead of the first application data
+	bool connected = SSL_connect(ssl) == 1 && SSL_read(ssl, &byte, 1) == 1;
+	serverThread.join();
+	bool resumed = connected && SSL_session_reused(ssl) != 0;
+	SSL_SESSION *next = connected ? SSL_get1_session(ssl) : nullptr;
+	// OpenSSL marks the session unusable if the connection is freed without a shutdown
+	SSL_shutdown(ssl);
+	server.reset();
+	SSL_free(ssl);
+	close(fds[1]);
+	return { next, resumed };
+}
+
+// Sends request over a new TLS connection and returns everything received until the server closes it
+std::string sTlsExchange(uint16_t port, const std::string &request) {
+	SSL_CTX *clientCtx = SSL_CTX_new(TLS_client_method());
+	SSL *ssl = SSL_new(clientCtx);
+	int fd = connectToServer(port);
+	std::string response;
+	if (fd >= 0 && SSL_set_fd(ssl, fd) == 1 && SSL_connect(ssl) == 1
+			&& SSL_write(ssl, request.data(), static_cast<int>(request.size())) == static_cast<int>(request.size())) {
+		std::array<char, 4096> buffer{};
+		int n = 0;
+		while ((n = SSL_read(ssl, buffer.data(), static_cast<int>(buffer.size()))) > 0)
+			response.append(buffer.data(), static_cast<size_t>(n));
+	}
+	SSL_free(ssl);
+	if (fd >= 0)
+		close(fd);
+	SSL_CTX_free(clientCtx);
+	return response;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(test_tls_sessions_resume) {
+	SSLSocketHandler::Config config{ .enabled = true, .certPath = OU_CERTS_DIR "/cert.pem", .keyPath = OU_CERTS_DIR "/key.pem" };
+	SSL_CTX *clientCtx = SSL_CTX_new(TLS_client_method());
+	SSL_CTX_set_session_cache_mode(clientCtx, SSL_SESS_CACHE_CLIENT);
+
+	// Resume returns whether a handshake offering a session from the first one resumed it
+	auto resumes = [clientCtx](SSLSocketHandler &issuer, SSLSocketHandler &resumer, auto betweenHandshakes) {
+		auto [session, resumed] = sTlsHandshake(issuer, clientCtx, nullptr);
+		BOOST_REQUIRE(session != nullptr);
+		BOOST_CHECK(!resumed);
+		betweenHandshakes();
+		auto [next, resumedNext] = sTlsHandshake(resumer, clientCtx, session);
+		SSL_SESSION_free(session);
+		SSL_SESSION_free(next);
+		return resumedNext;
+	};
+	auto nothing = []() {};
+
+	SSLSocketHandler handler(config);
+	BOOST_CHECK(resumes(handler, handler, nothing));
+	// Tickets issued under a rotated-out key are still accepted
+	BOOST_CHECK(resumes(handler, handler, [&handler]() { handler.rotateTicketKeys(); }));
+	auto stats = handler.stats();
+	BOOST_CHECK_EQUAL(stats.handshakes, 4);
+	BOOST_CHECK_EQUAL(stats.resumed, 2);
+	BOOST_CHECK_EQUAL(stats.ticketKeyRotations, 1);
+
+	// Another server's tickets cannot be decrypted
+	SSLSocketHandler stranger(config);
+	BOOST_CHECK(!resumes(stranger, handler, nothing));
+
+	// Without tickets, sessions resume from the server's cache
+	SSLSocketHandler cacheOnly({ .enabled = true, .certPath = config.certPath, .keyPath = config.keyPath, .sessionTickets = false });
+	BOOST_CHECK(resumes(cacheOnly, cacheOnly, nothing));
+	SSLSocketHandler neither(
+			{ .enabled = true, .certPath = config.certPath, .keyPath = config.keyPath, .sessionCacheSize = 0, .sessionTickets = false });
+	BOOST_CHECK(!resumes(neither, neither, nothing));
+
+	SSL_CTX_free(clientCtx);
+}
+
+BOOST_AUTO_TEST_CASE(test_tls_handshakes_do_not_block_worker) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18085;
+	config.threadCount = 1;
+	config.handshakeTimeout = std::chrono::milliseconds(300);
+	config.https = { .enabled = true, .certPath = OU_CERTS_DIR "/cert.pem", .keyPath = OU_CERTS_DIR "/key.pem" };
+	TestServer server(config);
+	// Larger than a TLS record, so a read leaves decrypted data buffered in the transport
+	std::string body(40000, 'b');
+	server.registerPathHandler(Method::POST, "/echo", [](const Request &request) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, std::string(request.body) };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	// A client that connects but never sends its hello must not stall the only worker thread
+	int stalledClient = connectToServer(config.port);
+	BOOST_REQUIRE(stalledClient >= 0);
+
+	std::string response = sTlsExchange(
+			config.port, std::format("POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}", body.size(), body));
+	BOOST_CHECK(response.starts_with("HTTP/1.1 200 OK"));
+	BOOST_CHECK(response.ends_with(body));
+
+	// The stalled client is dropped once its handshake times out
+	auto start = std::chrono::steady_clock::now();
+	BOOST_CHECK(readUntilClosed(stalledClient).empty());
+	BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+	close(stalledClient);
+
+	server.stop();
+}
+
+BOOST_AUTO_TEST_CASE(test_tls_failed_handshakes_do_not_break_other_connections) {
+	TestServer::Config config;
+	config.servingDirectory = ".";
+	config.port = 18092;
+	config.threadCount = 1;
+	config.https = { .enabled = true, .certPath = OU_CERTS_DIR "/cert.pem", .keyPath = OU_CERTS_DIR "/key.pem" };
+	TestServer server(config);
+	server.registerPathHandler(Method::GET, "/ping", [](const Request &) {
+		return Response{ 200, "OK", { { "Content-Type", "text/plain" } }, "pong" };
+	});
+	BOOST_REQUIRE(server.init());
+	server.start();
+
+	SSL_CTX *clientCtx = SSL_CTX_new(TLS_client_method());
+	SSL *ssl = SSL_new(clientCtx);
+	int fd = connectToServer(config.port);
+	BOOST_REQUIRE(fd >= 0);
+	BOOST_REQUIRE(SSL_set_fd(ssl, fd) == 1 && SSL_connect(ssl) == 1);
+	// Records are encrypted into memory so the test decides how they are split across TCP writes
+	BIO *records = BIO_new(BIO_s_mem());
+	SSL_set0_wbio(ssl, records);
+
+	// Each request's records arrive in two writes, with a plaintext client failing its handshake on the same worker
+	// in between; errors it leaves on the thread's OpenSSL queue must not be taken for this connection's
+	for (int i = 0; i < 3; ++i) {
+		std::string request = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+		BOOST_REQUIRE_EQUAL(SSL_write(ssl, request.data(), static_cast<int>(request.size())), static_cast<int>(request.size()));
+		char *data = nullptr;
+		long size = BIO_get_mem_data(records, &data);
+		std::string encrypted(data, static_cast<size_t>(size));
+		BIO_reset(records);
+
+		int plaintextClient = connectToServer(config.port);
+		BOOST_REQUIRE(plaintextClient >= 0);
+		sendAll(plaintextClient, "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n");
+		readUntilClosed(plaintextClient);
+		close(plaintextClient);
+
+		sendAll(fd, encrypted.substr(0, encrypted.size() / 2));
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		sendAll(fd, encrypted.substr(encrypted.size() / 2));
+
+		std::string response;
+		std::array<char, 4096> buffer{};
+		int n = 0;
+		while (!response.ends_with("pong") && (n = SSL_read(ssl, buffer.data(), static_cast<int>(buffer.size()))) > 0)
+			response.append(buffer.data(), static_cast<size_t>(n));
+		BOOST_CHECK(response.starts_with("HTTP/1.1 200 OK"));
+		BOOST_CHECK(response.ends_with("pong"));
+	}
+
+	auto stats = server.tlsStats();
+	BOOST_REQUIRE(stats.has_value());
+	BOOST_CHECK_EQUAL(stats->handshakes, 1);
+	BOOST_CHECK_EQUAL(stats->failed, 3);
+
+	SSL_free(ssl);
+	close(fd);
+	SSL_CTX_free(clientCtx);
+	server.stop();
+}
+
+BOOST_AUTO_TEST_CASE(test_tls_kernel_offload_sends_files) {
+	auto servingDirectory = std::filesystem::temp_directory_path() / "ou_http_ktls_test";
+	std::filesystem::create_directories(servingDirectory);
+	std::string contents;
+	for (int i = 0; contents.size() < 2 * 1024 * 1024; ++i)
+		contents += std::to_string(i) + '\n';
+	std::ofstream(servingDirectory / "large.txt", std::ios::binary) << contents;
+
+	// Where the kernel has no tls module, or OpenSSL no kTLS support, the connection falls back to userspace TLS; the
+	// response must be the same either way
+	for (bool kernelTls : { false, true }) {
+		TestServer::Config config;
+		config.servingDirectory = servingDirectory;
+		config.port = 18086;
+		config.threadCount = 1;
+		config.https = { .enabled = true, .certPath = OU_CERTS_DIR "/cert.pem", .keyPath = OU_CERTS_DIR "/key.pem", .kernelTls = kernelTls };
+		TestServer server(config);
+		BOOST_REQUIRE(server.init());
+		server.start();
+
+		std::string response = sTlsExchange(config.port, "GET /large.txt HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+		size_t headerEnd = response.find("\r\n\r\n");
+		BOOST_REQUIRE(headerEnd != std::string::npos);
+		BOOST_CHECK(response.compare(headerEnd + 4, std::string::npos, contents) == 0);
+
+		auto stats = server.tlsStats();
+		BOOST_REQUIRE(stats.has_value());
+		BOOST_CHECK_EQUAL(stats->handshakes, 1);
+		if (!kernelTls)
+			BOOST_CHECK_EQUAL(stats->kernelTls, 0);
+		server.stop();
+	}
+
+	std::filesystem::remove_all(servingDirectory);
+}
+
+BOOST_AUTO_TEST_CASE(test_tls_alpn_selects_http2) {
+	// Returns the protocol the server side selected for a client offering the given ALPN list
+	auto negotiate = [](bool http2, std::string_view offered) {
+		SSLSocketHandler handler(
+				{ .enabled = true, .certPath = OU_CERTS_DIR "/cert.pem", .keyPath = OU_CERTS_DIR "/key.pem", .http2 = http2 });
+		SSL_CTX *clientCtx = SSL_CTX_new(TLS_client_method());
+		if (!offered.empty())
+			SSL_CTX_set_alpn_protos(clientCtx, reinterpret_cast<const unsigned char *>(offered.data()), static_cast<unsigned>(offered.size()));
+		std::array<int, 2> fds{};
+		BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds.data()), 0);
+		std::string selected = "(failed)";
+		std::thread serverThread([&]() {
+			auto server = handler.acceptConnection(fds[0]);
+			if (server && server->handshake() == Socket::Handshake::Complete)
+				selected = server->protocol();
+		});
+		SSL *ssl = SSL_new(clientCtx);
+		SSL_set_fd(ssl, fds[1]);
+		SSL_connect(ssl);
+		serverThread.join();
+		SSL_free(ssl);
+		SSL_CTX_free(clientCtx);
+		close(fds[1]);
+		return selected;
+	};
+
+	BOOST_CHECK_EQUAL(negotiate(true, "\x08http/1.1\x02h2"), "h2");
+	BOOST_CHECK_EQUAL(negotiate(true, "\x08http/1.1"), "http/1.1");
+	BOOST_CHECK_EQUAL(negotiate(false, "\x02h2\x08http/1.1"), "http/1.1");
+	// Clients without ALPN, or offering nothing in common, carry on with HTTP/1.1
+	BOOST_CHECK_EQUAL(negotiate(true, ""), "");
+	BOOST_CHECK_EQUAL(negotiate(false, "\x02h2"), "");
+}
+
+#endif // DISABLE_HTTPS